@@ -1,5 +1,9 @@
 #include <pthread.h>
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <ev.h>
 #include "trie.h"
 #include "list.h"
@@ -10,6 +14,10 @@
 #include "serverinfo.h"
 #include "msgio.h"
 #include "wrappers.h"
+#include "worker.h"
+#include "reply.h"
+#include "pool.h"
+#include "link.h"
 
 /** @file
    @brief Channels management module
@@ -19,6 +27,9 @@
       `notify_privmsg()`.
    A thread-safe channel list is kept. With the exception of `chan_init()` and `chan_destroy()`, it is safe to call
       every other public function concurrently.
+   The channel list is split into `CHANNEL_SHARDS` independent lists, and each channel lives in the shard picked by a
+      hash of its name. Creating or destroying a channel only locks its shard. Every other operation on a channel,
+      including joins and parts, is performed with `list_find_and_execute()`, which only holds that channel's own lock.
    Note that `static` functions, that is, internal functions only used in this file, are NOT thread-safe, since it is
       assumed they are invoked from within the other public,thread-safe functions.
    @author Filipe Goncalves
@@ -31,21 +42,47 @@
  */
 #define CHANNEL_ALPHABET_SIZE (UCHAR_MAX + 1)
 
-/** This structure represents a channel user. We will store instances of this structure associated to each nick in the
-   channel in a trie */
+/** How many shards the channels list is split into. */
+#define CHANNEL_SHARDS 64
+
+/** How many entries fit in a LIST snapshot when it starts being built. The array doubles every time it is full. */
+#define LIST_SNAPSHOT_INITIAL_ENTRIES 256
+
+/** How many characters fit in a LIST snapshot's text when it starts being built. It doubles every time it is full. */
+#define LIST_SNAPSHOT_INITIAL_TEXT 8192
+
+/** For how many seconds a LIST snapshot is reused, even if channels were created, destroyed, joined or parted since it was
+   built. This bounds how often a flood of LIST commands can walk the whole channels list. */
+#define LIST_SNAPSHOT_MIN_AGE 2
+
+/** How many `RPL_LIST` lines are queued at once for a client. The rest of the list is queued as the client reads it. */
+#define LIST_STREAM_BATCH 256
+
+/** How many members fit in a channel's `members` array when it is created. The array doubles every time it is full. */
+#define CHAN_MEMBERS_INITIAL 4
+
+/** This structure represents a channel user. Every channel keeps its users in a dense array of these structures, so that
+   delivering a message to every user is a linear scan. */
 struct chan_user {
 	unsigned modes; /**<This user's status in the channel */
 	struct irc_client *user; /**<Pointer to this user's client structure */
 };
 
+/** A channel user's entry in the channel's `users` trie. It locates the user in the channel's `members` array. */
+struct chan_member_ref {
+	int index; /**<Position of the user in `members`. */
+};
+
 /** This structure represents an IRC channel
    The IRCd keeps a thread-safe list of channels associating each channel name to a node holding this structure.
  */
 struct irc_channel {
 	char *name; /**<Null terminated characters sequence holding the channel name */
 	char *topic; /**<Channel topic */
-	struct trie_t *users; /**<List of users on this channel */
-	int users_count; /**<How many users are in the channel */
+	struct trie_t *users; /**<Users on this channel by nick, used for membership lookups. Each word is associated to a `struct chan_member_ref`. */
+	struct chan_user *members; /**<Dense array with every user on this channel, in no particular order. Used to iterate through the users. */
+	int members_capacity; /**<How many users fit in `members`. */
+	int users_count; /**<How many users are in the channel, i.e., how many positions in `members` are taken */
 	unsigned modes; /**<Channel modes */
 };
 
@@ -57,10 +94,78 @@ struct irc_channel_wrapper {
 	char irc_reply[MAX_MSG_SIZE+1]; /**<Complete IRC Message to send to other channel users. This is used because we only need to print the message
 										once into the buffer, and then echo it to every other channel user. Thus, this can be a join message, part, quit,
 										privmsg, etc. This buffer must be null terminated. */
+	int empty_chan; /**<Set by `leave_channel()` and `quit_channel()` when the client who left was the last one in the channel. */
+	unsigned quit_stamp; /**<Stamp of the QUIT being delivered. Only used by `do_quit()`. */
+	int quit_slot; /**<Which entry of the `quit_seen` arrays belongs to the worker running `do_quit()`. */
+	struct msg_buf *shared_reply; /**<A shared copy of `irc_reply` that is queued by reference in every channel user's queue, so that the message is allocated once no matter how many users it reaches.
+										  Created by `share_reply()`, and released by `release_reply()` after every user was notified. If it is `NULL`, `irc_reply` is copied into each queue instead. */
+	int forward; /**<Whether users on other servers get the message, through their server links. Only channel messages are forwarded like this: other servers learn about JOINs,
+					 PARTs and QUITs from `link_broadcast_from()`, since they must know every channel user, even where they have none. Set to `0` by `share_reply()`. */
+	struct irc_client *links_done[LINK_MAX_LINKS]; /**<Server links that already got the message. A message is forwarded to each link once, no matter how many of the channel users
+													   are behind it; the servers on the other side deliver it to their own users. */
+	int links_done_count; /**<How many links are stored in `links_done`. Set to `0` by `share_reply()`. */
+};
+
+/** A channel, as seen by a LIST snapshot. */
+struct list_snapshot_entry {
+	size_t name; /**<Offset in the snapshot's `text` of the null terminated channel name. */
+	size_t topic; /**<Offset in the snapshot's `text` of the null terminated channel topic. */
+	int users; /**<How many users were in the channel. */
+};
+
+/** A copy of every channel's name, users count and topic, used to answer LIST commands without holding the channels list
+   locks while the reply is sent. Snapshots are reference counted: the current one holds a reference, and so does every
+   client still receiving it. */
+struct list_snapshot {
+	int refs; /**<How many references exist to this snapshot. Updated atomically. */
+	unsigned version; /**<Value of `channels_version` when this snapshot was built. */
+	time_t created; /**<When this snapshot was built. */
+	struct list_snapshot_entry *entries; /**<The channels, in no particular order. */
+	int count; /**<How many entries are stored in `entries`. */
+	int capacity; /**<How many entries fit in `entries`. */
+	char *text; /**<Every name and topic, null terminated, one after the other. */
+	size_t length; /**<How many characters are stored in `text`. */
+	size_t text_capacity; /**<How many characters fit in `text`. */
+	int failed; /**<Set while building the snapshot if there wasn't enough memory. */
 };
 
-/**Global channels list for the whole network */
-Word_list_ptr channels;
+/** A LIST reply that is being streamed to a client. See `list_stream_continue()`. */
+struct list_stream {
+	struct list_snapshot *snapshot; /**<The snapshot being sent. This stream holds a reference to it. */
+	int next; /**<The next entry of the snapshot to send. */
+	int min_users; /**<Only channels with at least this many users are sent. */
+	int max_users; /**<Only channels with at most this many users are sent. */
+};
+
+/** Incremented atomically every time a channel's users change, including when a channel is created or destroyed. Tells
+   `snapshot_acquire()` whether the current LIST snapshot is outdated. */
+static unsigned channels_version;
+
+/** Topic of every new channel. Channels whose topic is something else own a copy, allocated with `malloc()`. */
+static char default_topic[] = "No topic. yaIRCd doesn't support TOPIC command yet!";
+
+static struct list_snapshot *current_snapshot; /**<The snapshot handed to new LIST commands. */
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `current_snapshot`, and the building of a new one. */
+
+static void snapshot_release(struct list_snapshot *snapshot);
+static void destroy_channel(irc_channel_ptr chan);
+
+/**Global channels list for the whole network, split into shards. Use `shard_of()` to find a channel's shard. */
+static Word_list_ptr channels[CHANNEL_SHARDS];
+
+/** Finds the shard where a channel is stored. The hash is FNV-1a over the name's characters, exactly as they are stored
+   in the channels list.
+   @param name Null terminated characters sequence holding the channel name.
+   @return The channel's shard.
+ */
+static Word_list_ptr shard_of(const char *name)
+{
+	unsigned hash = 2166136261U;
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (unsigned char) *name) * 16777619U;
+	}
+	return channels[hash % CHANNEL_SHARDS];
+}
 
 /** Defines valid characters for a channel name. As of this writing, the protocol allows any character except NUL, BELL,
    CR, LF, SPACE, COMMA and SEMI-COLLON.
@@ -97,8 +202,14 @@ static int char_to_pos(char c)
  */
 int chan_init(void)
 {
-	if ((channels = init_word_list(NULL, is_valid, pos_to_char, char_to_pos, CHANNEL_ALPHABET_SIZE)) == NULL) {
-		return -1;
+	int i;
+	for (i = 0; i < CHANNEL_SHARDS; i++) {
+		if ((channels[i] = init_word_list(NULL, is_valid, pos_to_char, char_to_pos, CHANNEL_ALPHABET_SIZE)) == NULL) {
+			while (i-- > 0) {
+				destroy_word_list(channels[i], LIST_NO_FREE_NODE_DATA);
+			}
+			return -1;
+		}
 	}
 	return 0;
 }
@@ -109,31 +220,153 @@ int chan_init(void)
  */
 void chan_destroy(void)
 {
-	destroy_word_list(channels, LIST_NO_FREE_NODE_DATA);
+	int i;
+	for (i = 0; i < CHANNEL_SHARDS; i++) {
+		destroy_word_list(channels[i], LIST_NO_FREE_NODE_DATA);
+	}
+	snapshot_release(current_snapshot);
+	current_snapshot = NULL;
+}
+
+/** Creates the shared reply that will be delivered to every channel user, from the `size` characters already printed
+	into `args->irc_reply`. The reply is not forwarded to other servers, unless the caller sets `args->forward`.
+	@param args The arguments wrapper that will be passed to `notify_channel_user()`.
+	@param size Length of the message in `args->irc_reply`.
+ */
+static void share_reply(struct irc_channel_wrapper *args, int size)
+{
+	args->shared_reply = msg_buf_create(args->irc_reply, (size_t) size);
+	args->forward = 0;
+	args->links_done_count = 0;
+}
+
+/** Releases the reference to the shared reply created by `share_reply()`. Any queue that still holds the reply keeps it
+	alive until it is written.
+	@param args The arguments wrapper previously passed to `share_reply()`.
+ */
+static void release_reply(struct irc_channel_wrapper *args)
+{
+	if (args->shared_reply != NULL) {
+		msg_buf_release(args->shared_reply);
+	}
 }
 
 /** Notifies a user in a channel with a generic complete IRC message passed through `args`. 
-	To do so, it enqueues a new IRC message into `to_notify`'s messages queue and sends a libev async signal to his thread.
+	To do so, it enqueues a reference to the shared IRC message into `to_notify`'s messages queue and wakes up his worker with `worker_wake_client()`.
+	Members served by the same worker share that worker's wakeup, so fanning out to a channel signals each worker at most once.
 	This function is used by `JOIN`, `QUIT`, `PART`, `PRIVMSG`, and other channel commands that must be propagated to every user
 	in a channel.
+	If `to_notify_generic`'s queue is full, the message is not queued, but it isn't silently lost either: the queue is marked as
+	overflowed, and `to_notify_generic` is disconnected by his own worker when it wakes up.
+	Users on other servers are reached through their server link, which gets the message once, and only if `forward` is set; the
+	link the message came from never gets it back.
 	@param to_notify_generic A pointer to a client structure denoting the client to notify. This client is inside the channel.
-	@param args A `struct irc_channel_wrapper *` holding a valid null terminated characters sequence in the field `irc_reply`.
-				This sequence will be enqueued to `to_notify_generic`'s messages write queue, thus, it must be a
+	@param args A `struct irc_channel_wrapper *` holding a valid null terminated characters sequence in the field `irc_reply`,
+				and the corresponding shared message in `shared_reply`, as created by `share_reply()`.
+				This message will be enqueued to `to_notify_generic`'s messages write queue, thus, it must be a
 				valid IRC message.
  */
 static void notify_channel_user(void *to_notify_generic, void *args) {
 	struct irc_client *to_notify = ((struct chan_user *) to_notify_generic)->user;
 	struct irc_channel_wrapper *info = (struct irc_channel_wrapper *) args;
-	client_enqueue(&to_notify->write_queue, info->irc_reply);
-	ev_async_send(to_notify->ev_loop, &to_notify->async_watcher);
+	int i;
+	if (to_notify->link != NULL) {
+		if (!info->forward || to_notify->link == info->client->link) {
+			return;
+		}
+		for (i = 0; i < info->links_done_count && info->links_done[i] != to_notify->link; i++)
+			; /* Intentionally left blank */
+		if (i < info->links_done_count || i == LINK_MAX_LINKS) {
+			return;
+		}
+		info->links_done[info->links_done_count++] = to_notify->link;
+		to_notify = to_notify->link;
+	}
+	if (info->shared_reply != NULL) {
+		client_enqueue_shared(&to_notify->write_queue, info->shared_reply);
+	} else {
+		/* No memory for the shared message; fall back to a private copy */
+		client_enqueue(&to_notify->write_queue, info->irc_reply);
+	}
+	worker_wake_client(to_notify);
+}
+
+/** Calls `f` for every user in a channel, passing it the user's `struct chan_user` and `args`.
+	This is a linear scan over the channel's `members` array. `f` must not add or remove channel users.
+	@param chan The channel.
+	@param f Function to call for each user.
+	@param args Second argument for `f`.
+ */
+static void for_each_member(irc_channel_ptr chan, void (*f)(void *, void *), void *args)
+{
+	int i;
+	for (i = 0; i < chan->users_count; i++) {
+		f((void*)&chan->members[i], args);
+	}
+}
+
+/** Adds a client to a channel's users.
+	@param chan The channel.
+	@param client The new channel user. He must not be in the channel yet.
+	@return `0` on success; `-1` if there's not enough memory, in which case the channel is left untouched.
+ */
+static int add_member(irc_channel_ptr chan, struct irc_client *client)
+{
+	struct chan_member_ref *ref;
+	struct chan_user *members;
+	int capacity;
+
+	if (chan->users_count == chan->members_capacity) {
+		capacity = (chan->members_capacity == 0 ? CHAN_MEMBERS_INITIAL : chan->members_capacity * 2);
+		if ((members = realloc(chan->members, (size_t) capacity * sizeof(*members))) == NULL) {
+			return -1;
+		}
+		chan->members = members;
+		chan->members_capacity = capacity;
+	}
+	if ((ref = pool_alloc(sizeof(*ref))) == NULL) {
+		return -1;
+	}
+	ref->index = chan->users_count;
+	if (add_word_trie(chan->users, client->nick, (void*)ref) == TRIE_NO_MEM) {
+		pool_free(ref);
+		return -1;
+	}
+	chan->members[ref->index].modes = 0;
+	chan->members[ref->index].user = client;
+	chan->users_count++;
+	__sync_add_and_fetch(&channels_version, 1);
+	return 0;
+}
+
+/** Removes a client from a channel's users. The last user in `members` is moved to the position that was left empty.
+	@param chan The channel.
+	@param nick The client's nickname.
+	@return `0` on success; `-1` if there is no such user in the channel.
+ */
+static int remove_member(irc_channel_ptr chan, char *nick)
+{
+	struct chan_member_ref *ref;
+	struct chan_member_ref *moved;
+	int last;
+
+	if ((ref = delete_word_trie(chan->users, nick)) == NULL) {
+		return -1;
+	}
+	last = --chan->users_count;
+	__sync_add_and_fetch(&channels_version, 1);
+	if (ref->index != last) {
+		chan->members[ref->index] = chan->members[last];
+		moved = find_word_trie(chan->users, chan->members[ref->index].user->nick);
+		moved->index = ref->index;
+	}
+	pool_free(ref);
+	return 0;
 }
 
 /** Auxiliary function indirectly used by `join_ack()` that is called for every user inside a channel after a new user
    joins and is added to the channel's userlist.
-   For each user inside a channel, an `RPL_NAMREPLY` message is sent to the new user informing him of who is inside the
-      channel at the moment, as specified by the RFC.
-   This list contains the user himself.
-   For every other client, a join notification is also sent by calling `notify_channel_user()`.
+   Every client other than the new user is sent a join notification by calling `notify_channel_user()`.
    @param chanuser A pointer to `struct chan_user` denoting the current user in this iteration. `chanuser` is always
       casted to `struct chan_user `.
    @param args A pointer to `struct irc_channel_wrappers` that shall contain the client where the join request
@@ -141,28 +374,77 @@ static void notify_channel_user(void *to_notify_generic, void *args) {
  */
 static void join_ack_aux(void *chanuser, void *args)
 {
-	char msg[MAX_MSG_SIZE + 1];
-	int size;
 	struct chan_user *chanusr;
 	struct irc_channel_wrapper *info;
 
 	chanusr = (struct chan_user*)chanuser;
 	info = (struct irc_channel_wrapper*)args;
-	size = cmd_print_reply(msg, sizeof(msg),
-			       ":%s " RPL_NAMREPLY " %s = %s :%s!%s@%s\r\n",
-			       get_server_name(), info->client->nick, info->channel, chanusr->user->nick,
-			       chanusr->user->username,
-			       chanusr->user->public_host);
-	(void)write_to(info->client, msg, size);
 	if (chanusr->user != info->client) {
 		notify_channel_user(chanusr, args);
 	}
 }
 
+/** Starts an `RPL_NAMREPLY` line, ":<server name> 353 <nick> = <channel> :".
+   @param reply The reply. Anything it held is discarded.
+   @param client The client that will receive the reply.
+   @param chan The channel.
+ */
+static void names_begin(struct reply *reply, struct irc_client *client, irc_channel_ptr chan)
+{
+	reply_numeric(reply, client, RPL_NAMREPLY);
+	reply_param(reply, "=");
+	reply_param(reply, chan->name);
+	reply_append_buf(reply, " :", 2);
+}
+
+/** Sends the list of users in a channel to a client, as `RPL_NAMREPLY` lines. Each line holds as many nicknames as fit
+   in `MAX_MSG_SIZE`, so even a huge channel only takes a few lines. The lines are queued with `reply_queue()`, so this
+   function can be, and must be, called while holding the channel's lock. `RPL_ENDOFNAMES` is not sent.
+   @param client The client that will receive the list.
+   @param chan The channel.
+ */
+static void send_names(struct irc_client *client, irc_channel_ptr chan)
+{
+	struct reply r;
+	size_t empty, len;
+	const char *nick;
+	int i;
+
+	names_begin(&r, client, chan);
+	empty = r.length;
+	for (i = 0; i < chan->users_count; i++) {
+		nick = chan->members[i].user->nick;
+		len = strlen(nick);
+		if (r.length > empty && len + 1 > reply_room(&r)) {
+			(void)reply_queue(&r, client);
+			names_begin(&r, client, chan);
+		}
+		if (r.length > empty) {
+			reply_append_buf(&r, " ", 1);
+		}
+		reply_append_buf(&r, nick, len);
+	}
+	if (r.length > empty) {
+		(void)reply_queue(&r, client);
+	}
+}
+
+/** Builds the `RPL_ENDOFNAMES` reply that closes a NAMES list.
+   @param reply The reply. Anything it held is discarded.
+   @param client The client that will receive the reply.
+   @param channel The channel name, or `*`.
+ */
+static void names_end(struct reply *reply, struct irc_client *client, const char *channel)
+{
+	reply_numeric(reply, client, RPL_ENDOFNAMES);
+	reply_param(reply, channel);
+	reply_trailing(reply, "End of NAMES list");
+}
+
 /** Acknowledges a JOIN command issued by `client` to join channel `chan`.
-   Sends a JOIN reply to the requester, followed by `RPL_TOPIC`, and then iterates through every client in a channel to
-      generate the appropriate `RPL_NAMREPLY` entries.
-   While doing so, it also notifies other clients about this new client.
+   Sends a JOIN reply to the requester, followed by `RPL_TOPIC` and the channel's NAMES list (see `send_names()`),
+      and then iterates through every client in a channel to notify them about this new client. Clients on other servers
+      are acknowledged by their own server, so they only get the latter.
    @param client Pointer to a client's structure denoting the client who issued the JOIN command.
    @param chan A pointer to the channel instance where `client` wants to join.
  */
@@ -171,124 +453,122 @@ static void join_ack(struct irc_client *client, irc_channel_ptr chan)
 	char msg[MAX_MSG_SIZE + 1];
 	int size;
 	struct irc_channel_wrapper args;
+	struct reply r;
 
-	size = cmd_print_reply(msg,
-			       sizeof(msg),
-			       ":%s!%s@%s JOIN :%s\r\n",
-			       client->nick,
-			       client->username,
-			       client->public_host,
-			       chan->name);
-	(void)write_to(client, msg, size);
-	size = cmd_print_reply(msg, sizeof(msg),
-			       ":%s MODE %s +nt\r\n", get_server_name(), chan->name);
-	(void)write_to(client, msg, size);
-	size = cmd_print_reply(msg, sizeof(msg),
-			       ":%s " RPL_TOPIC " %s %s :%s\r\n",
-			       get_server_name(), client->nick, chan->name, chan->topic);
-	(void)write_to(client, msg, size);
+	if (client->link == NULL) {
+		size = print_prefixed_msg(msg, sizeof(msg), client, "JOIN", NULL, chan->name);
+		(void)queue_to(client, msg, size);
+		size = cmd_print_reply(msg, sizeof(msg),
+				       ":%s MODE %s +nt\r\n", get_server_name(), chan->name);
+		(void)queue_to(client, msg, size);
+		size = cmd_print_reply(msg, sizeof(msg),
+				       ":%s " RPL_TOPIC " %s %s :%s\r\n",
+				       get_server_name(), client->nick, chan->name, chan->topic);
+		(void)queue_to(client, msg, size);
+		send_names(client, chan);
+		names_end(&r, client, chan->name);
+		(void)reply_queue(&r, client);
+	}
 
 	args.client = client;
 	args.channel = chan->name;
-	cmd_print_reply(args.irc_reply, sizeof(args.irc_reply), ":%s!%s@%s JOIN %s\r\n", client->nick, client->username, client->public_host, chan->name);
-	trie_for_each(chan->users, join_ack_aux, (void*)&args);
-	size = cmd_print_reply(msg, sizeof(msg),
-			       ":%s " RPL_ENDOFNAMES " %s %s :End of NAMES list\r\n",
-			       get_server_name(), client->nick, chan->name);
-	(void)write_to(client, msg, size);
+	size = print_prefixed_msg(args.irc_reply, sizeof(args.irc_reply), client, "JOIN", chan->name, NULL);
+	share_reply(&args, size);
+	for_each_member(chan, join_ack_aux, (void*)&args);
+	release_reply(&args);
 }
 
-/** Called every time a client joins a nonexisting chan, thus creating it implicitly.
-   This function will allocate and store a new channel structure in the server's channels list, and add the requesting
-      clientto the channel's user list. Then, the join request is acknowledged using `join_ack()`.
-   @param args A pointer to `struct irc_channel_wrapper` holding information about the channel name and the client who
-      issued the command.
-   This parameter is always casted to `struct irc_channel_wrapper `.
-   @return `NULL` if it was not possible to create a new channel name due to lack of memory.
-   Otherwise, this function will return an `irc_channel_ptr` for the newly created channel casted to `void `.
+/** Creates an empty channel and adds it to its shard. Must be called while holding the lock of the channel's shard, and
+   the channel must get its first user right away; otherwise, it must be destroyed with `destroy_channel()`.
+   @param name The channel name.
+   @return The new channel; `NULL` if there isn't enough memory, or if the channel could not be added to its shard
+      (invalid name, or a channel with that name already exists).
  */
-static void *join_newchan(void *args)
+static irc_channel_ptr create_channel(const char *name)
 {
-	struct irc_channel_wrapper *info;
 	irc_channel_ptr new_chan;
-	struct chan_user *new_user;
 
-	info = (struct irc_channel_wrapper*)args;
-	if ((new_chan = malloc(sizeof(*new_chan))) == NULL || (new_user = malloc(sizeof(*new_user))) == NULL) {
+	if ((new_chan = malloc(sizeof(*new_chan))) == NULL) {
 		return NULL;
 	}
-	if ((new_chan->name = strdup(info->channel)) == NULL) {
+	if ((new_chan->name = strdup(name)) == NULL) {
 		free(new_chan);
-		free(new_user);
 		return NULL;
 	}
 	if ((new_chan->users =
 		     init_trie(NULL, nick_is_valid, nick_pos_to_char, nick_char_to_pos, NICK_EDGES_NO)) == NULL) {
 		free(new_chan->name);
 		free(new_chan);
-		free(new_user);
 		return NULL;
 	}
-	if (list_add_nolock(channels, new_chan, info->channel) == LST_NO_MEM) {
+	new_chan->members = NULL;
+	new_chan->members_capacity = 0;
+	new_chan->users_count = 0;
+	new_chan->modes = 0;
+	new_chan->topic = default_topic;
+	if (list_add_nolock(shard_of(name), new_chan, new_chan->name) != 0) {
 		destroy_trie(new_chan->users, TRIE_NO_FREE_DATA, NULL);
 		free(new_chan->name);
 		free(new_chan);
-		free(new_user);
 		return NULL;
 	}
-	new_user->modes = 0;
-	new_user->user = info->client;
-	if (add_word_trie(new_chan->users, info->client->nick, (void*)new_user) == TRIE_NO_MEM) {
-		free(new_chan->name);
-		list_delete_nolock(channels, info->channel);
-		destroy_trie(new_chan->users, TRIE_NO_FREE_DATA, NULL);
-		free(new_chan);
-		free(new_user);
+	return new_chan;
+}
+
+/** Called every time a client joins a nonexisting chan, thus creating it implicitly.
+   This function will allocate and store a new channel structure in the server's channels list, and add the requesting
+      clientto the channel's user list. Then, the join request is acknowledged using `join_ack()`.
+   It is called while holding the lock of the channel's shard.
+   @param args A pointer to `struct irc_channel_wrapper` holding information about the channel name and the client who
+      issued the command.
+   This parameter is always casted to `struct irc_channel_wrapper `.
+   @return `NULL` if it was not possible to create a new channel name due to lack of memory.
+   Otherwise, this function will return an `irc_channel_ptr` for the newly created channel casted to `void `.
+ */
+static void *join_newchan(void *args)
+{
+	struct irc_channel_wrapper *info;
+	irc_channel_ptr new_chan;
+
+	info = (struct irc_channel_wrapper*)args;
+	if ((new_chan = create_channel(info->channel)) == NULL) {
+		return NULL;
+	}
+	if (add_member(new_chan, info->client) == -1) {
+		destroy_channel(new_chan);
 		return NULL;
 	}
-	new_chan->users_count = 1;
-	new_chan->modes = 0;
-
-	new_chan->topic = "No topic. yaIRCd doesn't support TOPIC command yet!";
 	join_ack(info->client, new_chan);
 	return (void*)new_chan;
 }
 
 /** Called every time a client joins an existing chan.
-   This function creates a new `chan_user` instance, adds it to the channel, increments the channel users count, and
-      acknowledges the join request using `join_ack()`.
+   This function adds the client to the channel with `add_member()`, and acknowledges the join request using
+      `join_ack()`.
    @param channel An `irc_channel_ptr` holding information about the channel. This parameter is always casted to
       `irc_channel_ptr`.
    @param args A pointer to `struct irc_channel_wrapper` holding the original client where the request came from. This
       parameter is always casted to `struct irc_channel_wrapper `.
    @return `NULL` if it was not possible to join this user due to lack of memory, in which case no `join_ack()` is
       performed.
-   Otherwise, this function will return a pointer to `struct chan_user` holding the new channel user instance.
+   Otherwise, this function will return `channel`.
  */
 static void *join_existingchan(void *channel, void *args)
 {
 	struct irc_channel_wrapper *info;
-	struct chan_user *new_user;
 	irc_channel_ptr chan;
 
 	info = (struct irc_channel_wrapper*)args;
 	chan = (irc_channel_ptr)channel;
-	if ((new_user = malloc(sizeof(*new_user))) == NULL) {
-		return NULL;
-	}
-	new_user->modes = 0;
-	new_user->user = info->client;
-	if (add_word_trie(chan->users, info->client->nick, (void*)new_user) == TRIE_NO_MEM) {
-		free(new_user);
+	if (add_member(chan, info->client) == -1) {
 		return NULL;
 	}
 	join_ack(info->client, chan);
-	chan->users_count++;
-	return (void*)new_user;
+	return channel;
 }
 
-/** Atomically handles a join command. Calls either `join_existingchan()` or `join_newchan()` while holding a global
-   lock to the channels list.
+/** Atomically handles a join command. Calls either `join_existingchan()` while holding the channel's lock, or
+   `join_newchan()` while holding the lock of the channel's shard.
    On success, acknowledges the join request and notifies every other client in the channel about the new comer.
    @param client Pointer to the client who issued the JOIN command.
    @param channel Pointer to a null terminated characters sequence holding the channel name in the JOIN command.
@@ -307,19 +587,25 @@ int do_join(struct irc_client *client, char *channel)
 	int result;
 	int i;
 	/* We don't need a mutex in client->channels_count, since only the client's thread will be accessing this field */
+	for (i = 0; i < get_chanlimit(); i++) {
+		if (client->channels[i] != NULL && strcasecmp(client->channels[i], ==, channel)) {
+			/* Already there; a channel user must not be added twice */
+			return 0;
+		}
+	}
 	if (client->channels_count == get_chanlimit()) {
 		return CHAN_LIMIT_EXCEEDED;
 	}
 	
 	args.client = client;
 	args.channel = channel;
-	ret = list_find_and_execute_globalock(channels,
-					      channel,
-					      join_existingchan,
-					      join_newchan,
-					      (void*)&args,
-					      (void*)&args,
-					      &result);
+	ret = list_find_and_execute(shard_of(channel),
+				    channel,
+				    join_existingchan,
+				    join_newchan,
+				    (void*)&args,
+				    (void*)&args,
+				    &result);
 	if (ret == NULL) {
 		return CHAN_NO_MEM;
 	}
@@ -338,77 +624,200 @@ int do_join(struct irc_client *client, char *channel)
 }
 
 /** Destroys a channel when it no longer holds any client, freeing every allocated resources. This is called by
-   `leave_channel()` when the last client leaves the channel.
+   `destroy_if_empty()`, after `leave_channel()` reported that the last client left the channel.
    @param chan An `irc_channel_ptr` holding the channel to destroy.
  */
 static void destroy_channel(irc_channel_ptr chan)
 {
-	(void)list_delete_nolock(channels, chan->name);
+	(void)list_delete_nolock(shard_of(chan->name), chan->name);
 	free(chan->name);
-	/*free(chan->topic);*/
+	if (chan->topic != default_topic) {
+		free(chan->topic);
+	}
 	destroy_trie(chan->users, TRIE_NO_FREE_DATA, NULL);
+	free(chan->members);
 	free(chan);
 }
 
-/** Callback function used by `do_quit()` and `do_part()` to process the event triggered for a client leaving a
-	channel.
+/** Callback function used by `leave()` and `destroy_empty_channels()` to destroy a channel once its last client left. It
+	is invoked with `list_find_and_execute_globalock()` or `list_find_each_and_execute_globalock()`, since it deletes the
+	channel from its shard. Someone may have joined the channel
+	after it became empty, in which case nothing happens.
+	@param channel An `irc_channel_ptr` holding the target channel.
+	@param args Not used.
+	@return Always `NULL`.
+*/
+static void *destroy_if_empty(void *channel, void *args)
+{
+	irc_channel_ptr chan = (irc_channel_ptr)channel;
+	(void)args;
+	if (chan->users_count == 0) {
+		destroy_channel(chan);
+	}
+	return NULL;
+}
+
+/** Callback function used by `leave()` to process the event triggered for a client leaving a
+	channel. It is called while holding the channel's lock.
 	This function will delete the client from the channel's user list, and notify every other channel user about this.
-	If the channel becomes empty as a result of this user leaving, `destroy_channel()` is called.
 	@param channel An `irc_channel_ptr` holding the target channel.
 	@param args A `struct irc_channel_wrapper *` which must hold a valid pointer to the client leaving in the
 				`client` field.
-	@return `NULL` if the user was not on the channel, `args` otherwise.
+	@return `NULL` if the user was not on the channel, `args` otherwise. If the channel became empty, `empty_chan` is
+			set in `args`.
 */	
 static void *leave_channel(void *channel, void *args)
 {
 	irc_channel_ptr chan;
 	struct irc_channel_wrapper *info;
-	void *user;
 
 	info = (struct irc_channel_wrapper*)args;
 	chan = (irc_channel_ptr)channel;
-	if ((user = delete_word_trie(chan->users, info->client->nick)) == NULL) {
+	if (remove_member(chan, info->client->nick) == -1) {
 		return NULL;
 	}
-	free(user);
-	trie_for_each(((irc_channel_ptr)channel)->users, notify_channel_user, args);
-	if (--chan->users_count == 0) {
-		/* Channel empty, clear up */
-		destroy_channel(chan);
+	for_each_member(chan, notify_channel_user, args);
+	info->empty_chan = (chan->users_count == 0);
+	return args;
+}
+
+/** Removes a client from a channel using `leave_channel()`, and destroys the channel if it became empty. The channel's
+	shard is only locked in the latter case.
+	@param channel Channel name.
+	@param args A `struct irc_channel_wrapper *` holding the client leaving and the message to deliver to other channel
+				users.
+	@param result After this function returns, holds `1` if the channel exists; `0` otherwise.
+	@return `NULL` if the user was not on the channel, `args` otherwise.
+*/
+static void *leave(char *channel, struct irc_channel_wrapper *args, int *result)
+{
+	void *ret;
+	int destroyed;
+	args->empty_chan = 0;
+	ret = list_find_and_execute(shard_of(channel), channel, leave_channel, NULL, (void*)args, NULL, result);
+	if (ret != NULL && args->empty_chan) {
+		(void)list_find_and_execute_globalock(shard_of(channel), channel, destroy_if_empty, NULL, NULL, NULL, &destroyed);
+	}
+	return ret;
+}
+
+/** Notifies a neighbour of a client that is quitting, unless he was already notified by the same QUIT in another channel.
+	Each client has a `quit_seen` array with one stamp per worker; the worker running `do_quit()` owns an entry in every
+	array, so the check and the update need no locking, even if other workers are delivering their own QUITs to the same
+	neighbour at the same time.
+	@param chanuser A pointer to the neighbour's `struct chan_user`.
+	@param args The `struct irc_channel_wrapper *` of the QUIT, with `quit_stamp` and `quit_slot` set.
+ */
+static void notify_quit_neighbour(void *chanuser, void *args)
+{
+	struct irc_client *neighbour = ((struct chan_user *)chanuser)->user;
+	struct irc_channel_wrapper *info = (struct irc_channel_wrapper *)args;
+	if (neighbour->quit_seen[info->quit_slot] != info->quit_stamp) {
+		neighbour->quit_seen[info->quit_slot] = info->quit_stamp;
+		notify_channel_user(chanuser, args);
 	}
+}
+
+/** Callback function used by `do_quit()` to remove a quitting client from a channel. It is called while holding the
+	channel's lock. It works like `leave_channel()`, except that users who were already notified about this QUIT in a
+	channel processed before are not notified again.
+	@param channel An `irc_channel_ptr` holding the target channel.
+	@param args A `struct irc_channel_wrapper *` holding the client leaving, the QUIT message, and the QUIT stamp.
+	@return `NULL` if the user was not on the channel, `args` otherwise. If the channel became empty, `empty_chan` is
+			set in `args`.
+*/
+static void *quit_channel(void *channel, void *args)
+{
+	irc_channel_ptr chan;
+	struct irc_channel_wrapper *info;
+
+	info = (struct irc_channel_wrapper*)args;
+	chan = (irc_channel_ptr)channel;
+	if (remove_member(chan, info->client->nick) == -1) {
+		return NULL;
+	}
+	for_each_member(chan, notify_quit_neighbour, args);
+	info->empty_chan = (chan->users_count == 0);
 	return args;
 }
 
+/** Destroys, if they are still empty, the channels that became empty while a client was quitting. Channels are grouped by
+	shard, so that each shard's global lock is only taken once, no matter how many of its channels are destroyed.
+	@param names The channels names. This array is reordered.
+	@param count How many names are stored in `names`.
+ */
+static void destroy_empty_channels(char *names[], int count)
+{
+	Word_list_ptr shard;
+	char *tmp;
+	int i, j, k;
+
+	for (i = 0; i < count; i = j) {
+		shard = shard_of(names[i]);
+		for (j = i + 1, k = i + 1; k < count; k++) {
+			if (shard_of(names[k]) == shard) {
+				tmp = names[j];
+				names[j++] = names[k];
+				names[k] = tmp;
+			}
+		}
+		list_find_each_and_execute_globalock(shard, names + i, j - i, destroy_if_empty, NULL);
+	}
+}
+
 /** This is the function invoked by the rest of the code to deal with QUIT messages.
-   It indirectly invokes `leave_channel()` using `list_find_and_execute_globalock()`.
-   The following actions are performed for each channel in the user's channels list:
+   It removes the client from every channel he's in with `quit_channel()`, in a single pass over his channels list:
 	<ul>
-		<li>The user is deleted from the channel's user list</li>
-		<li>Other channel users are notified about this</li>
-		<li>If the channel becomes empty, it is deleted</li>
-		<li>Finally, the channel name is removed from this user's channels list</li>
+		<li>The user is deleted from each channel's user list</li>
+		<li>Every user sharing at least one channel with him gets exactly one QUIT message, no matter how many channels
+		    they share. Neighbours are stamped as they are notified (see `notify_quit_neighbour()`), so a neighbour met
+		    again in a later channel is skipped.</li>
+		<li>The channels that became empty are deleted at the end, in one batch (see `destroy_empty_channels()`)</li>
+		<li>Finally, this user's channels list is emptied</li>
 	</ul>
    @param client The client where the QUIT request came from.
    @param quit_msg Quit message. The code using this function should always provide a quit message.
    This must be a valid null terminated characters sequence.
+   @note This function must be called by the client's worker, since the QUIT stamp belongs to it.
  */
 void do_quit(struct irc_client *client, char *quit_msg) {
 	struct irc_channel_wrapper args;
+	char *channel;
 	int result;
+	int empty;
 	int i;
 	args.client = client;
-	cmd_print_reply(args.irc_reply, sizeof(args.irc_reply), ":%s!%s@%s QUIT :%s\r\n", client->nick, client->username, client->public_host, quit_msg);
-	for (i = 0; i < get_chanlimit(); i++) {
-		if (client->channels[i] != NULL) {
-			(void) list_find_and_execute_globalock(channels, client->channels[i], leave_channel, NULL, (void*)&args, NULL, &result);
-			free(client->channels[i]);
+	args.quit_slot = client->worker->id;
+	if ((args.quit_stamp = ++client->worker->quit_stamp) == 0) {
+		/* 0 is the initial stamp of every client; never use it */
+		args.quit_stamp = ++client->worker->quit_stamp;
+	}
+	share_reply(&args, print_prefixed_msg(args.irc_reply, sizeof(args.irc_reply), client, "QUIT", NULL, quit_msg));
+	for (i = 0, empty = 0; i < get_chanlimit(); i++) {
+		if ((channel = client->channels[i]) == NULL) {
+			continue;
+		}
+		client->channels[i] = NULL;
+		args.empty_chan = 0;
+		if (list_find_and_execute(shard_of(channel), channel, quit_channel, NULL, (void*)&args, NULL, &result) != NULL &&
+		    args.empty_chan) {
+			/* Keep the name until the channel is destroyed; empty <= i, so this doesn't overwrite what's left to visit */
+			client->channels[empty++] = channel;
+		} else {
+			free(channel);
 		}
 	}
+	release_reply(&args);
+	destroy_empty_channels(client->channels, empty);
+	for (i = 0; i < empty; i++) {
+		free(client->channels[i]);
+		client->channels[i] = NULL;
+	}
 	client->channels_count = 0;
 }
 
 /** This is the function invoked by the rest of the code to deal with PART messages.
-   It indirectly invokes `leave_channel()` using `list_find_and_execute_globalock()`. Note that `leave_channel()` is only
+   It indirectly invokes `leave_channel()` using `leave()`. Note that `leave_channel()` is only
       called if the channel really exists.
    When the channel exists, the user is deleted from the channel's user list, the channel name is removed from this user's channels list,
    other channel users are notified about this, and finally, if the channel becomes empty, it is deleted.
@@ -430,9 +839,10 @@ int do_part(struct irc_client *client, char *channel, char *part_msg)
 	args.client = client;
 	args.channel = channel;
 	
-	cmd_print_reply(args.irc_reply, sizeof(args.irc_reply), ":%s!%s@%s PART %s :%s\r\n", client->nick, client->username, client->public_host, channel, part_msg);
+	share_reply(&args, print_prefixed_msg(args.irc_reply, sizeof(args.irc_reply), client, "PART", channel, part_msg));
 	
-	ret = list_find_and_execute_globalock(channels, channel, leave_channel, NULL, (void*)&args, NULL, &result);
+	ret = leave(channel, &args, &result);
+	release_reply(&args);
 	if (result != 0 && ret == NULL) {
 		/* Attempted to part a channel he's not part of */
 		return CHAN_NOT_ON_CHANNEL;
@@ -478,13 +888,14 @@ static void send_msg_to_chan_aux(void *channel_user, void *args)
  */
 static void *send_msg_to_chan(void *channel, void *arg)
 {
-	trie_for_each(((irc_channel_ptr)channel)->users, send_msg_to_chan_aux, arg);
+	for_each_member((irc_channel_ptr)channel, send_msg_to_chan_aux, arg);
 	return NULL;
 }
 
 /** Function responsible for dealing with channel PRIVMSG command. This is the function invoked by the rest of the code.
    It indirectly invokes `send_msg_to_chan()` using `list_find_and_execute()`. On success, the message is delivered to
       every other client on the channel.
+   Channel users on other servers are reached through their server links, each of which gets the message once.
    @param from The message's author.
    @param channel Target channel.
    @param msg The message.
@@ -497,54 +908,571 @@ int channel_msg(struct irc_client *from, char *channel, char *msg)
 	int result;
 	args.client = from;
 	args.channel = channel;
-	cmd_print_reply(args.irc_reply, sizeof(args.irc_reply), ":%s!%s@%s PRIVMSG %s :%s\r\n", from->nick, from->username, from->public_host, channel, msg);
-	list_find_and_execute(channels, channel, send_msg_to_chan, NULL, (void *) &args, NULL, &result);
+	share_reply(&args, print_prefixed_msg(args.irc_reply, sizeof(args.irc_reply), from, "PRIVMSG", channel, msg));
+	args.forward = 1;
+	list_find_and_execute(shard_of(channel), channel, send_msg_to_chan, NULL, (void *) &args, NULL, &result);
+	release_reply(&args);
 	if (result == 0) {
 		return CHAN_NO_SUCH_CHANNEL;
 	}
 	return 0;
 }
 
-/**
- * This function sends to the client a line denoting information about the channel, in response to a LIST command.
- * @param data The channel data
- * @param args The client who invoked the LIST command.
+/** Sends a channel's NAMES list to a client. This is called by `channel_names()` using `list_find_and_execute()`.
+   @param channel An `irc_channel_ptr` holding the channel.
+   @param arg The client who asked for the list.
+   @return This function always returns `NULL`.
  */
-static void list_channel(void *data, void *args)
+static void *names_of_chan(void *channel, void *arg)
 {
-	char msg[MAX_MSG_SIZE + 1];
-	int size;
-	irc_channel_ptr channel;
-	struct irc_client * client;
-	
-	channel = (irc_channel_ptr)data;
-	client = (struct irc_client*)args;
+	send_names((struct irc_client *)arg, (irc_channel_ptr)channel);
+	return NULL;
+}
+
+/** Answers a NAMES query for a channel: its users, if the channel exists, followed by `RPL_ENDOFNAMES`. If there is no such
+   channel, only `RPL_ENDOFNAMES` is sent.
+   @param client The client who issued the NAMES command.
+   @param channel The channel name.
+   @warning Since this function may call `terminate_session()`, it must not be used while holding locks.
+ */
+void channel_names(struct irc_client *client, char *channel)
+{
+	struct reply r;
+	int result;
 
-	size = cmd_print_reply(msg, sizeof(msg),
-					":%s " RPL_LIST " %s %s %d :%s\r\n",
-					get_server_name(), 
-					client->nick, 
-					channel->name, 
-					channel->users_count, 
-					channel->topic);
-					
-	(void)write_to(client, msg, size);
+	list_find_and_execute(shard_of(channel), channel, names_of_chan, NULL, (void *)client, NULL, &result);
+	names_end(&r, client, channel);
+	reply_send(&r, client);
 }
 
-/**
- * This function lists every channel available and a line denoting the end of the list of the channels, in response to a LIST command.
- * @param client The client who invoked the LIST command.
+/** Drops a reference to a LIST snapshot, freeing it if it was the last one.
+	@param snapshot The snapshot. Can be `NULL`.
  */
-void list_each_channel(struct irc_client *client)
+static void snapshot_release(struct list_snapshot *snapshot)
 {
-	char msg[MAX_MSG_SIZE + 1];
-	int size;
-	
-	list_for_each(channels, list_channel, client);
-	
-	size = cmd_print_reply(msg, sizeof(msg),
-				":%s " RPL_LISTEND " %s :End of LIST\r\n",
-				get_server_name(), client->nick);
-				
-	(void)write_to(client, msg, size);
+	if (snapshot != NULL && __sync_sub_and_fetch(&snapshot->refs, 1) == 0) {
+		free(snapshot->entries);
+		free(snapshot->text);
+		free(snapshot);
+	}
+}
+
+/** Appends a null terminated characters sequence to a snapshot's text, growing it if needed.
+	@param snapshot The snapshot being built.
+	@param str What to append.
+	@param offset Where the offset of the copy in `snapshot->text` is stored.
+	@return `0` on success; `-1` if there is not enough memory.
+ */
+static int snapshot_append(struct list_snapshot *snapshot, const char *str, size_t *offset)
+{
+	size_t len = strlen(str) + 1;
+	size_t capacity;
+	char *text;
+
+	if (snapshot->length + len > snapshot->text_capacity) {
+		for (capacity = snapshot->text_capacity == 0 ? LIST_SNAPSHOT_INITIAL_TEXT : snapshot->text_capacity;
+		     capacity < snapshot->length + len; capacity *= 2)
+			; /* Intentionally left blank */
+		if ((text = realloc(snapshot->text, capacity)) == NULL) {
+			return -1;
+		}
+		snapshot->text = text;
+		snapshot->text_capacity = capacity;
+	}
+	memcpy(snapshot->text + snapshot->length, str, len);
+	*offset = snapshot->length;
+	snapshot->length += len;
+	return 0;
+}
+
+/** Copies a channel into the snapshot being built. This is the callback passed to `list_for_each()` by
+	`snapshot_build()`, so it runs with the channel's shard locked, and must be quick.
+	@param data The channel.
+	@param args The snapshot being built. If there is not enough memory, its `failed` flag is set and the channel is
+	   skipped.
+ */
+static void snapshot_channel(void *data, void *args)
+{
+	irc_channel_ptr channel = (irc_channel_ptr)data;
+	struct list_snapshot *snapshot = (struct list_snapshot*)args;
+	struct list_snapshot_entry *entries;
+	struct list_snapshot_entry *entry;
+	int capacity;
+
+	if (snapshot->failed) {
+		return;
+	}
+	if (snapshot->count == snapshot->capacity) {
+		capacity = (snapshot->capacity == 0 ? LIST_SNAPSHOT_INITIAL_ENTRIES : 2 * snapshot->capacity);
+		if ((entries = realloc(snapshot->entries, (size_t) capacity * sizeof(*entries))) == NULL) {
+			snapshot->failed = 1;
+			return;
+		}
+		snapshot->entries = entries;
+		snapshot->capacity = capacity;
+	}
+	entry = &snapshot->entries[snapshot->count];
+	if (snapshot_append(snapshot, channel->name, &entry->name) == -1 ||
+	    snapshot_append(snapshot, channel->topic, &entry->topic) == -1) {
+		snapshot->failed = 1;
+		return;
+	}
+	entry->users = channel->users_count;
+	snapshot->count++;
+}
+
+/** Builds a new LIST snapshot. Shards are copied one at a time, so no more than one shard is locked at once, and each
+	one is only locked while its channels are copied.
+	@param version The value of `channels_version` read before the first shard was copied. If the channels change while
+	   the snapshot is built, the version will differ, and the next LIST builds a fresh snapshot.
+	@return The new snapshot, holding one reference; `NULL` if there is not enough memory.
+ */
+static struct list_snapshot *snapshot_build(unsigned version)
+{
+	struct list_snapshot *snapshot;
+	int i;
+
+	if ((snapshot = calloc(1, sizeof(*snapshot))) == NULL) {
+		return NULL;
+	}
+	snapshot->refs = 1;
+	snapshot->version = version;
+	snapshot->created = time(NULL);
+	for (i = 0; i < CHANNEL_SHARDS && !snapshot->failed; i++) {
+		list_for_each(channels[i], snapshot_channel, snapshot);
+	}
+	if (snapshot->failed) {
+		snapshot_release(snapshot);
+		return NULL;
+	}
+	return snapshot;
+}
+
+/** Gets a reference to an up to date LIST snapshot, which must be dropped with `snapshot_release()`.
+	The current snapshot is reused if no channel changed since it was built, or if it was built less than
+	`LIST_SNAPSHOT_MIN_AGE` seconds ago; otherwise, a new one is built. Threads asking for a snapshot while it is built
+	wait for it, instead of building their own.
+	@return A snapshot; `NULL` if there is not enough memory to build one, and there's no older snapshot to fall back to.
+ */
+static struct list_snapshot *snapshot_acquire(void)
+{
+	struct list_snapshot *snapshot;
+	unsigned version;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	version = __sync_add_and_fetch(&channels_version, 0);
+	if (current_snapshot == NULL || (current_snapshot->version != version &&
+					 time(NULL) - current_snapshot->created >= LIST_SNAPSHOT_MIN_AGE)) {
+		if ((snapshot = snapshot_build(version)) != NULL) {
+			snapshot_release(current_snapshot);
+			current_snapshot = snapshot;
+		}
+	}
+	if ((snapshot = current_snapshot) != NULL) {
+		__sync_add_and_fetch(&snapshot->refs, 1);
+	}
+	pthread_mutex_unlock(&snapshot_mutex);
+	return snapshot;
+}
+
+/** Queues the line that ends a LIST reply.
+	@param client The client who invoked the LIST command.
+ */
+static void list_end(struct irc_client *client)
+{
+	struct reply r;
+
+	reply_numeric(&r, client, RPL_LISTEND);
+	reply_trailing(&r, "End of LIST");
+	(void)reply_queue(&r, client);
+}
+
+/** Starts streaming the channels list to a client, in response to a LIST command. `RPL_LISTSTART` is queued, followed
+	by the first batch of `RPL_LIST` lines. The rest of the list is queued by `list_stream_continue()` as the client reads
+	it, and ends with `RPL_LISTEND`. If the client was still receiving the reply to a previous LIST, that reply is
+	abandoned.
+	The channels are taken from a snapshot, so the list may be up to `LIST_SNAPSHOT_MIN_AGE` seconds old.
+	@param client The client who invoked the LIST command.
+	@param min_users Only channels with at least this many users are listed.
+	@param max_users Only channels with at most this many users are listed.
+ */
+void list_each_channel(struct irc_client *client, int min_users, int max_users)
+{
+	struct list_stream *stream;
+	struct reply r;
+
+	list_stream_end(client);
+	reply_numeric(&r, client, RPL_LISTSTART);
+	reply_param(&r, "Channel");
+	reply_trailing(&r, "Users  Name");
+	(void)reply_queue(&r, client);
+	if ((stream = malloc(sizeof(*stream))) == NULL) {
+		list_end(client);
+		return;
+	}
+	if ((stream->snapshot = snapshot_acquire()) == NULL) {
+		free(stream);
+		list_end(client);
+		return;
+	}
+	stream->next = 0;
+	stream->min_users = min_users;
+	stream->max_users = max_users;
+	client->list_stream = stream;
+	list_stream_continue(client);
+}
+
+/** Queues the next batch of a client's LIST reply. At most `LIST_STREAM_BATCH` lines are queued at once, and nothing is
+	queued while the client's output buffer is above its soft limit. Once the whole snapshot was sent, `RPL_LISTEND` is
+	queued and the stream is released.
+	This is called by `list_each_channel()` and, every time the client's output buffer is emptied, by `client_flush()`.
+	@param client The client receiving a LIST reply. `client->list_stream` must not be `NULL`.
+ */
+void list_stream_continue(struct irc_client *client)
+{
+	struct list_stream *stream = client->list_stream;
+	struct list_snapshot *snapshot = stream->snapshot;
+	struct list_snapshot_entry *entry;
+	char users[16];
+	struct reply r;
+	int sent;
+
+	for (sent = 0; stream->next < snapshot->count && sent < LIST_STREAM_BATCH &&
+	     !client_queue_above_soft(&client->write_queue); stream->next++) {
+		entry = &snapshot->entries[stream->next];
+		if (entry->users < stream->min_users || entry->users > stream->max_users) {
+			continue;
+		}
+		snprintf(users, sizeof(users), "%d", entry->users);
+		reply_numeric(&r, client, RPL_LIST);
+		reply_param(&r, snapshot->text + entry->name);
+		reply_param(&r, users);
+		reply_trailing(&r, snapshot->text + entry->topic);
+		if (reply_queue(&r, client) == -1) {
+			/* The queue overflowed; client_flush() will terminate this session */
+			return;
+		}
+		sent++;
+	}
+	if (stream->next == snapshot->count) {
+		list_end(client);
+		list_stream_end(client);
+	}
+}
+
+/** Releases a client's LIST stream, if there is one, without sending the rest of the list. This must be called before
+	the client is freed.
+	@param client The client.
+ */
+void list_stream_end(struct irc_client *client)
+{
+	if (client->list_stream != NULL) {
+		snapshot_release(client->list_stream->snapshot);
+		free(client->list_stream);
+		client->list_stream = NULL;
+	}
+}
+
+/** The channels names collected by `burst_collect()`. */
+struct burst_names {
+	char **names; /**<The names. Each one is dynamically allocated. */
+	int count; /**<How many names are stored in `names`. */
+	int capacity; /**<How many names fit in `names`. */
+	int failed; /**<Set if there wasn't enough memory for every name, or if a line could not be queued in `link`. */
+	struct irc_client *link; /**<The server link being netbursted. */
+};
+
+/** Copies a channel's name into the list of channels to burst. This is the callback passed to `list_for_each()` by
+	`chan_burst()`, so it runs with the channel's shard locked.
+	@param data The channel.
+	@param args The `struct burst_names` being filled. If there is not enough memory, its `failed` flag is set.
+ */
+static void burst_collect(void *data, void *args)
+{
+	struct burst_names *burst = (struct burst_names*)args;
+	char **names;
+	int capacity;
+
+	if (burst->failed) {
+		return;
+	}
+	if (burst->count == burst->capacity) {
+		capacity = (burst->capacity == 0 ? LIST_SNAPSHOT_INITIAL_ENTRIES : 2 * burst->capacity);
+		if ((names = realloc(burst->names, (size_t) capacity * sizeof(*names))) == NULL) {
+			burst->failed = 1;
+			return;
+		}
+		burst->names = names;
+		burst->capacity = capacity;
+	}
+	if ((burst->names[burst->count] = strdup(((irc_channel_ptr)data)->name)) == NULL) {
+		burst->failed = 1;
+		return;
+	}
+	burst->count++;
+}
+
+/** Starts an `NJOIN` line, ":<server name> NJOIN <channel> :".
+   @param reply The reply. Anything it held is discarded.
+   @param chan The channel.
+ */
+static void njoin_begin(struct reply *reply, irc_channel_ptr chan)
+{
+	reply_begin(reply, "NJOIN");
+	reply_param(reply, chan->name);
+	reply_append_buf(reply, " :", 2);
+}
+
+/** Queues a channel's users in a server link, as `NJOIN` lines with a comma separated list of nicknames. Each line holds as
+	many nicknames as fit in `MAX_MSG_SIZE`. Users reached through the link itself are left out, since the other side already
+	knows about them. This is called by `chan_burst()` using `list_find_and_execute()`, with the channel's lock held.
+	@param channel An `irc_channel_ptr` holding the channel.
+	@param arg The `struct burst_names` of the netburst. If a line can't be queued, its `failed` flag is set.
+	@return This function always returns `NULL`.
+ */
+static void *burst_channel(void *channel, void *arg)
+{
+	irc_channel_ptr chan = (irc_channel_ptr)channel;
+	struct burst_names *burst = (struct burst_names*)arg;
+	struct irc_client *link = burst->link;
+	struct irc_client *user;
+	struct reply r;
+	size_t empty, len;
+	int i;
+
+	njoin_begin(&r, chan);
+	empty = r.length;
+	for (i = 0; i < chan->users_count; i++) {
+		user = chan->members[i].user;
+		if (user->link == link) {
+			continue;
+		}
+		len = strlen(user->nick);
+		if (r.length > empty && len + 1 > reply_room(&r)) {
+			if (reply_queue(&r, link) == -1) {
+				burst->failed = 1;
+				return NULL;
+			}
+			njoin_begin(&r, chan);
+		}
+		if (r.length > empty) {
+			reply_append_buf(&r, ",", 1);
+		}
+		reply_append_buf(&r, user->nick, len);
+	}
+	if (r.length > empty && reply_queue(&r, link) == -1) {
+		burst->failed = 1;
+	}
+	return NULL;
+}
+
+/** Queues every channel and its users in a server link that was just established, as part of the netburst (see `link.c`).
+	Channel names are collected first, one shard at a time, and then each channel is sent with its own lock held, so that
+	JOINs and PARTs can't be lost in between: they are either seen here, or broadcast to the link after this channel was
+	sent.
+	@param link The server link.
+	@return `0` on success; `-1` if there wasn't enough memory to collect the channels names, or if a line could not be
+	   queued in the link, in which case the netburst is incomplete.
+	@note The link's hard limit must be large enough for the whole netburst.
+ */
+int chan_burst(struct irc_client *link)
+{
+	struct burst_names burst;
+	int result;
+	int i;
+
+	burst.names = NULL;
+	burst.count = 0;
+	burst.capacity = 0;
+	burst.failed = 0;
+	burst.link = link;
+	for (i = 0; i < CHANNEL_SHARDS && !burst.failed; i++) {
+		list_for_each(channels[i], burst_collect, &burst);
+	}
+	for (i = 0; i < burst.count; i++) {
+		if (!burst.failed) {
+			list_find_and_execute(shard_of(burst.names[i]), burst.names[i], burst_channel, NULL, (void*)&burst, NULL, &result);
+		}
+		free(burst.names[i]);
+	}
+	free(burst.names);
+	return burst.failed ? -1 : 0;
+}
+
+/** Arguments for `export_channel()`. */
+struct chan_export_args {
+	int (*f)(void *, const char *, const char *, unsigned, struct chan_member_info *, int); /**<Function to call for each channel. */
+	void *args; /**<First argument for `f`. */
+	int failed; /**<Set if `f` failed, or if there wasn't enough memory. */
+};
+
+/** Hands a channel and its users to the function given to `chan_export()`. This is the callback passed to
+	`list_for_each()`, so it runs with the channel's shard locked.
+	@param data The channel.
+	@param args The `struct chan_export_args`.
+ */
+static void export_channel(void *data, void *args)
+{
+	irc_channel_ptr chan = (irc_channel_ptr)data;
+	struct chan_export_args *e = (struct chan_export_args*)args;
+	struct chan_member_info *members;
+	int i;
+
+	if (e->failed || chan->users_count == 0) {
+		return;
+	}
+	if ((members = malloc((size_t) chan->users_count * sizeof(*members))) == NULL) {
+		e->failed = 1;
+		return;
+	}
+	for (i = 0; i < chan->users_count; i++) {
+		members[i].user = chan->members[i].user;
+		members[i].prefix = chan->members[i].user->prefix + 1;
+		members[i].modes = chan->members[i].modes;
+	}
+	if (e->f(e->args, chan->name, chan->topic, chan->modes, members, chan->users_count) == -1) {
+		e->failed = 1;
+	}
+	free(members);
+}
+
+/** Calls a function for every channel, with the channel's name, topic, modes and users. This is used by `upgrade.c` to
+	hand the channels to a new process.
+	@param f The function. It is called with `args`, the channel's name, topic and modes, and an array with the channel's
+	   users, along with their count. It returns `0` on success, and `-1` to stop.
+	@param args First argument for `f`.
+	@return `0` on success; `-1` if `f` failed, or if there wasn't enough memory.
+	@warning Channels must not change meanwhile: every worker must be stopped. `f` runs with the channel's shard locked.
+ */
+int chan_export(int (*f)(void *, const char *, const char *, unsigned, struct chan_member_info *, int), void *args)
+{
+	struct chan_export_args e;
+	int i;
+
+	e.f = f;
+	e.args = args;
+	e.failed = 0;
+	for (i = 0; i < CHANNEL_SHARDS && !e.failed; i++) {
+		list_for_each(channels[i], export_channel, &e);
+	}
+	return e.failed ? -1 : 0;
+}
+
+/** Arguments for `import_newchan()`. */
+struct chan_import_args {
+	char *name; /**<The channel's name. */
+	const char *topic; /**<The channel's topic. */
+	unsigned modes; /**<The channel's modes. */
+	struct chan_member_info *members; /**<The channel's users. */
+	int count; /**<How many users there are. */
+};
+
+/** Callback used by `chan_import()` when the channel already exists. Nothing is done.
+	@param channel The channel.
+	@param args Not used.
+	@return Always `NULL`.
+ */
+static void *import_existingchan(void *channel, void *args)
+{
+	(void)channel;
+	(void)args;
+	return NULL;
+}
+
+/** Tells a channel's users that someone who is no longer on the channel quit. This is done for the users that were not
+	resumed by `chan_import()`, so that nobody has them in his users list anymore.
+	@param chan The channel.
+	@param prefix The prefix of the user who quit, without the leading `:`.
+ */
+static void import_ghost_quit(irc_channel_ptr chan, const char *prefix)
+{
+	struct reply r;
+	int i;
+
+	r.buf[0] = ':';
+	r.length = 1;
+	reply_append(&r, prefix);
+	reply_param(&r, "QUIT");
+	reply_trailing(&r, RESTART_QUIT_MSG);
+	(void)reply_end(&r);
+	for (i = 0; i < chan->users_count; i++) {
+		(void)queue_to(chan->members[i].user, r.buf, r.length);
+	}
+}
+
+/** Creates a channel handed over by `chan_import()`, and silently adds its users. It is called while holding the lock of
+	the channel's shard.
+	@param args A `struct chan_import_args *`.
+	@return The new channel; `NULL` if there wasn't enough memory, or none of the users could be added.
+ */
+static void *import_newchan(void *args)
+{
+	struct chan_import_args *info = (struct chan_import_args*)args;
+	struct irc_client *user;
+	irc_channel_ptr chan;
+	char *copy;
+	int i, j;
+
+	if ((chan = create_channel(info->name)) == NULL) {
+		return NULL;
+	}
+	if (strcmp(info->topic, !=, default_topic) && (copy = strdup(info->topic)) != NULL) {
+		chan->topic = copy;
+	}
+	chan->modes = info->modes;
+	for (i = 0; i < info->count; i++) {
+		if ((user = info->members[i].user) == NULL || user->channels_count == get_chanlimit()) {
+			continue;
+		}
+		if ((copy = strdup(info->name)) == NULL) {
+			continue;
+		}
+		if (add_member(chan, user) == -1) {
+			free(copy);
+			continue;
+		}
+		chan->members[chan->users_count - 1].modes = info->members[i].modes;
+		for (j = 0; user->channels[j] != NULL; j++)
+			; /* Intentionally left blank */
+		user->channels[j] = copy;
+		user->channels_count++;
+	}
+	if (chan->users_count == 0) {
+		destroy_channel(chan);
+		return NULL;
+	}
+	for (i = 0; i < info->count; i++) {
+		if (info->members[i].user == NULL) {
+			import_ghost_quit(chan, info->members[i].prefix);
+		}
+	}
+	return chan;
+}
+
+/** Recreates a channel handed over by the process that was running before a hot restart, see `upgrade.c`. Users are added
+	without any JOIN or NAMES being sent, since, as far as they know, they never left. Users that didn't make it to this
+	process, as told by a `NULL` `user`, are not added; the others get a QUIT from each of them instead.
+	@param name The channel's name.
+	@param topic The channel's topic.
+	@param modes The channel's modes.
+	@param members The channel's users.
+	@param count How many users there are.
+	@return `0` on success; `CHAN_NO_MEM` if the channel could not be created, or nobody could be added to it.
+	@warning This must be called before the users' sessions are resumed.
+ */
+int chan_import(char *name, const char *topic, unsigned modes, struct chan_member_info *members, int count)
+{
+	struct chan_import_args args;
+	int result;
+
+	args.name = name;
+	args.topic = topic;
+	args.modes = modes;
+	args.members = members;
+	args.count = count;
+	if (list_find_and_execute(shard_of(name), name, import_existingchan, import_newchan, NULL, (void*)&args, &result) == NULL &&
+	    result == 0) {
+		return CHAN_NO_MEM;
+	}
+	return 0;
 }
@@ -5,10 +5,14 @@
 #include <ev.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <setjmp.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 #include "client.h"
 #include "client_list.h"
 #include "protocol.h"
@@ -21,6 +25,13 @@
 #include "read_msgs.h"
 #include "send_err.h"
 #include "channel.h"
+#include "worker.h"
+#include "pool.h"
+#include "stats.h"
+#include "cmd_hash.h"
+#include "trace.h"
+#include "link.h"
+#include "uring.h"
 
 /** @file
    @brief Implementation of functions that deal with irc clients
@@ -33,54 +44,102 @@
  */
 
 static void manage_client_messages(EV_P_ ev_io *watcher, int revents);
+static int process_messages(struct irc_client *client, int max);
+static const struct read_budget *client_read_budget(struct irc_client *client);
+static void serve_input(struct irc_client *client);
+static void hold_input(struct irc_client *client);
+static int ssl_input_pending(struct irc_client *client);
+static void flood_timer_cb(EV_P_ ev_timer *w, int revents);
+static void start_reading(struct irc_client *client);
+static void stop_reading(struct irc_client *client);
 void destroy_client(void *arg);
 static void free_client(struct irc_client *client);
-static struct irc_client *create_client(struct irc_client_args_wrapper *args);
+static struct irc_client *create_client(struct worker *worker, int socket, SSL *ssl);
+static int lookup_client_host(struct irc_client *client, struct irc_client_args_wrapper *args);
+static int set_client_host(struct irc_client *client, const char *host);
+static void lookup_done(void *arg, const char *host);
+static void dns_timeout_cb(EV_P_ ev_timer *w, int revents);
+static void start_session(struct irc_client *client);
+static void setup_step_done(struct irc_client *client);
+static int start_handshake(struct irc_client *client);
+static int continue_handshake(struct irc_client *client);
+static void handshake_cb(EV_P_ ev_io *w, int revents);
+static void handshake_timeout_cb(EV_P_ ev_timer *w, int revents);
 void free_thread_arguments(struct irc_client_args_wrapper *);
-static void queue_async_cb(EV_P_ ev_async *w, int revents);
-static void ping_timer_cb(EV_P_ ev_timer *w, int revents);
+static void ping_timer_cb(struct wheel_timer *timer);
+static void write_ready_cb(EV_P_ ev_io *w, int revents);
+static void client_flush(struct irc_client *client);
 
-/** Accepts a new client's connection. This function is indirectly called by the threads scheduler. When a new client
-   pops in, the main process allocates a new thread whose init function is this one.
-   This function creates a new client instance and starts an event loop for this client.
+/** Sets up a new client's connection. This function is a worker task: when a new client pops in, the main thread hands
+   it over to a worker with `worker_dispatch()`, and the worker runs this function inside its own thread.
+   This function creates a new client instance and registers this client's watchers in the worker's events loop. From
+      this point on, every callback for this client runs in `worker`'s thread.
+   @param worker The worker that will own this client.
    @param args A pointer to `struct irc_client_args_wrapper`, casted to `void `. It is assumed that it points to an
       address in heap. This is always casted to `struct irc_client_args_wrapper `.
    This parameter is `free()`'d when it is not needed anymore; the caller does not need to worry about freeing the
       memory.
-   We chose heap allocation here because otherwise there would be a possible race condition: after the main process
-      calls `pthread_create()`, it is undefined which instruction is executed next (the next instructions inside the
-      main process, or the thread's init routine). In the unfortunate case that the main process kept executing and a
-      new client immediately arrived, there was a chance that `irc_client_args_wrapper` in the main's process stack
-      would be updated with the new client's values before the thread execution for this client started. Therefore, the
-      main process explicitly allocs memoryto pass arguments for each new client that arrives.
-   @return This function always returns `NULL`
+   We chose heap allocation here because the main thread keeps accepting new connections while this task is waiting to be
+      executed by the worker; the arguments for each new client must outlive the accepting code that filled them.
  */
-void *new_client(void *args)
+void new_client(struct worker *worker, void *args)
 {
 	struct irc_client *client;
-	if ((client = create_client((struct irc_client_args_wrapper*)args)) == NULL) {
-		return NULL;
+	struct irc_client_args_wrapper *arguments = (struct irc_client_args_wrapper*)args;
+	if ((client = create_client(worker, arguments->socket, arguments->ssl)) == NULL) {
+		free_thread_arguments(arguments);
+		worker_release_client(worker);
+		return;
+	}
+	if (setjmp(worker->session_exit) != 0) {
+		/* terminate_session() was called while talking to this client for the first time */
+		free_thread_arguments(arguments);
+		destroy_client(worker->terminated);
+		return;
+	}
+	if (lookup_client_host(client, arguments) == -1) {
+		free_thread_arguments(arguments);
+		destroy_client(client);
+		return;
+	}
+	free_thread_arguments(arguments);
+	if (client->uses_ssl && start_handshake(client) == -1) {
+		destroy_client(client);
+		return;
+	}
+	setup_step_done(client);
+}
+
+/** Starts serving a client once every connection setup step is over, namely, the reverse lookup of its address (see
+      `lookup_client_host()`) and, for secure connections, the SSL handshake (see `start_handshake()`). Both steps run
+      concurrently; each one calls this function when it is done, and the session is started by the last one.
+   @param client The new client.
+   @warning This function writes to the client; the caller must have set up an exit point for `terminate_session()`.
+ */
+static void setup_step_done(struct irc_client *client)
+{
+	if (client->dns_query == NULL && !client->in_handshake) {
+		start_session(client);
 	}
-	pthread_cleanup_push(destroy_client, (void*)client);
+}
+
+/** Starts serving a client whose hostname is known. From this point on, the client's messages are read and interpreted.
+   @param client The new client.
+   @warning This function writes to the client; the caller must have set up an exit point for `terminate_session()`.
+ */
+static void start_session(struct irc_client *client)
+{
 	/* At this point, we have:
 	        - A client structure successfully allocated
-	        - An events loop and 4 watchers - IO watcher, async watcher, and timers for PING
-	        - A thread's cleanup handler to exit gracefully
+	        - 2 watchers in the worker's events loop - IO watchers for reading and writing
+	        - A PING timer in the worker's timer wheel
+	        - An exit point in each callback to leave gracefully
 	   Let the party begin!
 	 */
-	ev_io_init(&client->io_watcher, manage_client_messages, client->socket_fd, EV_READ);
-	ev_io_start(client->ev_loop, &client->io_watcher);
-	ev_async_init(&client->async_watcher, queue_async_cb);
-	ev_async_start(client->ev_loop, &client->async_watcher);
+	start_reading(client);
 	client->last_activity = ev_now(client->ev_loop);
-	ev_init(&client->time_watcher, ping_timer_cb);
-	ping_timer_cb(client->ev_loop, &client->time_watcher, 0);
-	ev_run(client->ev_loop, 0); /* Go */
-
-	/* This is never reached, but we need to pair up push() and pop() calls */
-	pthread_cleanup_pop(0);
-
-	return NULL;
+	timer_wheel_add(&client->worker->timers, &client->ping_timer, get_ping_freq());
+	client_flush(client);
 }
 
 /** The core function that deals with a client. This is the callback function for a client's connection (previously set
@@ -109,13 +168,6 @@ void *new_client(void *args)
 static void manage_client_messages(EV_P_ ev_io *watcher, int revents)
 {
 	struct irc_client *client;
-	char *msg_in;
-	int msg_size;
-	int params_no;
-	int parse_res;
-	char *prefix;
-	char *cmd;
-	char *params[MAX_IRC_PARAMS];
 
 	if (revents & EV_ERROR) {
 		fprintf(stderr, "::client.c:manage_client_messages(): unexpected EV_ERROR on client event watcher\n");
@@ -128,13 +180,165 @@ static void manage_client_messages(EV_P_ ev_io *watcher, int revents)
 		return;
 	}
 	client = (struct irc_client*)((char*)watcher - offsetof(struct irc_client, io_watcher));
+	if (setjmp(client->worker->session_exit) != 0) {
+		TRACE_MSG_END();
+		destroy_client(client->worker->terminated);
+		return;
+	}
+
+	read_data(client, (size_t) client_read_budget(client)->bytes);
+	serve_input(client);
+	TRACE_MSG_END();
+	/* Every reply to the commands we just processed is written at once */
+	client_flush(client);
+}
+
+/** Returns the read budget of a client's class: server links, clients of the secure socket, or clients of the
+   standard socket.
+   @param client The client.
+   @return The budget. See `struct read_budget`.
+ */
+static const struct read_budget *client_read_budget(struct irc_client *client)
+{
+	if (client->is_server) {
+		return get_link_read_budget();
+	}
+	return client->uses_ssl ? get_ssl_read_budget() : get_std_read_budget();
+}
+
+/** Processes as many messages from a client's input buffer as his read budget allows, and decides what happens to the rest,
+   see `hold_input()`. If the client's class has a token bucket, it is refilled first, and every message processed takes one token.
+   @param client The client.
+   @warning Commands may call `terminate_session()`; the caller must have set up an exit point.
+ */
+static void serve_input(struct irc_client *client)
+{
+	const struct read_budget *budget = client_read_budget(client);
+	ev_tstamp now;
+	int max = budget->msgs;
+
+	if (budget->rate > 0) {
+		now = ev_now(client->ev_loop);
+		client->flood_tokens += (now - client->flood_stamp) * budget->rate;
+		if (client->flood_tokens > budget->burst) {
+			client->flood_tokens = budget->burst;
+		}
+		client->flood_stamp = now;
+		if ((int) client->flood_tokens < max) {
+			max = (int) client->flood_tokens;
+		}
+	}
+	client->flood_tokens -= process_messages(client, max);
+	hold_input(client);
+}
 
-	read_data(client);
+/** Called once a client was served, to deal with the messages left in his input buffer, if any.
+   If there are none, the client's socket is read again, unless his output is paused. Otherwise, the socket is not read until
+   every message in the buffer was processed, so that the buffer never overflows and the kernel pushes the client back; the
+   rest is processed by `client_resume_input()` in the next loop iteration, or, if his token bucket is empty, once it has a
+   token again.
+   Secure clients are held as well while OpenSSL has decrypted characters that were not read yet, since the socket won't
+   report them again; see `ssl_input_pending()`.
+   @param client The client.
+ */
+static void hold_input(struct irc_client *client)
+{
+	const struct read_budget *budget;
+	int msgs = msg_pending(&client->last_msg);
+
+	if (!msgs && !ssl_input_pending(client)) {
+		if (client->input_held) {
+			client->input_held = 0;
+			if (!client->read_paused) {
+				start_reading(client);
+			}
+		}
+		return;
+	}
+	if (!client->input_held) {
+		client->input_held = 1;
+		if (!client->read_paused) {
+			stop_reading(client);
+		}
+	}
+	if (client->read_paused) {
+		/* client_flush() defers him once his output drains */
+		return;
+	}
+	budget = client_read_budget(client);
+	if (msgs && budget->rate > 0 && client->flood_tokens < 1) {
+		ev_timer_stop(client->ev_loop, &client->flood_timer);
+		ev_timer_set(&client->flood_timer, (1 - client->flood_tokens) / budget->rate, 0.);
+		ev_timer_start(client->ev_loop, &client->flood_timer);
+	} else {
+		worker_defer_client(client);
+	}
+}
+
+/** Determines if a secure client's SSL structure holds decrypted characters that were not read yet. `SSL_read()` decrypts
+   whole records, which can be larger than the client's read budget, so part of a record may be left there after `read_data()`.
+   @param client The client.
+   @return `1` if there are such characters; `0` otherwise, and always for plaintext clients.
+ */
+static int ssl_input_pending(struct irc_client *client)
+{
+	return client->ssl != NULL && !client->in_handshake && SSL_pending(client->ssl) > 0;
+}
+
+/** Processes the messages that a client's read budget left in his input buffer, or, if there are none, reads the rest of
+   what OpenSSL decrypted for him. Called by the client's worker, see `worker_defer_client()`, and by the client's flood timer.
+   @param client The client. It must be owned by the calling worker.
+ */
+void client_resume_input(struct irc_client *client)
+{
+	if (setjmp(client->worker->session_exit) != 0) {
+		TRACE_MSG_END();
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	if (client->read_paused) {
+		return;
+	}
+	if (!msg_pending(&client->last_msg) && ssl_input_pending(client)) {
+		read_data(client, (size_t) client_read_budget(client)->bytes);
+	}
+	serve_input(client);
+	TRACE_MSG_END();
+	client_flush(client);
+}
 
-	while ((msg_size = next_msg(&client->last_msg, &msg_in)) != MSG_CONTINUE) {
+/** Callback for a client's flood timer, which fires once his token bucket has a token again.
+   @param w Pointer to this client's flood timer. A pointer to the client is obtained with `offsetof()`, as usual.
+   @param revents libev's flags.
+ */
+static void flood_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+	client_resume_input((struct irc_client*)((char*)w - offsetof(struct irc_client, flood_timer)));
+}
+
+/** Interprets the complete messages in a client's input buffer, up to a given number of them.
+   @param client The client.
+   @param max Maximum number of messages to interpret. Empty messages count too.
+   @return How many messages were interpreted.
+   @warning Commands may call `terminate_session()`; the caller must have set up an exit point.
+ */
+static int process_messages(struct irc_client *client, int max)
+{
+	int processed = 0;
+	char *msg_in;
+	int msg_size;
+	int params_no;
+	int cmd_id;
+	int parse_res;
+	char *prefix;
+	char *cmd;
+	char *params[MAX_IRC_PARAMS];
+	unsigned long long started;
+
+	while (processed < max && (msg_size = next_msg(&client->last_msg, &msg_in)) != MSG_CONTINUE) {
+		processed++;
 		if (msg_size == 0 || (msg_size == 1 && msg_in[msg_size - 1] == '\r')) {
 			/* Silently ignore empty messages */
-			printf("EMPTY MSG\n");
 			continue;
 		}
 		/* Handle clients which terminate messages with \n and clients that use \r\n */
@@ -143,128 +347,641 @@ static void manage_client_messages(EV_P_ ev_io *watcher, int revents)
 		} else {
 			msg_in[msg_size] = '\0';
 		}
-		printf("Got new message: %s\n", msg_in);
-		parse_res = parse_msg(msg_in, &prefix, &cmd, params, &params_no);
+		TRACE_MSG_PARSE(client, msg_in);
+		parse_res = parse_msg(msg_in, &prefix, &cmd, &cmd_id, params, &params_no);
 		if (parse_res == -1) {
+			stats_command(CMD_UNKNOWN, 0);
 			send_err_unknowncommand(client, "");
 			continue;
 		}
-		interpret_msg(client, prefix, cmd, params, params_no);
+		/* Commands that end the session, such as QUIT, never come back here, and are not timed */
+		TRACE_MSG_DISPATCH(client, cmd_id);
+		started = stats_clock();
+		interpret_msg(client, prefix, cmd, cmd_id, params, params_no);
+		stats_command(cmd_id, stats_clock() - started);
 	}
+	return processed;
 }
 
+/** Starts reading a client's input. Plaintext clients are read through io_uring if their worker has a ring, see
+   `uring.h`; otherwise, or if that fails, their IO watcher is started.
+   @param client The client.
+ */
+static void start_reading(struct irc_client *client)
+{
+#ifdef YAIRCD_URING
+	if (client->uring == NULL && !client->uses_ssl && client->worker->uring != NULL &&
+	    uring_conn_open(client->worker->uring, client) == -1) {
+		fprintf(stderr, "::client.c:start_reading(): Could not serve a client through io_uring, using libev.\n");
+	}
+	if (client->uring != NULL) {
+		if (uring_conn_read(client, 1) == 0) {
+			return;
+		}
+		/* No submission queue entries left; the socket is still non-blocking, so libev can take over */
+		uring_conn_close(client);
+	}
+#endif
+	ev_io_start(client->ev_loop, &client->io_watcher);
+}
+
+/** Stops reading a client's input, see `start_reading()`.
+   @param client The client.
+ */
+static void stop_reading(struct irc_client *client)
+{
+#ifdef YAIRCD_URING
+	if (client->uring != NULL) {
+		(void)uring_conn_read(client, 0);
+		return;
+	}
+#endif
+	ev_io_stop(client->ev_loop, &client->io_watcher);
+}
+
+#ifdef YAIRCD_URING
+/** Called by io_uring when characters were received from a client's socket. They are processed just like
+   `manage_client_messages()` processes what it reads, see `store_data()`. The client's read budget limits how many messages
+   are processed, but not how many characters are received: if they don't fit in the input buffer, every message is processed
+   to make room. Those messages are still charged to the client's token bucket, which may go below zero; his next messages then
+   wait until it is refilled.
+   @param client The client.
+   @param buf The characters received.
+   @param len How many characters were received. `0` means that the other end closed the connection, and a negative value
+      is a negated `errno` value; either way, the client's session is terminated with `BAD_READ_QUIT_MSG`.
+ */
+void client_uring_input(struct irc_client *client, const char *buf, ssize_t len)
+{
+	size_t stored;
+
+	if (setjmp(client->worker->session_exit) != 0) {
+		TRACE_MSG_END();
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	if (len <= 0) {
+		terminate_session(client, BAD_READ_QUIT_MSG);
+	}
+	for (;;) {
+		stored = store_data(client, buf, (size_t) len);
+		buf += stored;
+		len -= (ssize_t) stored;
+		if (len == 0) {
+			break;
+		}
+		client->flood_tokens -= process_messages(client, INT_MAX);
+	}
+	serve_input(client);
+	TRACE_MSG_END();
+	client_flush(client);
+}
+
+/** Called by io_uring when a send to a client's socket completed, so that the rest of his queue is sent. This is what
+   `write_ready_cb()` is for clients served by libev.
+   @param client The client.
+ */
+void client_uring_output(struct irc_client *client)
+{
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	client_flush(client);
+}
+#endif
+
 /** Creates a new client instance that will be used throughout this client's lifetime.
-   @param args A pre-filled arguments wrapper with appropriate information. See the documentation for `struct
-      irc_client_args_wrapper` for further information.
+   The client's watchers are initialized and bound to `worker`'s loop, but they are not started.
+   @param worker The worker that will own this client.
+   @param socket The client's socket, or `-1` for clients on other servers.
+   @param ssl The SSL structure of a secure connection, or `NULL` if the connection is plaintext.
    @return `NULL` if there aren't enough resources to create a new client; otherwise, pointer to `struct irc_client` for
       this user.
  */
-static struct irc_client *create_client(struct irc_client_args_wrapper *args)
+static struct irc_client *create_client(struct worker *worker, int socket, SSL *ssl)
 {
 	struct irc_client *new_client;
-	char hostbuf[NI_MAXHOST];
-	char ip[INET_ADDRSTRLEN];
-	/* In the future
-	   char ip6[INET6_ADDRSTRLEN];
-	 */
-	if ((new_client = malloc(sizeof(struct irc_client))) == NULL) {
-		free_thread_arguments(args);
+	if ((new_client = pool_alloc(sizeof(struct irc_client))) == NULL) {
 		return NULL;
 	}
-	if ((new_client->ev_loop = ev_loop_new(0)) == NULL) {
-		free(new_client);
-		free_thread_arguments(args);
+	if (client_queue_init(&new_client->write_queue,
+			      (size_t) (ssl != NULL ? get_ssl_socket_sendq() : get_std_socket_sendq()),
+			      (size_t) (ssl != NULL ? get_ssl_socket_sendq_soft() : get_std_socket_sendq_soft())) == -1) {
+		pool_free(new_client);
 		return NULL;
 	}
-	if (client_queue_init(&new_client->write_queue) == -1) {
-		ev_loop_destroy(new_client->ev_loop);
-		free(new_client);
-		free_thread_arguments(args);
+	if ((new_client->channels = pool_calloc((size_t) get_chanlimit() * sizeof(*new_client->channels))) == NULL) {
+		client_queue_destroy(&new_client->write_queue);
+		pool_free(new_client);
 		return NULL;
 	}
-	if ((new_client->channels = calloc((size_t) get_chanlimit(), sizeof(*new_client->channels))) == NULL) {
+	if ((new_client->quit_seen = pool_calloc((size_t) worker_pool_size() * sizeof(*new_client->quit_seen))) == NULL) {
+		pool_free(new_client->channels);
 		client_queue_destroy(&new_client->write_queue);
-		ev_loop_destroy(new_client->ev_loop);
-		free(new_client);
-		free_thread_arguments(args);
+		pool_free(new_client);
+		return NULL;
 	}
-	new_client->socket_fd = args->socket;
+	new_client->worker = worker;
+	new_client->ev_loop = worker->loop;
+	new_client->socket_fd = socket;
+	new_client->uring = NULL;
 	new_client->server = NULL; /* local client */
+	new_client->link = NULL;
+	new_client->link_next = NULL;
+	new_client->link_prev = NULL;
+	new_client->hopcount = 0;
+	new_client->server_link = NULL;
+	new_client->kill_reason = NULL;
 	new_client->is_registered = 0;
-	new_client->uses_ssl = (args->ssl != NULL);
-	new_client->ssl = args->ssl;
+	new_client->is_server = 0;
+	new_client->uses_ssl = (ssl != NULL);
+	new_client->ssl = ssl;
 	new_client->realname = NULL;
 	new_client->nick = NULL;
 	new_client->username = NULL;
 	new_client->hostname = NULL;
 	new_client->public_host = NULL;
+	new_client->prefix = NULL;
+	new_client->prefix_len = 0;
+	new_client->host_reversed = 0;
+	new_client->in_handshake = 0;
+	new_client->is_oper = 0;
+	new_client->read_paused = 0;
+	new_client->input_held = 0;
+	new_client->deferred_pending = 0;
+	new_client->deferred_next = NULL;
 	new_client->channels_count = 0;
 	new_client->connection_status = STATUS_OK;
+	new_client->wakeup_next = NULL;
+	new_client->wakeup_pending = 0;
+	new_client->list_stream = NULL;
 	initialize_irc_message(&new_client->last_msg);
+	ev_io_init(&new_client->io_watcher, manage_client_messages, new_client->socket_fd, EV_READ);
+	ev_io_init(&new_client->write_watcher, write_ready_cb, new_client->socket_fd, EV_WRITE);
+	wheel_timer_init(&new_client->ping_timer, ping_timer_cb);
+	ev_init(&new_client->handshake_watcher, handshake_cb);
+	ev_init(&new_client->handshake_timer, handshake_timeout_cb);
+	ev_init(&new_client->dns_timer, dns_timeout_cb);
+	ev_init(&new_client->flood_timer, flood_timer_cb);
+	new_client->flood_tokens = client_read_budget(new_client)->burst;
+	new_client->flood_stamp = ev_now(new_client->ev_loop);
+	new_client->dns_query = NULL;
+	return new_client;
+}
 
-	yaircd_send(new_client, ":%s NOTICE AUTH :*** Looking up your hostname...\r\n", get_server_name());
+/** Sets up the connection of a server link that this server established, see `link.c`. The peer's address is used as its
+   hostname, and its messages are read right away; nothing is written to it.
+   @param worker The worker that will own the link. Must be the calling worker.
+   @param socket The connected socket. It is closed if the link can't be created.
+   @param address The peer's address.
+   @return The new link's client structure; `NULL` if there aren't enough resources.
+ */
+struct irc_client *new_link_client(struct worker *worker, int socket, const char *address)
+{
+	struct irc_client *client;
+	if ((client = create_client(worker, socket, NULL)) == NULL) {
+		close(socket);
+		return NULL;
+	}
+	if ((client->hostname = strdup(address)) == NULL || (client->public_host = strdup(address)) == NULL) {
+		free_client(client);
+		return NULL;
+	}
+	worker_adopt_client(worker);
+	client->is_server = 1;
+	start_reading(client);
+	client->last_activity = ev_now(client->ev_loop);
+	timer_wheel_add(&client->worker->timers, &client->ping_timer, get_ping_freq());
+	return client;
+}
+
+/** Creates the structure for a client on another server of the network, introduced by a server link with `NICK`.
+   The client has no socket: it belongs to the link's worker, and messages for him are queued in the link, see `link.c`.
+   He is not added to the clients list.
+   @param link The server link this client is reached through.
+   @param nick The client's nickname.
+   @param username The client's username.
+   @param host The client's public host, as shown by his own server.
+   @param server The name of the client's server.
+   @param realname The client's GECOS field.
+   @param hopcount How many servers away the client is.
+   @return The new client; `NULL` if there aren't enough resources.
+ */
+struct irc_client *new_remote_client(struct irc_client *link, const char *nick, const char *username, const char *host,
+				     const char *server, const char *realname, int hopcount)
+{
+	struct irc_client *client;
+	if ((client = create_client(link->worker, -1, NULL)) == NULL) {
+		return NULL;
+	}
+	if ((client->nick = strdup(nick)) == NULL || (client->username = strdup(username)) == NULL ||
+	    (client->hostname = strdup(host)) == NULL || (client->public_host = strdup(host)) == NULL ||
+	    (client->server = strdup(server)) == NULL || (client->realname = strdup(realname)) == NULL ||
+	    update_client_prefix(client) == -1) {
+		free_client(client);
+		return NULL;
+	}
+	client->link = link;
+	client->hopcount = hopcount;
+	client->is_registered = 1;
+	return client;
+}
+
+/** Frees a client on another server of the network, created by `new_remote_client()`.
+   @param client The client. He must no longer be in any channel, nor in the clients list.
+   @warning Must only be called by the worker that owns the client's link.
+ */
+void destroy_remote_client(struct irc_client *client)
+{
+	free_client(client);
+}
+
+/** Recreates a registered client handed over by the process that was running before a hot restart, see `upgrade.c`. The
+   client is added to the clients list, but his watchers are not started until `start_resumed_client()` runs.
+   @param worker The worker that will own this client.
+   @param socket The client's socket. It is closed if the client can't be created.
+   @param nick The client's nickname.
+   @param username The client's username.
+   @param hostname The client's hostname.
+   @param public_host The client's cloaked hostname.
+   @param realname The client's GECOS field.
+   @return The new client; `NULL` if there aren't enough resources, or if his nickname is taken.
+ */
+struct irc_client *resume_client(struct worker *worker, int socket, const char *nick, const char *username,
+				 const char *hostname, const char *public_host, const char *realname)
+{
+	struct irc_client *client;
+	if ((client = create_client(worker, socket, NULL)) == NULL) {
+		close(socket);
+		return NULL;
+	}
+	if ((client->nick = strdup(nick)) == NULL || (client->username = strdup(username)) == NULL ||
+	    (client->hostname = strdup(hostname)) == NULL || (client->public_host = strdup(public_host)) == NULL ||
+	    (client->realname = strdup(realname)) == NULL || update_client_prefix(client) == -1 ||
+	    client_list_add(client, client->nick) != 0) {
+		free_client(client);
+		return NULL;
+	}
+	client->is_registered = 1;
+	return client;
+}
+
+/** Destroys a client created by `resume_client()` whose session can't be resumed after all. His socket is closed.
+   @param client The client. His watchers must not have been started.
+ */
+void discard_resumed_client(struct irc_client *client)
+{
+	client_list_delete(client);
+	free_client(client);
+}
+
+/** Worker task that resumes the session of a client created by `resume_client()`: his watchers are started, and whatever
+   was queued for him is written.
+   @param worker The worker that owns the client.
+   @param arg The client.
+ */
+void start_resumed_client(struct worker *worker, void *arg)
+{
+	struct irc_client *client = (struct irc_client*)arg;
+	worker_adopt_client(worker);
+	start_reading(client);
+	/* He may have handed over messages that were not processed yet */
+	hold_input(client);
+	client->last_activity = ev_now(client->ev_loop);
+	timer_wheel_add(&worker->timers, &client->ping_timer, get_ping_freq());
+	client_wakeup(client);
+}
+
+/** Starts the reverse lookup of a new client's address. The client is notified of the lookup progress with `NOTICE AUTH`
+      messages.
+   `hostname` is set to the client's IP address right away. If the resolver's cache knows the address, `hostname`,
+      `public_host` and `host_reversed` are filled in immediately; otherwise, a query is handed to the resolver, and
+      `dns_query` is set. In the latter case, the session is started by `lookup_done()` or `dns_timeout_cb()`, whichever
+      comes first.
+   @param client The new client.
+   @param args The arguments wrapper that was used to create `client`.
+   @return `0` on success; `-1` if there aren't enough resources or the client's address is invalid.
+   @warning This function writes to the client; the caller must have set up an exit point for `terminate_session()`.
+ */
+static int lookup_client_host(struct irc_client *client, struct irc_client_args_wrapper *args)
+{
+	char hostbuf[NI_MAXHOST];
+	char ip[INET_ADDRSTRLEN];
+	/* In the future
+	   char ip6[INET6_ADDRSTRLEN];
+	 */
+	yaircd_send(client, ":%s NOTICE AUTH :*** Looking up your hostname...\r\n", get_server_name());
 	if (!args->is_ipv6) {
-		if (getnameinfo((struct sockaddr*)&args->address.ipv4_address, args->address_length, hostbuf,
-				sizeof(hostbuf), NULL, 0, NI_NAMEREQD) != 0) {
-			yaircd_send(
-				new_client,
-				":%s NOTICE AUTH :*** Couldn't resolve your hostname; using your IP address instead.\r\n",
-				get_server_name());
-			if (inet_ntop(AF_INET, (void*)&args->address.ipv4_address.sin_addr, ip, sizeof(ip)) == NULL) {
-				/* Weird case ... no reverse lookup, and invalid IP..? */
-				fprintf(
-					stderr,
-					"::client.c:create_client(): Couldn't find a reverse hostname, and inet_ntop() reported an error.\n");
-				ev_loop_destroy(new_client->ev_loop);
-				free(new_client);
-				free_thread_arguments(args);
-				return NULL;
-			}
-			new_client->host_reversed = 0;
-			if ((new_client->hostname = strdup(ip)) == NULL) {
-				ev_loop_destroy(new_client->ev_loop);
-				free(new_client);
-				free_thread_arguments(args);
-				return NULL;
-			}
-		}else {
-			yaircd_send(new_client, ":%s NOTICE AUTH :*** Found your hostname.\r\n", get_server_name());
-			new_client->host_reversed = 1;
-			if ((new_client->hostname = strdup(hostbuf)) == NULL) {
-				ev_loop_destroy(new_client->ev_loop);
-				free(new_client);
-				free_thread_arguments(args);
-				return NULL;
-			}
+		if (inet_ntop(AF_INET, (void*)&args->address.ipv4_address.sin_addr, ip, sizeof(ip)) == NULL) {
+			/* Weird case ... invalid IP..? */
+			fprintf(stderr, "::client.c:lookup_client_host(): inet_ntop() reported an error.\n");
+			return -1;
+		}
+		if ((client->hostname = strdup(ip)) == NULL) {
+			return -1;
 		}
-		if ((new_client->public_host = (new_client->host_reversed ? hide_host(new_client->hostname) : hide_ipv4(new_client->hostname))) == NULL) {
-			free(new_client->hostname);
-			ev_loop_destroy(new_client->ev_loop);
-			free(new_client);
-			free_thread_arguments(args);
-			return NULL;
+		switch (resolver_cache_lookup(&args->address.ipv4_address, hostbuf, sizeof(hostbuf))) {
+		case RESOLVER_HIT:
+			return set_client_host(client, hostbuf);
+		case RESOLVER_NEGATIVE:
+			return set_client_host(client, NULL);
 		}
+		if ((client->dns_query = resolver_query(client->worker, &args->address.ipv4_address, lookup_done, client)) == NULL) {
+			return set_client_host(client, NULL);
+		}
+		ev_timer_set(&client->dns_timer, get_dns_timeout(), 0.);
+		ev_timer_start(client->ev_loop, &client->dns_timer);
 	}
-	free_thread_arguments(args);
-	return new_client;
+	return 0;
+}
+
+/** Fills in a new client's `hostname`, `public_host` and `host_reversed` once its reverse lookup is over, and notifies the
+      client.
+   @param client The new client. Its `hostname` holds its IP address.
+   @param host The hostname found, or `NULL` if the address could not be resolved, in which case the IP address is kept.
+   @return `0` on success; `-1` if there aren't enough resources.
+   @warning This function writes to the client; the caller must have set up an exit point for `terminate_session()`.
+ */
+static int set_client_host(struct irc_client *client, const char *host)
+{
+	char *name;
+	if (host == NULL) {
+		yaircd_send(client, ":%s NOTICE AUTH :*** Couldn't resolve your hostname; using your IP address instead.\r\n",
+			    get_server_name());
+		client->host_reversed = 0;
+	} else {
+		yaircd_send(client, ":%s NOTICE AUTH :*** Found your hostname.\r\n", get_server_name());
+		if ((name = strdup(host)) == NULL) {
+			return -1;
+		}
+		free(client->hostname);
+		client->hostname = name;
+		client->host_reversed = 1;
+	}
+	if ((client->public_host = (client->host_reversed ? hide_host(client->hostname) : hide_ipv4(client->hostname))) == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+/** Rebuilds a client's message prefix, ":nick!username@public_host", from its current nickname, username and public host.
+   Messages sent on behalf of this client copy the prefix as is, instead of formatting it every time.
+   This must be called whenever any of these fields changes. If any of them is still `NULL`, the prefix is `NULL` too.
+   @param client The client.
+   @return `0` on success; `-1` if there is no memory for the new prefix, in which case the old prefix is kept.
+ */
+int update_client_prefix(struct irc_client *client)
+{
+	size_t nick_len, user_len, host_len;
+	char *prefix;
+
+	if (client->nick == NULL || client->username == NULL || client->public_host == NULL) {
+		free(client->prefix);
+		client->prefix = NULL;
+		client->prefix_len = 0;
+		return 0;
+	}
+	nick_len = strlen(client->nick);
+	user_len = strlen(client->username);
+	host_len = strlen(client->public_host);
+	if ((prefix = malloc(nick_len + user_len + host_len + 4)) == NULL) {
+		return -1;
+	}
+	prefix[0] = ':';
+	memcpy(prefix + 1, client->nick, nick_len);
+	prefix[nick_len + 1] = '!';
+	memcpy(prefix + nick_len + 2, client->username, user_len);
+	prefix[nick_len + user_len + 2] = '@';
+	memcpy(prefix + nick_len + user_len + 3, client->public_host, host_len + 1);
+	free(client->prefix);
+	client->prefix = prefix;
+	client->prefix_len = (int) (nick_len + user_len + host_len + 3);
+	return 0;
+}
+
+/** Finishes a new client's reverse lookup and starts its session.
+   @param client The new client.
+   @param host The hostname found, or `NULL` if there is none.
+   @warning This function writes to the client; the caller must have set up an exit point for `terminate_session()`.
+ */
+static void finish_lookup(struct irc_client *client, const char *host)
+{
+	if (set_client_host(client, host) == -1) {
+		destroy_client(client);
+		return;
+	}
+	setup_step_done(client);
+}
+
+/** Completion function for a client's reverse lookup, as passed to `resolver_query()`. It runs in the client's worker.
+   @param arg The client.
+   @param host The hostname found, or `NULL` if there is none.
+ */
+static void lookup_done(void *arg, const char *host)
+{
+	struct irc_client *client = (struct irc_client*)arg;
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	client->dns_query = NULL;
+	ev_timer_stop(client->ev_loop, &client->dns_timer);
+	/* The handshake, if still running, goes on; it stops its own watchers when it is over */
+	finish_lookup(client, host);
+}
+
+/** Callback function for a client's DNS timer. The reverse lookup took too long: it is cancelled and the client's IP
+      address is used instead.
+   @param w Pointer to this client's DNS timer. A pointer to the client is obtained with `offsetof()`.
+   @param revents libev's flags. Not used.
+ */
+static void dns_timeout_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct irc_client *client = (struct irc_client*)((char*)w - offsetof(struct irc_client, dns_timer));
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	resolver_cancel(client->dns_query);
+	client->dns_query = NULL;
+	finish_lookup(client, NULL);
+}
+
+/** Starts a secure client's SSL handshake. The handshake is driven by `handshake_cb()`, which is registered for whatever
+      socket event `SSL_accept()` is waiting for, and it must be over within `get_handshake_timeout()` seconds.
+   @param client The new client. Its `ssl` structure is in accept state.
+   @return `0` on success; `-1` if the handshake failed.
+ */
+static int start_handshake(struct irc_client *client)
+{
+	client->in_handshake = 1;
+	client->handshake_start = stats_clock();
+	if (continue_handshake(client) == -1) {
+		return -1;
+	}
+	if (client->in_handshake) {
+		ev_timer_set(&client->handshake_timer, get_handshake_timeout(), 0.);
+		ev_timer_start(client->ev_loop, &client->handshake_timer);
+	}
+	return 0;
 }
 
-/** Callback function for a client's async watcher.
-   This function is called by libev when another thread issues `async_send()` on this thread's async watcher.
-   We use this mechanism to notify client threads that new data is queued, waiting to be written into the socket.
-   For example, if a thread from client A reads a PRIVMSG command with a message whose destination is B, then A's thread
-      willqueue the message into B's queue, and call `async_send()` on B's async watcher, to wake B up. When B wakes up,
-      this function is called.
-   Therefore, the main purpose of this function is to flush a client's queue.
-   @param w Pointer to this client's async watcher. A pointer to the client is obtained with `(struct irc_client *) ((char *)w - offsetof(struct irc_client, async_watcher))`. 
-			This pointer manipulation is necessary to extract the client's structure where `w` is embedded. In doubt, read about `offsetof()` macro in `stddef.h`'s manpage.
-   @param revents libev's flags. Not used for async callbacks.
+/** Moves a client's SSL handshake forward as far as the socket allows, without blocking. If `SSL_accept()` needs to read or
+      write more data, the handshake watcher is set up accordingly. When the handshake is over, `in_handshake` is cleared and every
+      handshake watcher is stopped.
+   @param client The client.
+   @return `0` if the handshake is over or waiting for the socket; `-1` if it failed, in which case the caller must destroy the client.
  */
-static void queue_async_cb(EV_P_ ev_async *w, int revents)
+static int continue_handshake(struct irc_client *client)
+{
+	int ret;
+	int err;
+	ERR_clear_error();
+	if ((ret = SSL_accept(client->ssl)) == 1) {
+		client->in_handshake = 0;
+		ev_io_stop(client->ev_loop, &client->handshake_watcher);
+		ev_timer_stop(client->ev_loop, &client->handshake_timer);
+		stats_handshake(stats_clock() - client->handshake_start);
+		return 0;
+	}
+	err = SSL_get_error(client->ssl, ret);
+	if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+		fprintf(stderr, "::client.c:continue_handshake(): SSL Handshake failed.\n");
+		return -1;
+	}
+	ev_io_stop(client->ev_loop, &client->handshake_watcher);
+	ev_io_set(&client->handshake_watcher, client->socket_fd, err == SSL_ERROR_WANT_READ ? EV_READ : EV_WRITE);
+	ev_io_start(client->ev_loop, &client->handshake_watcher);
+	return 0;
+}
+
+/** Callback function for a client's handshake watcher. The socket is ready for the next step of the SSL handshake.
+   @param w Pointer to this client's handshake watcher. A pointer to the client is obtained with `offsetof()`.
+   @param revents libev's flags.
+ */
+static void handshake_cb(EV_P_ ev_io *w, int revents)
+{
+	struct irc_client *client = (struct irc_client*)((char*)w - offsetof(struct irc_client, handshake_watcher));
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	if (continue_handshake(client) == -1) {
+		destroy_client(client);
+		return;
+	}
+	if (!client->in_handshake) {
+		setup_step_done(client);
+	}
+}
+
+/** Callback function for a client's handshake timer. The SSL handshake took too long, and the connection is dropped.
+   @param w Pointer to this client's handshake timer. A pointer to the client is obtained with `offsetof()`.
+   @param revents libev's flags. Not used.
+ */
+static void handshake_timeout_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct irc_client *client = (struct irc_client*)((char*)w - offsetof(struct irc_client, handshake_timer));
+	fprintf(stderr, "::client.c:handshake_timeout_cb(): SSL Handshake timed out.\n");
+	destroy_client(client);
+}
+
+/** Flushes a client's queue after some thread queued new data for him and called `worker_wake_client()`.
+   For example, if the worker serving client A reads a PRIVMSG command with a message whose destination is B, then A's
+      worker will queue the message into B's queue, and call `worker_wake_client()` on B, to wake B's worker up.
+      When B's worker wakes up, this function is called in its thread, once for every client that got new data.
+   Therefore, the main purpose of this function is to flush a client's queue. It is also how another thread disconnects a
+      client: if `kill_reason` is set, the session is terminated.
+   @param client The client. It must be owned by the calling worker.
+ */
+void client_wakeup(struct irc_client *client)
+{
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	if (client->kill_reason != NULL) {
+		/* Another server killed him */
+		terminate_session(client, client->kill_reason);
+	}
+	if (client_queue_overflowed(&client->write_queue)) {
+		/* Someone couldn't deliver a message to this client: he's not reading what we send him */
+		terminate_session(client, SENDQ_QUIT_MSG);
+	}
+	if (!ev_is_active(&client->write_watcher)) {
+		/* If the write watcher is active, the socket is full; write_ready_cb() will flush the queue */
+		client_flush(client);
+	}
+}
+
+/** Callback function for a client's write watcher. The write watcher is only active while the socket can't take every
+   queued message, so this function is called when the socket becomes writable again after a short write.
+   It flushes as much as possible; the watcher is stopped once the queue is empty.
+   @param w Pointer to this client's write watcher. A pointer to the client is obtained with `offsetof()`, as usual.
+   @param revents libev's flags. Only `EV_WRITE` is expected.
+ */
+static void write_ready_cb(EV_P_ ev_io *w, int revents)
 {
 	struct irc_client *client;
-	client = (struct irc_client*)((char*)w - offsetof(struct irc_client, async_watcher));
-	flush_queue(client, &client->write_queue);
+	client = (struct irc_client*)((char*)w - offsetof(struct irc_client, write_watcher));
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	client_flush(client);
+}
+
+/** Writes as much as possible from a client's output buffer into his socket. If the socket can't take everything, the
+   client's write watcher is started, so that the rest is written when the socket becomes writable; once the buffer is
+   empty, the write watcher is stopped.
+   If a write error occurs, the client's session is terminated with `BAD_WRITE_QUIT_MSG`; if a message could not be
+   queued for this client because his queue reached its hard limit, it is terminated with `SENDQ_QUIT_MSG`.
+   While the output buffer is above its soft limit, the client's commands are not read.
+   If the client is receiving a LIST reply, the next batch of it is queued every time the output buffer is emptied.
+   @param client The client whose output buffer shall be flushed.
+   @warning Since this function may call `terminate_session()`, it must not be called while holding locks.
+ */
+static void client_flush(struct irc_client *client)
+{
+	if (client_queue_overflowed(&client->write_queue)) {
+		terminate_session(client, SENDQ_QUIT_MSG);
+	}
+	switch (flush_queue(client, &client->write_queue)) {
+	case FLUSH_DONE:
+		if (client->list_stream != NULL) {
+			/* The socket took everything; queue more of the LIST reply, and write it once the socket is writable */
+			list_stream_continue(client);
+			ev_io_start(client->ev_loop, &client->write_watcher);
+		} else {
+			ev_io_stop(client->ev_loop, &client->write_watcher);
+		}
+		break;
+	case FLUSH_PENDING:
+		/* With io_uring, the rest is sent once the send in flight completes */
+		if (client->uring == NULL) {
+			ev_io_start(client->ev_loop, &client->write_watcher);
+		}
+		break;
+	default:
+		terminate_session(client, BAD_WRITE_QUIT_MSG);
+	}
+	/* Backpressure: don't read more commands from a client that isn't reading our replies */
+	if (client_queue_above_soft(&client->write_queue)) {
+		if (!client->read_paused) {
+			if (!client->input_held) {
+				stop_reading(client);
+			}
+			client->read_paused = 1;
+		}
+	} else if (client->read_paused) {
+		client->read_paused = 0;
+		if (client->input_held) {
+			/* Finish what is already in his input buffer before reading more */
+			worker_defer_client(client);
+		} else {
+			start_reading(client);
+		}
+	}
 }
 
 /** Called by the rest of the code everytime a client's session must be terminated. The reason for terminating a
@@ -275,35 +992,48 @@ static void queue_async_cb(EV_P_ ev_async *w, int revents)
 	Either way, this function starts by trying to notify the client about this action, using the `ERROR` command,
 	as described in the protocol. The exact syntax of the message sent to the client follows this form:
 	`ERROR :Closing Link: &lt;nick&gt;[&lt;hostname&gt;] (&lt;quit message&gt;)`.
-	Whether the write is successfull or not is irrelevant, after attempting to notify the client about this,
+	Whether the write is successfull or not is irrelevant (a write error may be the very reason why the session is being
+	terminated, and the socket is non-blocking, so a slow client may not get this message), after attempting to notify the client about this,
 	the function calls `do_quit()`, to let every other client sharing a channel with this one that he's leaving,
-	and finally, `pthread_exit()` is called to free every resource allocated to this client and kill the thread.
+	removes him from the clients list and tells the other servers of the network, and finally, it jumps back to the exit point of the callback that is currently running in this client's worker, which
+	calls `destroy_client()` to free every resource allocated to this client. Every client callback (and `new_client()`)
+	sets up this exit point with `setjmp()` on the worker's `session_exit` before doing anything else, thus, this function
+	never returns.
 	@param client The client to disconnect.
 	@param quit_msg The quit message. This must be a valid pointer to a null-terminated characters sequence with
 	the quit message. Since no `free()`'s are performed on this parameter, it must NOT be a dynamically allocated pointer.
 	Typically, this will be a pointer to a string constant defined in `protocol.h` if the event triggering the QUIT
 	was an error on the server side. Otherwise, it is ok for this parameter to be a pointer to a local variable
 	stored in the stack of the calling function, as is the case with `cmd_quit()` in `interpretmsg.c`.
-	@note No other place in the code should call `pthread_exit()`. Always use this function to terminate a client's
-	session.
+	@note Always use this function to terminate a client's session. As with any other blocking operation in a worker, it must
+	only be called by the worker that owns `client`, and never while holding a lock.
 */
 void terminate_session(struct irc_client *client, char *quit_msg) {
 	int size;
 	char err_msg[MAX_MSG_SIZE+1];
 	size = cmd_print_reply(err_msg, sizeof(err_msg), "ERROR :Closing Link: %s[%s] (%s)\r\n",
 				(client->is_registered ? client->nick : "*"), client->hostname, quit_msg);
-	(void) write_to(client, err_msg, size);
+	/* Try to deliver what's left in the output buffer, along with the ERROR message */
+	(void) queue_to(client, err_msg, size);
+	(void) flush_queue(client, &client->write_queue);
 	do_quit(client, quit_msg);
-	pthread_exit(NULL); /* Calls destroy_client() */
+	if (client->is_registered) {
+		/* Other servers are told once nobody can find him anymore, so a netburst that is being sent can't
+		   introduce him after his QUIT */
+		client_list_delete(client);
+		client->is_registered = 0;
+		link_broadcast_from(client, "QUIT", NULL, quit_msg);
+	}
+	client->worker->terminated = client;
+	longjmp(client->worker->session_exit, 1); /* Calls destroy_client() */
 }
 
-/** Callback function used by the time watcher for each client.
-	Alright now, listen up, this is important. We have carefully followed libev's documentation suggestions, and implemented
-	the 3rd method described in this section: http://pod.tst.eu/http://cvs.schmorp.de/libev/ev.pod#code_ev_timer_code_relative_and_opti
-	We use a timer for each client, stored in the client's structure, and also a connection_status bit-field. See the definition for the client's
-	structure in `client.h` for further information.
-	The basic layout goes like this: We let the timer expire every `get_ping_freq()` seconds. When that happens, we check up on this client, using
-	his `last_activity` field, which is updated by `read_data()` (see `read_msgs.c`) everytime new data arrives to the socket. `last_activity` is a time
+/** Callback function used by the PING timer for each client.
+	Alright now, listen up, this is important. Every client has a timer in its worker's timer wheel (see `timer_wheel.h`), and also a connection_status bit-field. See
+	the definition for the client's structure in `client.h` for further information. The wheel is driven by a single libev timer per worker, so tens of thousands
+	of clients don't keep libev's timers heap busy; in exchange, timers are only accurate to `TIMER_WHEEL_TICK` seconds, which is more than enough for PINGs.
+	The basic layout goes like this: We let the timer expire `get_ping_freq()` seconds after the last known period of activity. When that happens, we check up on
+	this client, using his `last_activity` field, which is updated by `read_data()` (see `read_msgs.c`) everytime new data arrives to the socket. `last_activity` is a time
 	stamp holding the last known time when a message from this client arrived from the socket. If the difference between the current time and `last_activity`
 	is greater than `get_ping_freq()`, then `get_ping_freq()` seconds have elapsed since the last period of activity, and it is time to send a PING message.
 	When we send a PING message, this client's connection state is switched to `STATUS_TIMEOUT`, meaning we are waiting for a PONG reply. As a consequence,
@@ -311,61 +1041,65 @@ void terminate_session(struct irc_client *client, char *quit_msg) {
 	time we enter the callback function, using `connection_status`, we can know if we have sent a ping to this client before. If that is the case, and the timeout
 	time has elapsed, then it means we didn't get a PONG (or any other message) reply, and we assume this connection is dead. `terminate_session()` is called, and
 	the client is removed from the server.
-	In any other case, we just reset back the timer to expire after `get_ping_freq()` seconds, and the whole cycle repeats.
-   @param w Pointer to this client's time watcher. A pointer to the client is obtained with `(struct irc_client *) ((char *)w - offsetof(struct irc_client, time_watcher))`. 
-			This pointer manipulation is necessary to extract the client's structure where `w` is embedded. In doubt, read about `offsetof()` macro in `stddef.h`'s manpage.
-   @param revents libev's flags. Not used for this specific callback.
+	In any other case, there was recent activity, and the timer is set to expire `get_ping_freq()` seconds after it. Reading from the socket never touches the
+	timer, so each client costs `O(1)` per period, regardless of how chatty it is.
+   @param timer Pointer to this client's PING timer. A pointer to the client is obtained with `(struct irc_client *) ((char *)timer - offsetof(struct irc_client, ping_timer))`. 
+			This pointer manipulation is necessary to extract the client's structure where `timer` is embedded. In doubt, read about `offsetof()` macro in `stddef.h`'s manpage.
 */
-static void ping_timer_cb(EV_P_ ev_timer *w, int revents) {
+static void ping_timer_cb(struct wheel_timer *timer) {
 	char ping_msg[MAX_MSG_SIZE+1];
 	struct irc_client *client;
 	int size;
 	ev_tstamp after;
-	client = (struct irc_client*)((char*)w - offsetof(struct irc_client, time_watcher));
-    after = client->last_activity - ev_now(client->ev_loop) + get_ping_freq();
-	if (after < 0.) {
+	client = (struct irc_client*)((char*)timer - offsetof(struct irc_client, ping_timer));
+	if (setjmp(client->worker->session_exit) != 0) {
+		destroy_client(client->worker->terminated);
+		return;
+	}
+	after = client->last_activity - ev_now(client->ev_loop) + get_ping_freq();
+	if (after <= 0.) {
 		if (client->connection_status == STATUS_OK) {
 			/* Hey, you there? */
 			size = cmd_print_reply(ping_msg, sizeof(ping_msg), "PING :%s\r\n", get_server_name());
 			client->connection_status = STATUS_TIMEOUT;
-			(void) write_to(client, ping_msg, (size_t) size);
-			ev_timer_set(w, get_timeout(), 0.);
-			ev_timer_start(client->ev_loop, w);
+			(void) queue_to(client, ping_msg, (size_t) size);
+			timer_wheel_add(&client->worker->timers, timer, get_timeout());
+			client_flush(client);
 		}
 		else {
 			/* Oops! */
 			terminate_session(client, TIMEOUT_QUIT_MSG);
 		}
 	}
-    else {
-		/* There was recent activity, reset timer */
-		ev_timer_set(w, get_ping_freq(), 0.);
-        ev_timer_start(client->ev_loop, w);
-    }
+	else {
+		/* There was recent activity, wait until a whole period has elapsed since then */
+		timer_wheel_add(&client->worker->timers, timer, after);
+	}
 }
 
-/** This function is set by the thread init function (`new_client()`) as the cleanup handler for `pthread_exit()`, thus,
+/** This function is called from the exit point of a client callback after `terminate_session()` jumps into it, thus,
    this is called when a fatal error with this client occurred andhe needs to be kicked out of the server.
    Examples of fatal errors are: we were writing to his socket and processing a command he sent and suddenly the
       connection was lost, causing write() to return an error; there's no space in client_list for this user; or
       something else went terribly wrong and we can't keep a connection to this user.
-   The socket is closed, every watcher is stopped, the events loop is destroyed, the client is deleted from the client's
-      list (if his connection was registered), and every resource associated with this client is freed.
+   The socket is closed, every watcher is detached from the worker's events loop, the client is deleted from the client's
+      list (if his connection was registered), the worker's load is decremented, and every resource associated with this
+      client is freed.
    @param arg A pointer to a `struct irc_client` describing this client. This argument is always casted to `struct
       irc_client `.
    @warning This function is only active after we have a fully allocated client struct for this user. Problems with
       structure allocation are dealt earlier in `new_client()`.
    @warning Care must be taken when killing a client. For example, deleting a client from the list can be problematic.
       Clients list implementation is thread safe; consider the case that this thread was doing some processing and was
-      currently holding a lock to the clients list when a fatal error occurs, `pthread_exit()` is called, and we end up
+      currently holding a lock to the clients list when a fatal error occurs, `terminate_session()` is called, and we end up
       in this function. This function would try to delete the client from the list, trying to obtain the lock again,
       which would result in a deadlock, since the thread would be waiting for itself. Although it is a rare case, it is
-      extremely undesirable, therefore, abstract implementations used by each client's threaddo not call
-      `pthread_exit()` directly. Furthermore, imagine another example where we just killed the thread - what if this
-      thread was currently holding a lock to a shared list? This lock won't be released, and from now on,no other thread
-      will ever be able to access this shared resource.
+      extremely undesirable, therefore, abstract implementations used by each client's worker do not call
+      `terminate_session()` directly. Furthermore, imagine another example where we just jumped out of a callback - what if
+      this worker was currently holding a lock to a shared list? This lock won't be released, and from now on,no other
+      thread will ever be able to access this shared resource.
    This is why library functions such as `client_list_add()` and others use special return values or parameters to
-      indicate failure, so that the client's thread can decide to call `pthread_exit()` after making sure
+      indicate failure, so that the client's worker can decide to call `terminate_session()` after making sure
       everysynchronization mechanism is unlocked.
    @note You may have wondered if closing the socket is safe, since we don't really know what happened: the socket can
       be invalid by this time, and closing it can yield an error. According to `close()` manpage, "Not checking the
@@ -374,9 +1108,9 @@ static void ping_timer_cb(EV_P_ ev_timer *w, int revents) {
       closing the file may lead to silent loss of data. This can especially be observed with NFS and with disk quota."
       We think this is great advice, but is not very applicable to sockets. We're killing this client anyway, why bother
       with some final errors on his socket? Thus, the return value for `close()` is ignored.
-   @note Every exiting path for a client ends up his thread with `pthread_exit()`. This destructor is always called when
-      the client exits the server. Due to `pthread_exit()`'s nature, we don't actually ever returnback to
-      `new_client()`.
+   @note Every exiting path for a client ends up in `terminate_session()`. This destructor is always called when the
+      client exits the server. Due to `longjmp()`'s nature, we don't actually ever return back to the code that called
+      `terminate_session()`; the worker goes back to its events loop right after this function returns.
    @todo Notify other clients when someone leaves.
  */
 void destroy_client(void *arg)
@@ -393,14 +1127,18 @@ void destroy_client(void *arg)
 	if (client->is_registered) {
 		client_list_delete(client);
 	}
+	if (client->server_link != NULL) {
+		/* Every client and server behind this link is gone as well */
+		link_drop(client);
+	}
+	worker_release_client(client->worker);
 	free_client(client);
 }
 
 /** Auxiliary function called by `destroy_client()` to free a client's resources.
    It frees every dynamic allocated resource, closes the socket, stops the callback mechanism by detaching the watcher
-      from the events loop, and destroys this client'sev_loop.
+      from the worker's events loop. The loop itself belongs to the worker and keeps running for the other clients.
    @param client The client to free
-   @todo find the way to free client->ssl
  */
 static void free_client(struct irc_client *client)
 {
@@ -414,22 +1152,39 @@ static void free_client(struct irc_client *client)
 	free(client->username);
 	free(client->server);
 	free(client->public_host);
-	free(client->channels);
+	free(client->prefix);
+	pool_free(client->channels);
+	pool_free(client->quit_seen);
+	list_stream_end(client);
 	if (client_queue_destroy(&client->write_queue) == -1) {
 		fprintf(stderr, "Warning: client_queue_destroy() reported an error - THIS SHOULD NEVER HAPPEN!\n");
 	}
-	//if(client->ssl == NULL){
-	//SSL_shutdown(client->ssl);
-	//SSL_free(client->ssl);
-	//}
-	close(client->socket_fd);
+	if (client->ssl != NULL) {
+		if (!client->in_handshake) {
+			/* Best effort close notify; the socket is non-blocking and is closed right away */
+			SSL_shutdown(client->ssl);
+		}
+		SSL_free(client->ssl);
+	}
 
-	/* Stop the callback mechanism for this client */
+	/* Stop the callback mechanism for this client. The loop is shared with other clients, so this must happen before the
+	   socket is closed and its descriptor can be reused.
+	 */
+	uring_conn_close(client);
 	ev_io_stop(client->ev_loop, &client->io_watcher);
-	ev_async_stop(client->ev_loop, &client->async_watcher);
-	ev_timer_stop(client->ev_loop, &client->time_watcher);
-	
-	ev_break(client->ev_loop, EVBREAK_ONE); /* Stop iterating */
-	ev_loop_destroy(client->ev_loop);
-	free(client);
+	ev_io_stop(client->ev_loop, &client->write_watcher);
+	ev_io_stop(client->ev_loop, &client->handshake_watcher);
+	ev_timer_stop(client->ev_loop, &client->handshake_timer);
+	if (client->socket_fd != -1) {
+		close(client->socket_fd);
+	}
+	worker_cancel_wakeup(client);
+	worker_cancel_defer(client);
+	ev_timer_stop(client->ev_loop, &client->flood_timer);
+	timer_wheel_remove(&client->worker->timers, &client->ping_timer);
+	ev_timer_stop(client->ev_loop, &client->dns_timer);
+	if (client->dns_query != NULL) {
+		resolver_cancel(client->dns_query);
+	}
+	pool_free(client);
 }
@@ -116,7 +116,7 @@ void client_list_destroy(void)
       must be taken if `(f)()` uses synchronization tools (mutexes, semaphores, etc.) to perform its job. Always
       remember that the global clients list is locked - using any locking mechanism inside `(f)()` is rarely necessary,
       and can easily introduce deadlock conditions.
-   @warning `(f)()` must not call `pthread_exit()`, otherwise, the lock for this list is never unlocked, and the whole
+   @warning `(f)()` must not call `terminate_session()`, otherwise, the lock for this list is never unlocked, and the whole
       IRCd freezes.
    @note `(f)()` shall cast its first argument to a client's structure pointer.
  */
@@ -125,6 +125,17 @@ void *client_list_find_and_execute(char *nick, void *(*f)(void *, void *), void
 	return list_find_and_execute(clients, nick, f, NULL, fargs, NULL, success);
 }
 
+/** Calls a function for every client in the clients list, atomically: nobody is added or removed meanwhile.
+   @param f The function. It is called with each client as its first parameter, and with `fargs` as second parameter.
+   @param fargs This will be passed to `f` as a second parameter.
+   @warning The whole list is locked while this function runs, so `(f)()` must be fast, and the same warnings of
+      `client_list_find_and_execute()` apply.
+ */
+void client_list_for_each(void (*f)(void *, void *), void *fargs)
+{
+	list_for_each(clients, f, fargs);
+}
+
 /** Atomically adds a client to the clients list if there isn't already a client with the same nickname.
    This operation is thread safe and guaranteed to be free of race conditions. The search and add operations are
       executed atomically.
@@ -1,6 +1,9 @@
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 #include <stdio.h>
@@ -63,6 +66,13 @@
    Special care must be taken, since IPv6 addresses do not necessarily hold every field `a-h`. For example, `localhost`
    can be written using `::1`. This still needs some discussion, but a possible solution is to expand every IPv6 into
    a unified form where fields `a-h` can always be matched, and then use the above method safely.
+   Networks that don't need to keep the cloaked hosts computed by older versions can set the cloak mode to `siphash` in
+   the configuration file. In this mode, every `downsample(md5(sha1(KEYa:text:KEYb)+KEYc))` above is replaced by
+   `fold(siphash(Kabc, text))`, where `siphash()` is SipHash-2-4, `Kabc` is the first 128 bits of `sha1(KEYa:KEYb:KEYc)`,
+   derived once by `cloak_init()`, and `fold()` XORs the upper and lower halves of the 64-bit result. The shape of the
+   cloaked hosts, and thus the way bans match them, is the same in both modes, but the values are not.
+   Whatever the mode, the result for a given host never changes while the IRCd runs, so recent results are kept in a
+   bounded LRU cache keyed by the real host. Clients that reconnect many times from the same place are only hashed once.
    @author Filipe Goncalves
    @date December 2013
  */
@@ -74,6 +84,63 @@
    `hide_host()` */
 #define MAX_HOST_LEN 128
 
+/** How many parts a cloaked IPv4 address has */
+#define CLOAK_PARTS 3
+
+/** Index of `alpha` in `key_order` and `sip_keys` */
+#define CLOAK_ALPHA 0
+
+/** Index of `beta` in `key_order` and `sip_keys` */
+#define CLOAK_BETA 1
+
+/** Index of `gamma` in `key_order` and `sip_keys`. Reverse looked up hostnames use the same keys. */
+#define CLOAK_GAMMA 2
+
+/** SipHash key length, in bytes */
+#define SIPHASH_KEY_LENGTH 16
+
+/** Rotates a 64-bit integer `b` bits to the left */
+#define ROTL64(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+/** A SipHash round */
+#define SIPROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+/** Which keys are used, and in which order, for each part of a cloaked host. Entry `i` holds the keys numbers for
+   `KEYa`, `KEYb` and `KEYc`, as explained in this file's description. */
+static const int key_order[CLOAK_PARTS][3] = {
+	{ 2, 3, 1 }, /* CLOAK_ALPHA */
+	{ 3, 1, 2 }, /* CLOAK_BETA */
+	{ 1, 2, 3 }  /* CLOAK_GAMMA and reverse looked up hostnames */
+};
+
+/** SipHash keys for each part of a cloaked host, derived from the cloak keys by `cloak_init()`. Only used in
+   `CLOAK_MODE_SIPHASH` */
+static unsigned char sip_keys[CLOAK_PARTS][SIPHASH_KEY_LENGTH];
+
+/** An entry of the cloaked hosts cache */
+struct cloak_entry {
+	char host[CLOAK_CACHE_HOST_SIZE]; /**<The real host, null terminated. */
+	char cloak[MAX_HOST_LEN]; /**<The cloaked host for `host`, null terminated. */
+	int is_ip; /**<Whether `host` is an IP address, cloaked with `hide_ipv4()`, or a hostname, cloaked with `hide_host()`. */
+	unsigned hash; /**<Hash of `host` and `is_ip`, used to find its bucket. */
+	int next; /**<Next entry in the same bucket; `-1` if this is the last one. */
+	int newer; /**<The entry used right after this one; `-1` if this is the most recently used entry. */
+	int older; /**<The entry used right before this one; `-1` if this is the least recently used entry. */
+};
+
+static struct cloak_entry cache[CLOAK_CACHE_SIZE]; /**<The cloaked hosts cache. */
+static int buckets[CLOAK_CACHE_SIZE]; /**<First entry in each bucket of `cache`; `-1` for an empty bucket. */
+static int cache_used; /**<How many entries of `cache` were ever filled. Once it is full, the LRU entry makes room. */
+static int newest; /**<The most recently used entry; `-1` if the cache is empty. */
+static int oldest; /**<The least recently used entry; `-1` if the cache is empty. */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects the cache. */
+
 /** Takes 3 salt keys and a text, and stores `md5(sha1(salt1+":"+text+":"+salt2)+salt3)` into `result`.
    @param salt1 The key used as a salt to prepend to `":"+text+":"`. Does not have to be null terminated.
    @param salt2 The key used as a salt to append to `":"+text+":"`. Does not have to be null terminated.
@@ -88,6 +155,7 @@
 				(defined in `openssl/md5.h`) characters, and where the result of evaluating
 				`md5(sha1(salt1+":"text+":"+salt2)+salt3)` is stored. The resulting sequence is not null terminated.
    @note Upon returning, `result` will hold exactly `MD5_DIGEST_LENGTH` characters.
+   @note Both digests are computed incrementally, so nothing is copied around to build their inputs.
    @warning `result` is not null terminated.
    @warning `result` shall be a valid and allocated memory location.
  */
@@ -101,16 +169,21 @@ static void do_md5(const char *salt1,
 		   size_t text_len,
 		   unsigned char result[MD5_DIGEST_LENGTH])
 {
-	char buf1[salt1_len + salt2_len + text_len + 2]; /* +2 because we need space for two ':' */
-	char buf2[SHA_DIGEST_LENGTH + salt3_len];
-	strncpy(buf1, salt1, salt1_len);
-	buf1[salt1_len] = ':';
-	strncpy(buf1 + salt1_len + 1, text, text_len);
-	buf1[salt1_len + text_len + 1] = ':';
-	strncpy(buf1 + salt1_len + text_len + 2, salt2, salt2_len);
-	SHA1((const unsigned char*)buf1, (unsigned long) sizeof(buf1), (unsigned char*)buf2);
-	strncpy(buf2 + SHA_DIGEST_LENGTH, salt3, salt3_len);
-	MD5((const unsigned char*)buf2, sizeof(buf2), result);
+	unsigned char sha[SHA_DIGEST_LENGTH];
+	SHA_CTX sha_ctx;
+	MD5_CTX md5_ctx;
+
+	SHA1_Init(&sha_ctx);
+	SHA1_Update(&sha_ctx, salt1, salt1_len);
+	SHA1_Update(&sha_ctx, ":", 1);
+	SHA1_Update(&sha_ctx, text, text_len);
+	SHA1_Update(&sha_ctx, ":", 1);
+	SHA1_Update(&sha_ctx, salt2, salt2_len);
+	SHA1_Final(sha, &sha_ctx);
+	MD5_Init(&md5_ctx);
+	MD5_Update(&md5_ctx, sha, sizeof(sha));
+	MD5_Update(&md5_ctx, salt3, salt3_len);
+	MD5_Final(result, &md5_ctx);
 }
 
 /** Packs an MD5 hash consisting of `MD5_DIGEST_LENGTH` bytes into a singe integer.
@@ -154,34 +227,264 @@ static unsigned int downsample(unsigned char hash[MD5_DIGEST_LENGTH])
 	return sample;
 }
 
+/** Reads 8 bytes as a little endian 64-bit integer.
+   @param p Where to read from.
+   @return The integer.
+ */
+static uint64_t read_le64(const unsigned char *p)
+{
+	uint64_t x = 0;
+	int i;
+	for (i = 7; i >= 0; i--) {
+		x = (x << 8) | p[i];
+	}
+	return x;
+}
+
+/** Computes SipHash-2-4 of a text.
+   @param key The key, with `SIPHASH_KEY_LENGTH` bytes.
+   @param text The text. Does not have to be null terminated.
+   @param len `text` length.
+   @return The 64-bit hash.
+ */
+static uint64_t siphash(const unsigned char key[SIPHASH_KEY_LENGTH], const char *text, size_t len)
+{
+	const unsigned char *in = (const unsigned char *) text;
+	uint64_t k0 = read_le64(key);
+	uint64_t k1 = read_le64(key + 8);
+	uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ k1;
+	uint64_t b = (uint64_t) len << 56;
+	uint64_t m;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		m = read_le64(in + i);
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	for (; i < len; i++) {
+		b |= (uint64_t) in[i] << (8 * (i & 7));
+	}
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/** Hashes one part of a cloaked host with the configured cloak mode.
+   @param part Which part: `CLOAK_ALPHA`, `CLOAK_BETA` or `CLOAK_GAMMA`.
+   @param text The text to hash. Does not have to be null terminated.
+   @param len `text` length.
+   @return The hash, to be printed in hexadecimal notation.
+ */
+static unsigned cloak_part(int part, const char *text, size_t len)
+{
+	unsigned char md5[MD5_DIGEST_LENGTH];
+	const int *keys = key_order[part];
+	uint64_t hash;
+
+	if (get_cloak_mode() == CLOAK_MODE_SIPHASH) {
+		hash = siphash(sip_keys[part], text, len);
+		return (unsigned) (hash ^ (hash >> 32));
+	}
+	do_md5(get_cloak_key(keys[0]), get_cloak_key_length(keys[0]), get_cloak_key(keys[1]), get_cloak_key_length(keys[1]),
+	       get_cloak_key(keys[2]), get_cloak_key_length(keys[2]), text, len, md5);
+	return downsample(md5);
+}
+
+/** Computes the hash used to find a host in the cache.
+   @param host The real host.
+   @param is_ip Whether `host` is an IP address.
+   @return The hash.
+ */
+static unsigned cache_hash(const char *host, int is_ip)
+{
+	unsigned h = 2166136261U ^ (unsigned) is_ip;
+	for (; *host != '\0'; host++) {
+		h = (h ^ (unsigned char) *host) * 16777619U;
+	}
+	return h;
+}
+
+/** Removes an entry from the recently used list. Must be called with `cache_mutex` held.
+   @param i The entry.
+ */
+static void lru_unlink(int i)
+{
+	if (cache[i].newer == -1) {
+		newest = cache[i].older;
+	} else {
+		cache[cache[i].newer].older = cache[i].older;
+	}
+	if (cache[i].older == -1) {
+		oldest = cache[i].newer;
+	} else {
+		cache[cache[i].older].newer = cache[i].newer;
+	}
+}
+
+/** Inserts an entry in the recently used list as the most recently used. Must be called with `cache_mutex` held.
+   @param i The entry.
+ */
+static void lru_push(int i)
+{
+	cache[i].older = newest;
+	cache[i].newer = -1;
+	if (newest == -1) {
+		oldest = i;
+	} else {
+		cache[newest].newer = i;
+	}
+	newest = i;
+}
+
+/** Finds a host in the cache. Must be called with `cache_mutex` held.
+   @param host The real host.
+   @param is_ip Whether `host` is an IP address.
+   @param hash `cache_hash(host, is_ip)`.
+   @return The entry; `-1` if `host` is not in the cache.
+ */
+static int cache_find(const char *host, int is_ip, unsigned hash)
+{
+	int i;
+	for (i = buckets[hash & (CLOAK_CACHE_SIZE - 1)]; i != -1; i = cache[i].next) {
+		if (cache[i].hash == hash && cache[i].is_ip == is_ip && strcmp(cache[i].host, host) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Searches the cache for a cloaked host, and marks it as the most recently used. This function is thread safe.
+   @param host The real host.
+   @param is_ip Whether `host` is an IP address.
+   @return A dynamically allocated copy of the cloaked host; `NULL` if `host` is not in the cache, or if there isn't enough
+		   memory available.
+ */
+static char *cache_lookup(const char *host, int is_ip)
+{
+	unsigned hash = cache_hash(host, is_ip);
+	char *cloak = NULL;
+	int i;
+
+	pthread_mutex_lock(&cache_mutex);
+	if ((i = cache_find(host, is_ip, hash)) != -1) {
+		lru_unlink(i);
+		lru_push(i);
+		cloak = strdup(cache[i].cloak);
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	return cloak;
+}
+
+/** Stores a cloaked host in the cache. When the cache is full, the least recently used entry is replaced. Hosts that are
+   too long for `CLOAK_CACHE_HOST_SIZE` are not stored. This function is thread safe.
+   @param host The real host.
+   @param is_ip Whether `host` is an IP address.
+   @param cloak The cloaked host.
+ */
+static void cache_store(const char *host, int is_ip, const char *cloak)
+{
+	unsigned hash;
+	int i, *p;
+
+	if (strlen(host) >= CLOAK_CACHE_HOST_SIZE || strlen(cloak) >= MAX_HOST_LEN) {
+		return;
+	}
+	hash = cache_hash(host, is_ip);
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_find(host, is_ip, hash) != -1) {
+		/* Another thread cloaked the same host in the meantime */
+		pthread_mutex_unlock(&cache_mutex);
+		return;
+	}
+	if (cache_used < CLOAK_CACHE_SIZE) {
+		i = cache_used++;
+	} else {
+		i = oldest;
+		lru_unlink(i);
+		for (p = &buckets[cache[i].hash & (CLOAK_CACHE_SIZE - 1)]; *p != i; p = &cache[*p].next)
+			; /* Intentionally left blank */
+		*p = cache[i].next;
+	}
+	strcpy(cache[i].host, host);
+	strcpy(cache[i].cloak, cloak);
+	cache[i].is_ip = is_ip;
+	cache[i].hash = hash;
+	cache[i].next = buckets[hash & (CLOAK_CACHE_SIZE - 1)];
+	buckets[hash & (CLOAK_CACHE_SIZE - 1)] = i;
+	lru_push(i);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/** Initializes the cloaking module: empties the cache and, in `CLOAK_MODE_SIPHASH`, derives the SipHash keys from the
+   cloak keys. This must be called exactly once by the main thread, after the configuration file is loaded and before
+   any host is cloaked.
+ */
+void cloak_init(void)
+{
+	unsigned char sha[SHA_DIGEST_LENGTH];
+	SHA_CTX ctx;
+	int i, j;
+
+	for (i = 0; i < CLOAK_CACHE_SIZE; i++) {
+		buckets[i] = -1;
+	}
+	cache_used = 0;
+	newest = oldest = -1;
+	for (i = 0; i < CLOAK_PARTS; i++) {
+		SHA1_Init(&ctx);
+		for (j = 0; j < 3; j++) {
+			if (j > 0) {
+				SHA1_Update(&ctx, ":", 1);
+			}
+			SHA1_Update(&ctx, get_cloak_key(key_order[i][j]), get_cloak_key_length(key_order[i][j]));
+		}
+		SHA1_Final(sha, &ctx);
+		memcpy(sip_keys[i], sha, SIPHASH_KEY_LENGTH);
+	}
+}
+
 /** Knows how to hide an IPv4 address. See this file's description for further details on the algorithm.
    @param host A pointer to a null terminated characters sequence denoting the user's ip address. Should be a string of
 			   the form "A.B.C.D".
    @return A dynamically allocated pointer to a null terminated characters sequence holding the cloaked host for this
 		   user. If there isn't enough memory available, `NULL` is returned.
 	@note The caller is responsible for freeing the returned pointer.
+	@note This function is thread safe.
  */
 char *hide_ipv4(char *host)
 {
-	unsigned char alpha[MD5_DIGEST_LENGTH];
-	unsigned char beta[MD5_DIGEST_LENGTH];
-	unsigned char gamma[MD5_DIGEST_LENGTH];
+	unsigned alpha, beta, gamma;
 	char result[(CHAR_BIT / BITS_IN_HEXA) * sizeof(unsigned) * 3 + 6];
+	char *cloak;
 	size_t len;
 
+	if ((cloak = cache_lookup(host, 1)) != NULL) {
+		return cloak;
+	}
 	len = strlen(host);
-	do_md5(get_cloak_key(2), get_cloak_key_length(2), get_cloak_key(3), get_cloak_key_length(3), get_cloak_key(
-		       1), get_cloak_key_length(1), host, len, alpha);
+	alpha = cloak_part(CLOAK_ALPHA, host, len);
 	for (len--; host[len] != '.'; len--)
 		;  /* Intentionally left blank */
 	/* assert: host[len] == '.' */
-	do_md5(get_cloak_key(3), get_cloak_key_length(3), get_cloak_key(1), get_cloak_key_length(1), get_cloak_key(
-		       2), get_cloak_key_length(2), host, len, beta);
+	beta = cloak_part(CLOAK_BETA, host, len);
 	for (len--; host[len] != '.'; len--)
 		;  /* Intentionally left blank */
-	do_md5(get_cloak_key(1), get_cloak_key_length(1), get_cloak_key(2), get_cloak_key_length(2), get_cloak_key(
-		       3), get_cloak_key_length(3), host, len, gamma);
-	sprintf(result, "%X.%X.%X.IP", downsample(alpha), downsample(beta), downsample(gamma));
+	gamma = cloak_part(CLOAK_GAMMA, host, len);
+	sprintf(result, "%X.%X.%X.IP", alpha, beta, gamma);
+	cache_store(host, 1, result);
 	return strdup(result);
 }
 
@@ -190,18 +493,22 @@ char *hide_ipv4(char *host)
    @return A dynamically allocated pointer to a null terminated characters sequence holding the cloaked host for this
            user. If there isn't enough memory available, `NULL` is returned. 
    @note The caller is responsible for freeing the returned pointer.
+   @note This function is thread safe.
  */
 char *hide_host(char *host)
 {
-	unsigned char alpha[MD5_DIGEST_LENGTH];
 	char *p;
 	char result[MAX_HOST_LEN];
-	size_t host_len = strlen(host);
+	char *cloak;
+	unsigned alpha;
 
-	do_md5(get_cloak_key(1), get_cloak_key_length(1), get_cloak_key(2), get_cloak_key_length(2), get_cloak_key(
-		       3), get_cloak_key_length(3), host, host_len, alpha);
+	if ((cloak = cache_lookup(host, 0)) != NULL) {
+		return cloak;
+	}
+	alpha = cloak_part(CLOAK_GAMMA, host, strlen(host));
 	for (p = host; *p != '\0' && (*p != '.' || !isalpha((unsigned char)*(p + 1))); p++)
 		;  /* Intentionally left blank */
-	snprintf(result, sizeof(result), "%s-%X%s", get_cloak_net_prefix(), downsample(alpha), *p == '\0' ? "" : p);
+	snprintf(result, sizeof(result), "%s-%X%s", get_cloak_net_prefix(), alpha, *p == '\0' ? "" : p);
+	cache_store(host, 0, result);
 	return strdup(result);
 }
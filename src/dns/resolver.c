@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "resolver.h"
+#include "worker.h"
+
+/** @file
+	@brief Implementation of the asynchronous reverse DNS resolver
+
+	Queries are kept in a FIFO queue protected by `queue_mutex`; resolver threads sleep on `queue_cond` until a query arrives,
+	and then call the blocking `getnameinfo()` on their own. When `getnameinfo()` returns, the result is stored in the cache, and
+	`query_done()` is posted to the worker that issued the query.
+
+	A query is shared by two parties: the client that is waiting for it, and the resolver that is working on it. Each party holds a
+	reference, and the query is freed when both references are gone. The client can give up at any time (for example, because the
+	lookup timed out, or because the client left) by calling `resolver_cancel()`; after that, the completion function is never
+	called, but the resolver may still be using the query.
+	Since `query_done()` runs in the worker's thread, and the client can only be cancelled by its own worker, there is no race between
+	calling the completion function and cancelling the query.
+
+	The cache is a direct mapped table indexed by a hash of the IPv4 address. Collisions simply replace the older entry.
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** A pending reverse lookup */
+struct dns_query {
+	struct sockaddr_in address; /**<The address being resolved. */
+	char host[NI_MAXHOST]; /**<Where the hostname is stored, if it is found. */
+	int found; /**<Whether `host` holds a valid hostname. */
+	int refs; /**<How many parties hold this query. Updated atomically. */
+	volatile int cancelled; /**<Set when the completion function must not be called anymore. Only written by the worker. */
+	struct worker *worker; /**<The worker where `done` runs. */
+	void (*done)(void *, const char *); /**<Completion function. */
+	void *arg; /**<Argument for `done`. */
+	struct dns_query *next; /**<Next query in the resolvers queue. */
+};
+
+/** Possible states of a cache entry */
+enum cache_state {
+	CACHE_EMPTY = 0, /**<Unused entry */
+	CACHE_POSITIVE, /**<The address resolved to `host` */
+	CACHE_NEGATIVE /**<The address does not have a hostname */
+};
+
+/** An entry in the results cache */
+struct cache_entry {
+	in_addr_t ip; /**<The address, in network byte order. */
+	enum cache_state state; /**<What this entry tells about `ip`. */
+	time_t expires; /**<When this entry stops being valid. */
+	char host[RESOLVER_CACHE_HOST_SIZE]; /**<The hostname, if `state` is `CACHE_POSITIVE`. */
+};
+
+static struct dns_query *queue_head; /**<Oldest query waiting for a resolver. */
+static struct dns_query *queue_tail; /**<Most recent query waiting for a resolver. */
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `queue_head` and `queue_tail`. */
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER; /**<Signaled when a new query is queued. */
+
+static struct cache_entry cache[RESOLVER_CACHE_SIZE]; /**<The results cache. */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `cache`. */
+static int positive_ttl; /**<For how many seconds a hostname is cached. */
+static int negative_ttl; /**<For how many seconds a failed lookup is cached. */
+
+static void *resolver_main(void *arg);
+
+/** Starts the resolver threads. This must be called exactly once by the main thread, before any connection is accepted.
+	@param threads How many resolver threads to start. Values less than or equal to `0` start a single thread.
+	@param cache_ttl For how many seconds a resolved hostname is cached. `0` disables positive caching.
+	@param neg_ttl For how many seconds an address that could not be resolved is cached. `0` disables negative caching.
+	@return `0` on success; `-1` if the threads could not be created.
+*/
+int resolver_init(int threads, int cache_ttl, int neg_ttl)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int i;
+
+	positive_ttl = cache_ttl;
+	negative_ttl = neg_ttl;
+	queue_head = queue_tail = NULL;
+	if (threads <= 0) {
+		threads = 1;
+	}
+	if (pthread_attr_init(&attr) != 0) {
+		perror("::resolver.c:resolver_init(): Could not initialize thread attributes");
+		return -1;
+	}
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&thread, &attr, resolver_main, NULL) != 0) {
+			perror("::resolver.c:resolver_init(): Could not create resolver thread");
+			pthread_attr_destroy(&attr);
+			return -1;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+/** Computes the cache slot for an address
+	@param ip The address, in network byte order.
+	@return The index in `cache` where `ip` is stored.
+*/
+static unsigned cache_slot(in_addr_t ip)
+{
+	return ((unsigned) ip * 2654435761U) >> 20 & (RESOLVER_CACHE_SIZE - 1);
+}
+
+/** Searches the cache for an address. This function is thread safe.
+	@param address The address to look for.
+	@param host Where the cached hostname is copied on a hit.
+	@param size Size of `host`. Hostnames that don't fit are reported as a miss.
+	@return `RESOLVER_HIT` if the address' hostname was copied to `host`; `RESOLVER_NEGATIVE` if the address is known not to
+		have a hostname; `RESOLVER_MISS` if the address is not in the cache, or if its entry expired.
+*/
+int resolver_cache_lookup(const struct sockaddr_in *address, char *host, size_t size)
+{
+	struct cache_entry *entry;
+	in_addr_t ip = address->sin_addr.s_addr;
+	int ret = RESOLVER_MISS;
+
+	entry = &cache[cache_slot(ip)];
+	pthread_mutex_lock(&cache_mutex);
+	if (entry->state != CACHE_EMPTY && entry->ip == ip && entry->expires > time(NULL)) {
+		if (entry->state == CACHE_NEGATIVE) {
+			ret = RESOLVER_NEGATIVE;
+		} else if (strlen(entry->host) < size) {
+			strcpy(host, entry->host);
+			ret = RESOLVER_HIT;
+		}
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	return ret;
+}
+
+/** Stores a lookup result in the cache. This function is thread safe.
+	@param address The address that was looked up.
+	@param host The hostname found, or `NULL` if the lookup failed.
+*/
+static void cache_store(const struct sockaddr_in *address, const char *host)
+{
+	struct cache_entry *entry;
+	in_addr_t ip = address->sin_addr.s_addr;
+	int ttl = (host != NULL ? positive_ttl : negative_ttl);
+
+	if (ttl <= 0 || (host != NULL && strlen(host) >= RESOLVER_CACHE_HOST_SIZE)) {
+		return;
+	}
+	entry = &cache[cache_slot(ip)];
+	pthread_mutex_lock(&cache_mutex);
+	entry->ip = ip;
+	entry->expires = time(NULL) + ttl;
+	if (host != NULL) {
+		entry->state = CACHE_POSITIVE;
+		strcpy(entry->host, host);
+	} else {
+		entry->state = CACHE_NEGATIVE;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/** Drops a reference to a query, freeing it if it was the last one.
+	@param query The query.
+*/
+static void query_release(struct dns_query *query)
+{
+	if (__sync_sub_and_fetch(&query->refs, 1) == 0) {
+		free(query);
+	}
+}
+
+/** Queues a reverse lookup. The lookup is performed by a resolver thread; when it is done, `done` is called inside `worker`'s thread
+	with `arg` and the hostname found, or `NULL` if the address has no hostname. The hostname is only valid during the call.
+	The result is also stored in the cache, so, before calling this function, it is a good idea to try `resolver_cache_lookup()`.
+	@param worker The worker that shall run `done`.
+	@param address The address to resolve.
+	@param done Completion function.
+	@param arg Argument for `done`.
+	@return A handle for the query, that can be passed to `resolver_cancel()` if the caller is no longer interested in the result
+		before `done` is called; `NULL` if there is not enough memory to create the query, in which case `done` is never called.
+	@warning Once `done` is called, the handle is not valid anymore and must not be cancelled.
+*/
+struct dns_query *resolver_query(struct worker *worker, const struct sockaddr_in *address, void (*done)(void *, const char *),
+				 void *arg)
+{
+	struct dns_query *query;
+
+	if ((query = malloc(sizeof(*query))) == NULL) {
+		return NULL;
+	}
+	memcpy(&query->address, address, sizeof(query->address));
+	query->found = 0;
+	query->refs = 2;
+	query->cancelled = 0;
+	query->worker = worker;
+	query->done = done;
+	query->arg = arg;
+	query->next = NULL;
+
+	pthread_mutex_lock(&queue_mutex);
+	if (queue_tail == NULL) {
+		queue_head = query;
+	} else {
+		queue_tail->next = query;
+	}
+	queue_tail = query;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+	return query;
+}
+
+/** Cancels a query. The completion function given to `resolver_query()` will not be called. This must be called in the thread of
+	the worker that issued the query.
+	@param query The query, as returned by `resolver_query()`.
+*/
+void resolver_cancel(struct dns_query *query)
+{
+	query->cancelled = 1;
+	query_release(query);
+}
+
+/** Worker task that delivers a query's result. This runs inside the thread of the worker that issued the query.
+	@param worker The worker running this task.
+	@param arg The query.
+*/
+static void query_done(struct worker *worker, void *arg)
+{
+	struct dns_query *query = (struct dns_query *) arg;
+	(void) worker;
+
+	if (!query->cancelled) {
+		/* The client's reference is consumed by completing the query; the resolver's reference keeps it alive during done() */
+		query->cancelled = 1;
+		query_release(query);
+		query->done(query->arg, query->found ? query->host : NULL);
+	}
+	query_release(query);
+}
+
+/** A resolver thread's starting point. It waits for queries and resolves them, forever.
+	@param arg Not used.
+	@return This function never returns.
+*/
+static void *resolver_main(void *arg)
+{
+	struct dns_query *query;
+	(void) arg;
+
+	for (;;) {
+		pthread_mutex_lock(&queue_mutex);
+		while (queue_head == NULL) {
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		}
+		query = queue_head;
+		if ((queue_head = query->next) == NULL) {
+			queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&queue_mutex);
+
+		if (query->cancelled) {
+			/* Nobody is waiting for this one anymore */
+			query_release(query);
+			continue;
+		}
+		query->found = (getnameinfo((struct sockaddr *) &query->address, sizeof(query->address), query->host,
+					    sizeof(query->host), NULL, 0, NI_NAMEREQD) == 0);
+		cache_store(&query->address, query->found ? query->host : NULL);
+		if (worker_post(query->worker, query_done, query) == -1) {
+			/* The client will give up on this query when it times out */
+			fprintf(stderr, "::resolver.c:resolver_main(): Could not post a lookup result to its worker.\n");
+			query_release(query);
+		}
+	}
+	return NULL;
+}
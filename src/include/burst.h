@@ -0,0 +1,30 @@
+#ifndef __YAIRCD_BURST_GUARD__
+#define __YAIRCD_BURST_GUARD__
+#include "client.h"
+
+/** @file
+	@brief Registration burst
+
+	When a client registers, it is greeted with `RPL_WELCOME` through `RPL_ISUPPORT` (001 to 005), followed by the MOTD.
+	Except for the client's nickname, and for the user mask in `RPL_WELCOME`, these messages are the same for everyone.
+	Thus, they are rendered only once, when the IRCd boots and every time the MOTD is reloaded (on `SIGHUP`), into a
+	contiguous template that records where the nickname goes. Greeting a client is then a matter of copying the template,
+	pasting the nickname in its holes, and queueing the result with a single call.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see burst.c
+*/
+
+/** How many characters a template can hold initially. It grows as needed. */
+#define BURST_INITIAL_SIZE 4096
+
+/** How many nickname holes a template can hold initially. The array grows as needed. */
+#define BURST_INITIAL_HOLES 64
+
+/* Documented in burst.c */
+int burst_init(void);
+int burst_rehash(void);
+void send_burst(struct irc_client *client);
+
+#endif /* __YAIRCD_BURST_GUARD__ */
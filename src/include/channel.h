@@ -28,6 +28,13 @@
 /** Used to report when a client attempts to join a channel, but he has hit the maximum number of channels allowed */
 #define CHAN_LIMIT_EXCEEDED 5
 
+/** A channel user, as seen by `chan_export()` and `chan_import()`. */
+struct chan_member_info {
+	struct irc_client *user; /**<The user. For `chan_import()`, `NULL` if he is not coming back. */
+	const char *prefix; /**<The user's prefix, "nick!username@host", without the leading `:`. */
+	unsigned modes; /**<The user's status in the channel. */
+};
+
 /** Opaque type for a channelused by the rest of the code */
 typedef struct irc_channel *irc_channel_ptr;
 
@@ -38,6 +45,12 @@ int do_join(struct irc_client *client, char *channel);
 int do_part(struct irc_client *client, char *channel, char *part_msg);
 void do_quit(struct irc_client *client, char *quit_msg);
 int channel_msg(struct irc_client *from, char *channel, char *msg);
-void list_each_channel(struct irc_client *client);
+void list_each_channel(struct irc_client *client, int min_users, int max_users);
+void list_stream_continue(struct irc_client *client);
+void list_stream_end(struct irc_client *client);
+void channel_names(struct irc_client *client, char *channel);
+int chan_burst(struct irc_client *link);
+int chan_export(int (*f)(void *, const char *, const char *, unsigned, struct chan_member_info *, int), void *args);
+int chan_import(char *name, const char *topic, unsigned modes, struct chan_member_info *members, int count);
 
 #endif /* __YAIRCD_CHANNEL_GUARD__ */
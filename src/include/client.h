@@ -5,6 +5,11 @@
 #include <netinet/in.h>
 #include "write_msgs_queue.h"
 #include "read_msgs.h"
+#include "worker.h"
+#include "resolver.h"
+
+struct server_link;
+struct uring_conn;
 
 /** @file
 	@brief Functions that deal with irc clients
@@ -25,33 +30,65 @@
 /** The structure that describes an IRC client */
 struct irc_client {
 	struct ev_io io_watcher; /**<io watcher for this client's socket. This watcher will be responsible for calling the appropriate callback function when there is interesting data to read from the socket. */
-	struct ev_async async_watcher; /**<async watcher used to wake up a client's thread when there is new data queued and waiting to be sent. */
-	struct ev_timer time_watcher; /**<A time watcher that calls a function every `get_ping_freq()` seconds to send a possible PING message to the client, if no other activity was detected recently.
-									  Once a PING is sent, the timer is set to expire after `get_timeout()` seconds; if no PONG reply arrives in between, the connection is assumed to be dead, and the
+	struct ev_io write_watcher; /**<io watcher for this client's socket that is only active while the socket can't take everything queued in `write_queue`. It flushes the rest of the queue as soon as the socket becomes writable again. */
+	struct irc_client *wakeup_next; /**<Next client in the worker's wakeup list. Protected by the worker's `wakeup_mutex`. See `worker_wake_client()`. */
+	int wakeup_pending; /**<Whether this client is in its worker's wakeup list, waiting to have its queue flushed. Protected by the worker's `wakeup_mutex`. It is not a bit
+							field, since other threads change it while the client's worker changes the bit fields below. */
+	struct wheel_timer ping_timer; /**<A timer in the worker's timer wheel that fires every `get_ping_freq()` seconds to send a possible PING message to the client, if no other activity was detected recently.
+									  Once a PING is sent, the timer is set to fire after `get_timeout()` seconds; if no PONG reply arrives in between, the connection is assumed to be dead, and the
 									  client's session is terminated. See `ping_timer_cb()` */
+	struct irc_client *deferred_next; /**<Next client in the worker's deferred list. Only touched by the client's worker. See `worker_defer_client()`. */
+	ev_tstamp flood_stamp; /**<When `flood_tokens` was last refilled. */
+	double flood_tokens; /**<How many messages this client can send right now, according to his token bucket. See `struct read_budget` in `serverinfo.h`. */
+	struct ev_timer flood_timer; /**<Timer that is only active while this client's messages wait for his token bucket to refill. */
+	struct ev_io handshake_watcher; /**<io watcher for this client's socket that is only active while the SSL handshake is in progress. It waits for whatever direction `SSL_accept()` asked for. */
+	unsigned long long handshake_start; /**<When the SSL handshake started, as returned by `stats_clock()`. */
+	struct ev_timer handshake_timer; /**<A time watcher that is only active while the SSL handshake is in progress. If it expires, the connection is dropped. See `get_handshake_timeout()`. */
+	struct ev_timer dns_timer; /**<A time watcher that is only active while this client's hostname is being looked up. If it expires before the lookup is done, the client's IP address is used instead. */
+	struct dns_query *dns_query; /**<The pending reverse lookup for this client, or `NULL` if there is none. See `resolver.h`. */
 	ev_tstamp last_activity; /**<Timestamp for the last activity on this connection. This is updated everytime new data is read from the socket. */
-	struct ev_loop *ev_loop; /**<libev loop for this client's thread. Each thread holds its own loop. */
-	struct msg_queue write_queue; /**<Write queue that holds messages waiting to be sent. @see client_queue.h */
+	struct ev_loop *ev_loop; /**<libev loop of the worker that owns this client. Every client owned by the same worker shares this loop. */
+	struct worker *worker; /**<The worker that owns this client. Every callback for this client runs in this worker's thread. */
+	struct msg_queue write_queue; /**<Write queue that holds messages waiting to be sent, including replies to this client's own commands. @see write_msgs_queue.h */
 	char *realname; /**<GECOS field. */
 	char *hostname; /**<reverse looked up hostname, or the IP address if no reverse is available. */
 	char *public_host; /**<cloaked hostname for this client. This is the address shown to other regular users, so that a client's address is kept private. */
 	char *nick; /**<nickname */
 	char *username; /**<ident field */
-	char *server; /**<this client's server ip address. `NULL` if it's a local client. */
+	char *prefix; /**<Pre-rendered message prefix, ":nick!username@public_host", used as the source of every message this client sends to others. `NULL` until the client registers. See `update_client_prefix()`. */
+	int prefix_len; /**<Length of `prefix`. */
+	char *server; /**<Name of the server this client is connected to, if it is a client on another server of the network. `NULL` if it's a local client. */
+	struct irc_client *link; /**<For clients on other servers, the server link they are reached through; messages for them are queued in the link. `NULL` for local clients. See `link.h`. */
+	struct irc_client *link_next; /**<Next client reached through the same server link. Only touched by the link's worker. */
+	struct irc_client *link_prev; /**<Previous client reached through the same server link. Only touched by the link's worker. */
+	int hopcount; /**<How many servers away this client is. `0` for local clients. */
+	struct server_link *server_link; /**<Server link state, if this connection is, or claims to be, another server of the network. `NULL` otherwise. See `link.h`. */
+	char *kill_reason; /**<Set by another thread, before calling `worker_wake_client()`, when this client must be disconnected, for example, because another server killed him.
+						   The client's worker terminates the session with it as the quit message. It must be a string constant. See `client_wakeup()`. */
 	char **channels; /**<A dynamically allocated array of `char *` holding a list of the channels this client is in. Free positions hold a NULL pointer. */
+	unsigned *quit_seen; /**<Array with one entry per worker, holding the stamp of the last QUIT that each worker delivered to this client. Entry `i` is only touched by worker `i`'s thread.
+							  See `do_quit()` in `channel.c`. */
+	struct list_stream *list_stream; /**<The LIST reply that is being streamed to this client, or `NULL` if there is none. See `list_each_channel()` in `channel.c`. */
 	int channels_count; /**<How many channels he joined, i.e., how many positions in `channels` are taken (not NULL). */
 	struct irc_message last_msg; /**<last IRC message received coming from this client. This structure will be filled as we read this client's socket, and when an entire message is finished reading, this structure
 									 will contain the necessary information. */
 	unsigned is_registered : 1; /**<bit field indicating if this client has registered his connection. */
 	unsigned uses_ssl : 1; /**<bit field indicating if this client is using a secure connection. */
+	unsigned read_paused : 1; /**<bit field indicating if we stopped reading this client's commands because his write queue is above its soft limit. See `client_flush()`. */
+	unsigned input_held : 1; /**<bit field indicating if we stopped reading this client's socket because his input buffer holds messages beyond his read budget, which wait to be processed. See `serve_input()`. */
+	unsigned deferred_pending : 1; /**<bit field indicating if this client is in his worker's deferred list. */
+	unsigned in_handshake : 1; /**<bit field indicating if this client's SSL handshake is still in progress. */
+	unsigned is_oper : 1; /**<bit field indicating if this client became an IRC operator with the OPER command. */
+	unsigned is_server : 1; /**<bit field indicating if this connection is a link to another server. Server links are never registered as clients; their messages are interpreted by `link_interpret()`. */
 	unsigned host_reversed : 1; /**<bit field indicating if we were able to reverse lookup this client's IP address. If this field is not set, then `hostname` holds an IP address, otherwise, a hostname. */
 	unsigned connection_status : 1; /**<bit field indicating the connection status: `STATUS_OK` in normal situations; `STATUS_TIMEOUT` if we're waiting for a PONG reply from a previous PING. */
 	int socket_fd; /**<the socket descriptor used to communicate with this client. */
+	struct uring_conn *uring; /**<This client's io_uring connection, if his socket is served through io_uring instead of his watchers; `NULL` otherwise. See `uring.h`. */
 	SSL *ssl; /**<main SSL structure, created per establish connection. */
 };
 
-/** This structure serves as a wrapper to pass arguments to this client's thread initialization function. `pthread_create()` is capable of passing a generic pointer holding the arguments, thus, we encapsulate
-	every argument to be passed to `new_client()` in this structure.
+/** This structure serves as a wrapper to pass arguments to `new_client()`. The accepting thread hands new connections to a worker with `worker_dispatch()`, which is capable of passing a generic pointer
+	holding the arguments, thus, we encapsulate every argument to be passed to `new_client()` in this structure.
 */
 struct irc_client_args_wrapper {
 	int socket; /**<socket file descriptor for the new connection. Typically, this is the return value from `accept()` */
@@ -66,7 +103,18 @@ struct irc_client_args_wrapper {
 };
 
 /* Documented in client.c */		
-void *new_client(void *args);
+void new_client(struct worker *worker, void *args);
 void terminate_session(struct irc_client *client, char *quit_msg);
+int update_client_prefix(struct irc_client *client);
+void client_wakeup(struct irc_client *client);
+struct irc_client *new_link_client(struct worker *worker, int socket, const char *address);
+struct irc_client *new_remote_client(struct irc_client *link, const char *nick, const char *username, const char *host,
+				     const char *server, const char *realname, int hopcount);
+void destroy_remote_client(struct irc_client *client);
+struct irc_client *resume_client(struct worker *worker, int socket, const char *nick, const char *username,
+				 const char *hostname, const char *public_host, const char *realname);
+void start_resumed_client(struct worker *worker, void *arg);
+void discard_resumed_client(struct irc_client *client);
+void client_resume_input(struct irc_client *client);
 
 #endif /* __IRC_CLIENT_GUARD__ */
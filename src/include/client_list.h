@@ -27,6 +27,7 @@
 int client_list_init(void);
 void client_list_destroy(void);
 void *client_list_find_and_execute(char *nick, void *(*f)(void *, void *), void *fargs, int *success);
+void client_list_for_each(void (*f)(void *, void *), void *fargs);
 int client_list_add(struct irc_client *client, char *newnick);
 void client_list_delete(struct irc_client *client);
 int nick_is_valid(char s);
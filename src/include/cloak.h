@@ -16,12 +16,27 @@
 	Interested readers can learn about the algorithm in the documentation for cloak.c. For other, non-interested readers, it suffices to know that `hide_userhost()` returns a unique cloaked host for a given user
 	without leaking information about his IP.
 	
+	Cloaked hosts are cached, so this module must be initialized with `cloak_init()` before it is used.
+	
 	@author Filipe Goncalves
 	@date November 2013
 	@see cloak.c
 */
 
+/** Cloak mode computing the same cloaked hosts as previous versions, with SHA1 and MD5 */
+#define CLOAK_MODE_LEGACY 0
+
+/** Cloak mode computing cloaked hosts with SipHash-2-4. It is faster, but the cloaked hosts differ from `CLOAK_MODE_LEGACY` */
+#define CLOAK_MODE_SIPHASH 1
+
+/** Number of entries in the cloaked hosts cache. Must be a power of 2. */
+#define CLOAK_CACHE_SIZE 4096
+
+/** Maximum length of a cached real host, including the null terminator. Longer hosts are never cached. */
+#define CLOAK_CACHE_HOST_SIZE 256
+
 /* Documented in C source file */
+void cloak_init(void);
 char *hide_ipv4(char *host);
 char *hide_host(char *host);
 
@@ -0,0 +1,36 @@
+#ifndef __YAIRCD_CMD_HASH_GUARD__
+#define __YAIRCD_CMD_HASH_GUARD__
+#include <stddef.h>
+#include "cmd_ids.h"
+
+/** @file
+	@brief Commands lookup
+
+	The set of commands is fixed at compile time, and is listed in `msg/commands.def`. When the IRCd is built, `tools/gen_cmd_hash.c`
+	generates a perfect hash table for these commands: `include/cmd_ids.h`, with an ID for each command, and `msg/cmd_hash.c`, with the
+	lookup functions declared here.
+	The hash function is FNV-1a over the case folded command, starting at a seed chosen by the generator such that no two commands
+	collide; thus, looking up a command takes one hash and one compare.
+	`parse_msg()` computes the hash while it scans the command, and fills in the command ID. The rest of the code only ever deals with IDs.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see tools/gen_cmd_hash.c
+*/
+
+/** Command ID for a command that doesn't exist */
+#define CMD_UNKNOWN -1
+
+/** Feeds an alphabetic character into a command's hash. The hash shall start with `CMD_HASH_SEED`.
+	Characters are folded to lower case, so that commands are case insensitive.
+	@param h The hash so far.
+	@param c The next character. Must be alphabetic.
+*/
+#define cmd_hash_step(h, c) (((h) ^ (unsigned) ((unsigned char) (c) | 0x20)) * 16777619U)
+
+/* Documented in cmd_hash.c, which is generated by tools/gen_cmd_hash.c */
+int cmd_lookup_hashed(const char *cmd, size_t length, unsigned hash);
+int cmd_lookup(const char *cmd);
+const char *cmd_name(int id);
+
+#endif /* __YAIRCD_CMD_HASH_GUARD__ */
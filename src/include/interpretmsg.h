@@ -24,5 +24,5 @@ struct cmd_parse {
 
 /* Documented in source file */
 int cmds_init(void);
-void interpret_msg(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void interpret_msg(struct irc_client *client, char *prefix, char *cmd, int cmd_id, char *params[], int params_size);
 #endif /* __INTERPRET_MSG_GUARD__ */
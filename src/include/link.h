@@ -0,0 +1,56 @@
+#ifndef __YAIRCD_LINK_GUARD__
+#define __YAIRCD_LINK_GUARD__
+#include "client.h"
+
+/** @file
+	@brief Server links
+
+	Several yaIRCd servers can link with each other to form a single IRC network, as described in RFC 2813. Servers link in a tree: a server is
+	only known through one link, and a server that is already known is refused.
+	A server link is an ordinary connection, with a `struct irc_client` owned by a worker, whose `is_server` bit is set. Links are authenticated
+	against the `links` list of the configuration file: both ends exchange `PASS` and `SERVER`, and then a netburst with every server, client and
+	channel they know.
+	Clients on other servers are kept in the clients list and in the channels like local clients, with `link` pointing at the server link they are
+	reached through, so that every lookup works as usual. Messages for them are queued in their link. They belong to the link's worker, which is
+	the only one creating and freeing them.
+	A channel message is forwarded once to each link that leads to some of the channel's users; JOIN, PART and QUIT are broadcast to every link,
+	since every server knows every channel user.
+	With the exception of `link_init()` and `links_start()`, every function declared here is thread safe.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see link.c
+*/
+
+/** How many servers can be linked directly to this one. */
+#define LINK_MAX_LINKS 16
+
+/** Every how many seconds a server configured with `autoconnect` is connected to, while its link is down. A connection attempt that
+	takes longer is given up. */
+#define LINK_RETRY_INTERVAL 30.
+
+struct link_connector;
+
+/** State of a server link, or of a connection that claims to be one. */
+struct server_link {
+	char *password; /**<Password sent by the other server with `PASS`, or `NULL` if it didn't send one. */
+	char *name; /**<The other server's name, once it is linked. */
+	char *description; /**<The other server's description, once it is linked. */
+	int conf; /**<Position of the other server's link block in the configuration file. */
+	unsigned outgoing : 1; /**<Bit field indicating if this server connected to the other one. */
+	unsigned linked : 1; /**<Bit field indicating if both servers authenticated, and the link is part of the network. */
+	struct irc_client *clients; /**<Head of the list of clients reached through this link, linked with `link_next` and `link_prev`. Only touched by the link's worker. */
+	struct link_connector *connector; /**<For outgoing links, the connector that established the link. */
+};
+
+/* Documented in link.c */
+int link_init(void);
+void links_start(void);
+void link_pass(struct irc_client *client, char *password);
+void link_register(struct irc_client *client, char *name, char *description);
+void link_interpret(struct irc_client *link, char *prefix, int cmd_id, char *params[], int params_size);
+void link_introduce(struct irc_client *client);
+void link_broadcast_from(struct irc_client *from, const char *cmd, const char *target, const char *trailing);
+void link_drop(struct irc_client *link);
+
+#endif /* __YAIRCD_LINK_GUARD__ */
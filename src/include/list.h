@@ -51,6 +51,7 @@ void *list_find_word(Word_list_ptr list, char *word);
 void *list_find_word_nolock(Word_list_ptr list, char *word);
 void *list_find_and_execute(Word_list_ptr list, char *word, void *(*match_fun)(void *, void *), void *(*nomatch_fun)(void *), void *match_fargs, void *nomatch_fargs, int *success);
 void *list_find_and_execute_globalock(Word_list_ptr list, char *word, void *(*match_fun)(void *, void *), void *(*nomatch_fun)(void *), void *match_fargs, void *nomatch_fargs, int *success);
+void list_find_each_and_execute_globalock(Word_list_ptr list, char *words[], int count, void *(*match_fun)(void *, void *), void *match_fargs);
 int list_add(Word_list_ptr list, void *data, char *word);
 int list_add_nolock(Word_list_ptr list, void *data, char *word);
 void *list_delete(Word_list_ptr list, char *word);
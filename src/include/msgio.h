@@ -12,19 +12,29 @@
 	@see msgio.c
 */
 
-/** A macro that knows how to write to a client. It is an abstraction used by every function that wants to write to a client socket.
-	It knows how to deal with plaintext sockets and SSL sockets. No other function in the whole ircd should worry about this.
+/** A macro that knows how to write to a client socket. It is the low-level primitive used by `flush_queue()` to drain a client's output buffer; no other code should write to a socket directly.
+	Replies and notifications must be queued with `queue_to()` or `client_enqueue()` instead, so that they are coalesced and written in order.
+	It knows how to deal with plaintext sockets and SSL sockets.
 	@param client The client to notify.
 	@param buf A characters sequence, possibly not null-terminated, that shall be written to this client's socket.
 	@param len How many characters from `buf` are to be written into this client's socket.
-	@note On success, exactly `len` characters will be written to `client`'s socket, and the macro evaluates to `0`. On failure, the macro evaluates to `-1`.
+	@note Sockets are non-blocking. On success, the macro evaluates to the number of characters written, which may be less than `len`. On failure, the macro evaluates to `-1` (or to a non positive value for SSL sockets).
 */
 #define write_to(client,buf,len) ((client)->uses_ssl ? SSL_write((client)->ssl, (buf), (len)) : send((client)->socket_fd, (buf), (len), 0))
 
+/** A macro that queues a message in a client's own output buffer. This is how a client's worker replies to the client it is serving; the buffer is flushed with a single write after
+	the worker is done processing the client's input. It is safe to use this macro while holding locks, since it never calls `terminate_session()`.
+	@param client The client to write to.
+	@param buf A characters sequence, possibly not null-terminated.
+	@param len How many characters from `buf` are to be queued.
+	@note The macro evaluates to `0` on success, and to `-1` if the client's queue is full or there is no memory available, in which case nothing is queued.
+*/
+#define queue_to(client,buf,len) client_enqueue_buf(&(client)->write_queue, (buf), (len))
+
 /** A macro that knows how to read from a client socket. It is an abstraction used by every function that wants to read from a client.
 	It knows how to deal with plaintext sockets and SSL sockets. No other function in the whole ircd should worry about this.
 	On success, the macro evaluates to a positive integer of type `ssize_t` denoting the number of characters read on success. If the other end closed the connection, the macro evaluates to `0`.
-	In case of failure, the macro evaluates to `-1`.
+	In case of failure, the macro evaluates to `-1`. Since sockets are non-blocking, this can also mean that there is nothing to read at the moment; see `read_from_noerr()`.
 	@param client The client to read from.
 	@param buf Buffer to store the message read.
 	@param len Maximum length of the message. This is usually bounded by the size of `buf`. This parameter avoids buffer overflow.
@@ -37,7 +47,9 @@
 /* Functions documented in the source file */
 void yaircd_send(struct irc_client *client, const char *fmt, ...);
 int cmd_print_reply(char *buf, size_t size, const char *msg, ...);
-inline void write_to_noerr(struct irc_client *client, char *buf, size_t len);
-inline ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len);
+int print_prefixed_msg(char *buf, size_t size, struct irc_client *from, const char *cmd, const char *target,
+		       const char *trailing);
+void write_to_noerr(struct irc_client *client, char *buf, size_t len);
+ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len);
 
 #endif /* __YAIRCD_MSGIO_GUARD__ */
@@ -13,6 +13,6 @@
 */
 
 /* Documented in parsemsg.c */
-int parse_msg(char *buf, char **prefix, char **cmd, char *params[MAX_IRC_PARAMS], int *params_filled);
+int parse_msg(char *buf, char **prefix, char **cmd, int *cmd_id, char *params[MAX_IRC_PARAMS], int *params_filled);
 
 #endif /* __PARSEMSG_GUARD__ */
@@ -0,0 +1,64 @@
+#ifndef __YAIRCD_POOL_GUARD__
+#define __YAIRCD_POOL_GUARD__
+#include <stddef.h>
+
+/** @file
+	@brief Slab pools for small, frequently allocated objects
+
+	Clients, trie nodes, list nodes, channel member entries and write queue blocks are allocated and freed all the time. Rather
+	than going through `malloc()` for each of them, they are carved out of fixed size slabs, with one pool per size class.
+	`pool_init()` sets up generic classes for small objects, and `pool_add_class()` adds exact classes for the large objects
+	that are allocated often, such as clients. An allocation is served by the smallest class it fits in. Every worker thread
+	has its own set of pools, so allocating and freeing in a worker never takes a lock.
+
+	An object remembers the pool it came from. When it is freed by the thread that allocated it, it goes straight back into
+	that pool's free list; otherwise, it is pushed into the pool's remote free list, which is lock free, and the owner takes
+	the whole remote list back once its own free list runs dry. Slabs are never returned to the system: they are reused by
+	the same size class for the whole life of the process, which keeps the heap from fragmenting.
+
+	Threads without pools (the main thread, for example) and objects larger than every class fall back to `malloc()`.
+	Either way, memory returned by `pool_alloc()` must be released with `pool_free()`.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see pool.c
+*/
+
+/** How many size classes can exist, including the generic ones */
+#define POOL_MAX_CLASSES 16
+
+/** Minimum size of a slab, in bytes. Slabs for large classes are grown to hold at least `POOL_MIN_SLAB_OBJECTS` objects. */
+#define POOL_SLAB_SIZE 65536
+
+/** Minimum number of objects in a slab */
+#define POOL_MIN_SLAB_OBJECTS 8
+
+/** Occupancy of a size class, added over every thread's pools. See `pool_get_stats()`. */
+struct pool_class_stats {
+	size_t size; /**<Largest object served by this class, in bytes. */
+	unsigned long slabs; /**<How many slabs were allocated. */
+	unsigned long capacity; /**<How many objects fit in those slabs. */
+	unsigned long in_use; /**<How many objects are currently allocated. */
+	unsigned long allocs; /**<How many objects were ever allocated. */
+	unsigned long remote_frees; /**<How many objects were freed by a thread other than the one that allocated them. */
+};
+
+/** Occupancy of every pool. See `pool_get_stats()`. */
+struct pool_stats {
+	struct pool_class_stats classes[POOL_MAX_CLASSES]; /**<One entry per size class, in increasing size. */
+	int classes_no; /**<How many entries are stored in `classes`. */
+	int threads; /**<How many threads have pools. */
+	unsigned long fallback_in_use; /**<How many objects allocated with `malloc()`, because they were too large or were allocated
+					  by a thread without pools, are still in use. */
+};
+
+/* Documented in pool.c */
+int pool_init(void);
+int pool_add_class(size_t size);
+int pool_thread_init(void);
+void *pool_alloc(size_t size);
+void *pool_calloc(size_t size);
+void pool_free(void *ptr);
+void pool_get_stats(struct pool_stats *stats);
+
+#endif /* __YAIRCD_POOL_GUARD__ */
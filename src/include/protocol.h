@@ -30,6 +30,9 @@
 /** Max. chan name length */
 #define MAX_CHANNAME_LENGTH 32
 
+/** Max. server name length, as specified in RFC 2812 Section 1.1 */
+#define MAX_SERVNAME_LENGTH 63
+
 /** Max. quit message length. Must be greater than `QUIT_MSG_PREFIX` */
 #define MAX_QUITMSG_LENGTH 64
 
@@ -185,6 +188,9 @@
 /** The server sends Replies 001 to 004 to a user upon successful registration. */
 #define RPL_MYINFO "004"
 
+/** Sent after RPL_MYINFO to advertise the features and limits of this server, as `NAME=value` tokens. */
+#define RPL_ISUPPORT "005"
+
 /** Dummy reply number. Not used. */
 #define RPL_NONE "300"
 
@@ -377,6 +383,9 @@
 /** hlines stats reply */
 #define RPL_STATSHLINE "244"
 
+/** Free form debug information for /stats */
+#define RPL_STATSDEBUG "249"
+
 /** To answer a query about a client's own mode, RPL_UMODEIS is sent back. */
 #define RPL_UMODEIS "221"
 
@@ -435,6 +444,27 @@
 /** Quit message for when `write_to()` is not successfull */
 #define BAD_WRITE_QUIT_MSG "Write error on client's socket"
 
+/** Quit message for when a client's write queue reaches its hard limit, because he's not reading fast enough */
+#define SENDQ_QUIT_MSG "SendQ exceeded"
+
+/** Quit message for a client killed by another server, see `link.c` */
+#define KILLED_QUIT_MSG "Killed"
+
+/** Quit message for a client killed because another server introduced a client with the same nickname */
+#define COLLISION_QUIT_MSG "Nick collision"
+
+/** Quit message for a server link that could not authenticate, see `link_register()` */
+#define LINK_AUTH_QUIT_MSG "Link authentication failed"
+
+/** Quit message for a server link whose server is already known to the network */
+#define LINK_EXISTS_QUIT_MSG "Server exists"
+
+/** Quit message for a server link that sent ERROR, or asked to be removed with SQUIT */
+#define LINK_CLOSED_QUIT_MSG "Link closed by peer"
+
+/** Quit message for the clients that don't survive a hot restart, see `upgrade.c` */
+#define RESTART_QUIT_MSG "Server restarting"
+
 /* End misc */
 
 #endif /* __PROTOCOL_SPECS_GUARD__ */
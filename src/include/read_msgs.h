@@ -1,5 +1,6 @@
 #ifndef __YAIRCD_READ_MSGS_GUARD__
 #define __YAIRCD_READ_MSGS_GUARD__
+#include <stddef.h>
 #include "protocol.h"
 
 /** @file
@@ -21,6 +22,11 @@
 */
 #define MSG_CONTINUE -1
 
+/** Size of each client's input buffer. It must be bigger than `MAX_MSG_SIZE`; the bigger it is, the more pipelined messages are
+	read with a single `read_data()` call, and the less often a partial message has to be moved to the front of the buffer.
+*/
+#define INPUT_BUFFER_SIZE 16384
+
 /** This structure represents the status of a socket read. Socket reading is undeterministic by nature: multiple messages can arrive in a single read, or no complete messages may arrive.
 	Note that even though we're using TCP connections, the sockets implementation uses buffers, and will not always deliver data exactly as it was sent in the other end.
 	For example, a client may write "NICK <nick>\\r\\n" and then "USER <user> 0 * :GECOS field\\r\\n", but in the server side, when we read, we get the whole thing with one read.
@@ -31,16 +37,19 @@
 	make it look like only one single, full IRC messages arrives to the socket at a time.
 */	
 struct irc_message {
-	char msg[MAX_MSG_SIZE]; /**<IRC message buffer, holding up to `MAX_MSG_SIZE` characters, including the terminating characters \\r\\n. This buffer is not null terminated. */
-	int index; /**<This field denotes the next free position in `msg`. Any new data arriving on the socket shall be written starting at `msg[index]`. `index` is always lower than `MAX_MSG_SIZE`. */
+	char msg[INPUT_BUFFER_SIZE]; /**<Input buffer. It holds as many messages as fit, each one with up to `MAX_MSG_SIZE` characters, including the terminating characters \\r\\n. This buffer is not null terminated. */
+	int index; /**<This field denotes the next free position in `msg`. Any new data arriving on the socket shall be written starting at `msg[index]`. `index` is never greater than `INPUT_BUFFER_SIZE`. */
 	int last_stop; /**<Used to keep track of where we previously stopped processing the current message. This field allows `next_msg()` to resume parsing for the rest of the information not yet parsed but already retrieved from the socket. */
 	int msg_begin; /**<Index that denotes the position in `msg` where the current message begins. There can be old messages behind which were already reported. Anything behind `msg_begin` is trash. */
+	int discarding; /**<Set when the current message exceeded `MAX_MSG_SIZE` and was thrown away; everything up to the next newline must be thrown away too. */
 };
 
 struct irc_client;
 /* Documented in read_msgs.c */
 void initialize_irc_message(struct irc_message *in);
-void read_data(struct irc_client *client);
+void read_data(struct irc_client *client, size_t max);
+size_t store_data(struct irc_client *client, const char *buf, size_t len);
 int next_msg(struct irc_message *client_msg, char **msg);
+int msg_pending(struct irc_message *client_msg);
 
 #endif /* __YAIRCD_READ_MSGS_GUARD__ */
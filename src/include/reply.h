@@ -0,0 +1,52 @@
+#ifndef __YAIRCD_REPLY_GUARD__
+#define __YAIRCD_REPLY_GUARD__
+#include <stddef.h>
+#include "protocol.h"
+#include "client.h"
+
+/** @file
+	@brief Reply builder
+
+	An append-only builder for server generated messages, such as numeric replies and errors. A reply is built piece by piece
+	into a buffer on the stack, and queued in the client's output buffer with `reply_send()`; no format string is ever parsed.
+
+	The typical usage is:
+	@code
+	struct reply r;
+	reply_numeric(&r, client, RPL_WHOISSERVER);
+	reply_param(&r, target->nick);
+	reply_param(&r, get_server_name());
+	reply_trailing(&r, get_server_desc());
+	reply_send(&r, client);
+	@endcode
+
+	Replies are silently truncated to `MAX_MSG_SIZE` characters, including the terminating \\r\\n, which is appended only once,
+	by `reply_send()`.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see reply.c
+*/
+
+/** How many characters a reply can hold, excluding the terminating \\r\\n */
+#define REPLY_MAX_LENGTH (MAX_MSG_SIZE - 2)
+
+/** A reply being built */
+struct reply {
+	char buf[MAX_MSG_SIZE]; /**<The reply. It is not null terminated. */
+	size_t length; /**<How many characters are stored in `buf`. Never greater than `REPLY_MAX_LENGTH`. */
+};
+
+/* Documented in reply.c */
+void reply_begin(struct reply *reply, const char *cmd);
+void reply_numeric(struct reply *reply, struct irc_client *client, const char *numeric);
+void reply_append_buf(struct reply *reply, const char *str, size_t len);
+void reply_append(struct reply *reply, const char *str);
+void reply_param(struct reply *reply, const char *param);
+void reply_trailing(struct reply *reply, const char *trailing);
+size_t reply_room(struct reply *reply);
+size_t reply_end(struct reply *reply);
+void reply_send(struct reply *reply, struct irc_client *client);
+int reply_queue(struct reply *reply, struct irc_client *client);
+
+#endif /* __YAIRCD_REPLY_GUARD__ */
@@ -0,0 +1,47 @@
+#ifndef __YAIRCD_RESOLVER_GUARD__
+#define __YAIRCD_RESOLVER_GUARD__
+#include <netinet/in.h>
+#include <stddef.h>
+
+/** @file
+	@brief Asynchronous reverse DNS resolver
+
+	Reverse lookups are slow and, when a nameserver doesn't answer, can block for several seconds. A worker must never wait for them,
+	since it serves many other clients. Instead, lookups are handed to a small pool of resolver threads with `resolver_query()`.
+	When a lookup is done, its completion is posted back to the worker that asked for it with `worker_post()`, so the completion
+	function always runs in the same thread as the rest of the client's callbacks.
+
+	Results, both positive and negative, are cached per IP address for a configurable amount of time, so that many connections
+	arriving from the same address (NATs, reconnect storms after a netsplit) are only resolved once.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see resolver.c
+*/
+
+/** Number of entries in the results cache. Must be a power of 2. */
+#define RESOLVER_CACHE_SIZE 4096
+
+/** Maximum length of a cached hostname, including the null terminator. Longer hostnames are never cached. */
+#define RESOLVER_CACHE_HOST_SIZE 256
+
+/** Return code for `resolver_cache_lookup()` indicating that the address has a hostname in the cache */
+#define RESOLVER_HIT 1
+
+/** Return code for `resolver_cache_lookup()` indicating that the cache remembers that the address does not have a hostname */
+#define RESOLVER_NEGATIVE 0
+
+/** Return code for `resolver_cache_lookup()` indicating that the address is not in the cache */
+#define RESOLVER_MISS -1
+
+struct worker;
+struct dns_query;
+
+/* Documented in resolver.c */
+int resolver_init(int threads, int cache_ttl, int negative_ttl);
+int resolver_cache_lookup(const struct sockaddr_in *address, char *host, size_t size);
+struct dns_query *resolver_query(struct worker *worker, const struct sockaddr_in *address, void (*done)(void *, const char *),
+				 void *arg);
+void resolver_cancel(struct dns_query *query);
+
+#endif /* __YAIRCD_RESOLVER_GUARD__ */
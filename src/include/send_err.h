@@ -27,4 +27,7 @@ void send_err_notonchannel(struct irc_client *client, char *chan);
 void send_err_toomanychannels(struct irc_client *client, char *chan);
 void send_err_noorigin(struct irc_client *client);
 void send_err_nomotd(struct irc_client *client);
+void send_err_noprivileges(struct irc_client *client);
+void send_err_passwdmismatch(struct irc_client *client);
+void send_err_nooperhost(struct irc_client *client);
 #endif /* __YAIRCD_SEND_ERR_GUARD__ */
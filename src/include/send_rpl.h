@@ -12,8 +12,6 @@
 */
 
 /* Functions documented in the source file */
-void send_motd(struct irc_client *client);
-void send_welcome(struct irc_client *client);
 void notify_privmsg(struct irc_client *from, struct irc_client *to, char *dest, char *message);
 
 #endif /* __YAIRCD_SEND_RPL_GUARD__ */
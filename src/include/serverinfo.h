@@ -27,23 +27,71 @@
 /** Knows how to access a MOTD's entry line */
 #define motd_entry_line(m) (*(m))
 
+/** How much of a client's input is processed every time his worker serves him. Each class of clients has its own budget: clients of the
+	standard socket, clients of the secure socket, and server links. Whatever is left over is processed in later loop iterations, once the
+	worker served everyone else; see `client.c`.
+*/
+struct read_budget {
+	int msgs; /**<Maximum number of messages processed each time. */
+	int bytes; /**<Maximum number of characters read from the socket each time. Never less than `MAX_MSG_SIZE`. */
+	double rate; /**<How many messages per second refill the client's token bucket. While the bucket is empty, the client's messages wait.
+	                `0` disables the token bucket. */
+	double burst; /**<The token bucket's capacity: how many messages a client that was quiet can send at once. */
+};
+
+/** `check_oper()` found an operator with the given name and password */
+#define OPER_OK 0
+/** `check_oper()` didn't find an operator with the given name */
+#define OPER_NO_SUCH 1
+/** `check_oper()` found an operator with the given name, but the password is wrong */
+#define OPER_BAD_PASSWORD 2
+
 /* Documented in .c source file */
 int loadServerInfo(void);
 const char *get_server_name(void);
 const char *get_server_desc(void);
+const char *get_net_name(void);
 const char *get_std_socket_ip(void);
 const char *get_ssl_socket_ip(void);
 int get_std_socket_port(void);
 int get_ssl_socket_port(void);
 int get_std_socket_hangup(void);
 int get_ssl_socket_hangup(void);
+int get_std_socket_sendq(void);
+int get_ssl_socket_sendq(void);
+int get_std_socket_sendq_soft(void);
+int get_ssl_socket_sendq_soft(void);
+const struct read_budget *get_std_read_budget(void);
+const struct read_budget *get_ssl_read_budget(void);
+const struct read_budget *get_link_read_budget(void);
 const char *get_cert_path(void);
 const char *get_priv_key_path(void);
 const char *get_cloak_net_prefix(void);
 const char *get_cloak_key(int i);
 size_t get_cloak_key_length(int i);
+int get_cloak_mode(void);
 int get_chanlimit(void);
 double get_ping_freq(void);
 double get_timeout(void);
+double get_handshake_timeout(void);
 MOTD_ENTRY get_motd(void);
+void reload_motd(void);
+int get_worker_threads(void);
+int get_worker_balance(void);
+int get_worker_reuseport(void);
+int get_dns_threads(void);
+double get_dns_timeout(void);
+int get_dns_cache_ttl(void);
+int get_dns_negative_ttl(void);
+const char *get_stats_socket(void);
+int check_oper(const char *name, const char *password);
+int get_links_count(void);
+const char *get_link_name(int i);
+const char *get_link_host(int i);
+int get_link_port(int i);
+int get_link_autoconnect(int i);
+int get_link_sendq(int i);
+const char *get_link_password(int i);
+int find_link(const char *name);
+int check_link_password(int i, const char *password);
 #endif /* __YAIRCD_SERVINFO_GUARD__ */
@@ -0,0 +1,67 @@
+#ifndef __YAIRCD_STATS_GUARD__
+#define __YAIRCD_STATS_GUARD__
+#include <stddef.h>
+#include <ev.h>
+#include "cmd_ids.h"
+
+/** @file
+	@brief Server statistics
+
+	Counters and latency histograms for commands, traffic, write queues, lock contention, accepts and SSL handshakes.
+	Every thread that calls `stats_thread_init()` updates its own set of counters without any synchronization; threads that
+	don't, such as the resolver threads, update a shared set with atomic operations. A report adds every set up when it's
+	read.
+
+	Statistics are shown to IRC operators with the `STATS` command, and can also be read by monitoring tools, in the
+	Prometheus text format, from a Unix socket set in the `stats` block of the configuration file.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see stats.c
+*/
+
+/** How many buckets a latency histogram has. Bucket `i` counts samples shorter than `2^i` microseconds, except for the last one,
+	which counts every sample that didn't fit in the others. */
+#define STATS_LATENCY_BUCKETS 18
+
+/** A latency histogram */
+struct stats_histogram {
+	unsigned long buckets[STATS_LATENCY_BUCKETS]; /**<How many samples fell in each bucket. Not cumulative. */
+	unsigned long count; /**<How many samples were recorded. */
+	unsigned long long sum_ns; /**<Sum of every sample, in nanoseconds. */
+};
+
+/** Every counter kept by the server */
+struct stats_counters {
+	struct stats_histogram commands[CMD_COUNT]; /**<Calls and handling time of each command, indexed by command ID. */
+	unsigned long unknown_commands; /**<How many messages held an unknown command, or couldn't be parsed. */
+	unsigned long long bytes_in; /**<Bytes read from clients. */
+	unsigned long long bytes_out; /**<Bytes written to clients. */
+	long long queued_bytes; /**<Bytes waiting in write queues. A thread may queue bytes that another thread writes, so only the
+				   sum over every thread is meaningful. */
+	unsigned long queue_high_water; /**<Largest write queue seen, in bytes. */
+	unsigned long lock_waits; /**<How many times a list lock was contended. */
+	unsigned long long lock_wait_ns; /**<Time spent waiting for contended list locks, in nanoseconds. */
+	unsigned long accepts; /**<How many connections were accepted. */
+	struct stats_histogram handshakes; /**<Duration of the SSL handshakes that completed. */
+};
+
+struct irc_client;
+
+/* Documented in stats.c */
+void stats_init(void);
+int stats_thread_init(void);
+unsigned long long stats_clock(void);
+void stats_command(int cmd_id, unsigned long long ns);
+void stats_bytes_in(size_t bytes);
+void stats_bytes_out(size_t bytes);
+void stats_queue_push(size_t bytes, size_t depth);
+void stats_queue_pop(size_t bytes);
+void stats_lock_wait(unsigned long long ns);
+void stats_accept(void);
+void stats_handshake(unsigned long long ns);
+void stats_collect(struct stats_counters *totals);
+int stats_listen(struct ev_loop *loop, const char *path);
+void send_stats(struct irc_client *client, const char *query);
+
+#endif /* __YAIRCD_STATS_GUARD__ */
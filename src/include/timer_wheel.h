@@ -0,0 +1,67 @@
+#ifndef __YAIRCD_TIMER_WHEEL_GUARD__
+#define __YAIRCD_TIMER_WHEEL_GUARD__
+#include <ev.h>
+
+/** @file
+	@brief Hierarchical timer wheel
+
+	Every client needs a timer to send PINGs and to enforce the PONG timeout. With tens of thousands of clients per worker, one
+	`ev_timer` per client means constant churn in libev's timers heap, since every timer is re-armed once per period. These timers
+	don't need precision, so each worker keeps them in a timer wheel instead, driven by a single `ev_timer` that ticks every
+	`TIMER_WHEEL_TICK` seconds. Adding, removing and expiring a timer costs `O(1)`, no matter how many timers are pending.
+
+	The wheel has two levels. The inner wheel has a slot for each of the next `TIMER_WHEEL_INNER_SLOTS` ticks; the outer wheel has
+	a slot for each of the next `TIMER_WHEEL_OUTER_SLOTS` turns of the inner wheel. When the inner wheel completes a turn, the timers
+	in the next outer slot are moved to the inner wheel. Timers further away than the whole outer wheel are parked in its last slot,
+	and placed again when that slot is reached.
+
+	A timer may fire up to one tick later than asked for, but never earlier.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see timer_wheel.c
+*/
+
+/** How many seconds a tick lasts */
+#define TIMER_WHEEL_TICK 1.0
+
+/** log2 of `TIMER_WHEEL_INNER_SLOTS` */
+#define TIMER_WHEEL_INNER_BITS 8
+
+/** How many slots the inner wheel has, one per tick */
+#define TIMER_WHEEL_INNER_SLOTS (1 << TIMER_WHEEL_INNER_BITS)
+
+/** log2 of `TIMER_WHEEL_OUTER_SLOTS` */
+#define TIMER_WHEEL_OUTER_BITS 6
+
+/** How many slots the outer wheel has, one per turn of the inner wheel */
+#define TIMER_WHEEL_OUTER_SLOTS (1 << TIMER_WHEEL_OUTER_BITS)
+
+/** A timer stored in a wheel. It is meant to be embedded in the structure it belongs to; the callback finds that structure with
+	`offsetof()`, like libev's watchers.
+*/
+struct wheel_timer {
+	struct wheel_timer *prev; /**<Previous timer in the same slot. `NULL` if this timer is not pending. */
+	struct wheel_timer *next; /**<Next timer in the same slot. `NULL` if this timer is not pending. */
+	unsigned expires; /**<Tick when this timer fires. */
+	void (*cb)(struct wheel_timer *timer); /**<Function called when this timer fires. The timer is no longer pending, and can be
+	                                          added again. */
+};
+
+/** A timer wheel. Each worker owns one. */
+struct timer_wheel {
+	struct wheel_timer inner[TIMER_WHEEL_INNER_SLOTS]; /**<Inner wheel. Each slot is the sentinel of a circular list. */
+	struct wheel_timer outer[TIMER_WHEEL_OUTER_SLOTS]; /**<Outer wheel. Each slot is the sentinel of a circular list. */
+	unsigned now; /**<Current tick. */
+	int pending; /**<How many timers are pending. The tick watcher only runs while this is positive. */
+	struct ev_loop *loop; /**<The loop running `tick_watcher`. */
+	struct ev_timer tick_watcher; /**<Advances the wheel every `TIMER_WHEEL_TICK` seconds. */
+};
+
+/* Documented in timer_wheel.c */
+void timer_wheel_init(struct timer_wheel *wheel, struct ev_loop *loop);
+void wheel_timer_init(struct wheel_timer *timer, void (*cb)(struct wheel_timer *));
+void timer_wheel_add(struct timer_wheel *wheel, struct wheel_timer *timer, ev_tstamp after);
+void timer_wheel_remove(struct timer_wheel *wheel, struct wheel_timer *timer);
+
+#endif /* __YAIRCD_TIMER_WHEEL_GUARD__ */
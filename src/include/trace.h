@@ -0,0 +1,91 @@
+#ifndef __YAIRCD_TRACE_GUARD__
+#define __YAIRCD_TRACE_GUARD__
+
+/** @file
+	@brief Static tracepoints
+
+	USDT probes, compatible with SystemTap, bpftrace and perf, along the path of a message: from the socket read, through parsing,
+	dispatching and lock waits, to the write queues of its recipients, their worker's wakeup, and the socket write. Probes are only
+	compiled in when the server is built with `make TRACE=1`, which defines `YAIRCD_TRACE` and requires `sys/sdt.h` (shipped with
+	SystemTap's development package); otherwise, every macro in this file expands to nothing.
+
+	Every message read from a client gets a new ID when it is extracted from the input buffer, and the thread that processes it
+	remembers it until the next message is extracted. Probes that fire while a message is being processed carry its ID, so that
+	the output it queues for other clients can be traced back to it; probes that fire outside of any message carry `0`. IDs are
+	unique across threads.
+
+	Probes in the `yaircd` provider, and their arguments:
+	<ul>
+	<li>`msg__read(client, bytes, next_id)`: `bytes` were read from `client`. The first complete message in them gets `next_id`.</li>
+	<li>`msg__parse(id, client, line)`: message `id`, the null terminated `line`, is about to be parsed.</li>
+	<li>`msg__dispatch(id, client, cmd_id)`: message `id` was parsed, and its command handler is about to run.</li>
+	<li>`lock__wait(id, ns)`: while processing message `id`, a contended list lock was waited for during `ns` nanoseconds.</li>
+	<li>`msg__enqueue(id, queue, bytes)`: `bytes` of output for message `id` were queued in `queue`.</li>
+	<li>`client__wake(id, client, signalled)`: `client`'s worker was asked to flush its queue. `signalled` is `0` if the
+	   wakeup was folded into one that was already pending for the same worker.</li>
+	<li>`msg__flush(id, client, queue, bytes)`: `bytes` from `queue` were written to `client`'s socket.</li>
+	</ul>
+
+	A queue is written in the order it is filled, so the output queued by a message is on the wire once the total of the
+	`bytes` flushed from its `queue` reaches the total queued up to and including that message. That is how a recipient's
+	`msg__flush` is matched with the sender's message. A simpler example, this bpftrace script shows how long messages take
+	from parsing until their output is queued for each recipient:
+
+	@code
+	usdt:./yaircd.out:yaircd:msg__parse { @start[arg0] = nsecs; }
+	usdt:./yaircd.out:yaircd:msg__enqueue /@start[arg0]/ { @to_queue = hist(nsecs - @start[arg0]); }
+	@endcode
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see trace.c
+*/
+
+#ifdef YAIRCD_TRACE
+#include <sys/sdt.h>
+
+/* Documented in trace.c */
+unsigned long long trace_msg_begin(void);
+unsigned long long trace_msg_next(void);
+unsigned long long trace_msg_current(void);
+void trace_msg_end(void);
+
+/** Fires `msg__read`. See the file documentation for the arguments. */
+#define TRACE_MSG_READ(client, bytes) DTRACE_PROBE3(yaircd, msg__read, (client), (bytes), trace_msg_next())
+
+/** Gives a new ID to the message that the calling thread is going to process, and fires `msg__parse`. */
+#define TRACE_MSG_PARSE(client, line) DTRACE_PROBE3(yaircd, msg__parse, trace_msg_begin(), (client), (line))
+
+/** Fires `msg__dispatch`. */
+#define TRACE_MSG_DISPATCH(client, cmd_id) DTRACE_PROBE3(yaircd, msg__dispatch, trace_msg_current(), (client), (cmd_id))
+
+/** Fires `lock__wait`. */
+#define TRACE_LOCK_WAIT(ns) DTRACE_PROBE2(yaircd, lock__wait, trace_msg_current(), (ns))
+
+/** Fires `msg__enqueue`. */
+#define TRACE_MSG_ENQUEUE(queue, bytes) DTRACE_PROBE3(yaircd, msg__enqueue, trace_msg_current(), (queue), (bytes))
+
+/** Fires `client__wake`. */
+#define TRACE_CLIENT_WAKE(client, signalled) DTRACE_PROBE3(yaircd, client__wake, trace_msg_current(), (client), (signalled))
+
+/** Tells that the calling thread is done with its messages; probes fired from now on carry `0`. */
+#define TRACE_MSG_END() trace_msg_end()
+
+/** Fires `msg__flush`. */
+#define TRACE_MSG_FLUSH(client, queue, bytes) \
+	DTRACE_PROBE4(yaircd, msg__flush, trace_msg_current(), (client), (queue), (bytes))
+
+#else
+
+#define TRACE_MSG_READ(client, bytes) do { } while (0)
+#define TRACE_MSG_PARSE(client, line) do { } while (0)
+#define TRACE_MSG_DISPATCH(client, cmd_id) do { } while (0)
+#define TRACE_LOCK_WAIT(ns) do { } while (0)
+#define TRACE_MSG_ENQUEUE(queue, bytes) do { } while (0)
+#define TRACE_CLIENT_WAKE(client, signalled) do { } while (0)
+#define TRACE_MSG_FLUSH(client, queue, bytes) do { } while (0)
+#define TRACE_MSG_END() do { } while (0)
+
+#endif /* YAIRCD_TRACE */
+
+#endif /* __YAIRCD_TRACE_GUARD__ */
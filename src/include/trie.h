@@ -19,6 +19,8 @@
 	@see trie.c
 	@warning This implementation is reentrant, but it is not thread safe. The same trie instance cannot be fed into this implementation from different threads concurrently. 
 	Upper caller needs to make the necessary use of mutexes or other synchronization primitives.
+	The only exception is `find_word_trie()`, which may run concurrently with one thread modifying the trie, as long as released nodes are kept alive with `trie_set_release()` until
+	every concurrent lookup is done, and the caller discards any result obtained while the trie was being modified. `list.c` does this with a sequence counter.
 */
 
 /** Return code for invalid words */
@@ -37,12 +39,27 @@
 */
 #define TRIE_NO_FREE_DATA 0
 
-/** A node in a trie. */
+/** Node kind whose children are kept in `edges[0 .. children-1]`, sorted by their edge IDs, which are stored in `keys[0 .. children-1]`. Used for leaves and for nodes with up to 16 children. */
+#define TRIE_NODE_SORTED 0
+
+/** Node kind with up to 48 children stored in `edges[0 .. children-1]` in no particular order. `keys` has one entry per character of the alphabet: `keys[i]` is `0` if there is no child for edge ID `i`, otherwise the child is in `edges[keys[i]-1]`. */
+#define TRIE_NODE_INDEXED 1
+
+/** Node kind where `edges` is a direct array with one entry per character of the alphabet: `edges[i]` is the child for edge ID `i`, or `NULL`. */
+#define TRIE_NODE_FULL 2
+
+/** A node in a trie. A node is allocated in a single memory block that also holds its edges, keys and prefix. */
 struct trie_node {
 	char is_word; /**<Indicates if the path from root down to this node denotes a word */
+	unsigned char kind; /**<How children are stored: `TRIE_NODE_SORTED`, `TRIE_NODE_INDEXED` or `TRIE_NODE_FULL`. */
+	unsigned short capacity; /**<How many children fit in `edges[]` before the node must grow. */
 	int children; /**<Says how many children are present in `edges[]` */
-	struct trie_node **edges; /**<Edges pointing to this node's children. This is a dynamically allocated array. Each `edges[i]` represents the character returned by `(*trie->pos_to_char)(i)`. */
+	int prefix_len; /**<Length of `prefix`. */
+	struct trie_node **edges; /**<Edges pointing to this node's children. The layout depends on `kind`. */
+	unsigned char *keys; /**<Edge IDs for `TRIE_NODE_SORTED` nodes, or the index into `edges` for `TRIE_NODE_INDEXED` nodes. Not used by `TRIE_NODE_FULL` nodes. */
+	unsigned char *prefix; /**<Compressed path: edge IDs that follow the edge leading to this node. A node with a prefix stands for a chain of nodes with a single child and no word. The root never has a prefix. */
 	void *data; /**<Pointer to arbitrary data associated with this node. This is valid only if `is_word` is true, and it is used by the client code to associate data with words. */
+	struct trie_node *next_released; /**<Free for use by the function set with `trie_set_release()`, typically to chain released nodes that are waiting to be freed. Never read by the trie itself. */
 };
 
 /** A trie */
@@ -50,22 +67,24 @@ struct trie_t {
 	struct trie_node *root; /**<Root node */
 	void (*free_f)(void *, void *); /**<A pointer to a function that is responsible for free'ing a node's `data` when it is about to be destroyed. See `destroy_trie()` and `delete_word_trie()` for further info. */									     
 	int (*is_valid)(char s); /**<A pointer to a function that returns `1` if `s` is a valid character (considered part of a word), and `0` otherwise. */
-	char (*pos_to_char)(int p); /**<A pointer to a function that converts an index position from `edges` back to its character representation. */
-	int (*char_to_pos)(char s); /**<A pointer to a function that converts a character `s` into a valid, unique position that is used to index `edges`. */
-	int edges_no; /**<Number of edges. It is valid to reference any position in `edges[0 .. edges_no-1]`. */
+	char (*pos_to_char)(int p); /**<A pointer to a function that converts an edge ID back to its character representation. */
+	int (*char_to_pos)(char s); /**<A pointer to a function that converts a character `s` into a valid, unique edge ID. */
+	int edges_no; /**<Alphabet size. Edge IDs range from `0` to `edges_no-1`; it is never greater than 256. */
+	void (*release_f)(struct trie_node *, void *); /**<A pointer to a function that is called instead of `free()` when a node is no longer part of the trie, or `NULL` to free nodes right away. See `trie_set_release()`. */
+	void *release_arg; /**<Passed as second argument to `release_f`. */
 };
 
 /** A stack element describing a node in a path of a prefix search. */
 struct trie_node_stack_elm {
 	struct trie_node *el; /**<Pointer to the node that this element describes */
 	struct trie_node_stack_elm *next; /**<Pointer to the next stack element */
-	char letter; /**<Letter that was last used to reach this node, namely, the result of calling `(*trie->pos_to_char)(i)` for an edge `i` such that `edges[i] == `el`. */
-	int depth; /**<Depth of this element on the stack. Starts counting from 1. */
+	char letter; /**<Letter of the edge that was last used to reach this node, namely, the result of calling `(*trie->pos_to_char)(i)` for the edge ID `i` that leads to `el`. */
+	int depth; /**<Length of the path from the search's starting point down to this node, including `el`'s prefix. Starts counting from 1. */
 };
 
 /** A stack used to maintain state between different calls to `find_by_prefix_next_trie()`. */
 struct trie_node_stack {
-	char *path; /**<A characters sequence describing the path from the root node down to the current node. Each `trie_node_stack_elm` in the stack writes to `path[element->depth-1]`. */
+	char *path; /**<A characters sequence describing the path from the root node down to the current node. Each `trie_node_stack_elm` in the stack writes its letter and its node's prefix, ending at `path[element->depth-1]`. */
 	char *prefix; /**<The prefix originally passed to `find_by_prefix_next_trie()` in the first call that started this search. */
 	int depth; /**<Max. depth allowed. Only character sequences of at most `depth-1` will be reported and written to `path`. When a match is found, `path` is null terminated; it must hold enough space for at least `depth` characters. */
 	struct trie_node_stack_elm *top; /**<The top of the stack */
@@ -78,6 +97,7 @@ int add_word_trie(struct trie_t *trie, char *word, void *data);
 void *delete_word_trie(struct trie_t *trie, char *word);
 void *find_word_trie(struct trie_t *trie, char *word);
 void trie_for_each(struct trie_t *trie, void (*f)(void *, void *), void *args);
+void trie_set_release(struct trie_t *trie, void (*release_f)(struct trie_node *, void *), void *arg);
 struct trie_node_stack *find_by_prefix_next_trie(struct trie_t *trie, struct trie_node_stack *st, const char *prefix, int depth, char *result, int *err_code, void **data);
 void free_trie_stack(struct trie_node_stack *st);
 #endif /* TRIE_GUARD */
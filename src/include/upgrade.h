@@ -0,0 +1,39 @@
+#ifndef __YAIRCD_UPGRADE_GUARD__
+#define __YAIRCD_UPGRADE_GUARD__
+#include <netinet/in.h>
+
+/** @file
+	@brief Hot restart
+
+	When the IRCd receives `SIGUSR2`, it runs its executable again, which may have been upgraded in the meantime, and hands
+	over to the new process the listening sockets and every plaintext client, through a Unix socket, passing the sockets
+	with `SCM_RIGHTS`. Each client's nickname, username, hosts, realname, channels, and whatever was half read or not yet
+	written, goes along with the socket; so do the channels, with their topic, modes and users. The new process resumes
+	these sessions exactly where they were left, and the clients don't notice anything.
+	Secure clients are not handed over, since their SSL state can't be; neither are server links, nor connections that
+	didn't register yet. They are disconnected when the old process exits, and the clients that are resumed get a QUIT
+	for each of them.
+	If anything goes wrong before the new process confirms that it took over, it is killed, and the old process keeps
+	running as if nothing happened.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see upgrade.c
+*/
+
+/** Environment variable that tells a new process which file descriptor leads to the process it replaces. */
+#define UPGRADE_ENV "YAIRCD_RESUME"
+
+/** How many seconds each step of a hot restart can take before it is given up, including the new process' boot. */
+#define UPGRADE_TIMEOUT 30
+
+/** Largest record accepted from the old process, in bytes. */
+#define UPGRADE_MAX_RECORD (64 * 1024 * 1024)
+
+/* Documented in upgrade.c */
+int upgrade_start(const int fds[], int count);
+int upgrade_resume(void);
+int upgrade_listener(struct sockaddr_in *addr);
+void upgrade_done(void);
+
+#endif /* __YAIRCD_UPGRADE_GUARD__ */
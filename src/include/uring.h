@@ -0,0 +1,78 @@
+#ifndef __YAIRCD_URING_GUARD__
+#define __YAIRCD_URING_GUARD__
+
+/** @file
+	@brief io_uring socket I/O
+
+	When the server is built with `make URING=1`, which defines `YAIRCD_URING` and links with liburing (2.4 or newer), every
+	loop that owns sockets, the main loop and each worker's, gets an io_uring instance, and plaintext sockets are served through it:
+	<ul>
+	<li>Listening sockets use multishot accept: one request accepts every new connection until it is cancelled.</li>
+	<li>Clients and server links use multishot recv into a ring of provided buffers shared by the whole loop. The characters received
+	   are copied into the client's input buffer, and processed right away, exactly as if they had been read with `read_data()`.</li>
+	<li>Writes are sent with `sendmsg()` requests pointing directly at the buffers in the client's write queue, which are kept alive
+	   until the request completes. A client has at most one send request in flight.</li>
+	</ul>
+	Requests are not submitted as they are prepared: a prepare watcher submits every pending request at once, right before the loop
+	blocks, so each loop iteration takes a single system call regardless of how many clients it served. The ring signals completions
+	through an `eventfd()` watched by the loop, so libev keeps driving everything else: timers, async watchers, and secure clients,
+	which are still served with `SSL_read()` and `SSL_write()`.
+	If the kernel does not support io_uring, or an instance can't be set up, that loop falls back to plain libev watchers.
+	Without `YAIRCD_URING`, every macro in this file expands to nothing, and no code in this module is compiled.
+
+	Before a hot restart hands the sockets over, every ring is quiesced with `uring_quiesce()`: its requests are cancelled, and
+	their final completions are handled, so that the old process doesn't accept, receive or send anything behind the new one's
+	back. See `upgrade.h`.
+	@author Filipe Goncalves
+	@date November 2013
+	@see uring.c
+*/
+
+#ifdef YAIRCD_URING
+#include <sys/types.h>
+#include <ev.h>
+
+/** How many submission queue entries each ring has. Completion queues are twice as large. */
+#define URING_ENTRIES 4096
+
+/** How many provided buffers each ring has for multishot recv. Must be a power of 2. */
+#define URING_BUFFERS 1024
+
+/** Size of each provided buffer. */
+#define URING_BUFFER_SIZE 4096
+
+/** Buffer group ID of the provided buffers. Every ring has a single group. */
+#define URING_BUFFER_GROUP 0
+
+/** Maximum number of queue segments sent by a single `sendmsg()` request. */
+#define URING_SEND_SEGMENTS 64
+
+/** How many seconds `uring_quiesce()` waits for a completion before giving up. */
+#define URING_QUIESCE_TIMEOUT 5
+
+struct uring;
+struct uring_conn;
+struct irc_client;
+struct msg_queue;
+
+/* Documented in uring.c */
+struct uring *uring_create(struct ev_loop *loop);
+int uring_accept(struct uring *ring, int fd, void (*cb)(void *arg, int sock), void *arg);
+int uring_conn_open(struct uring *ring, struct irc_client *client);
+int uring_conn_read(struct irc_client *client, int on);
+int uring_flush(struct irc_client *client, struct msg_queue *queue);
+void uring_conn_close(struct irc_client *client);
+int uring_quiesce(struct uring *ring);
+void uring_unquiesce(struct uring *ring);
+
+/* Documented in client.c */
+void client_uring_input(struct irc_client *client, const char *buf, ssize_t len);
+void client_uring_output(struct irc_client *client);
+
+#else
+
+#define uring_conn_close(client) do { } while (0)
+
+#endif /* YAIRCD_URING */
+
+#endif /* __YAIRCD_URING_GUARD__ */
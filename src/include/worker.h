@@ -0,0 +1,80 @@
+#ifndef __YAIRCD_WORKER_GUARD__
+#define __YAIRCD_WORKER_GUARD__
+#include <pthread.h>
+#include <setjmp.h>
+#include <ev.h>
+#include "timer_wheel.h"
+
+/** @file
+	@brief Event loop worker threads
+
+	yaIRCd serves clients from a fixed pool of worker threads. Each worker runs its own libev loop and owns every client that was
+	handed to it, so that a client's watchers, queue flushes and timers are always processed by the same thread.
+	The main thread only accepts new connections and hands them over to a worker with `worker_dispatch()`. Alternatively, each worker
+	can accept its own clients on its own `SO_REUSEPORT` listening sockets (see the `workers` block in the configuration file).
+	Any thread can post work to a worker with `worker_post()`; posted tasks are executed later inside the worker's thread.
+	Threads that queue messages for a worker's clients wake it up with `worker_wake_client()`, which batches every client that has
+	new data into a single wakeup.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see worker.c
+*/
+
+/** Balancing policy that hands new clients to each worker in turn */
+#define WORKER_BALANCE_ROUND_ROBIN 0
+
+/** Balancing policy that hands new clients to the worker currently serving the fewest clients */
+#define WORKER_BALANCE_LEAST_LOAD 1
+
+struct irc_client;
+struct worker;
+struct uring;
+
+/** A task posted to a worker. Tasks are executed in the worker's thread in the same order they were posted. */
+struct worker_task {
+	void (*run)(struct worker *w, void *arg); /**<Function to execute. */
+	void *arg; /**<Argument passed to `run`. */
+	struct worker_task *next; /**<Next task in the queue. */
+};
+
+/** A worker thread. */
+struct worker {
+	int id; /**<This worker's index in the pool, starting at 0. */
+	pthread_t thread; /**<Thread running this worker's loop. */
+	struct ev_loop *loop; /**<libev loop shared by every client owned by this worker. */
+	struct ev_async task_watcher; /**<async watcher used to wake up the worker when new tasks are posted. */
+	pthread_mutex_t tasks_mutex; /**<Protects `tasks_head` and `tasks_tail`. */
+	struct worker_task *tasks_head; /**<First pending task, or `NULL` if there is none. */
+	struct worker_task *tasks_tail; /**<Last pending task, or `NULL` if there is none. */
+	int clients; /**<How many clients this worker is serving. Updated atomically; it is read by the accepting thread to balance the load. */
+	jmp_buf session_exit; /**<Exit point for the client callback currently running in this worker. See `terminate_session()` in `client.c`. */
+	struct irc_client *terminated; /**<The client whose session was terminated when a jump to `session_exit` is taken. */
+	struct ev_async wakeup_watcher; /**<async watcher used to wake up the worker when some of its clients have new data queued. See `worker_wake_client()`. */
+	pthread_mutex_t wakeup_mutex; /**<Protects `wakeup_head`, `wakeup_tail`, and the `wakeup_next` and `wakeup_pending` fields of this worker's clients. */
+	struct irc_client *wakeup_head; /**<First client waiting to have its queue flushed, or `NULL` if there is none. */
+	struct irc_client *wakeup_tail; /**<Last client waiting to have its queue flushed, or `NULL` if there is none. */
+	unsigned quit_stamp; /**<Stamp of the last QUIT fan-out done by this worker. Only touched by this worker's thread. See `do_quit()` in `channel.c`. */
+	struct timer_wheel timers; /**<Coarse timers for this worker's clients, such as the PING timer. See `timer_wheel.h`. */
+	struct irc_client *deferred_head; /**<First client whose messages wait for the next loop iteration, or `NULL` if there is none. Only touched by this worker's thread. See `worker_defer_client()`. */
+	struct irc_client *deferred_tail; /**<Last client whose messages wait for the next loop iteration, or `NULL` if there is none. */
+	struct irc_client *deferred_running; /**<Clients taken out of the deferred list that `deferred_cb()` did not serve yet in the current loop iteration. */
+	struct ev_check deferred_check; /**<check watcher that serves the deferred clients after every poll. Only active while there are any. */
+	struct ev_idle deferred_idle; /**<idle watcher that keeps the loop from blocking while there are deferred clients. */
+	struct uring *uring; /**<This worker's io_uring instance, or `NULL` if its sockets are served by libev watchers only. See `uring.h`. */
+};
+
+/* Documented in worker.c */
+int worker_pool_init(int threads, int balance);
+int worker_post(struct worker *w, void (*run)(struct worker *, void *), void *arg);
+int worker_dispatch(void (*run)(struct worker *, void *), void *arg);
+void worker_adopt_client(struct worker *w);
+void worker_release_client(struct worker *w);
+void worker_wake_client(struct irc_client *client);
+void worker_cancel_wakeup(struct irc_client *client);
+void worker_defer_client(struct irc_client *client);
+void worker_cancel_defer(struct irc_client *client);
+int worker_pool_size(void);
+struct worker *worker_get(int i);
+
+#endif /* __YAIRCD_WORKER_GUARD__ */
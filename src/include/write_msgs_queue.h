@@ -1,44 +1,102 @@
 #ifndef __IRC_CLIENT_QUEUE_GUARD__
 #define __IRC_CLIENT_QUEUE_GUARD__
 #include <pthread.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "protocol.h"
 /** @file
 	@brief Client's messages queue management functions
 
 	This file provides a module that knows how to operate on a client's messages queue. Every function is reentrant and thread-safe.
-	It is easy for a client's thread to wake up and read incoming data using an IO watcher. However, sporadically, we also need to wake up a client's thread to write to his socket.
-	For example, if user A PRIVMSGs user B, user A's thread must be able to somehow inform user B thread that something needs to be sent to user B.
+	It is easy for a client's worker to wake up and read incoming data using an IO watcher. However, sporadically, we also need to wake up a client's worker to write to his socket.
+	For example, if user A PRIVMSGs user B, user A's worker must be able to somehow inform user B's worker that something needs to be sent to user B.
 	To do so, we use an async watcher. An async watcher allows an arbitrary thread X to wake up another thread Y. Thread Y must be running an events loop and must have initialized and started an async watcher.
 	An async watcher works pretty much the same way as an IO watcher, but libev's documentation explicitly states that queueing is not supported. In other words, if more async messages arrive when we are processing
 	an async callback, these will be silently discarded. To avoid losing messages like this, we implement our own messages queueing system.
-	Each client holds a queue of messages waiting to be written to his socket. These messages can originate from any thread.
-	
+	Each client holds a queue of messages waiting to be written to his socket. These messages can originate from any thread, including the client's own worker, which queues every reply to this client's commands.
+	The queue is a list of buffers: small messages are appended to the last private block, messages shared by many clients (such as channel messages) are queued by reference,
+	and the whole queue is written to the socket with a single `writev()` when it is flushed.
+
 	Every operation in a client's queue shall be invoked through the use of the functions declared in this file, to ensure thread safety.
-	
+
 	@author Filipe Goncalves
 	@date November 2013
 */
 
-/** Defines the queue size. The queue size determines how many messages are allowed to be on hold waiting to be written to the client's socket.
-	Each client's queue is writable by any other client's thread that wishes to deliver a message to this client. Queue operations are thread safe and reentrant.
+/** How many segments (either private blocks or references to shared messages) a queue can hold when it is created. The segments array
+	grows as needed; the amount of data a queue can hold is bounded by its byte limits instead, see `client_queue_init()`.
 */
-#define WRITE_QUEUE_SIZE 512
+#define WRITE_QUEUE_INITIAL_SEGMENTS 16
+
+/** Maximum number of segments written to the socket with a single `writev()` call. Must not exceed the system's `IOV_MAX`. */
+#define WRITE_FLUSH_SEGMENTS 512
+
+/** Maximum number of new private blocks that a single message can take. Longer messages are rejected by `client_enqueue_buf()`. */
+#define WRITE_MSG_MAX_BLOCKS 16
+
+/** Size of each private block in a queue's output buffer. */
+#define WRITE_BLOCK_SIZE 4096
+
+/** Return code for `flush_queue()` indicating that every queued message was written. */
+#define FLUSH_DONE 0
+
+/** Return code for `flush_queue()` indicating that the socket could not take every queued message; the rest must be written when the socket becomes writable again. */
+#define FLUSH_PENDING 1
+
+/** Return code for `flush_queue()` indicating that a write error occurred in the socket. */
+#define FLUSH_ERROR -1
+
+/** A reference counted buffer holding queued characters. There are two kinds of buffers:
+	<ul>
+	<li>Private blocks, with `WRITE_BLOCK_SIZE` capacity, which belong to a single queue. Messages queued with `client_enqueue()` and `client_enqueue_buf()` are appended to the last private block in the queue.</li>
+	<li>Shared messages, created with `msg_buf_create()`, which are immutable and can be queued in any number of queues at the same time. Each queue holds a reference; the last one to release it frees it.
+	This is how a channel message is delivered to every channel member with a single allocation.</li>
+	</ul>
+*/
+struct msg_buf {
+	int refs; /**<How many references exist to this buffer. Updated atomically. */
+	unsigned appendable : 1; /**<Bit-field indicating if this is a private block, where new messages can still be appended. Shared messages are never appendable. */
+	size_t capacity; /**<How many characters fit in `data`. */
+	size_t length; /**<How many characters were stored in `data`. */
+	char data[]; /**<The characters. This buffer is not null terminated. */
+};
+
+/** An entry in a queue, referencing a buffer and the amount of it that was already written to the socket. */
+struct msg_segment {
+	struct msg_buf *buf; /**<The buffer. The queue holds a reference to it. */
+	size_t sent; /**<How many characters from `buf` were already written into the socket. Always less than or equal to `buf->length`. */
+};
 
 /** The structure that holds a queue */
 struct msg_queue {
-	char *messages[WRITE_QUEUE_SIZE]; /**<a queue with messages */
-	int top; /**<index denoting the position where a new element will be inserted in `messages`. Will always be less than `WRITE_QUEUE_SIZE` */
-	int bottom; /**<index denoting the position where the least recent element is located. This is the element that will be dequeued in the next dequeue operation. */
-	int elements; /**<indicates how many elements are stored in this queue at the moment. */
+	struct msg_segment *segments; /**<A dynamically allocated circular queue of segments waiting to be written. */
+	int capacity; /**<How many segments fit in `segments`. Always a power of 2. */
+	int top; /**<index denoting the position where a new segment will be inserted in `segments`. Will always be less than `capacity` */
+	int bottom; /**<index denoting the position where the least recent segment is located. This is where the next flush starts. */
+	int elements; /**<indicates how many segments are stored in this queue at the moment. */
+	size_t bytes; /**<How many characters are waiting to be written. Never greater than `max_bytes`. */
+	size_t max_bytes; /**<Hard limit. A message that would take `bytes` above this limit is dropped, and `overflowed` is set. */
+	size_t soft_bytes; /**<Soft limit. While `bytes` is above this limit, the owner of the queue should stop generating new output for it. */
+	unsigned overflowed : 1; /**<Bit-field set when a message was dropped because of the hard limit. The queue's owner must be disconnected. */
 	pthread_mutex_t mutex; /**<a mutex to coordinate concurrent access to a queue. */
 };
 
 struct irc_client;
 /* Documented in write_msgs_queue.c */
-int client_queue_init(struct msg_queue *queue);
+int client_queue_init(struct msg_queue *queue, size_t max_bytes, size_t soft_bytes);
+void client_queue_set_limits(struct msg_queue *queue, size_t max_bytes, size_t soft_bytes);
+int client_queue_copy(struct msg_queue *queue, char **buf, size_t *len);
 int client_queue_destroy(struct msg_queue *queue);
 int client_enqueue(struct msg_queue *queue, char *message);
-char *client_dequeue(struct msg_queue *queue);
+int client_enqueue_buf(struct msg_queue *queue, const char *buf, size_t len);
+int client_enqueue_shared(struct msg_queue *queue, struct msg_buf *msg);
+struct msg_buf *msg_buf_create(const char *buf, size_t len);
+void msg_buf_release(struct msg_buf *msg);
 int client_is_queue_empty(struct msg_queue *queue);
-void flush_queue(struct irc_client *client, struct msg_queue *queue);
+int client_queue_above_soft(struct msg_queue *queue);
+int client_queue_overflowed(struct msg_queue *queue);
+int client_queue_gather(struct msg_queue *queue, struct iovec *iov, struct msg_buf **bufs, int max);
+void client_queue_consume(struct msg_queue *queue, size_t written);
+int flush_queue(struct irc_client *client, struct msg_queue *queue);
 
 #endif /* __IRC_CLIENT_QUEUE_GUARD__ */
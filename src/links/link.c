@@ -0,0 +1,1093 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ev.h>
+#include "link.h"
+#include "client.h"
+#include "client_list.h"
+#include "channel.h"
+#include "cmd_hash.h"
+#include "msgio.h"
+#include "protocol.h"
+#include "reply.h"
+#include "send_rpl.h"
+#include "serverinfo.h"
+#include "worker.h"
+#include "wrappers.h"
+
+/** @file
+	@brief Server links implementation
+
+	The network is a tree. Every server this one knows about is kept in `servers`, with the link it is reached through; and
+	every link that is part of the network is kept in `links`. Both are protected by `links_mutex`, which is only held for
+	short periods, and never while calling `terminate_session()`.
+
+	A link's messages are read and interpreted by its worker, exactly like a client's. The same worker creates and frees the
+	clients reached through the link, so their structures never disappear under the link's feet; other threads only find
+	them in the clients list and in the channels, and queue messages in `link`.
+
+	The netburst is made of one `SERVER` line per known server, one `NICK` line per known client, and compact `NJOIN` lines
+	with every channel's users, built by `chan_burst()`.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see link.h
+*/
+
+/** A server of the network other than this one. */
+struct remote_server {
+	char *name; /**<The server's name. */
+	char *description; /**<The server's description. */
+	char *uplink; /**<Name of the server it is linked to. */
+	int hops; /**<How many servers away it is. `1` for servers linked directly to this one. */
+	struct irc_client *link; /**<The link it is reached through. */
+	unsigned doomed : 1; /**<Bit field set on the servers of a subtree being removed, see `detach_servers()`. */
+	struct remote_server *next; /**<Next server. Servers are appended when introduced, so a server's uplink always comes first. */
+};
+
+/** Connects to a server configured with `autoconnect`, and reconnects every `LINK_RETRY_INTERVAL` seconds while the link is
+	down. Each connector belongs to a worker, which owns the link it establishes. */
+struct link_connector {
+	int conf; /**<Position of the server's link block in the configuration file. */
+	struct worker *worker; /**<The worker that owns this connector. */
+	struct ev_timer timer; /**<Retry timer. */
+	struct ev_io watcher; /**<Watches a connection in progress, until it is writable. */
+	int fd; /**<Socket of the connection in progress, or `-1` if there is none. */
+	struct irc_client *link; /**<The link this connector established, while it is up; `NULL` otherwise. See `link_drop()`. */
+};
+
+/** Pairs a command with the function that processes it when it comes from a server link. */
+struct link_cmd {
+	int id; /**<The command's ID. */
+	/** Processes the command. `link` is the link it arrived from; the other parameters are the ones filled by `parse_msg()`. */
+	void (*f)(struct irc_client *link, char *prefix, char *params[], int params_size);
+};
+
+/** Arguments for `kill_found()`. */
+struct kill_args {
+	struct irc_client *link; /**<The link the KILL, or the colliding NICK, came from. */
+	char *reason; /**<Quit message for a local victim. Must be a string constant. */
+	struct reply *line; /**<The KILL line to forward if the victim is reached through another link. */
+	struct irc_client *victim; /**<Set if the victim is reached through `link` itself. */
+};
+
+/** Arguments for `privmsg_found()`. */
+struct privmsg_args {
+	struct irc_client *link; /**<The link the message came from. */
+	struct irc_client *from; /**<The message's author. */
+	char *msg; /**<The message. */
+};
+
+static struct irc_client *links[LINK_MAX_LINKS]; /**<Every link that is part of the network. */
+static int links_count; /**<How many positions of `links` are taken. */
+static struct remote_server *servers; /**<Every other server of the network. */
+static pthread_mutex_t links_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `links`, `links_count` and `servers`. */
+static struct link_connector *connectors; /**<One connector per link block with `autoconnect` set. */
+static int connectors_count; /**<How many connectors there are. */
+
+/** Dispatch table for the messages coming from server links, indexed by command ID. Filled by `link_init()`. */
+static void (*handlers[CMD_COUNT])(struct irc_client *, char *, char *[], int);
+
+/* These functions are documented below */
+static void link_cmd_pass(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_server(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_nick(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_quit(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_kill(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_join(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_njoin(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_part(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_privmsg(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_squit(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_ping(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void link_cmd_error(struct irc_client *link, char *prefix, char *params[], int params_size);
+static void connector_timer_cb(EV_P_ ev_timer *w, int revents);
+static void connector_io_cb(EV_P_ ev_io *w, int revents);
+
+/** Commands understood from server links. Anything else, including `PONG` and numerics, is ignored. */
+static const struct link_cmd link_cmds[] = {
+	{ CMD_PASS, link_cmd_pass },
+	{ CMD_SERVER, link_cmd_server },
+	{ CMD_NICK, link_cmd_nick },
+	{ CMD_QUIT, link_cmd_quit },
+	{ CMD_KILL, link_cmd_kill },
+	{ CMD_JOIN, link_cmd_join },
+	{ CMD_NJOIN, link_cmd_njoin },
+	{ CMD_PART, link_cmd_part },
+	{ CMD_PRIVMSG, link_cmd_privmsg },
+	{ CMD_SQUIT, link_cmd_squit },
+	{ CMD_PING, link_cmd_ping },
+	{ CMD_ERROR, link_cmd_error }
+};
+
+/** Fills the dispatch table for server links, and creates a connector for each link block with `autoconnect` set.
+	@return `0` on success; `-1` if there isn't enough memory.
+	@warning This function must be called exactly once, by the parent thread, after the configuration file was loaded and
+	   before the workers start.
+ */
+int link_init(void)
+{
+	size_t i;
+	int j;
+
+	for (i = 0; i < sizeof(link_cmds) / sizeof(*link_cmds); i++) {
+		handlers[link_cmds[i].id] = link_cmds[i].f;
+	}
+	for (j = 0, connectors_count = 0; j < get_links_count(); j++) {
+		connectors_count += (get_link_autoconnect(j) != 0);
+	}
+	if (connectors_count == 0) {
+		return 0;
+	}
+	if ((connectors = calloc((size_t) connectors_count, sizeof(*connectors))) == NULL) {
+		return -1;
+	}
+	for (j = 0, connectors_count = 0; j < get_links_count(); j++) {
+		if (get_link_autoconnect(j)) {
+			connectors[connectors_count].conf = j;
+			connectors[connectors_count].fd = -1;
+			connectors[connectors_count].link = NULL;
+			connectors_count++;
+		}
+	}
+	return 0;
+}
+
+/** Worker task that starts a connector's retry timer. Watchers must be started by the thread running the loop. The first
+	connection attempt is made right away.
+	@param w The worker that owns the connector.
+	@param arg The connector.
+ */
+static void connector_start(struct worker *w, void *arg)
+{
+	struct link_connector *c = (struct link_connector*)arg;
+	ev_timer_init(&c->timer, connector_timer_cb, 0., LINK_RETRY_INTERVAL);
+	ev_io_init(&c->watcher, connector_io_cb, -1, EV_WRITE);
+	ev_timer_start(w->loop, &c->timer);
+}
+
+/** Starts connecting to the servers configured with `autoconnect`. Connectors are spread among the workers.
+	@warning This function must be called exactly once, by the parent thread, after the workers started.
+ */
+void links_start(void)
+{
+	int i;
+	for (i = 0; i < connectors_count; i++) {
+		connectors[i].worker = worker_get(i % worker_pool_size());
+		if (worker_post(connectors[i].worker, connector_start, &connectors[i]) == -1) {
+			fprintf(stderr, "::link.c:links_start(): Won't connect to %s.\n", get_link_name(connectors[i].conf));
+		}
+	}
+}
+
+/** Queues this server's `PASS` and `SERVER` lines in a link. The server that connected sends them first, and the other one answers with its own.
+	@param link The link.
+	@param conf Position of the other server's link block in the configuration file.
+ */
+static void send_credentials(struct irc_client *link, int conf)
+{
+	struct reply r;
+	r.length = 0;
+	reply_append(&r, "PASS");
+	reply_param(&r, get_link_password(conf));
+	(void)reply_queue(&r, link);
+	r.length = 0;
+	reply_append(&r, "SERVER");
+	reply_param(&r, get_server_name());
+	reply_param(&r, "1");
+	reply_trailing(&r, get_server_desc());
+	(void)reply_queue(&r, link);
+}
+
+/** Gives up on a connector's connection in progress, if there is one.
+	@param c The connector.
+ */
+static void connector_abort(struct link_connector *c)
+{
+	if (c->fd != -1) {
+		ev_io_stop(c->worker->loop, &c->watcher);
+		close(c->fd);
+		c->fd = -1;
+	}
+}
+
+/** Callback for a connector's retry timer. A connection attempt that is still in progress has timed out; a new one is
+	started, unless the other server is already linked, either through this connector, or because it connected to us.
+	@param w The connector's timer. A pointer to the connector is obtained with `offsetof()`.
+ */
+static void connector_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct link_connector *c = (struct link_connector*)((char*)w - offsetof(struct link_connector, timer));
+	struct sockaddr_in addr;
+	struct remote_server *s;
+	int known;
+
+	connector_abort(c);
+	if (c->link != NULL) {
+		return;
+	}
+	pthread_mutex_lock(&links_mutex);
+	for (s = servers; s != NULL && strcasecmp(s->name, !=, get_link_name(c->conf)); s = s->next)
+		; /* Intentionally left blank */
+	known = (s != NULL);
+	pthread_mutex_unlock(&links_mutex);
+	if (known) {
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(get_link_port(c->conf));
+	if (inet_pton(AF_INET, get_link_host(c->conf), &addr.sin_addr) != 1) {
+		fprintf(stderr, "::link.c:connector_timer_cb(): Invalid address for %s.\n", get_link_name(c->conf));
+		return;
+	}
+	if ((c->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		perror("::link.c:connector_timer_cb(): Could not create socket");
+		return;
+	}
+	if (fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK) == -1 ||
+	    (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS)) {
+		close(c->fd);
+		c->fd = -1;
+		return;
+	}
+	ev_io_set(&c->watcher, c->fd, EV_WRITE);
+	ev_io_start(EV_A_ &c->watcher);
+}
+
+/** Callback for a connection in progress, called when the socket becomes writable. If the connection succeeded, the link
+	is created, and this server's `PASS` and `SERVER` lines are queued; the link is part of the network once the other
+	server answers with its own, see `link_register()`.
+	@param w The connector's io watcher. A pointer to the connector is obtained with `offsetof()`.
+ */
+static void connector_io_cb(EV_P_ ev_io *w, int revents)
+{
+	struct link_connector *c = (struct link_connector*)((char*)w - offsetof(struct link_connector, watcher));
+	struct server_link *sl;
+	struct irc_client *link;
+	socklen_t len;
+	int err;
+	int fd;
+
+	ev_io_stop(EV_A_ w);
+	fd = c->fd;
+	c->fd = -1;
+	len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+		close(fd);
+		return;
+	}
+	if ((sl = calloc(1, sizeof(*sl))) == NULL) {
+		close(fd);
+		return;
+	}
+	sl->conf = c->conf;
+	sl->outgoing = 1;
+	sl->connector = c;
+	if ((link = new_link_client(c->worker, fd, get_link_host(c->conf))) == NULL) {
+		free(sl);
+		return;
+	}
+	link->server_link = sl;
+	c->link = link;
+	send_credentials(link, c->conf);
+	worker_wake_client(link);
+}
+
+/** Queues a message in every link but one, and wakes up their workers.
+	@param except The link that must not get the message, or `NULL`.
+	@param msg The message, terminated with \\r\\n.
+	@param len The message's length.
+ */
+static void send_links(struct irc_client *except, const char *msg, size_t len)
+{
+	int i;
+	pthread_mutex_lock(&links_mutex);
+	for (i = 0; i < links_count; i++) {
+		if (links[i] != except) {
+			(void)client_enqueue_buf(&links[i]->write_queue, msg, len);
+			worker_wake_client(links[i]);
+		}
+	}
+	pthread_mutex_unlock(&links_mutex);
+}
+
+/** Terminates a reply and queues it in every link but one, with `send_links()`.
+	@param except The link that must not get the message, or `NULL`.
+	@param reply The reply. Its contents are undefined after this call.
+ */
+static void send_links_reply(struct irc_client *except, struct reply *reply)
+{
+	(void)reply_end(reply);
+	send_links(except, reply->buf, reply->length);
+}
+
+/** Starts a message that another server sent, ":<source> <cmd>".
+	@param reply The reply. Anything it held is discarded.
+	@param source The message's source, usually the prefix it arrived with.
+	@param cmd The command.
+ */
+static void reply_from(struct reply *reply, const char *source, const char *cmd)
+{
+	reply->buf[0] = ':';
+	reply->length = 1;
+	reply_append(reply, source);
+	reply_param(reply, cmd);
+}
+
+/** Builds the `NICK` line that introduces a client to other servers, ":<server name> NICK <nick> <hopcount> <username>
+	<host> <server> + :<realname>".
+	@param reply The reply. Anything it held is discarded.
+	@param client The client.
+ */
+static void nick_line(struct reply *reply, struct irc_client *client)
+{
+	char hops[16];
+	snprintf(hops, sizeof(hops), "%d", client->hopcount + 1);
+	reply_begin(reply, "NICK");
+	reply_param(reply, client->nick);
+	reply_param(reply, hops);
+	reply_param(reply, client->username);
+	reply_param(reply, client->public_host);
+	reply_param(reply, client->server != NULL ? client->server : get_server_name());
+	reply_param(reply, "+");
+	reply_trailing(reply, client->realname);
+}
+
+/** Tells every link about a message sent by a client: a JOIN, a PART or a QUIT. The link the client is reached through, if
+	any, doesn't get it back.
+	@param from The client.
+	@param cmd The command.
+	@param target The command's target, or `NULL`.
+	@param trailing The trailing parameter, or `NULL`.
+ */
+void link_broadcast_from(struct irc_client *from, const char *cmd, const char *target, const char *trailing)
+{
+	char msg[MAX_MSG_SIZE + 1];
+	int size;
+	size = print_prefixed_msg(msg, sizeof(msg), from, cmd, target, trailing);
+	send_links(from->link, msg, (size_t) size);
+}
+
+/** Introduces a client that just registered, or that another server introduced, to every other link.
+	@param client The client.
+ */
+void link_introduce(struct irc_client *client)
+{
+	struct reply r;
+	nick_line(&r, client);
+	send_links_reply(client->link, &r);
+}
+
+/** Finds a known server by name. Must be called with `links_mutex` held.
+	@param name The server's name.
+	@return The server, or `NULL` if there is none.
+ */
+static struct remote_server *find_server(const char *name)
+{
+	struct remote_server *s;
+	for (s = servers; s != NULL && strcasecmp(s->name, !=, name); s = s->next)
+		; /* Intentionally left blank */
+	return s;
+}
+
+/** Frees a list of servers, linked with `next`.
+	@param s The list's head.
+ */
+static void free_servers(struct remote_server *s)
+{
+	struct remote_server *next;
+	for (; s != NULL; s = next) {
+		next = s->next;
+		free(s->name);
+		free(s->description);
+		free(s->uplink);
+		free(s);
+	}
+}
+
+/** Creates a server's entry. It must be added to `servers` with `add_server()`.
+	@param name The server's name.
+	@param description The server's description.
+	@param uplink Name of the server it is linked to.
+	@param hops How many servers away it is.
+	@param link The link it is reached through.
+	@return The new server; `NULL` if there isn't enough memory.
+ */
+static struct remote_server *new_server(const char *name, const char *description, const char *uplink, int hops,
+					struct irc_client *link)
+{
+	struct remote_server *s;
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+		return NULL;
+	}
+	if ((s->name = strdup(name)) == NULL || (s->description = strdup(description)) == NULL ||
+	    (s->uplink = strdup(uplink)) == NULL) {
+		free_servers(s);
+		return NULL;
+	}
+	s->hops = hops;
+	s->link = link;
+	return s;
+}
+
+/** Atomically adds a server to `servers`, if no server by that name is known, and it is not this server.
+	@param s The server.
+	@return `0` on success; `-1` if the server is known, in which case the caller still owns `s`.
+ */
+static int add_server(struct remote_server *s)
+{
+	struct remote_server **tail;
+	int ret = -1;
+	pthread_mutex_lock(&links_mutex);
+	if (strcasecmp(s->name, !=, get_server_name()) && find_server(s->name) == NULL) {
+		for (tail = &servers; *tail != NULL; tail = &(*tail)->next)
+			; /* Intentionally left blank */
+		*tail = s;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&links_mutex);
+	return ret;
+}
+
+/** Removes a server from `servers`, along with every server behind it. Only servers reached through `link` are removed:
+	another link can't split them. Since a server's uplink always comes before it, a single pass finds the whole subtree.
+	@param link The link.
+	@param name The name of the subtree's root, or `NULL` to remove every server reached through `link`.
+	@return The removed servers, in their original order; `NULL` if there are none.
+ */
+static struct remote_server *detach_servers(struct irc_client *link, const char *name)
+{
+	struct remote_server **prev, *s, *gone, **gone_tail;
+	struct remote_server *u;
+
+	gone = NULL;
+	gone_tail = &gone;
+	pthread_mutex_lock(&links_mutex);
+	for (prev = &servers; (s = *prev) != NULL;) {
+		if (s->link == link && (name == NULL || strcasecmp(s->name, ==, name))) {
+			s->doomed = 1;
+		} else if (s->link == link) {
+			for (u = gone; u != NULL && strcasecmp(u->name, !=, s->uplink); u = u->next)
+				; /* Intentionally left blank */
+			s->doomed = (u != NULL);
+		}
+		if (s->doomed) {
+			*prev = s->next;
+			s->next = NULL;
+			*gone_tail = s;
+			gone_tail = &s->next;
+		} else {
+			prev = &s->next;
+		}
+	}
+	pthread_mutex_unlock(&links_mutex);
+	return gone;
+}
+
+/** Callback for `client_list_find_and_execute()` that only matches clients reached through a link.
+	@param data The client found.
+	@param args The link.
+	@return The client, if it is reached through the link; `NULL` otherwise.
+ */
+static void *behind_link(void *data, void *args)
+{
+	return ((struct irc_client*)data)->link == (struct irc_client*)args ? data : NULL;
+}
+
+/** Finds a client reached through a link. The client can be used after the list lock is released, since only the link's
+	worker, which is calling this function, frees him.
+	@param link The link.
+	@param nick The client's nickname.
+	@return The client; `NULL` if there isn't a client by that name reached through `link`.
+ */
+static struct irc_client *find_remote(struct irc_client *link, char *nick)
+{
+	int found;
+	return (struct irc_client*)client_list_find_and_execute(nick, behind_link, (void*)link, &found);
+}
+
+/** Finds the client that sent a message, from the message's prefix. The prefix holds the client's nickname, optionally
+	followed by his username and host.
+	@param link The link the message came from.
+	@param prefix The prefix, or `NULL`.
+	@return The client; `NULL` if there's no prefix, or it doesn't name a client reached through `link`.
+ */
+static struct irc_client *find_source(struct irc_client *link, char *prefix)
+{
+	char nick[MAX_NICK_LENGTH + 1];
+	size_t len;
+	if (prefix == NULL) {
+		return NULL;
+	}
+	len = strcspn(prefix, "!@");
+	if (len == 0 || len > MAX_NICK_LENGTH) {
+		return NULL;
+	}
+	memcpy(nick, prefix, len);
+	nick[len] = '\0';
+	return find_remote(link, nick);
+}
+
+/** Removes a client reached through a link from every channel and from the clients list, and frees him. Channel users on
+	this server are told that he quit; other servers are not.
+	@param link The link.
+	@param client The client.
+	@param quit_msg The quit message.
+ */
+static void remove_remote(struct irc_client *link, struct irc_client *client, char *quit_msg)
+{
+	struct server_link *sl = link->server_link;
+	do_quit(client, quit_msg);
+	client_list_delete(client);
+	if (client->link_prev != NULL) {
+		client->link_prev->link_next = client->link_next;
+	} else {
+		sl->clients = client->link_next;
+	}
+	if (client->link_next != NULL) {
+		client->link_next->link_prev = client->link_prev;
+	}
+	destroy_remote_client(client);
+}
+
+/** Removes the clients of a list of servers, after a netsplit. Their quit message is "<uplink> <server>", the names of the
+	servers that split.
+	@param link The link the servers were reached through.
+	@param gone The servers.
+	@param uplink The name of the server that lost the link.
+	@param server The name of the server that split.
+ */
+static void remove_servers_clients(struct irc_client *link, struct remote_server *gone, const char *uplink,
+				   const char *server)
+{
+	char quit_msg[2 * MAX_SERVNAME_LENGTH + 2];
+	struct irc_client *c, *next;
+	struct remote_server *s;
+
+	snprintf(quit_msg, sizeof(quit_msg), "%s %s", uplink, server);
+	for (c = link->server_link->clients; c != NULL; c = next) {
+		next = c->link_next;
+		for (s = gone; s != NULL && strcasecmp(s->name, !=, c->server); s = s->next)
+			; /* Intentionally left blank */
+		if (s != NULL) {
+			remove_remote(link, c, quit_msg);
+		}
+	}
+}
+
+/** Arguments for `burst_client()`. */
+struct burst_clients {
+	struct irc_client *link; /**<The link being netbursted. */
+	int failed; /**<Set if a line could not be queued in `link`. */
+};
+
+/** Queues a known client's `NICK` line in a link that is being netbursted. This is the callback passed to
+	`client_list_for_each()` by `send_netburst()`, so it runs with the clients list locked. Clients that didn't register yet,
+	and clients reached through the link itself, are left out.
+	@param data The client.
+	@param args The `struct burst_clients` of the netburst. Once a line can't be queued, the rest are not even tried.
+ */
+static void burst_client(void *data, void *args)
+{
+	struct irc_client *client = (struct irc_client*)data;
+	struct burst_clients *burst = (struct burst_clients*)args;
+	struct reply r;
+	if (!burst->failed && client->is_registered && client->link != burst->link) {
+		nick_line(&r, client);
+		if (reply_queue(&r, burst->link) == -1) {
+			burst->failed = 1;
+		}
+	}
+}
+
+/** Queues the netburst in a link that was just established: every other known server, every known client, and every
+	channel with its users.
+	Nothing that happens meanwhile is lost. A client that registers during the netburst is either in the clients list
+	already, or introduced by `link_introduce()` after the link was added to `links`; the same holds for JOIN, PART and QUIT,
+	see `chan_burst()` and `terminate_session()`.
+	@param link The link.
+	@return `0` on success; `-1` if part of the netburst could not be queued, either because it doesn't fit in the link's
+	   hard limit or because there wasn't enough memory. The other server would then have an incomplete view of the network,
+	   so the caller must drop the link.
+ */
+static int send_netburst(struct irc_client *link)
+{
+	struct remote_server *s;
+	struct reply r;
+	struct burst_clients burst;
+	char hops[16];
+
+	burst.link = link;
+	burst.failed = 0;
+	pthread_mutex_lock(&links_mutex);
+	for (s = servers; s != NULL && !burst.failed; s = s->next) {
+		if (s->link != link) {
+			snprintf(hops, sizeof(hops), "%d", s->hops + 1);
+			reply_from(&r, s->uplink, "SERVER");
+			reply_param(&r, s->name);
+			reply_param(&r, hops);
+			reply_trailing(&r, s->description);
+			if (reply_queue(&r, link) == -1) {
+				burst.failed = 1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&links_mutex);
+	if (!burst.failed) {
+		client_list_for_each(burst_client, (void*)&burst);
+	}
+	if (burst.failed || chan_burst(link) == -1) {
+		fprintf(stderr, "::link.c:send_netburst(): Could not queue the whole netburst for %s.\n", link->server_link->name);
+		return -1;
+	}
+	return 0;
+}
+
+/** Stores the password that a connection sent with `PASS`. The password is only checked when the connection identifies
+	itself with `SERVER`, see `link_register()`.
+	@param client The connection.
+	@param password The password.
+	@warning This function may call `terminate_session()`.
+ */
+void link_pass(struct irc_client *client, char *password)
+{
+	char *copy;
+	if (client->server_link == NULL) {
+		if ((client->server_link = calloc(1, sizeof(*client->server_link))) == NULL) {
+			terminate_session(client, NO_MEM_QUIT_MSG);
+		}
+		client->server_link->conf = -1;
+	}
+	if ((copy = strdup(password)) == NULL) {
+		terminate_session(client, NO_MEM_QUIT_MSG);
+	}
+	free(client->server_link->password);
+	client->server_link->password = copy;
+}
+
+/** Makes a connection that identified itself with `SERVER` part of the network.
+	The other server must have a link block in the configuration file, and must have sent its password with `PASS`. On an
+	outgoing link, it must also be the server we connected to. If the other server is already known, the network would have
+	a loop, and the link is refused. Otherwise, this server's credentials are sent back, if the other server connected to
+	us, the rest of the network is told about the new server, and the netburst is sent.
+	@param client The connection.
+	@param name The other server's name.
+	@param description The other server's description.
+	@warning This function may call `terminate_session()`.
+ */
+void link_register(struct irc_client *client, char *name, char *description)
+{
+	struct server_link *sl = client->server_link;
+	struct remote_server *server;
+	struct reply r;
+	int conf;
+	int added;
+
+	if (sl == NULL || sl->password == NULL || client->nick != NULL || (conf = find_link(name)) == -1 ||
+	    !check_link_password(conf, sl->password) || (sl->outgoing && conf != sl->conf)) {
+		fprintf(stderr, "::link.c:link_register(): %s failed to authenticate as %s.\n", client->hostname, name);
+		terminate_session(client, LINK_AUTH_QUIT_MSG);
+	}
+	if ((sl->name = strdup(name)) == NULL || (sl->description = strdup(description)) == NULL ||
+	    (server = new_server(name, description, get_server_name(), 1, client)) == NULL) {
+		terminate_session(client, NO_MEM_QUIT_MSG);
+	}
+	sl->conf = conf;
+	if (!sl->outgoing) {
+		send_credentials(client, conf);
+	}
+	pthread_mutex_lock(&links_mutex);
+	added = (links_count < LINK_MAX_LINKS && strcasecmp(name, !=, get_server_name()) && find_server(name) == NULL);
+	if (added) {
+		links[links_count++] = client;
+		server->next = servers;
+		servers = server;
+	}
+	pthread_mutex_unlock(&links_mutex);
+	if (!added) {
+		free_servers(server);
+		fprintf(stderr, "::link.c:link_register(): Refused link with %s, which is already known.\n", name);
+		terminate_session(client, LINK_EXISTS_QUIT_MSG);
+	}
+	client->is_server = 1;
+	sl->linked = 1;
+	client_queue_set_limits(&client->write_queue, (size_t) get_link_sendq(conf), (size_t) get_link_sendq(conf) / 4);
+	reply_begin(&r, "SERVER");
+	reply_param(&r, name);
+	reply_param(&r, "2");
+	reply_trailing(&r, description);
+	send_links_reply(client, &r);
+	if (send_netburst(client) == -1) {
+		terminate_session(client, SENDQ_QUIT_MSG);
+	}
+}
+
+/** Interprets a message that arrived from a server link. Until both servers authenticated, only `PASS`, `SERVER`, `PING`
+	and `ERROR` are processed. Unknown commands and numerics are ignored: answering them would have two servers bouncing
+	errors at each other forever.
+	@param link The link.
+	@param prefix The message's prefix, or `NULL`.
+	@param cmd_id The command's ID, as returned by `parse_msg()`.
+	@param params The command's parameters, as filled by `parse_msg()`.
+	@param params_size How many parameters there are.
+	@warning This function may call `terminate_session()`.
+ */
+void link_interpret(struct irc_client *link, char *prefix, int cmd_id, char *params[], int params_size)
+{
+	if (cmd_id == CMD_UNKNOWN || handlers[cmd_id] == NULL) {
+		return;
+	}
+	if (!link->server_link->linked && cmd_id != CMD_PASS && cmd_id != CMD_SERVER && cmd_id != CMD_PING &&
+	    cmd_id != CMD_ERROR) {
+		return;
+	}
+	handlers[cmd_id](link, prefix, params, params_size);
+}
+
+/** Processes `PASS` from a link that didn't authenticate yet. */
+static void link_cmd_pass(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	if (params_size >= 1 && !link->server_link->linked) {
+		link_pass(link, params[0]);
+	}
+}
+
+/** Processes `SERVER`. Before the link is authenticated, this is the other server identifying itself, see
+	`link_register()`. Afterwards, it introduces a server behind the link, ":<uplink> SERVER <name> <hopcount> :<description>",
+	which is told to every other link. A server that is already known means that the network has a loop, and the link is
+	closed.
+ */
+static void link_cmd_server(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct server_link *sl = link->server_link;
+	struct remote_server *s;
+	struct reply r;
+	char hops[16];
+
+	if (params_size < 3) {
+		return;
+	}
+	if (!sl->linked) {
+		link_register(link, params[0], params[2]);
+		return;
+	}
+	if ((s = new_server(params[0], params[2], prefix != NULL ? prefix : sl->name, atoi(params[1]), link)) == NULL) {
+		terminate_session(link, NO_MEM_QUIT_MSG);
+	}
+	if (add_server(s) == -1) {
+		free_servers(s);
+		fprintf(stderr, "::link.c:link_cmd_server(): %s introduced %s, which is already known.\n", sl->name, params[0]);
+		terminate_session(link, LINK_EXISTS_QUIT_MSG);
+	}
+	snprintf(hops, sizeof(hops), "%d", s->hops + 1);
+	reply_from(&r, s->uplink, "SERVER");
+	reply_param(&r, s->name);
+	reply_param(&r, hops);
+	reply_trailing(&r, s->description);
+	send_links_reply(link, &r);
+}
+
+/** Callback for `client_list_find_and_execute()` that disconnects a client killed by another server. A local client is
+	disconnected by his own worker; a client on another server is killed by forwarding the KILL to his link. If the client is
+	reached through the link the KILL came from, he's left to the caller, in `victim`.
+	@param data The client.
+	@param args A `struct kill_args *`.
+	@return `data`.
+ */
+static void *kill_found(void *data, void *args)
+{
+	struct irc_client *client = (struct irc_client*)data;
+	struct kill_args *k = (struct kill_args*)args;
+	if (client->link == NULL) {
+		client->kill_reason = k->reason;
+		worker_wake_client(client);
+	} else if (client->link != k->link) {
+		(void)queue_to(client->link, k->line->buf, k->line->length);
+		worker_wake_client(client->link);
+	} else {
+		k->victim = client;
+	}
+	return data;
+}
+
+/** Processes `NICK`, which introduces a client behind the link, "NICK <nick> <hopcount> <username> <host> <server> <umode>
+	:<realname>". The client is added to the clients list, and introduced to every other link.
+	If another client has the same nickname, both are killed: the new one, by sending a KILL back, and the one we knew, like
+	`kill_found()` does.
+ */
+static void link_cmd_nick(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct server_link *sl = link->server_link;
+	struct irc_client *client;
+	struct kill_args k;
+	struct reply r;
+	int found;
+
+	if (params_size < 7) {
+		return;
+	}
+	reply_begin(&r, "KILL");
+	reply_param(&r, params[0]);
+	reply_trailing(&r, get_server_name());
+	reply_append(&r, " (");
+	reply_append(&r, COLLISION_QUIT_MSG);
+	reply_append(&r, ")");
+	(void)reply_end(&r);
+	k.link = link;
+	k.reason = COLLISION_QUIT_MSG;
+	k.line = &r;
+	k.victim = NULL;
+	(void)client_list_find_and_execute(params[0], kill_found, (void*)&k, &found);
+	if (found) {
+		if (k.victim == NULL) {
+			(void)queue_to(link, r.buf, r.length);
+		}
+		/* Otherwise, it is a client we already know about */
+		return;
+	}
+	if ((client = new_remote_client(link, params[0], params[2], params[3], params[4], params[6], atoi(params[1]))) == NULL) {
+		terminate_session(link, NO_MEM_QUIT_MSG);
+	}
+	if ((found = client_list_add(client, client->nick)) != 0) {
+		destroy_remote_client(client);
+		if (found == LST_NO_MEM) {
+			terminate_session(link, NO_MEM_QUIT_MSG);
+		}
+		/* Either an invalid nickname, or a local client registered it in the meantime */
+		(void)queue_to(link, r.buf, r.length);
+		return;
+	}
+	client->link_next = sl->clients;
+	if (sl->clients != NULL) {
+		sl->clients->link_prev = client;
+	}
+	sl->clients = client;
+	link_introduce(client);
+}
+
+/** Processes `QUIT` from a client behind the link, ":<nick> QUIT [:<message>]". The other links are told, and the client
+	is removed.
+ */
+static void link_cmd_quit(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct irc_client *client;
+	char *quit_msg;
+	if ((client = find_source(link, prefix)) == NULL) {
+		return;
+	}
+	quit_msg = (params_size >= 1 ? params[0] : client->nick);
+	link_broadcast_from(client, "QUIT", NULL, quit_msg);
+	remove_remote(link, client, quit_msg);
+}
+
+/** Processes `KILL`, "KILL <nick> :<path>". A local client is disconnected with `KILLED_QUIT_MSG`, and his QUIT tells the
+	rest of the network; a client on another server is killed by forwarding the KILL to his link.
+ */
+static void link_cmd_kill(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct kill_args k;
+	struct reply r;
+	int found;
+
+	if (params_size < 1) {
+		return;
+	}
+	reply_from(&r, prefix != NULL ? prefix : link->server_link->name, "KILL");
+	reply_param(&r, params[0]);
+	reply_trailing(&r, params_size >= 2 ? params[1] : KILLED_QUIT_MSG);
+	(void)reply_end(&r);
+	k.link = link;
+	k.reason = KILLED_QUIT_MSG;
+	k.line = &r;
+	k.victim = NULL;
+	(void)client_list_find_and_execute(params[0], kill_found, (void*)&k, &found);
+	if (k.victim != NULL) {
+		/* A KILL coming from the victim's own side; nobody else is going to tell the rest of the network */
+		link_broadcast_from(k.victim, "QUIT", NULL, KILLED_QUIT_MSG);
+		remove_remote(link, k.victim, KILLED_QUIT_MSG);
+	}
+}
+
+/** Processes `JOIN` from a client behind the link, ":<nick> JOIN <channel>". The channel's local users are told by
+	`do_join()`, and the other links by `link_broadcast_from()`.
+ */
+static void link_cmd_join(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct irc_client *client;
+	if (params_size < 1 || (client = find_source(link, prefix)) == NULL) {
+		return;
+	}
+	if (do_join(client, params[0]) == 0) {
+		link_broadcast_from(client, "JOIN", params[0], NULL);
+	}
+}
+
+/** Processes `NJOIN`, part of a netburst, ":<server> NJOIN <channel> :<nick>[,<nick>...]". Every client listed joins the
+	channel, and the line is forwarded to the other links.
+ */
+static void link_cmd_njoin(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct irc_client *client;
+	struct reply r;
+	char *nick, *saveptr;
+
+	if (params_size < 2) {
+		return;
+	}
+	reply_from(&r, prefix != NULL ? prefix : link->server_link->name, "NJOIN");
+	reply_param(&r, params[0]);
+	reply_trailing(&r, params[1]);
+	send_links_reply(link, &r);
+	for (nick = strtok_r(params[1], ",", &saveptr); nick != NULL; nick = strtok_r(NULL, ",", &saveptr)) {
+		if ((client = find_remote(link, nick)) != NULL) {
+			(void)do_join(client, params[0]);
+		}
+	}
+}
+
+/** Processes `PART` from a client behind the link, ":<nick> PART <channel> [:<message>]". */
+static void link_cmd_part(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct irc_client *client;
+	char *part_msg;
+	if (params_size < 1 || (client = find_source(link, prefix)) == NULL) {
+		return;
+	}
+	part_msg = (params_size >= 2 ? params[1] : client->nick);
+	if (do_part(client, params[0], part_msg) == 0) {
+		link_broadcast_from(client, "PART", params[0], part_msg);
+	}
+}
+
+/** Callback for `client_list_find_and_execute()` that delivers a private message coming from a link. Clients reached
+	through that same link are left alone, so that a message can't bounce back.
+	@param data The recipient.
+	@param args A `struct privmsg_args *`.
+	@return `data`.
+ */
+static void *privmsg_found(void *data, void *args)
+{
+	struct irc_client *to = (struct irc_client*)data;
+	struct privmsg_args *p = (struct privmsg_args*)args;
+	if (to->link != p->link) {
+		notify_privmsg(p->from, to, to->nick, p->msg);
+	}
+	return data;
+}
+
+/** Processes `PRIVMSG` from a client behind the link, ":<nick> PRIVMSG <target> :<message>". The target is a channel or a
+	nickname; either way, the message is delivered by this server, or forwarded to the link that leads to the recipient.
+ */
+static void link_cmd_privmsg(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct privmsg_args p;
+	int found;
+	if (params_size < 2 || (p.from = find_source(link, prefix)) == NULL) {
+		return;
+	}
+	if (params[0][0] == '#') {
+		(void)channel_msg(p.from, params[0], params[1]);
+		return;
+	}
+	p.link = link;
+	p.msg = params[1];
+	(void)client_list_find_and_execute(params[0], privmsg_found, (void*)&p, &found);
+}
+
+/** Processes `SQUIT`, "SQUIT <server> :<comment>". If it names this server, or the server at the other end, the link is
+	closed. Otherwise, the server and every server behind it are removed, along with their clients, and the other links are
+	told.
+ */
+static void link_cmd_squit(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct server_link *sl = link->server_link;
+	struct remote_server *gone;
+	struct reply r;
+
+	if (params_size < 1) {
+		return;
+	}
+	if (strcasecmp(params[0], ==, get_server_name()) || strcasecmp(params[0], ==, sl->name)) {
+		terminate_session(link, LINK_CLOSED_QUIT_MSG);
+	}
+	if ((gone = detach_servers(link, params[0])) == NULL) {
+		return;
+	}
+	remove_servers_clients(link, gone, gone->uplink, gone->name);
+	reply_begin(&r, "SQUIT");
+	reply_param(&r, gone->name);
+	reply_trailing(&r, params_size >= 2 ? params[1] : sl->name);
+	send_links_reply(link, &r);
+	free_servers(gone);
+}
+
+/** Processes `PING`, "PING <origin>", answering with ":<server name> PONG <server name> :<origin>". */
+static void link_cmd_ping(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	struct reply r;
+	reply_begin(&r, "PONG");
+	reply_param(&r, get_server_name());
+	reply_trailing(&r, params_size >= 1 ? params[0] : get_server_name());
+	(void)reply_queue(&r, link);
+}
+
+/** Processes `ERROR`, which the other server sends right before closing the link. */
+static void link_cmd_error(struct irc_client *link, char *prefix, char *params[], int params_size)
+{
+	fprintf(stderr, "::link.c:link_cmd_error(): %s closed the link: %s\n",
+		link->server_link->name != NULL ? link->server_link->name : link->hostname, params_size >= 1 ? params[0] : "");
+	terminate_session(link, LINK_CLOSED_QUIT_MSG);
+}
+
+/** Tears down a link's state when its connection is destroyed. If the link was part of the network, every server and
+	client behind it is removed, and the other links are told with `SQUIT`. This is called by `destroy_client()`.
+	@param link The link.
+	@warning Must only be called by the link's worker, without holding locks.
+ */
+void link_drop(struct irc_client *link)
+{
+	struct server_link *sl = link->server_link;
+	struct remote_server *gone;
+	char quit_msg[2 * MAX_SERVNAME_LENGTH + 2];
+	struct reply r;
+	int i;
+
+	if (sl->linked) {
+		pthread_mutex_lock(&links_mutex);
+		for (i = 0; i < links_count && links[i] != link; i++)
+			; /* Intentionally left blank */
+		if (i < links_count) {
+			links[i] = links[--links_count];
+		}
+		pthread_mutex_unlock(&links_mutex);
+		gone = detach_servers(link, NULL);
+		snprintf(quit_msg, sizeof(quit_msg), "%s %s", get_server_name(), sl->name);
+		while (sl->clients != NULL) {
+			remove_remote(link, sl->clients, quit_msg);
+		}
+		free_servers(gone);
+		reply_begin(&r, "SQUIT");
+		reply_param(&r, sl->name);
+		reply_trailing(&r, LINK_CLOSED_QUIT_MSG);
+		send_links_reply(link, &r);
+		fprintf(stderr, "::link.c:link_drop(): Lost link with %s.\n", sl->name);
+	}
+	if (sl->connector != NULL) {
+		sl->connector->link = NULL;
+	}
+	free(sl->password);
+	free(sl->name);
+	free(sl->description);
+	free(sl);
+	link->server_link = NULL;
+}
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include "list.h"
 #include "trie.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
 
 /** @file
    @brief Generic thread-safe words container.
@@ -22,6 +25,17 @@
       functions to invoke a delete operation on the node they're workingon (and only on that node), and the function
       guarantees that no other threads are waiting to acquire the node's lock once it is deleted in the current thread.
       See this function's documentation to learn how this is achieved.
+   Lookups do not take the global lock. Every operation that holds the global lock and may change the trie makes the
+      list's sequence counter odd while it runs, and even again when it is done. A lookup reads the counter, searches
+      the trie, and only trusts its result if the counter was even and did not change in the meantime; otherwise, it
+      tries again, and after `LIST_READ_ATTEMPTS` failed attempts it falls back to the global lock.
+   Because lookups may be reading trie nodes and list nodes that a writer has just unlinked, these are not freed right
+      away. They are kept in one of two limbo lists, according to the list's current epoch, and each lookup registers in
+      the epoch it started in. A limbo list is freed by a writer when the list switches back to its epoch, which is only
+      done when every lookup registered in that epoch has finished.
+   Lookups register in one of `LIST_READER_SLOTS` reader slots, each in its own cache line, picked by the calling thread
+      once and for all. Threads running lookups in parallel thus update different cache lines, and only writers, which
+      scan every slot, read them all.
    It is a very interesting and recommendable exercise to go through the trie implementation. Interested readers are
       invited to look at trie.c.
    @author Filipe Goncalves
@@ -30,12 +44,37 @@
    @see trie.c
  */
 
+/** How many times a lookup is attempted without the global lock before giving up and acquiring it. */
+#define LIST_READ_ATTEMPTS 16
+
+/** How many reader slots each list has. Threads beyond this number share slots, which is still correct. */
+#define LIST_READER_SLOTS 32
+
+/** Size of a cache line. Each reader slot takes a whole line, so that lookups in different threads don't share one. */
+#define LIST_CACHE_LINE 64
+
+/** How many lookups a group of threads is running in each epoch. */
+struct reader_slot {
+	int readers[2]; /**<How many lookups of these threads are running in each epoch. Updated atomically. */
+	char pad[LIST_CACHE_LINE - 2 * sizeof(int)]; /**<Keeps the next slot out of this slot's cache line. */
+};
+
+static int slots_taken; /**<How many threads picked a reader slot. Updated atomically. */
+static __thread int my_slot; /**<The calling thread's reader slot, plus `1`; `0` until it picks one. */
+
+struct yaircd_node;
+
 /** Structure defining a generic thread-safe words list. */
 struct yaircd_list {
-	pthread_mutex_t mutex; /**<Mutex to synchronize concurrent access to this list */
+	pthread_mutex_t mutex; /**<Mutex to synchronize writers and lookups that fell back to locking. */
 	struct trie_t *trie; /**<The underlying list implementation. A trie is used to associate words to data. */
 	void (*free_func)(void *); /**<Pointer to a function that knows how to free a generic data type stored in this
 	                              list by the code using this module. */
+	volatile unsigned seq; /**<Sequence counter. It is odd while a writer holding `mutex` may be changing the trie. */
+	volatile int epoch; /**<Current epoch, either `0` or `1`. Only changed by writers holding `mutex`. */
+	struct reader_slot slots[LIST_READER_SLOTS]; /**<Where lookups register. See `read_begin()`. */
+	struct trie_node *limbo_trie[2]; /**<Trie nodes released in each epoch, chained by `next_released`. */
+	struct yaircd_node *limbo_nodes[2]; /**<List nodes deleted in each epoch, chained by `next_released`. */
 };
 
 /** This is what we associate to each word stored. Each word is denoted a node; the trie allows association of a generic
@@ -51,6 +90,7 @@ struct yaircd_list {
 struct yaircd_node {
 	void *data; /**<Generic data type stored at this node; provided by the upper caller */
 	pthread_mutex_t mutex; /**<Mutex to synchronize concurrent access to this specific node */
+	struct yaircd_node *next_released; /**<Next node in the limbo list, once this node is deleted. */
 };
 
 /** Wrapper structure to hold arguments to pass to `free_yaircd_node()`. See `destroy_word_list()` and `list_delete()`
@@ -84,7 +124,159 @@ static void free_yaircd_node(void *node_generic, void *arg)
 	if (args != NULL && args->free_data == LIST_FREE_NODE_DATA) {
 		(*args->free_func)(node->data);
 	}
-	free(node);
+	pool_free(node);
+}
+
+/** Frees every trie node and list node in one of a list's limbo lists.
+   @param list The list.
+   @param epoch Which limbo list to free.
+   @warning Must only be called when no lookup can be reading the nodes, i.e., by `reclaim()`, or when the list is
+      being destroyed.
+ */
+static void free_limbo(Word_list_ptr list, int epoch)
+{
+	struct trie_node *tnode;
+	struct yaircd_node *node;
+
+	while ((tnode = list->limbo_trie[epoch]) != NULL) {
+		list->limbo_trie[epoch] = tnode->next_released;
+		pool_free(tnode);
+	}
+	while ((node = list->limbo_nodes[epoch]) != NULL) {
+		list->limbo_nodes[epoch] = node->next_released;
+		free_yaircd_node((void*)node, NULL);
+	}
+}
+
+/** Trie release function. Unlinked trie nodes are kept in the current epoch's limbo list, because lookups may still be
+   reading them. Called by the trie while a writer holds the global lock.
+   @param tnode The trie node that was unlinked.
+   @param list_generic The list owning the trie.
+ */
+static void release_trie_node(struct trie_node *tnode, void *list_generic)
+{
+	Word_list_ptr list = (Word_list_ptr)list_generic;
+	tnode->next_released = list->limbo_trie[list->epoch];
+	list->limbo_trie[list->epoch] = tnode;
+}
+
+/** Keeps a deleted list node in the current epoch's limbo list, instead of freeing it right away.
+   @param list The list.
+   @param node The node, which must have been deleted from the trie already.
+   @warning The global lock must be held.
+ */
+static void release_node(Word_list_ptr list, struct yaircd_node *node)
+{
+	node->next_released = list->limbo_nodes[list->epoch];
+	list->limbo_nodes[list->epoch] = node;
+}
+
+/** Switches a list to the other epoch, if every lookup registered there is done, and frees the nodes that were released
+   the last time that epoch was current. No lookup can reach them: they were unlinked before the current epoch started,
+   and every lookup that started before that is registered in the other epoch.
+   @param list The list.
+   @warning The global lock must be held.
+ */
+static void reclaim(Word_list_ptr list)
+{
+	int other = list->epoch ^ 1;
+	int readers = 0;
+	int i;
+
+	__sync_synchronize();
+	for (i = 0; i < LIST_READER_SLOTS && readers == 0; i++) {
+		readers = ((volatile struct reader_slot *) &list->slots[i])->readers[other];
+	}
+	if (readers == 0) {
+		free_limbo(list, other);
+		list->epoch = other;
+		__sync_synchronize();
+	}
+}
+
+/** Locks a list mutex. Contention is rare, so the lock is first tried without blocking; if someone else holds it, the time
+   spent waiting for it is accounted in the server statistics.
+   @param mutex The mutex.
+ */
+static void timed_lock(pthread_mutex_t *mutex)
+{
+	unsigned long long started;
+	unsigned long long waited;
+
+	if (pthread_mutex_trylock(mutex) == 0) {
+		return;
+	}
+	started = stats_clock();
+	pthread_mutex_lock(mutex);
+	waited = stats_clock() - started;
+	stats_lock_wait(waited);
+	TRACE_LOCK_WAIT(waited);
+}
+
+/** Acquires the global lock for an operation that may change the trie. Concurrent lookups will be retried until
+   `write_unlock()` is called.
+   @param list The list.
+ */
+static void write_lock(Word_list_ptr list)
+{
+	timed_lock(&list->mutex);
+	(void)__sync_fetch_and_add(&list->seq, 1);
+}
+
+/** Releases the global lock acquired with `write_lock()`, and frees released nodes if possible.
+   @param list The list.
+ */
+static void write_unlock(Word_list_ptr list)
+{
+	(void)__sync_fetch_and_add(&list->seq, 1);
+	reclaim(list);
+	pthread_mutex_unlock(&list->mutex);
+}
+
+/** Registers a lookup in the list's current epoch. Every node that the lookup may reach is guaranteed to stay allocated
+   until `read_end()` is called. The lookup is counted in the calling thread's reader slot, which the thread picks the
+   first time it gets here.
+   @param list The list.
+   @return The epoch where the lookup was registered, to be passed to `read_end()`.
+ */
+static int read_begin(Word_list_ptr list)
+{
+	struct reader_slot *slot;
+	int epoch;
+
+	if (my_slot == 0) {
+		my_slot = (__sync_fetch_and_add(&slots_taken, 1) % LIST_READER_SLOTS) + 1;
+	}
+	slot = &list->slots[my_slot - 1];
+	for (;;) {
+		epoch = list->epoch;
+		(void)__sync_fetch_and_add(&slot->readers[epoch], 1);
+		if (list->epoch == epoch) {
+			return epoch;
+		}
+		/* A writer switched epochs in the meantime; it may have missed us */
+		(void)__sync_fetch_and_sub(&slot->readers[epoch], 1);
+	}
+}
+
+/** Unregisters a lookup.
+   @param list The list.
+   @param epoch Value returned by the matching `read_begin()`.
+ */
+static void read_end(Word_list_ptr list, int epoch)
+{
+	(void)__sync_fetch_and_sub(&list->slots[my_slot - 1].readers[epoch], 1);
+}
+
+/** Checks that no writer changed the trie since a lookup read the sequence counter.
+   @param list The list.
+   @param seq Value of `list->seq` when the lookup started.
+   @return `1` if the lookup's result can be trusted; `0` otherwise.
+ */
+static int read_validate(Word_list_ptr list, unsigned seq)
+{
+	__sync_synchronize();
+	return (seq & 1) == 0 && list->seq == seq;
 }
 
 /** Initializes a new, empty list, with the necessary structures to control concurrent thread access.
@@ -103,6 +295,7 @@ Word_list_ptr init_word_list(void (*free_function)(void *), int (*is_valid)(char
 				     int), int (*char_to_pos)(char), int charcount)
 {
 	Word_list_ptr new_list;
+	int i;
 
 	new_list = malloc(sizeof(struct yaircd_list));
 	if (new_list == NULL) {
@@ -118,6 +311,14 @@ Word_list_ptr init_word_list(void (*free_function)(void *), int (*is_valid)(char
 		free(new_list);
 		return NULL;
 	}
+	trie_set_release(new_list->trie, release_trie_node, (void*)new_list);
+	new_list->seq = 0;
+	new_list->epoch = 0;
+	for (i = 0; i < LIST_READER_SLOTS; i++) {
+		new_list->slots[i].readers[0] = new_list->slots[i].readers[1] = 0;
+	}
+	new_list->limbo_trie[0] = new_list->limbo_trie[1] = NULL;
+	new_list->limbo_nodes[0] = new_list->limbo_nodes[1] = NULL;
 	return new_list;
 }
 
@@ -135,6 +336,8 @@ void destroy_word_list(Word_list_ptr list, int free_data)
 	args.free_data = free_data;
 	args.free_func = list->free_func;
 	destroy_trie(list->trie, TRIE_FREE_DATA, (void*)&args);
+	free_limbo(list, 0);
+	free_limbo(list, 1);
 	if (pthread_mutex_destroy(&list->mutex) != 0) {
 		perror("::list.c:destroy_word_list(): Could not destroy mutex");
 	}
@@ -168,34 +371,55 @@ void *list_find_word_nolock(Word_list_ptr list, char *word)
  */
 void *list_find_word(Word_list_ptr list, char *word)
 {
+	struct yaircd_node *node;
 	void *ret;
-	pthread_mutex_lock(&list->mutex);
-	ret = list_find_word_nolock(list, word);
+	unsigned seq;
+	int epoch;
+	int attempt;
+
+	for (attempt = 0; attempt < LIST_READ_ATTEMPTS; attempt++) {
+		epoch = read_begin(list);
+		seq = list->seq;
+		__sync_synchronize();
+		node = (struct yaircd_node*)find_word_trie(list->trie, word);
+		ret = (node != NULL ? node->data : NULL);
+		if (read_validate(list, seq)) {
+			read_end(list, epoch);
+			return ret;
+		}
+		read_end(list, epoch);
+	}
+	timed_lock(&list->mutex);
+	node = (struct yaircd_node*)find_word_trie(list->trie, word);
+	ret = (node != NULL ? node->data : NULL);
 	pthread_mutex_unlock(&list->mutex);
 	return ret;
 }
 
 /** Finds and performs an action on a word's data atomically, if a match exists.
-   This is the magical function that allows parallelism and locking at the same time. First, the global lock is obtained
-      to search the list for a match. If a match is not found, `nomatch_fun` is called, and then theglobal lock is
-      released and the function returns.
-   If a match is found, this function guarantees that a unique lock attached to the match is obtained, and then the
-      global list lock is released. Then, `match_fun` is called with the datapreviously associated to `word`. As a
-      consequence, this function is atomically executed with respect to the specific structure associated to `word`.
-      When that function returns, this unique lock is released, and thisfunction returns.
+   This is the magical function that allows parallelism and locking at the same time. First, the list is searched for a
+      match without holding the global lock. If a match is found, the unique lock attached to the match is obtained, and
+      the search is validated: if no writer changed the list in the meantime, the match is still in the list, and
+      because we now hold its lock, nobody can delete it until we are done. Then, `match_fun` is called with the data
+      previously associated to `word`. As a consequence, this function is atomically executed with respect to the
+      specific structure associated to `word`. When that function returns, this unique lock is released, and this
+      function returns.
    This means that multiple threads don't necessarily have to wait for each other when they want to do some work on
-      different list nodes. However, if a thread is doing some work on node B, and another thread comes in andasks for
-      node B, it will have to wait for the former thread to finish processing, and it will do so while holding the
-      global list lock. That is, if two threads concurrently try to access the same node, one of them willhave to wait,
-      and will force every other thread trying to access ANY node to wait.
-   This is necessary; we can't obtain the unique lock for a node without holding a global lock, otherwise, the
-      unfortunate situation in which we release the global lock; another thread deletes node B, and then we get back and
-      try to lock node B could arise, and we would be in very big trouble.
+      different list nodes: lookups never wait for each other, and they only wait for a writer when the writer is
+      changing the list at the same time. However, if a thread is doing some work on node B, and another thread comes in
+      and asks for node B, it will have to wait for the former thread to finish processing.
+   If the search cannot be validated `LIST_READ_ATTEMPTS` times in a row, or if it finds no match and `nomatch_fun` is
+      not `NULL`, the global lock is obtained and the list is searched again. If a match is not found, `nomatch_fun` is
+      called, and then the global lock is released and the function returns. Otherwise, the unique lock for the match is
+      obtained before the global lock is released, just like in the lock-free case. We can't obtain the unique lock for
+      a node and trust it without either holding a global lock or validating the search, otherwise, the unfortunate
+      situation in which another thread deletes node B right before we lock node B could arise, and we would be in very
+      big trouble.
    User supplied functions (`match_fun` and `nomatch_fun`) are allowed to be `NULL`, in that case, the corresponding
       pointer to the function is ignored.
    When `word` was not found in the list, `nomatch_fun` is called with `nomatch_fargs` while holding a global list lock.
-   When `word` is found, a unique lock associated to `word` is obtained, the global lock is released, and `match_fun` is
-      called with the generic data that was previously associated to `word` as its first parameter, and with
+   When `word` is found, a unique lock associated to `word` is obtained, and `match_fun` is called, without holding the
+      global lock, with the generic data that was previously associated to `word` as its first parameter, and with
       `match_fargs` as second parameter.
    This function should only be called with a `match_fun` that can't possibly invoke list operations that will add or
       delete elements from the list.
@@ -225,7 +449,7 @@ void *list_find_word(Word_list_ptr list, char *word)
    <li>If a match is found and `match_fun` is not `NULL`, then the result of evaluating `(match_fun)(node_data,
       match_fargs)` is returned.</li>
    </ul>
-   @warning The functions must not call `pthread_exit()`.
+   @warning The functions must not call `terminate_session()`.
    @warning Read the documentation carefully, and make sure to understand which locks are active inside `match_fun` and
       `nomatch_fun`. It is easy to create deadlock situations when not paying attention.
    @note `nomatch_fun` is free to add or delete elements from the list, since it will be executing inside a globally
@@ -244,17 +468,49 @@ void *list_find_and_execute(Word_list_ptr list,
 {
 	void *ret;
 	struct yaircd_node *node;
+	unsigned seq;
+	int epoch;
+	int attempt;
 	*success = 0;
-	pthread_mutex_lock(&list->mutex);
+	for (attempt = 0; attempt < LIST_READ_ATTEMPTS; attempt++) {
+		epoch = read_begin(list);
+		seq = list->seq;
+		__sync_synchronize();
+		node = (struct yaircd_node*)find_word_trie(list->trie, word);
+		if (node == NULL) {
+			if (nomatch_fun != NULL) {
+				/* nomatch_fun must run with the global lock */
+				read_end(list, epoch);
+				break;
+			}
+			if (read_validate(list, seq)) {
+				read_end(list, epoch);
+				return NULL;
+			}
+		} else {
+			timed_lock(&node->mutex);
+			if (read_validate(list, seq)) {
+				/* Nobody can delete this node without locking it first, so it is safe to leave the epoch */
+				read_end(list, epoch);
+				ret = (match_fun != NULL ? (*match_fun)(node->data, match_fargs) : NULL);
+				pthread_mutex_unlock(&node->mutex);
+				*success = 1;
+				return ret;
+			}
+			pthread_mutex_unlock(&node->mutex);
+		}
+		read_end(list, epoch);
+	}
+	write_lock(list);
 	ret = find_word_trie(list->trie, word);
 	if (ret == NULL) {
 		ret = (nomatch_fun != NULL ? (*nomatch_fun)(nomatch_fargs) : NULL);
-		pthread_mutex_unlock(&list->mutex);
+		write_unlock(list);
 		return ret;
 	}
 	node = (struct yaircd_node*)ret;
-	pthread_mutex_lock(&node->mutex);
-	pthread_mutex_unlock(&list->mutex);
+	timed_lock(&node->mutex);
+	write_unlock(list);
 	ret = (match_fun != NULL ? (*match_fun)(node->data, match_fargs) : NULL);
 	pthread_mutex_unlock(&node->mutex);
 	*success = 1;
@@ -272,9 +528,9 @@ void *list_find_and_execute(Word_list_ptr list,
       To do so, it must call `list_delete_nolock()`.
    We use a clever little trick to ensure both atomicity on this node and the capability to delete itself: after
       acquiring the global lock, a unique lock to the node is acquired and then immediately released; by the time it is
-      released,	no other thread can be working on this node, and since the global lock is with us, no one else is stuck
-      trying to lock this specific node. Also, because we released the node's lock, it is safe for the node to destroy
-      itself.
+      released,	no other thread can be working on this node. Lookups that lock the node afterwards will not trust it,
+      since the list's sequence counter is odd while we hold the global lock, so they will wait for the global lock
+      instead. Also, because we released the node's lock, it is safe for the node to destroy itself.
    If a match is not found, `nomatch_fun` is called with `nomatch_fargs` while holding the global list lock.
    @param list The list to perform the search on.
    @param word A pointer to a null terminated characters sequence holding the word to search for.
@@ -311,16 +567,16 @@ void *list_find_and_execute_globalock(Word_list_ptr list,
 	void *ret;
 	struct yaircd_node *node;
 	*success = 0;
-	pthread_mutex_lock(&list->mutex);
+	write_lock(list);
 	ret = find_word_trie(list->trie, word);
 	if (ret == NULL) {
 		ret = (nomatch_fun != NULL ? (*nomatch_fun)(nomatch_fargs) : NULL);
-		pthread_mutex_unlock(&list->mutex);
+		write_unlock(list);
 		return ret;
 	}
 	node = (struct yaircd_node*)ret;
 	/* Make sure no threads without the global lock are working on this node */
-	pthread_mutex_lock(&node->mutex);
+	timed_lock(&node->mutex);
 	/* By this point, we hold:
 	        - The global lock
 	        - The lock for this node
@@ -329,11 +585,42 @@ void *list_find_and_execute_globalock(Word_list_ptr list,
 	 */
 	pthread_mutex_unlock(&node->mutex);
 	ret = (match_fun != NULL ? (*match_fun)(node->data, match_fargs) : NULL);
-	pthread_mutex_unlock(&list->mutex);
+	write_unlock(list);
 	*success = 1;
 	return ret;
 }
 
+/** Batched version of `list_find_and_execute_globalock()`: calls `match_fun` for each of several words while holding the
+   global lock only once. Each call has the same guarantees as in `list_find_and_execute_globalock()`, thus, `match_fun`
+   may delete the node it's working on with `list_delete_nolock()`. Words that are not in the list are skipped.
+   @param list The list to perform the search on.
+   @param words Array of pointers to null terminated characters sequences holding the words to search for.
+   @param count How many words are stored in `words`.
+   @param match_fun Function called with the data associated to each word found, and with `match_fargs`.
+   @param match_fargs This will be passed to `match_fun` as a second parameter.
+   @warning The same restrictions of `list_find_and_execute_globalock()` apply to `match_fun`.
+ */
+void list_find_each_and_execute_globalock(Word_list_ptr list,
+					  char *words[],
+					  int count,
+					  void *(*match_fun)(void *, void *),
+					  void *match_fargs)
+{
+	struct yaircd_node *node;
+	int i;
+	write_lock(list);
+	for (i = 0; i < count; i++) {
+		if ((node = (struct yaircd_node*)find_word_trie(list->trie, words[i])) == NULL) {
+			continue;
+		}
+		/* Make sure no threads without the global lock are working on this node; see list_find_and_execute_globalock() */
+		timed_lock(&node->mutex);
+		pthread_mutex_unlock(&node->mutex);
+		(void)(*match_fun)(node->data, match_fargs);
+	}
+	write_unlock(list);
+}
+
 /** Adds a new word to a list if that word is not stored in the list yet without obtaining any lock.
    This funtion should only be called by anyone holding a lock for the list.
    @param list The list to add the word to.
@@ -350,24 +637,24 @@ int list_add_nolock(Word_list_ptr list, void *data, char *word)
 {
 	int ret;
 	struct yaircd_node *new_node;
-	new_node = malloc(sizeof(*new_node));
+	new_node = pool_alloc(sizeof(*new_node));
 	ret = 0;
 	if (new_node == NULL) {
 		return LST_NO_MEM;
 	}
 	if (pthread_mutex_init(&new_node->mutex, NULL) != 0) {
-		free(new_node);
+		pool_free(new_node);
 		return LST_NO_MEM;
 	}
 	new_node->data = data;
 	if (find_word_trie(list->trie, word) != NULL) {
-		return LST_ALREADY_EXISTS;
+		ret = LST_ALREADY_EXISTS;
 	}else {
-		return add_word_trie(list->trie, word, new_node);
+		ret = add_word_trie(list->trie, word, new_node);
 	}
 	if (ret == TRIE_INVALID_WORD || ret == TRIE_NO_MEM || ret == LST_ALREADY_EXISTS) {
 		pthread_mutex_destroy(&new_node->mutex);
-		free(new_node);
+		pool_free(new_node);
 	}
 	return ret == TRIE_INVALID_WORD ? LST_INVALID_WORD : ret == TRIE_NO_MEM ? LST_NO_MEM : ret;
 }
@@ -389,33 +676,34 @@ int list_add(Word_list_ptr list, void *data, char *word)
 {
 	int ret;
 	struct yaircd_node *new_node;
-	new_node = malloc(sizeof(*new_node));
+	new_node = pool_alloc(sizeof(*new_node));
 	ret = 0;
 	if (new_node == NULL) {
 		return LST_NO_MEM;
 	}
 	if (pthread_mutex_init(&new_node->mutex, NULL) != 0) {
-		free(new_node);
+		pool_free(new_node);
 		return LST_NO_MEM;
 	}
 	new_node->data = data;
-	pthread_mutex_lock(&list->mutex);
+	write_lock(list);
 	if (find_word_trie(list->trie, word) != NULL) {
 		ret = LST_ALREADY_EXISTS;
 	}else {
 		ret = add_word_trie(list->trie, word, new_node);
 	}
-	pthread_mutex_unlock(&list->mutex);
+	write_unlock(list);
 	if (ret == TRIE_INVALID_WORD || ret == TRIE_NO_MEM || ret == LST_ALREADY_EXISTS) {
 		pthread_mutex_destroy(&new_node->mutex);
-		free(new_node);
+		pool_free(new_node);
 	}
 	return ret == TRIE_INVALID_WORD ? LST_INVALID_WORD : ret == TRIE_NO_MEM ? LST_NO_MEM : ret;
 }
 
 /** Deletes an entry from a list. If no such entry exists, nothing happens.
    The deletion operation will only take place after both the global lock and a unique lock associated to `word` are
-      obtained. Thus, when an entry is deleted,no thread is ever doing some processing with that node.
+      obtained. Thus, when an entry is deleted,no thread is ever doing some processing with that node. The node itself
+      is freed later, once no lookup can be reading it.
    @param list The list.
    @param word A null terminated characters sequence denoting the entry to be deleted.
    @return If the word existed, its associated data is returned. Otherwise, `NULL` is returned.
@@ -426,19 +714,19 @@ void *list_delete(Word_list_ptr list, char *word)
 	void *ret;
 	void *old_data;
 	struct yaircd_node *node;
-	pthread_mutex_lock(&list->mutex);
+	write_lock(list);
 	ret = find_word_trie(list->trie, word);
 	if (ret == NULL) {
-		pthread_mutex_unlock(&list->mutex);
+		write_unlock(list);
 		return NULL;
 	}
 	node = (struct yaircd_node*)ret;
-	pthread_mutex_lock(&node->mutex);
+	timed_lock(&node->mutex);
 	(void)delete_word_trie(list->trie, word);
 	pthread_mutex_unlock(&node->mutex);
-	pthread_mutex_unlock(&list->mutex);
 	old_data = node->data;
-	free_yaircd_node((void*)node, NULL);
+	release_node(list, node);
+	write_unlock(list);
 	return old_data;
 }
 
@@ -460,7 +748,7 @@ void *list_delete_nolock(Word_list_ptr list, char *word)
 	}
 	node = (struct yaircd_node*)ret;
 	ret = node->data;
-	free_yaircd_node((void*)node, NULL);
+	release_node(list, node);
 	return ret;
 }
 
@@ -488,7 +776,7 @@ void list_for_each(Word_list_ptr list, void (*f)(void *, void *), void *fargs)
 	function.f = f;
 	function.args = fargs;  
 	
-	pthread_mutex_lock(&list->mutex);
+	timed_lock(&list->mutex);
 	trie_for_each(list->trie, unpack_and_execute, &function);
 	pthread_mutex_unlock(&list->mutex);
 	return;
@@ -1,8 +1,9 @@
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
-#include <ctype.h>
 #include "protocol.h"
 #include "interpretmsg.h"
 #include "wrappers.h"
@@ -10,10 +11,14 @@
 #include "client.h"
 #include "channel.h"
 #include "serverinfo.h"
-#include "trie.h"
+#include "cmd_hash.h"
 #include "send_err.h"
 #include "send_rpl.h"
 #include "msgio.h"
+#include "reply.h"
+#include "burst.h"
+#include "stats.h"
+#include "link.h"
 
 /** @file
    @brief Functions responsible for interpreting an IRC message.
@@ -34,16 +39,18 @@
 */
 #define array_count(a) (sizeof(a) / sizeof(*a))
 
-/** A trie used to store function pointers to process every commands issued by registered connections */
-static struct trie_t *commands_registered;
-/** A trie used to store function pointers to process every commands issued by unregistered connections */
-static struct trie_t *commands_unregistered;
+/** Dispatch table for registered connections, indexed by command ID. Filled by `cmds_init()`; commands that registered
+   connections can't use are `NULL`. */
+static void (*handlers_registered[CMD_COUNT])(struct irc_client *, char *, char *, char *[], int);
+/** Dispatch table for unregistered connections, indexed by command ID. Filled by `cmds_init()`; commands that
+   unregistered connections can't use are `NULL`. */
+static void (*handlers_unregistered[CMD_COUNT])(struct irc_client *, char *, char *, char *[], int);
 
-/** This structure defines a trie commands' node. It contains the command itself, i.e., the path taken by the trie to
-   arrive at this node, and a pointer to a function that knows how to process this command. */
+/** This structure pairs a command with the function that processes it. The command is identified by its ID, as listed in
+   `msg/commands.def` and generated in `cmd_ids.h`. */
 struct cmd_func {
-	char *command; /**<A null-terminated characters sequence describing the command that `f` knows how to process */
-	/** A pointer to a function that shall process `command`. `client` will be the client where the request came
+	int id; /**<The ID of the command that `f` knows how to process */
+	/** A pointer to a function that shall process the command. `client` will be the client where the request came
 	   from. The rest of the parameters correspond to the values filled by `parsemsg()`. */
 	void (*f)(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
 };
@@ -62,17 +69,24 @@ void cmd_whois(struct irc_client *client, char *prefix, char *cmd, char *params[
 void cmd_join(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
 void cmd_part(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
 void cmd_list(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void cmd_names(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
 void cmd_pong(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void cmd_oper(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void cmd_stats(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void cmd_pass(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
+void cmd_server(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size);
 
 /** The core processing functions. This array holds as many `struct cmd_func` instances as the number of commands
    available for unregistered connections. Developers adding new commands to yaIRCd for unregistered users only need to
-   change this array by adding one more element with the new command and the function to be called when someone issues
+   add the command to `msg/commands.def` and change this array by adding one more element with the new command's ID and the function to be called when someone issues
    that command.
  */
 static const struct cmd_func cmds_unregistered[] = {
-	{ "nick", cmd_nick_unregistered },
-	{ "user", cmd_user_unregistered },
-	{ "pong", cmd_pong }
+	{ CMD_NICK, cmd_nick_unregistered },
+	{ CMD_USER, cmd_user_unregistered },
+	{ CMD_PONG, cmd_pong },
+	{ CMD_PASS, cmd_pass },
+	{ CMD_SERVER, cmd_server }
 };
 
 /** This array holds the commands for registered connections. Each entry is an instance of `struct cmd_func`, thus, this
@@ -81,15 +95,18 @@ static const struct cmd_func cmds_unregistered[] = {
    this array.
  */
 static const struct cmd_func cmds_registered[] = {
-	{ "nick", cmd_nick_registered },
-	{ "user", cmd_user_registered },
-	{ "quit", cmd_quit },
-	{ "privmsg", cmd_privmsg },
-	{ "whois", cmd_whois },
-	{ "join", cmd_join },
-	{ "part", cmd_part },
-	{ "list", cmd_list },
-	{ "pong", cmd_pong }
+	{ CMD_NICK, cmd_nick_registered },
+	{ CMD_USER, cmd_user_registered },
+	{ CMD_QUIT, cmd_quit },
+	{ CMD_PRIVMSG, cmd_privmsg },
+	{ CMD_WHOIS, cmd_whois },
+	{ CMD_JOIN, cmd_join },
+	{ CMD_PART, cmd_part },
+	{ CMD_LIST, cmd_list },
+	{ CMD_NAMES, cmd_names },
+	{ CMD_PONG, cmd_pong },
+	{ CMD_OPER, cmd_oper },
+	{ CMD_STATS, cmd_stats }
 };
 
 /** Processes a `NICK` command for an unregistered connection.
@@ -102,9 +119,10 @@ static const struct cmd_func cmds_registered[] = {
 	<li>`ERR_NICKNAMEINUSE` if there's already a client, possibly unregistered, who chose this nickname</li>
 	</ul>
 	If no error condition occurs and the client already chose username, realname and GECOS, the client's request is
-	   acknowledged with the welcome message (see `send_welcome()`), along with the MOTD. If no error occurs, but
+	   acknowledged with the welcome messages and the MOTD (see `send_burst()`), and the other servers of the network are
+	   told about the new client (see `link_introduce()`). If no error occurs, but
 	   the client has not yet defined realname, username and GECOS, no reply is given.
-	If there's no memory to store the new nickname, `pthread_exit()` is called, and the client's connection is
+	If there's no memory to store the new nickname, `terminate_session()` is called, and the client's connection is
 	   closed.
 	@param client The client who issued the command.
 	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
@@ -161,9 +179,14 @@ void cmd_nick_unregistered(struct irc_client *client, char *prefix, char *cmd, c
 		return;
 	}
 	if (client->nick != NULL && client->username != NULL && client->realname != NULL) {
+		if (update_client_prefix(client) == -1) {
+			client_list_delete(client);
+			terminate_session(client, NO_MEM_QUIT_MSG);
+			return;
+		}
 		client->is_registered = 1;
-		send_welcome(client);
-		send_motd(client);
+		send_burst(client);
+		link_introduce(client);
 	}
 }
 
@@ -174,9 +197,10 @@ void cmd_nick_unregistered(struct irc_client *client, char *prefix, char *cmd, c
 	   stored in `params`.</li>
 	</ul>
 	If no error condition occurs and the client already defined a nickname, the client's request is acknowledged
-	   with the welcome message (see `send_welcome()`), along with the MOTD. If no error occurs and no nickname has
+	   with the welcome messages and the MOTD (see `send_burst()`), and the other servers of the network are told about
+	   the new client (see `link_introduce()`). If no error occurs and no nickname has
 	   been chosen yet, no reply is generated.
-	If there's no memory to store the new information, `pthread_exit()` is called, and the client's connection is
+	If there's no memory to store the new information, `terminate_session()` is called, and the client's connection is
 	   closed.
 	@param client The client who issued the command.
 	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
@@ -206,9 +230,14 @@ void cmd_user_unregistered(struct irc_client *client, char *prefix, char *cmd, c
 		return;
 	}
 	if (client->nick != NULL && client->username != NULL && client->realname != NULL) {
+		if (update_client_prefix(client) == -1) {
+			client_list_delete(client);
+			terminate_session(client, NO_MEM_QUIT_MSG);
+			return;
+		}
 		client->is_registered = 1;
-		send_welcome(client);
-		send_motd(client);
+		send_burst(client);
+		link_introduce(client);
 	}
 }
 
@@ -394,34 +423,33 @@ void cmd_privmsg(struct irc_client *client, char *prefix, char *cmd, char *param
 */
 static void cmd_whois_aux_channels(struct irc_client *client, struct irc_client *target_client)
 {
+	struct reply r;
+	size_t begin;
+	size_t len;
 	int i;
-	char buffer[MAX_MSG_SIZE];
-	char *buf_ptr;
-	char *ptr_begin;
-	
-	ptr_begin  = buffer;
-	
-	ptr_begin += cmd_print_reply(buffer, sizeof(buffer), ":%s " RPL_WHOISCHANNELS " %s %s :", get_server_name(), target_client->nick, target_client->nick);
-	buf_ptr=ptr_begin;
 
-	for (i=0; i < get_chanlimit(); i++) {
+	reply_numeric(&r, client, RPL_WHOISCHANNELS);
+	reply_param(&r, target_client->nick);
+	reply_append(&r, " :");
+	begin = r.length;
+
+	for (i = 0; i < get_chanlimit(); i++) {
 		if (target_client->channels[i] == NULL) {
 			continue;
 		}
-		if ((buffer+sizeof(buffer)-buf_ptr-2) < strlen(target_client->channels[i])+1) {
+		len = strlen(target_client->channels[i]);
+		if (reply_room(&r) < len + 1 && r.length != begin) {
 			/* Didn't fit */
-			buf_ptr[0] = '\r';
-			buf_ptr[1] = '\n';
-			write_to(client, buffer, buf_ptr-buffer+2);
-			buf_ptr = ptr_begin;
-			continue;
+			(void)reply_queue(&r, client);
+			reply_numeric(&r, client, RPL_WHOISCHANNELS);
+			reply_param(&r, target_client->nick);
+			reply_append(&r, " :");
 		}
-		buf_ptr += cmd_print_reply(buf_ptr, (size_t) (buffer+sizeof(buffer)-buf_ptr), "%s ", target_client->channels[i]);
+		reply_append_buf(&r, target_client->channels[i], len);
+		reply_append_buf(&r, " ", 1);
 	}
-	if(buf_ptr != ptr_begin) {
-		buf_ptr[0] = '\r';
-		buf_ptr[1] = '\n';
-		write_to(client, buffer, buf_ptr-buffer+2);
+	if (r.length != begin) {
+		(void)reply_queue(&r, client);
 	}
 }
 
@@ -437,30 +465,34 @@ static void *cmd_whois_aux(void *target_client, void *args)
 {
 	struct cmd_parse *info = (struct cmd_parse*)args;
 	struct irc_client *target = (struct irc_client*)target_client;
-	char message[MAX_MSG_SIZE + 1];
-	int length;
-	length = cmd_print_reply(message,
-				 sizeof(message),
-				 ":%s " RPL_WHOISUSER " %s %s %s %s * :%s\r\n",
-				 get_server_name(),
-				 info->from->nick,
-				 target->nick,
-				 target->username,
-				 target->public_host,
-				 target->realname);
-	(void)write_to(info->from, message, length);
-	length = cmd_print_reply(message, sizeof(message), ":%s " RPL_WHOISSERVER " %s %s %s :%s\r\n",
-				 get_server_name(), info->from->nick, target->nick, get_server_name(), get_server_desc());
-	(void)write_to(info->from, message, length);
+	struct reply r;
+
+	reply_numeric(&r, info->from, RPL_WHOISUSER);
+	reply_param(&r, target->nick);
+	reply_param(&r, target->username);
+	reply_param(&r, target->public_host);
+	reply_param(&r, "*");
+	reply_trailing(&r, target->realname);
+	(void)reply_queue(&r, info->from);
+
+	reply_numeric(&r, info->from, RPL_WHOISSERVER);
+	reply_param(&r, target->nick);
+	if (target->server != NULL) {
+		/* Other servers' descriptions are not kept */
+		reply_param(&r, target->server);
+		reply_trailing(&r, get_net_name());
+	} else {
+		reply_param(&r, get_server_name());
+		reply_trailing(&r, get_server_desc());
+	}
+	(void)reply_queue(&r, info->from);
 	/* TODO Implement RPL_WHOISIDLE */
-	cmd_whois_aux_channels(info->from, (struct irc_client*) target_client);
-	length = cmd_print_reply(message,
-				 sizeof(message),
-				 ":%s " RPL_ENDOFWHOIS " %s %s :End of WHOIS list\r\n",
-				 get_server_name(),
-				 info->from->nick,
-				 target->nick);
-	(void)write_to(info->from, message, length);
+	cmd_whois_aux_channels(info->from, target);
+
+	reply_numeric(&r, info->from, RPL_ENDOFWHOIS);
+	reply_param(&r, target->nick);
+	reply_trailing(&r, "End of WHOIS list");
+	(void)reply_queue(&r, info->from);
 	return NULL;
 }
 
@@ -530,7 +562,7 @@ void cmd_whois(struct irc_client *client, char *prefix, char *cmd, char *params[
 	   possibly been indicated</li>
 	</ul>
 	This function calls `do_join()` to process the command. See the documentation for that function for further
-	   information.
+	   information. If the client joined, the other servers of the network are told with `link_broadcast_from()`.
 	@param client The client who issued the command.
 	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
 	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
@@ -576,6 +608,9 @@ void cmd_join(struct irc_client *client, char *prefix, char *cmd, char *params[]
 		return;
 	}
 	switch (do_join(client, params[0])) {
+	case 0:
+		link_broadcast_from(client, "JOIN", params[0], NULL);
+		break;
 	case CHAN_INVALID_NAME:
 		send_err_nosuchchannel(client, params[0]);
 		break;
@@ -598,7 +633,8 @@ void cmd_join(struct irc_client *client, char *prefix, char *cmd, char *params[]
 	<li>`ERR_NOTONCHANNEL` if `client` is not currently on the channel he attempted to part from.
 	</ul>
 	This function calls `do_part()` to process the command. If no part message was specified, the client's nickname
-	   is used as the message. See the documentation for `do_part()` for further information.
+	   is used as the message. See the documentation for `do_part()` for further information. If the client parted, the
+	   other servers of the network are told with `link_broadcast_from()`.
 	@param client The client who issued the command.
 	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
 	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
@@ -615,11 +651,16 @@ void cmd_join(struct irc_client *client, char *prefix, char *cmd, char *params[]
  */
 void cmd_part(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
 {
+	char *part_msg;
 	if (params_size < 1) {
 		send_err_needmoreparams(client, cmd);
 		return;
 	}
-	switch (do_part(client, params[0], params_size > 1 ? params[1] : client->nick)) {
+	part_msg = (params_size > 1 ? params[1] : client->nick);
+	switch (do_part(client, params[0], part_msg)) {
+	case 0:
+		link_broadcast_from(client, "PART", params[0], part_msg);
+		break;
 	case CHAN_INVALID_NAME:
 		send_err_nosuchchannel(client, params[0]);
 		break;
@@ -631,6 +672,9 @@ void cmd_part(struct irc_client *client, char *prefix, char *cmd, char *params[]
 
 /**
  * Processes a 'LIST' command.
+ * The reply is streamed from a snapshot of the channels list by `list_each_channel()`, so it never blocks other commands,
+ * no matter how many channels exist. The parameter can be a comma separated list of conditions: `>N` lists channels with
+ * more than `N` users, and `<N` lists channels with less than `N` users.
  * @param client The client who issued the command.
  * @param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
  * @param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
@@ -638,91 +682,205 @@ void cmd_part(struct irc_client *client, char *prefix, char *cmd, char *params[]
  * in the IRC message arrived from `client`, as returned by `parse_msg()`.
  * @param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
  * @todo The list command is partially implemented. Consider implementing &lt;targets&gt; (check RFC) by the time multiple nodes are a reality in yaIRCd. 
+ * Channel names in the parameter are ignored for now.
  */
 void cmd_list(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
 {
-	list_each_channel(client);
+	int min_users = 0;
+	int max_users = INT_MAX;
+	char *cond;
+	char *next;
+	long value;
+
+	if (params_size >= 1) {
+		for (cond = params[0]; cond != NULL; cond = next) {
+			if ((next = strchr(cond, ',')) != NULL) {
+				*next++ = '\0';
+			}
+			if ((*cond == '>' || *cond == '<') && cond[1] >= '0' && cond[1] <= '9') {
+				value = strtol(cond + 1, NULL, 10);
+				if (value > INT_MAX - 1) {
+					value = INT_MAX - 1;
+				}
+				if (*cond == '>' && (int) value + 1 > min_users) {
+					min_users = (int) value + 1;
+				} else if (*cond == '<' && (int) value - 1 < max_users) {
+					max_users = (int) value - 1;
+				}
+			}
+		}
+	}
+	list_each_channel(client, min_users, max_users);
+}
+
+/** Processes a `NAMES` command.
+	The target can be a comma separated list of channels; each channel's users are sent with `channel_names()`, packed into
+	as few `RPL_NAMREPLY` lines as possible, followed by `RPL_ENDOFNAMES`. Channels that don't exist only get `RPL_ENDOFNAMES`.
+	@param client The client who issued the command.
+	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
+	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
+	@param params An array of pointers to null terminated characters sequences, each one holding a parameter passed
+	   in the IRC message arrived from `client`, as returned by `parse_msg()`.
+	@param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
+	@todo Without parameters, the RFC asks for every visible channel and user. On a big network, that is a huge reply for
+	   something clients rarely need, so, like most servers, we just send `RPL_ENDOFNAMES` for `*`.
+ */
+void cmd_names(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
+{
+	struct reply r;
+	char *channel;
+	char *next;
+
+	if (params_size < 1) {
+		reply_numeric(&r, client, RPL_ENDOFNAMES);
+		reply_param(&r, "*");
+		reply_trailing(&r, "End of NAMES list");
+		reply_send(&r, client);
+		return;
+	}
+	for (channel = params[0]; channel != NULL; channel = next) {
+		if ((next = strchr(channel, ',')) != NULL) {
+			*next++ = '\0';
+		}
+		if (*channel != '\0') {
+			channel_names(client, channel);
+		}
+	}
+}
+
+/** Processes an `OPER` command. The name and password are checked against the `opers` list of the configuration file with
+	`check_oper()`; on success, the client becomes an IRC operator and gets `RPL_YOUREOPER`.
+	@param client The client who issued the command.
+	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
+	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
+	@param params An array of pointers to null terminated characters sequences, each one holding a parameter passed
+	   in the IRC message arrived from `client`, as returned by `parse_msg()`.
+	@param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
+ */
+void cmd_oper(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
+{
+	struct reply r;
+
+	if (params_size < 2) {
+		send_err_needmoreparams(client, cmd);
+		return;
+	}
+	switch (check_oper(params[0], params[1])) {
+	case OPER_OK:
+		client->is_oper = 1;
+		reply_numeric(&r, client, RPL_YOUREOPER);
+		reply_trailing(&r, "You are now an IRC operator");
+		reply_send(&r, client);
+		break;
+	case OPER_BAD_PASSWORD:
+		send_err_passwdmismatch(client);
+		break;
+	default:
+		send_err_nooperhost(client);
+		break;
+	}
 }
 
-/** Defines what is a valid character for a command. We only allow alphabetic characters to be part of a command.
-	@param c The character to check.
-	@return `0` if `c` is an invalid character, `1` otherwise.
+/** Processes a `STATS` command. Only IRC operators can read the server's statistics; the query letter selects which
+	ones are sent, see `send_stats()`.
+	@param client The client who issued the command.
+	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
+	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
+	@param params An array of pointers to null terminated characters sequences, each one holding a parameter passed
+	   in the IRC message arrived from `client`, as returned by `parse_msg()`.
+	@param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
  */
-static int is_valid(char c)
+void cmd_stats(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
 {
-	return isalpha((unsigned char)c);
+	if (!client->is_oper) {
+		send_err_noprivileges(client);
+		return;
+	}
+	if (params_size < 1) {
+		send_err_needmoreparams(client, cmd);
+		return;
+	}
+	send_stats(client, params[0]);
 }
 
-/** Defines a mapping from a character ID back into its character representation. The commands trie maps a character `c`
-to `c - &lsquo;a&rsquo;`, thus, to map back, we just need to return `c + &lsquo;a&rsquo;`.
-	@param c Unique ID for a character
-	@return A character `i` such that `char_to_pos(i) == c`
+/** Processes a `PASS` command for an unregistered connection. The password is only used if the connection turns out to be
+	another server, see `link_pass()`; clients don't need one.
+	@param client The client who issued the command.
+	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
+	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
+	@param params An array of pointers to null terminated characters sequences, each one holding a parameter passed
+	   in the IRC message arrived from `client`, as returned by `parse_msg()`.
+	@param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
  */
-static char pos_to_char(int c)
+void cmd_pass(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
 {
-	return c - 'a';
+	if (params_size < 1) {
+		send_err_needmoreparams(client, cmd);
+		return;
+	}
+	link_pass(client, params[0]);
 }
 
-/** Maps a character into its unique ID. We use a direct mapping in which `c` is mapped to the integer `c -
-&lsquo;a&rsquo;`.
-	@param c The character to map.
-	@return A unique integer that represents `c`'s ID.
+/** Processes a `SERVER` command for an unregistered connection: another server of the network wants to link with this
+	one. See `link_register()`.
+	@param client The client who issued the command.
+	@param prefix Null terminated characters sequence holding the command's prefix, as returned by `parse_msg()`.
+	@param cmd Null terminated characters sequence holding the command itself, as returned by `parse_msg()`.
+	@param params An array of pointers to null terminated characters sequences, each one holding a parameter passed
+	   in the IRC message arrived from `client`, as returned by `parse_msg()`.
+	@param params_size How many elements are stored in `params`, as returned by `parse_msg()`.
  */
-static int char_to_pos(char c)
+void cmd_server(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
 {
-	return tolower((unsigned char)c) - 'a';
+	if (params_size < 3) {
+		send_err_needmoreparams(client, cmd);
+		return;
+	}
+	link_register(client, params[0], params[2]);
 }
 
-/** Inserts a set of commands stored in an array of commands into a given trie. This function is used by `cmds_init()`.
-Its purpose is to loop through an array of `struct cmd_fund` and add each command to the specified trie.
-	@param trie The trie to add the commands to.
-	@param array An array of `struct cmd_fund`. Typically, this will either be `cmds_unregistered` or
-	   `cmds_registered`. This array is iterated, and for each entry found, we add the pair `(array[i].command,
-	   (void *) &array[i])` to the trie.
+/** Fills a dispatch table with the functions in an array of commands. This function is used by `cmds_init()`.
+	@param handlers The dispatch table, indexed by command ID.
+	@param array An array of `struct cmd_func`. Typically, this will either be `cmds_unregistered` or
+	   `cmds_registered`.
 	@param array_size How many elements are stored in `array`.
-	@return `-1` if `add_word_trie()` could not move forward because of some error condition, normally indicating a
-	   resources allocation problem; `0` on success.
+	@return `-1` if `array` holds an invalid command ID; `0` on success.
  */
-static int add_commands(struct trie_t *trie, const struct cmd_func *array, size_t array_size)
+static int add_commands(void (*handlers[CMD_COUNT])(struct irc_client *, char *, char *, char *[], int),
+			const struct cmd_func *array, size_t array_size)
 {
 	size_t i;
 	for (i = 0; i < array_size; i++) {
-		if (add_word_trie(trie, array[i].command, (void*)&array[i]) != 0) {
+		if (array[i].id < 0 || array[i].id >= CMD_COUNT) {
 			return -1;
 		}
+		handlers[array[i].id] = array[i].f;
 	}
 	return 0;
 }
 
-/** Initializes the commands tries. There is a trie for commands issued by registered users, and a trie for command
-requests coming from unregistered users. This function initializes both tries, and calls `add_commands()` to iterate
-through each of the commands arrays and add each element to the appropriate trie.
-	@return `0` on success; `-1` if any of the tries could not be successfully filled due to resource allocation
-	   errors.
+/** Initializes the dispatch tables. There is a table for commands issued by registered users, and a table for command
+requests coming from unregistered users. This function calls `add_commands()` to iterate through each of the commands
+arrays and fill the appropriate table.
+	@return `0` on success; `-1` if any of the commands arrays holds an invalid command ID.
  */
 int cmds_init(void)
 {
 	int i, j;
-	if ((commands_registered = init_trie(NULL, is_valid, pos_to_char, char_to_pos, 'z' - 'a' + 1)) == NULL) {
-		return -1;
-	}
-	if ((commands_unregistered = init_trie(NULL, is_valid, pos_to_char, char_to_pos, 'z' - 'a' + 1)) == NULL) {
-		free(commands_registered);
-		return -1;
-	}
-	i = add_commands(commands_unregistered, cmds_unregistered, array_count(cmds_unregistered));
-	j = add_commands(commands_registered, cmds_registered, array_count(cmds_registered));
+	i = add_commands(handlers_unregistered, cmds_unregistered, array_count(cmds_unregistered));
+	j = add_commands(handlers_registered, cmds_registered, array_count(cmds_registered));
 	return -!(i == 0 && j == 0);
 }
 
 /** Interprets an IRC message. Assumes that the message is syntactically correct, that is, `parse_msg()` did not return
    an error condition.
    Interpreting a message consists of redirecting the request to the appropriate function that knows how to process it.
-      This is done by searching through the commands trie (a different trie is selected whether the request came from a
-      registered or unregistered connection), and invoking the function pointed to by the trie's node data if a match is
-      found.
+      This is done by indexing a dispatch table with the command ID that `parse_msg()` found (a different table is
+      selected whether the request came from a registered or unregistered connection), and invoking the function stored
+      there, if any.
    If a match is not found, `ERR_NOTREGISTERED` is sent if the request came from an unregistered connection;
       `ERR_UNKNOWNCOMMAND` is sent if the request came from a registered connection.
+   Messages coming from server links are handed to `link_interpret()` instead.
    If a match is found, i.e., the command invoked really exists, the appropriate function is called to dispatch this
       request, and is passed every argument. Thus, this specific function works for a generic set of commands, no
       changes are necessary to accomodate new commands implementations, and each specific function holds as much
@@ -732,22 +890,25 @@ int cmds_init(void)
       `parse_msg()` [OPTIONAL].
    @param cmd Pointer to a null terminated characters sequence that denotes the command part of the message, as returned
       by `parse_msg()`.
+   @param cmd_id The command's ID, as returned by `parse_msg()`. `CMD_UNKNOWN` if the command does not exist.
    @param params Array of pointers to the command parameters filled by `parse_msg()`.
    @param params_size How many parameters are stored in `params`. This must be an integer greater than or equal to 0.
  */
-void interpret_msg(struct irc_client *client, char *prefix, char *cmd, char *params[], int params_size)
+void interpret_msg(struct irc_client *client, char *prefix, char *cmd, int cmd_id, char *params[], int params_size)
 {
-	struct cmd_func *command_func;
-	if (!client->is_registered) {
-		if ((command_func = (struct cmd_func*)find_word_trie(commands_unregistered, cmd)) == NULL) {
+	void (*handler)(struct irc_client *, char *, char *, char *[], int);
+	if (client->is_server) {
+		link_interpret(client, prefix, cmd_id, params, params_size);
+		return;
+	}
+	handler = (cmd_id == CMD_UNKNOWN ? NULL : (client->is_registered ? handlers_registered : handlers_unregistered)[cmd_id]);
+	if (handler == NULL) {
+		if (!client->is_registered) {
 			send_err_notregistered(client);
-			return;
-		}
-	} else {
-		if ((command_func = (struct cmd_func*)find_word_trie(commands_registered, cmd)) == NULL) {
+		} else {
 			send_err_unknowncommand(client, cmd);
-			return;
 		}
+		return;
 	}
-	(*command_func->f)(client, prefix, cmd, params, params_size);
+	handler(client, prefix, cmd, params, params_size);
 }
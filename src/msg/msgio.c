@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <errno.h>
 #include <string.h>
 #include <pthread.h>
 #include <sys/types.h>
@@ -16,33 +17,47 @@
    @date November 2013
  */
 
-/** Similar to `write_to()`, but in case of socket error, `terminate_session()` is called using `BAD_WRITE_QUIT_MSG` as a quit message.
-   @param client The client to read from.
-   @param buf Buffer to store the message read.
-   @param len Maximum length of the message. This is usually bounded by the size of `buf`. This parameter avoids buffer
-      overflow.
+/** Similar to `queue_to()`, but in case the message can't be queued, `terminate_session()` is called using `BAD_WRITE_QUIT_MSG` as a quit message.
+   The message is written into the socket when the client's output buffer is flushed.
+   @param client The client to write to.
+   @param buf Buffer holding the message.
+   @param len How many characters from `buf` to write.
+   @warning Since this function may call `terminate_session()`, it must not be used while holding locks.
  */
-inline void write_to_noerr(struct irc_client *client, char *buf, size_t len)
+void write_to_noerr(struct irc_client *client, char *buf, size_t len)
 {
-	if (write_to(client, buf, len) == -1) {
+	if (queue_to(client, buf, len) == -1) {
 		terminate_session(client, BAD_WRITE_QUIT_MSG);
 	}
 }
 
 /** Similar to `read_from()`, but in case of socket error, `terminate_session()` is called using `BAD_READ_QUIT_MSG` as a quit message.
+   Sockets are non-blocking, and a read can find no data even though the socket was reported readable (for example, when
+      only part of an SSL record arrived). This is not an error: `0` is returned, and the caller shall wait for the next
+      read event.
    @param client The client to read from.
    @param buf Buffer to store the message read.
    @param len Maximum length of the message. This is usually bounded by the size of `buf`. This parameter avoids buffer
       overflow.
-   @return A positive integer denoting the number of characters read.
+   @return A positive integer denoting the number of characters read, or `0` if there was nothing to read at the moment.
  */
-inline ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len)
+ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len)
 {
 	ssize_t msg_size;
-	if ((msg_size = read_from(client, buf, len)) <= 0) {
-		terminate_session(client, BAD_READ_QUIT_MSG);
+	int err;
+	if ((msg_size = read_from(client, buf, len)) > 0) {
+		return msg_size;
+	}
+	if (client->uses_ssl) {
+		err = SSL_get_error(client->ssl, (int) msg_size);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+			return 0;
+		}
+	} else if (msg_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
 	}
-	return msg_size;
+	terminate_session(client, BAD_READ_QUIT_MSG);
+	return msg_size; /* Never reached */
 }
 
 /** A printf equivalent version for yaIRCd that sends a set of arbitrarily long IRC messages into a client's socket.
@@ -50,7 +65,7 @@ inline ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len)
 	It is the upper code's responsability to ensure this doesn't happen. Not that that's a problem, it's just that it's a little bit annoying for the client
 	to receive messages that exceed the limits defined in the protocol.
 	This function never overflows, since it uses two levels of buffers: first, a buffer of size `MAX_MSG_SIZE` is attempted; if that isn't enough, a buffer of the exact needed
-	size is dynamically allocated, the resulting string is generated and printed to this buffer, sent to the client, and freed.
+	size is dynamically allocated, the resulting string is generated and printed to this buffer, queued in the client's output buffer, and freed.
    @param client The client to send information to
    @param fmt The format string, pretty much like printf.
    @param ... Optional parameters to match formatters.
@@ -108,3 +123,55 @@ int cmd_print_reply(char *buf, size_t size, const char *msg, ...)
 	}
 	return ret;
 }
+
+/** Appends a characters sequence to a message being built, truncating it if there isn't enough room.
+   @param buf The message.
+   @param pos How many characters are already in `buf`.
+   @param max Maximum number of characters in `buf`.
+   @param str What to append. Does not need to be null terminated.
+   @param len How many characters from `str` to append.
+   @return The new number of characters in `buf`.
+ */
+static size_t append_chars(char *buf, size_t pos, size_t max, const char *str, size_t len)
+{
+	if (len > max - pos) {
+		len = max - pos;
+	}
+	memcpy(buf + pos, str, len);
+	return pos + len;
+}
+
+/** Builds a message sent on behalf of a client, in the form "<prefix> <cmd> <target> :<trailing>\r\n", where `prefix` is the
+   client's pre-rendered prefix (see `update_client_prefix()`).
+   This is the fast path for messages that are relayed to other clients, such as PRIVMSG, JOIN, PART and QUIT: everything is
+      copied with `memcpy()`, no format string is parsed. The output is truncated in the same way as `cmd_print_reply()`.
+   @param buf Output buffer.
+   @param size How many characters, at most, can be written in `buf`. Must be greater than or equal to 3.
+   @param from The client on whose behalf the message is sent. It must be registered.
+   @param cmd The command.
+   @param target The command's middle parameter, or `NULL` if there is none.
+   @param trailing The command's trailing parameter, or `NULL` if there is none.
+   @return A number less than `size` indicating how many characters, excluding the null terminator, were written.
+ */
+int print_prefixed_msg(char *buf, size_t size, struct irc_client *from, const char *cmd, const char *target,
+		       const char *trailing)
+{
+	size_t max = size - 3;
+	size_t pos;
+
+	pos = append_chars(buf, 0, max, from->prefix, (size_t) from->prefix_len);
+	pos = append_chars(buf, pos, max, " ", 1);
+	pos = append_chars(buf, pos, max, cmd, strlen(cmd));
+	if (target != NULL) {
+		pos = append_chars(buf, pos, max, " ", 1);
+		pos = append_chars(buf, pos, max, target, strlen(target));
+	}
+	if (trailing != NULL) {
+		pos = append_chars(buf, pos, max, " :", 2);
+		pos = append_chars(buf, pos, max, trailing, strlen(trailing));
+	}
+	buf[pos++] = '\r';
+	buf[pos++] = '\n';
+	buf[pos] = '\0';
+	return (int) pos;
+}
@@ -4,6 +4,7 @@
 #include "protocol.h"
 #include "parsemsg.h"
 #include "msgio.h"
+#include "cmd_hash.h"
 
 /** @file
    @brief IRC Messages parser implementation
@@ -104,6 +105,8 @@ static int read_params(char *buf, char *params[MAX_IRC_PARAMS])
       `NULL`.
    @param cmd `cmd` will point to the beginning of the command field (first non space character in the message; first
       non space character after prefix if one exists). The end is determined by a `NUL` character.
+   @param cmd_id `cmd_id` will hold the command's ID (see `cmd_hash.h`), which is found while the command is scanned, so
+      that no one needs to search for the command again. Numeric replies and unknown commands get `CMD_UNKNOWN`.
    @param params An array of pointers to a character sequence. Each array element points to a position in `buf` denoting
       a parameter. Parameters are null terminated.
    @param params_filled `params_filled` will hold the number of parameters parsed. Thus, after returning, it is valid to
@@ -127,10 +130,11 @@ static int read_params(char *buf, char *params[MAX_IRC_PARAMS])
       sequence, and the value in `params_filled` is undefined. Thus, the caller shall always check the return value of
       this function before using any of the information it provides.
  */
-int parse_msg(char *buf, char **prefix, char **cmd, char *params[MAX_IRC_PARAMS], int *params_filled)
+int parse_msg(char *buf, char **prefix, char **cmd, int *cmd_id, char *params[MAX_IRC_PARAMS], int *params_filled)
 {
 	char *current;
 	char *next;
+	unsigned hash;
 	int ret;
 
 	current = skipspaces(buf);
@@ -156,17 +160,20 @@ int parse_msg(char *buf, char **prefix, char **cmd, char *params[MAX_IRC_PARAMS]
 		if (isdigit((unsigned char)*(current + 1)) && isdigit((unsigned char)*(current + 2)) &&
 		    (*(current + 3) == '\0' || *(current + 3) == ' ')) {
 			*cmd = current;
+			*cmd_id = CMD_UNKNOWN;
 			next = current + 3;
 		}else {
 			return -1;
 		}
 	}else {
-		for (next = current; *next != '\0' && isalpha((unsigned char)*next); next++)
-			;  /* Intentionally left blank */
+		for (next = current, hash = CMD_HASH_SEED; *next != '\0' && isalpha((unsigned char)*next); next++) {
+			hash = cmd_hash_step(hash, *next);
+		}
 		if (*next != '\0' && *next != ' ') {
 			/* Invalid command */
 			return -1;
 		}
+		*cmd_id = cmd_lookup_hashed(current, next - current, hash);
 	}
 	*params_filled = 0;
 	/* assert: *next == ' ' || *next == '\0' */
@@ -1,8 +1,12 @@
 #include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
 #include <ev.h>
 #include "read_msgs.h"
 #include "client.h"
 #include "msgio.h"
+#include "stats.h"
+#include "trace.h"
 
 /** @file
 	@brief IRC Messages reader
@@ -25,63 +29,125 @@ void initialize_irc_message(struct irc_message *in)
 	in->index = 0;
 	in->last_stop = 0;
 	in->msg_begin = 0;
+	in->discarding = 0;
 };
 
-/** Copies every characters from `buf[0..length-1] to `to`. Assumes `to` has enough space, which is safe because this
-   function is only used inside this fileas an auxiliary function from `next_msg()`.
-   @param to Pointer to the beginning of the target buffer.
-   @param buf Pointer to the buffer being copied.
-   @param length How many characters to copy from `buf`.
-   @note `to` and `buf` may overlap in memory, and in fact that is the case. `next_msg()` uses this function to bring a
-      message to the front of the queue.
+/** Makes room in a client's input buffer for new characters, as described in `read_data()`. There is always room for at
+   least one character afterwards.
+   @param client The client.
  */
-static void bring_to_top(char *to, char *buf, int length)
+static void make_room(struct irc_client *client)
 {
-	if (buf == to) {
-		return;
+	struct irc_message *client_msg = &client->last_msg;
+	int pending;
+
+	if (client_msg->msg_begin == client_msg->index) {
+		/* Every message was reported, start over for free */
+		client_msg->index = client_msg->last_stop = client_msg->msg_begin = 0;
+	} else if (sizeof(client_msg->msg) - client_msg->index < MAX_MSG_SIZE) {
+		pending = client_msg->index - client_msg->msg_begin;
+		if (pending == (int) sizeof(client_msg->msg)) {
+			/* next_msg() was not called, and the buffer is full of unreported data */
+			fprintf(stderr,
+				"Parse error: input buffer is full. Received by %s\n",
+				client->nick == NULL ? "<unregistered>" : client->nick);
+			initialize_irc_message(client_msg);
+		} else {
+			memmove(client_msg->msg, client_msg->msg + client_msg->msg_begin, pending);
+			client_msg->last_stop -= client_msg->msg_begin;
+			client_msg->index = pending;
+			client_msg->msg_begin = 0;
+		}
 	}
-	for (; length-- > 0; *to++ = *buf++)
-		;  /* Intentionally left blank */
+}
+
+/** Accounts for new characters stored at the end of a client's input buffer.
+   @param client The client.
+   @param nread How many characters were stored.
+ */
+static void data_arrived(struct irc_client *client, size_t nread)
+{
+	client->last_msg.index += (int) nread;
+	stats_bytes_in(nread);
+	TRACE_MSG_READ(client, nread);
+	/* We got something new, update activity timestamp for this client */
+	client->last_activity = ev_now(client->ev_loop);
+	client->connection_status = STATUS_OK;
 }
 
 /** Called everytime there is new data to read from the socket. After calling this function, it is advised to use
    `next_msg()` to retrieve the IRC messages that can be extracted from this read,otherwise, the caller risks losing
    space in the messages buffer.
+   Complete messages are never moved: they are reported by `next_msg()` where they were read. However, when there is not
+      enough room left at the end of the buffer for a whole message, the partial message that is still waiting for its
+      terminator (which is shorter than `MAX_MSG_SIZE`) is moved to the front of the buffer. This only happens once for
+      every `INPUT_BUFFER_SIZE - MAX_MSG_SIZE` characters read, at most.
    @param client The client that transmitted new data.
+   @param max Maximum number of characters to read, which must be at least `MAX_MSG_SIZE`. This is how the client's read
+      budget is enforced, see `struct read_budget` in `serverinfo.h`.
    @note This function never overflows. If it is called repeatedly without calling `next_msg()`, it will eventually run
       out of space and throw away everything read, emptying the buffer.
-   @note This function only eads what it can. This means that, for example, there may be 256 characters available to
-      read from the socket, but if there's only space to read 28, only 28 are read.
-   This is generally the case when IRC messages were fragmented and we are waiting for the rest of some message, which
-      means our buffer is not empty.
+   @note This function only reads what it can. A client that pipelines many messages will typically have all of them
+      read at once, since there is room for `INPUT_BUFFER_SIZE` characters.
    The function shall be called again if it is known that there is more data in the socket to parse, but only after
       calling `next_msg()` to free some space in the buffer.
  */
-void read_data(struct irc_client *client)
+void read_data(struct irc_client *client, size_t max)
 {
 	struct irc_message *client_msg = &client->last_msg;
-	if (sizeof(client_msg->msg) <= client_msg->index) {
-		/* If we get here, it means we have read a characters sequence of at least MAX_MSG_SIZE length without
-		   finding
-		   the message terminators \r\n. A lame client is messing around with the server. Reset the message
-		      buffer and log
-		   this malicious behavior.
-		 */
-		fprintf(stderr,
-			"Parse error: message exceeds maximum allowed length. Received by %s\n",
-			client->nick == NULL ? "<unregistered>" : client->nick);
-		initialize_irc_message(client_msg);
+	ssize_t nread;
+	size_t room;
+
+	make_room(client);
+	room = sizeof(client_msg->msg) - (size_t) client_msg->index;
+	if ((nread = read_from_noerr(client, client_msg->msg + client_msg->index, room < max ? room : max)) == 0) {
+		/* Spurious wakeup, or only part of an SSL record arrived */
+		return;
 	}
-	client_msg->index += read_from_noerr(client,
-					     client_msg->msg + client_msg->index,
-					     sizeof(client_msg->msg) - client_msg->index);
-	/* We got something new, update activity timestamp for this client */
-	client->last_activity = ev_now(client->ev_loop);
-	client->connection_status = STATUS_OK;
+	data_arrived(client, (size_t) nread);
+}
+
+/** Stores characters that were already received from a client's socket in his input buffer, exactly as `read_data()`
+   would have read them. This is used when the socket is read by someone else, such as io_uring (see `uring.h`).
+   As with `read_data()`, `next_msg()` must be called until it returns `MSG_CONTINUE` before calling this function again,
+   or the buffer will eventually be thrown away.
+   @param client The client.
+   @param buf The characters received.
+   @param len How many characters were received.
+   @return How many characters from `buf` were stored, which is at least `1` if `len` is not `0`. The rest must be stored
+      with another call, after calling `next_msg()`.
+ */
+size_t store_data(struct irc_client *client, const char *buf, size_t len)
+{
+	struct irc_message *client_msg = &client->last_msg;
+	size_t room;
+
+	make_room(client);
+	room = sizeof(client_msg->msg) - (size_t) client_msg->index;
+	if (len > room) {
+		len = room;
+	}
+	memcpy(client_msg->msg + client_msg->index, buf, len);
+	data_arrived(client, len);
+	return len;
+}
+
+/** Determines if an input buffer holds a complete message that `next_msg()` did not report yet.
+   @param client_msg The input buffer.
+   @return `1` if `next_msg()` would find a newline; `0` otherwise.
+ */
+int msg_pending(struct irc_message *client_msg)
+{
+	return memchr(client_msg->msg + client_msg->last_stop, '\n', client_msg->index - client_msg->last_stop) != NULL;
 }
 
 /** Analyzes the incoming messages buffer and the information read from the socket to determine if there's any IRC
    message that can be retrieved from the buffer at the moment.
+   Newlines are searched with `memchr()`, which the C library implements with vector instructions, and the search resumes
+      where the previous call stopped, so no character is ever looked at twice.
+   Messages longer than `MAX_MSG_SIZE` characters, including the newline, are thrown away and never reported. If the
+      newline for such a message has not arrived yet, every character up to the next newline is thrown away as it
+      arrives.
    @param client_msg The structure representing state information for the sockets reading performed earlier.
    @param msg If a new message is available, `msg` will point to the beginning of a characters sequence that holds an
       IRC message terminated with \\r\\n or \\n. The RFC mandates that IRC messages terminate with \\r\\n, but we found
@@ -108,28 +174,33 @@ void read_data(struct irc_client *client)
  */
 int next_msg(struct irc_message *client_msg, char **msg)
 {
-	int i;
-	int len;
 	char *buf = client_msg->msg;
-	for (i = client_msg->last_stop; i < client_msg->index && buf[i] != '\n'; i++)
-		;  /* Intentionally left blank */
+	char *newline;
+	int len;
 
-	/* assert: i == client_msg->index || buf[i] == '\n' */
-	if (i == client_msg->index) {
-		bring_to_top(client_msg->msg,
-			     client_msg->msg + client_msg->msg_begin,
-			     client_msg->index -= client_msg->msg_begin);
-		client_msg->last_stop = client_msg->index;
-		client_msg->msg_begin = 0;
-		return MSG_CONTINUE;
-	}else {
-		/* Wooho, a new message! */
-		len = i - client_msg->msg_begin;
-		*msg = client_msg->msg + client_msg->msg_begin;
-		if ((client_msg->last_stop = client_msg->msg_begin = i + 1) == sizeof(client_msg->msg)) {
-			/* Wrap around */
-			initialize_irc_message(client_msg);
+	while ((newline = memchr(buf + client_msg->last_stop, '\n', client_msg->index - client_msg->last_stop)) != NULL) {
+		len = newline - (buf + client_msg->msg_begin);
+		*msg = buf + client_msg->msg_begin;
+		client_msg->last_stop = client_msg->msg_begin = newline - buf + 1;
+		if (client_msg->discarding) {
+			/* This was the tail of a message that was already thrown away */
+			client_msg->discarding = 0;
+		} else if ((size_t) len >= MAX_MSG_SIZE) {
+			fprintf(stderr, "Parse error: message exceeds maximum allowed length.\n");
+		} else {
+			/* Wooho, a new message! */
+			return len;
+		}
+	}
+	/* assert: there is no newline in buf[msg_begin..index-1] */
+	client_msg->last_stop = client_msg->index;
+	if (client_msg->discarding || (size_t) (client_msg->index - client_msg->msg_begin) >= MAX_MSG_SIZE) {
+		/* A lame client is messing around with the server: throw away everything until the next newline */
+		if (!client_msg->discarding) {
+			fprintf(stderr, "Parse error: message exceeds maximum allowed length.\n");
 		}
-		return len;
+		client_msg->discarding = 1;
+		client_msg->msg_begin = client_msg->index;
 	}
+	return MSG_CONTINUE;
 }
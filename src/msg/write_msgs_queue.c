@@ -1,15 +1,23 @@
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
 #include "client.h"
 #include "write_msgs_queue.h"
 #include "msgio.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+#include "uring.h"
 /** @file
    @brief Client's messages write queue management functions
    This file provides a module that knows how to operate on a client's messages write queue.
-   It is easy for a client's thread to wake up and read incoming data using an IO watcher. However, sporadically, we
-      also need to wake up a client's thread to write to his socket.
-   For example, if user A PRIVMSGs user B, user A's thread must be able to somehow inform user B thread that something
-      needs to be sent to user B.
+   It is easy for a client's worker to wake up and read incoming data using an IO watcher. However, sporadically, we
+      also need to wake up a client's worker to write to his socket.
+   For example, if user A PRIVMSGs user B, user A's worker must be able to somehow inform user B's worker that
+      something needs to be sent to user B.
    To do so, we use an async watcher. An async watcher allows an arbitrary thread X to wake up another thread Y. Thread
       Y must be running an events loop and must have initialized and started an async watcher.
    An async watcher works pretty much the same way as an IO watcher, but libev's documentation explicitly states that
@@ -19,6 +27,13 @@
       system.
    Each client holds a queue of messages waiting to be written to his socket. These messages can originate from any
       thread.
+   A queue is a circular list of segments, each one referencing a buffer. Enqueueing a message copies it to the end of
+      the last private block, so that many small IRC messages end up in contiguous memory. Messages delivered to many
+      clients at once (channel messages, for example) are created once with `msg_buf_create()`, and every recipient's
+      queue just takes a reference to them.
+      Flushing a queue builds an `iovec` array with every segment and writes it with one `writev()` call (or one
+      `SSL_write()` per segment for secure connections). The queue's mutex is not held while writing to the socket: only
+      the client's worker flushes, and other threads only append characters after the region that is being written.
    Every operation in a client's queue shall be invoked through the use of the functions declared in this file.
    @author Filipe Goncalves
    @date November 2013
@@ -27,18 +42,82 @@
 /** Initializes a queue. This function is typically called when a new client is created.
    No queue insertions or deletions can be performed before initializing a queue.
    @param queue The queue to initialize.
+   @param max_bytes Hard limit, in characters, for the data waiting to be written. Messages that don't fit are dropped, and the
+      queue is marked as overflowed; see `client_queue_overflowed()`. This bounds the memory taken by a client that doesn't read
+      what is sent to him.
+   @param soft_bytes Soft limit, in characters. See `client_queue_above_soft()`.
    @return `0` on success; `-1` if there aren't enough resources to initialize a queue.
    @warning Undefined behavior will occur if queue operations are invoked in a non-initialized queue.
  */
-int client_queue_init(struct msg_queue *queue)
+int client_queue_init(struct msg_queue *queue, size_t max_bytes, size_t soft_bytes)
 {
+	if ((queue->segments = malloc(WRITE_QUEUE_INITIAL_SEGMENTS * sizeof(*queue->segments))) == NULL) {
+		return -1;
+	}
+	queue->capacity = WRITE_QUEUE_INITIAL_SEGMENTS;
 	queue->top = 0;
 	queue->bottom = 0;
 	queue->elements = 0;
-	return pthread_mutex_init(&queue->mutex, NULL);
+	queue->bytes = 0;
+	queue->max_bytes = max_bytes;
+	queue->soft_bytes = soft_bytes;
+	queue->overflowed = 0;
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+		free(queue->segments);
+		return -1;
+	}
+	return 0;
+}
+
+/** Changes a queue's limits. Messages already queued are kept, even if they are above the new hard limit.
+   @param queue The queue.
+   @param max_bytes The new hard limit, in characters. See `client_queue_init()`.
+   @param soft_bytes The new soft limit, in characters. See `client_queue_init()`.
+ */
+void client_queue_set_limits(struct msg_queue *queue, size_t max_bytes, size_t soft_bytes)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->max_bytes = max_bytes;
+	queue->soft_bytes = soft_bytes;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/** Copies every character waiting in a queue, in the order they would be written, into a new buffer. The queue is left
+   untouched.
+   @param queue The queue.
+   @param buf Where to store the new buffer, allocated with `malloc()`, which the caller must free. `NULL` if the queue is
+      empty.
+   @param len Where to store how many characters were copied.
+   @return `0` on success; `-1` if there isn't enough memory.
+ */
+int client_queue_copy(struct msg_queue *queue, char **buf, size_t *len)
+{
+	struct msg_segment *seg;
+	size_t size;
+	int i, n;
+
+	pthread_mutex_lock(&queue->mutex);
+	*buf = NULL;
+	*len = 0;
+	for (i = queue->bottom, n = 0, size = 0; n < queue->elements; i = (i + 1) & (queue->capacity - 1), n++) {
+		size += queue->segments[i].buf->length - queue->segments[i].sent;
+	}
+	if (size > 0 && (*buf = malloc(size)) == NULL) {
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+	for (i = queue->bottom, n = 0; n < queue->elements; i = (i + 1) & (queue->capacity - 1), n++) {
+		seg = &queue->segments[i];
+		size = seg->buf->length - seg->sent;
+		memcpy(*buf + *len, seg->buf->data + seg->sent, size);
+		*len += size;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return 0;
 }
 
 /** Destroys a queue. This function is typically called when a client is exiting and is about to be destroyed.
+   Every reference held by the queue is released.
    @param queue The queue to destroy.
    @return `0` on success, `-1` if the destroy operation was not successfull. The error condition should never happen if
       this module is used properly and no race conditions occur. If `-1` is returned, it means something went terribly
@@ -54,89 +133,399 @@ int client_queue_destroy(struct msg_queue *queue)
 {
 	int i;
 	int j;
-	for (i = queue->bottom, j = 0; j < queue->elements; i = (i + 1) % WRITE_QUEUE_SIZE, j++) {
-		free(queue->messages[i]);
+	for (i = queue->bottom, j = 0; j < queue->elements; i = (i + 1) & (queue->capacity - 1), j++) {
+		msg_buf_release(queue->segments[i].buf);
 	}
+	stats_queue_pop(queue->bytes);
+	free(queue->segments);
 	return pthread_mutex_destroy(&queue->mutex);
 }
 
+/** Makes sure that a queue has room for `more` new segments, growing its segments array if needed. Segments keep their
+   order, but the array may move, and the queue is unwrapped so that `bottom` is `0`. Must be called with the queue's lock held.
+   @param queue The queue.
+   @param more How many segments are about to be inserted.
+   @return `0` on success; `-1` if there's no memory to grow the array.
+ */
+static int reserve_segments(struct msg_queue *queue, int more)
+{
+	struct msg_segment *segments;
+	int capacity;
+	int first;
+
+	if (queue->elements + more <= queue->capacity) {
+		return 0;
+	}
+	for (capacity = queue->capacity * 2; capacity < queue->elements + more; capacity *= 2)
+		; /* Intentionally left blank */
+	if ((segments = malloc((size_t) capacity * sizeof(*segments))) == NULL) {
+		return -1;
+	}
+	first = queue->capacity - queue->bottom;
+	first = (first < queue->elements ? first : queue->elements);
+	memcpy(segments, queue->segments + queue->bottom, (size_t) first * sizeof(*segments));
+	memcpy(segments + first, queue->segments, (size_t) (queue->elements - first) * sizeof(*segments));
+	free(queue->segments);
+	queue->segments = segments;
+	queue->capacity = capacity;
+	queue->bottom = 0;
+	queue->top = queue->elements;
+	return 0;
+}
+
+/** Appends a segment to a queue, which must have room for it. Must be called with the queue's lock held.
+   @param queue The queue.
+   @param buf The buffer referenced by the new segment. The queue takes over the caller's reference.
+ */
+static void push_segment(struct msg_queue *queue, struct msg_buf *buf)
+{
+	queue->segments[queue->top].buf = buf;
+	queue->segments[queue->top].sent = 0;
+	queue->top = (queue->top + 1) & (queue->capacity - 1);
+	queue->elements++;
+}
+
+/** Allocates a new buffer with a single reference.
+   @param capacity How many characters the buffer can hold.
+   @param appendable `1` for a private block; `0` for a shared message.
+   @return The new buffer, with `length` set to `0`, or `NULL` if there's no memory.
+ */
+static struct msg_buf *msg_buf_alloc(size_t capacity, int appendable)
+{
+	struct msg_buf *buf;
+	if ((buf = pool_alloc(sizeof(*buf) + capacity)) == NULL) {
+		return NULL;
+	}
+	buf->refs = 1;
+	buf->appendable = appendable;
+	buf->capacity = capacity;
+	buf->length = 0;
+	return buf;
+}
+
+/** Creates an immutable, shared message holding a copy of `buf`. The message can be queued in as many queues as needed
+   with `client_enqueue_shared()`, without any further copies.
+   The caller owns one reference to the new message, and must release it with `msg_buf_release()` after queueing it
+      everywhere it needs to go.
+   @param buf A characters sequence, possibly not null terminated, with one or more complete IRC messages.
+   @param len How many characters from `buf` to store.
+   @return The new message, or `NULL` if there's no memory.
+ */
+struct msg_buf *msg_buf_create(const char *buf, size_t len)
+{
+	struct msg_buf *msg;
+	if ((msg = msg_buf_alloc(len, 0)) == NULL) {
+		return NULL;
+	}
+	memcpy(msg->data, buf, len);
+	msg->length = len;
+	return msg;
+}
+
+/** Releases a reference to a buffer. The buffer is freed when the last reference is released.
+   @param msg The buffer.
+ */
+void msg_buf_release(struct msg_buf *msg)
+{
+	if (__sync_sub_and_fetch(&msg->refs, 1) == 0) {
+		pool_free(msg);
+	}
+}
+
 /** Inserts a new message in a queue.
    @param queue The target queue where the message shall be written to.
-   @param message A null terminated characters sequence to enqueue. A fresh new copy of `message` is performed using
-      `strdup()`, to ensure that the characters sequence lives for as long as it is needed. The caller of this function
-      need not worry about allocating and freeing resources, this module will take care of that.
-   @return `0` on success; `-1` if there is no space left in this client's queue, or if there's no memory to perform a
-      fresh copy of the message.
+   @param message A null terminated characters sequence to enqueue. The message is copied into the queue's output buffer,
+      so the caller of this function need not worry about allocating and freeing resources.
+   @return `0` on success; `-1` if the queue's hard limit was reached, or if there's no memory to store the message.
  */
 int client_enqueue(struct msg_queue *queue, char *message)
 {
-	char *str;
+	return client_enqueue_buf(queue, message, strlen(message));
+}
+
+/** Inserts the first `len` characters of `buf` in a queue. The characters are appended to the last private block in the
+   queue, if there is one and it has enough space; new blocks are allocated as needed. Either the whole sequence is
+   queued, or nothing is.
+   @param queue The target queue where the characters shall be written to.
+   @param buf A characters sequence, possibly not null terminated. It is copied into the queue's output buffer.
+   @param len How many characters from `buf` to enqueue.
+   @return `0` on success; `-1` if the queue's hard limit was reached, if `len` is longer than `WRITE_MSG_MAX_BLOCKS` blocks, or if
+      there's no memory to store the characters.
+ */
+int client_enqueue_buf(struct msg_queue *queue, const char *buf, size_t len)
+{
+	struct msg_buf *blocks[WRITE_MSG_MAX_BLOCKS];
+	struct msg_buf *last;
+	size_t space;
+	size_t chunk;
+	int needed;
+	int i;
+
 	pthread_mutex_lock(&queue->mutex);
-	if ((str = strdup(message)) == NULL || queue->elements == WRITE_QUEUE_SIZE) {
+	last = (queue->elements == 0 ? NULL : queue->segments[(queue->top - 1) & (queue->capacity - 1)].buf);
+	if (last != NULL && !last->appendable) {
+		last = NULL;
+	}
+	space = (last == NULL ? 0 : last->capacity - last->length);
+	needed = (len <= space ? 0 : (int) ((len - space + WRITE_BLOCK_SIZE - 1) / WRITE_BLOCK_SIZE));
+	if (queue->bytes + len > queue->max_bytes) {
+		queue->overflowed = 1;
 		pthread_mutex_unlock(&queue->mutex);
 		return -1;
 	}
-	queue->messages[queue->top] = str;
-	queue->top = (queue->top + 1) % WRITE_QUEUE_SIZE;
-	queue->elements++;
+	if (needed > WRITE_MSG_MAX_BLOCKS || reserve_segments(queue, needed) == -1) {
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+	/* Allocate every new block we need first, so that we don't end up with half a message queued */
+	for (i = 0; i < needed; i++) {
+		if ((blocks[i] = msg_buf_alloc(WRITE_BLOCK_SIZE, 1)) == NULL) {
+			while (i-- > 0) {
+				pool_free(blocks[i]);
+			}
+			pthread_mutex_unlock(&queue->mutex);
+			return -1;
+		}
+	}
+	queue->bytes += len;
+	stats_queue_push(len, queue->bytes);
+	TRACE_MSG_ENQUEUE(queue, len);
+	if (last != NULL) {
+		chunk = (space < len ? space : len);
+		memcpy(last->data + last->length, buf, chunk);
+		last->length += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+	for (i = 0; i < needed; i++) {
+		chunk = (WRITE_BLOCK_SIZE < len ? WRITE_BLOCK_SIZE : len);
+		memcpy(blocks[i]->data, buf, chunk);
+		blocks[i]->length = chunk;
+		buf += chunk;
+		len -= chunk;
+		push_segment(queue, blocks[i]);
+	}
 	pthread_mutex_unlock(&queue->mutex);
 	return 0;
 }
 
-/** Dequeues a message previously enqueued. Dequeue operations follow a FIFO policy.
-   @param queue The target queue to extract the message.
-   @return Pointer to a null terminated characters sequence previously inserted in this queue; `NULL` if there are no
-      elements. The pointer returned must be freed by the caller after it is no longer needed.
-   @warning A memory leak will occur if the caller does not free the pointer returned when it no longer needs it.
+/** Inserts a shared message in a queue. No characters are copied: the queue takes a new reference to `msg`, which is
+   released after the message is written into the socket.
+   @param queue The target queue.
+   @param msg A shared message created with `msg_buf_create()`.
+   @return `0` on success; `-1` if the queue's hard limit was reached, or if there's no memory to grow the queue, in which
+      case no reference is taken.
  */
-char *client_dequeue(struct msg_queue *queue)
+int client_enqueue_shared(struct msg_queue *queue, struct msg_buf *msg)
 {
-	char *ptr;
 	pthread_mutex_lock(&queue->mutex);
-	if (queue->elements == 0) {
+	if (queue->bytes + msg->length > queue->max_bytes) {
+		queue->overflowed = 1;
 		pthread_mutex_unlock(&queue->mutex);
-		return NULL;
+		return -1;
+	}
+	if (reserve_segments(queue, 1) == -1) {
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
 	}
-	ptr = queue->messages[queue->bottom];
-	queue->bottom = (queue->bottom + 1) % WRITE_QUEUE_SIZE;
-	queue->elements--;
+	__sync_fetch_and_add(&msg->refs, 1);
+	push_segment(queue, msg);
+	queue->bytes += msg->length;
+	stats_queue_push(msg->length, queue->bytes);
+	TRACE_MSG_ENQUEUE(queue, msg->length);
 	pthread_mutex_unlock(&queue->mutex);
-	return ptr;
+	return 0;
 }
 
 /** Determines if a queue is empty.
    @param queue The queue to examine.
    @return `0` if the queue is not empty; `1` if the queue is empty.
  */
-inline int client_is_queue_empty(struct msg_queue *queue)
+int client_is_queue_empty(struct msg_queue *queue)
 {
 	int ret;
 	pthread_mutex_lock(&queue->mutex);
-	ret = (queue->elements == 0);
+	ret = (queue->bytes == 0);
 	pthread_mutex_unlock(&queue->mutex);
 	return ret;
 }
 
-/** Function used when a client wants to flush his messages write queue.
-	This will destructively iterate through a queue for a given client, writing every pending message
-	to this client's socket.
-	@param client Target client.
-	@param queue The queue to flush.
+/** Determines if a queue holds more data than its soft limit. A client whose own queue is above the soft limit is producing
+   output faster than he reads it (for example, by flooding commands with long replies); his worker stops reading his commands
+   until the queue drains.
+   @param queue The queue to examine.
+   @return `1` if the queue is above its soft limit; `0` otherwise.
+ */
+int client_queue_above_soft(struct msg_queue *queue)
+{
+	int ret;
+	pthread_mutex_lock(&queue->mutex);
+	ret = (queue->bytes > queue->soft_bytes);
+	pthread_mutex_unlock(&queue->mutex);
+	return ret;
+}
+
+/** Determines if a message was ever dropped from a queue because of its hard limit.
+   @param queue The queue to examine.
+   @return `1` if the queue overflowed, in which case its owner shall be disconnected; `0` otherwise.
  */
-void flush_queue(struct irc_client *client, struct msg_queue *queue)
+int client_queue_overflowed(struct msg_queue *queue)
 {
-	/* We ignore possible errors that may arise during a write. We use write_to(), not write_to_noerr(),
-	   because write_to_noerr() calls pthread_exit() if things go wrong, and we can't call pthread_exit() here,
-	   since we're holding a lock to a queue. Things would fall apart if we did so.
-	 */
+	int ret;
+	pthread_mutex_lock(&queue->mutex);
+	ret = queue->overflowed;
+	pthread_mutex_unlock(&queue->mutex);
+	return ret;
+}
+
+/** Writes a set of buffers into a secure connection. Each buffer is written with one `SSL_write()` call; the connection
+   is assumed to have `SSL_MODE_ENABLE_PARTIAL_WRITE` and `SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER` set.
+   @param ssl The connection.
+   @param iov Buffers to write.
+   @param iovcnt How many buffers are in `iov`.
+   @return How many characters were written, which can be less than the total size of `iov` if the connection can't take
+      more data at the moment. If nothing was written because the connection would block, `-1` is returned with `errno`
+      set to `EAGAIN`. If a write error occurs, `-1` is returned with `errno` set to `EPIPE`.
+ */
+static ssize_t ssl_writev(SSL *ssl, struct iovec *iov, int iovcnt)
+{
+	ssize_t total;
+	int ret;
+	int err;
 	int i;
-	int j;
+
+	total = 0;
+	for (i = 0; i < iovcnt; i++) {
+		ret = SSL_write(ssl, iov[i].iov_base, (int) iov[i].iov_len);
+		if (ret <= 0) {
+			err = SSL_get_error(ssl, ret);
+			if (total > 0) {
+				return total;
+			}
+			errno = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? EAGAIN : EPIPE;
+			return -1;
+		}
+		total += ret;
+		if ((size_t) ret < iov[i].iov_len) {
+			break;
+		}
+	}
+	return total;
+}
+
+/** Discards the first `written` characters of a queue, which were successfully written into the socket, releasing every
+   buffer that was completely written.
+   @param queue The queue.
+   @param written How many characters were written.
+ */
+void client_queue_consume(struct msg_queue *queue, size_t written)
+{
+	struct msg_segment *seg;
+	size_t chunk;
+
 	pthread_mutex_lock(&queue->mutex);
-	for (i = queue->bottom, j = 0; j < queue->elements; j++, i = (i + 1) % WRITE_QUEUE_SIZE) {
-		(void)write_to(client, queue->messages[i], strlen(queue->messages[i]));
-		free(queue->messages[i]);
+	queue->bytes -= written;
+	stats_queue_pop(written);
+	while (written > 0) {
+		seg = &queue->segments[queue->bottom];
+		chunk = seg->buf->length - seg->sent;
+		chunk = (chunk < written ? chunk : written);
+		seg->sent += chunk;
+		written -= chunk;
+		if (seg->sent == seg->buf->length) {
+			msg_buf_release(seg->buf);
+			queue->bottom = (queue->bottom + 1) & (queue->capacity - 1);
+			queue->elements--;
+		}
 	}
-	queue->bottom = queue->top = queue->elements = 0;
 	pthread_mutex_unlock(&queue->mutex);
 }
 
+/** Describes the characters waiting at the bottom of a queue, in the order they shall be written, for a write that completes
+   asynchronously. A reference to each buffer described is taken, so that the buffers outlive the queue until the write
+   completes; once it does, the characters written must be discarded with `client_queue_consume()`, and the references
+   released with `msg_buf_release()`.
+   @param queue The queue.
+   @param iov Where to store the description of each segment.
+   @param bufs Where to store the buffer of each segment.
+   @param max How many positions `iov` and `bufs` have.
+   @return How many positions of `iov` and `bufs` were filled; `0` if the queue is empty.
+ */
+int client_queue_gather(struct msg_queue *queue, struct iovec *iov, struct msg_buf **bufs, int max)
+{
+	struct msg_segment *seg;
+	int i, n;
+
+	pthread_mutex_lock(&queue->mutex);
+	for (i = queue->bottom, n = 0; n < queue->elements && n < max; i = (i + 1) & (queue->capacity - 1), n++) {
+		seg = &queue->segments[i];
+		iov[n].iov_base = seg->buf->data + seg->sent;
+		iov[n].iov_len = seg->buf->length - seg->sent;
+		bufs[n] = seg->buf;
+		__sync_fetch_and_add(&seg->buf->refs, 1);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return n;
+}
+
+/** Function used when a client wants to flush his messages write queue.
+	This will write every pending message to this client's socket, using as few system calls as possible.
+	The socket is assumed to be non-blocking: if it can't take every pending message, this function returns `FLUSH_PENDING`,
+	and the caller shall call it again when the socket becomes writable.
+	Only the worker that owns `client` can flush his queue.
+	@param client Target client.
+	@param queue The queue to flush.
+	@return `FLUSH_DONE` if the queue is empty after this call; `FLUSH_PENDING` if there is still data waiting to be written,
+	or `FLUSH_ERROR` if a write error occurred. This function does not call `terminate_session()` on errors; that is up to the
+	caller.
+	@note For clients served through io_uring, the write is only prepared, see `uring_flush()`.
+ */
+int flush_queue(struct irc_client *client, struct msg_queue *queue)
+{
+	struct iovec iov[WRITE_FLUSH_SEGMENTS];
+	struct msg_segment *seg;
+	ssize_t written;
+	size_t total;
+	int iovcnt;
+	int i;
+
+#ifdef YAIRCD_URING
+	if (client->uring != NULL) {
+		return uring_flush(client, queue);
+	}
+#endif
+	for (;;) {
+		pthread_mutex_lock(&queue->mutex);
+		total = 0;
+		for (i = queue->bottom, iovcnt = 0; iovcnt < queue->elements && iovcnt < WRITE_FLUSH_SEGMENTS;
+		     i = (i + 1) & (queue->capacity - 1), iovcnt++) {
+			seg = &queue->segments[i];
+			iov[iovcnt].iov_base = seg->buf->data + seg->sent;
+			iov[iovcnt].iov_len = seg->buf->length - seg->sent;
+			total += iov[iovcnt].iov_len;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+
+		if (iovcnt == 0) {
+			return FLUSH_DONE;
+		}
+		if (client->uses_ssl) {
+			written = ssl_writev(client->ssl, iov, iovcnt);
+		} else {
+			written = writev(client->socket_fd, iov, iovcnt);
+		}
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? FLUSH_PENDING : FLUSH_ERROR;
+		}
+		stats_bytes_out((size_t) written);
+		TRACE_MSG_FLUSH(client, queue, written);
+		client_queue_consume(queue, (size_t) written);
+		if ((size_t) written < total) {
+			return FLUSH_PENDING;
+		}
+		/* Everything was written; loop again in case someone queued more in the meantime */
+	}
+}
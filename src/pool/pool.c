@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+/** @file
+	@brief Slab pools implementation
+
+	Every object is preceded by a `POOL_HEADER_SIZE` bytes header holding a pointer to the pool it came from, or `NULL` if it
+	was allocated with `malloc()`. The header is as large as the alignment guaranteed by `malloc()`, so objects are just as
+	well aligned. While an object is free, its first bytes link it to the next free object.
+
+	A pool's free list and counters are only touched by the thread that owns the pool. Other threads push the objects they
+	free into the pool's `remote` list with a compare and swap; the owner takes the whole list at once with an atomic
+	exchange, so there's no ABA problem.
+
+	The size classes must all be added before the first thread creates its pools; after that, the classes table is read
+	only.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** Size of the header that precedes every object */
+#define POOL_HEADER_SIZE 16
+
+/** Generic size classes set up by `pool_init()` */
+static const size_t generic_classes[] = { 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048 };
+
+/** An object while it is free */
+struct pool_object {
+	struct pool_object *next; /**<Next free object. */
+};
+
+/** A slab. Objects follow this structure, each one `POOL_HEADER_SIZE + size` bytes long. */
+struct pool_slab {
+	struct pool_slab *next; /**<Next slab in the same pool. */
+};
+
+/** A pool of objects of the same size class, owned by one thread. */
+struct pool {
+	size_t size; /**<Object size for this class, header not included. A multiple of `POOL_HEADER_SIZE`. */
+	int per_slab; /**<How many objects fit in a slab. */
+	struct pool_object *free; /**<Free objects, only touched by the owner. */
+	struct pool_object *remote; /**<Objects freed by other threads, waiting to be taken back by the owner. */
+	struct pool_slab *slabs; /**<Every slab allocated for this pool. */
+	unsigned long slabs_no; /**<How many slabs were allocated. */
+	unsigned long allocs; /**<How many objects were allocated. Only touched by the owner. */
+	unsigned long local_frees; /**<How many objects were freed by the owner. */
+	unsigned long remote_frees; /**<How many objects were freed by other threads. Updated atomically. */
+};
+
+/** Every pool owned by one thread, one per size class */
+struct pool_cache {
+	struct pool pools[POOL_MAX_CLASSES]; /**<The pools, in the same order as `class_sizes`. */
+	struct pool_cache *next; /**<Next thread's pools, in the `caches` list. */
+};
+
+static size_t class_sizes[POOL_MAX_CLASSES]; /**<Object size for each class, in increasing order. */
+static int classes_no; /**<How many entries are stored in `class_sizes`. */
+
+static struct pool_cache *caches; /**<Every thread's pools, for `pool_get_stats()`. */
+static int threads_no; /**<How many entries exist in `caches`. */
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `caches` and `threads_no`. */
+
+static unsigned long fallback_in_use; /**<How many objects allocated with `malloc()` are in use. Updated atomically. */
+
+static __thread struct pool_cache *thread_cache; /**<The calling thread's pools, or `NULL` if it has none. */
+
+/** Rounds a size up to a multiple of `POOL_HEADER_SIZE`.
+	@param size The size.
+	@return The rounded size.
+*/
+static size_t round_size(size_t size)
+{
+	return (size + POOL_HEADER_SIZE - 1) & ~(size_t) (POOL_HEADER_SIZE - 1);
+}
+
+/** Sets up the generic size classes. This must be called once by the main thread, before any thread creates its pools.
+	@return `0` on success; `-1` if there's no room for the classes, which should never happen.
+*/
+int pool_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(generic_classes) / sizeof(generic_classes[0]); i++) {
+		if (pool_add_class(generic_classes[i]) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Adds a size class, for objects of exactly `size` bytes (rounded up to the header's alignment). Adding a size that
+	already exists does nothing. This must only be called by the main thread, before any thread creates its pools.
+	@param size Object size.
+	@return `0` on success; `-1` if there are already `POOL_MAX_CLASSES` classes.
+*/
+int pool_add_class(size_t size)
+{
+	int i;
+
+	size = round_size(size);
+	for (i = 0; i < classes_no && class_sizes[i] < size; i++)
+		; /* Intentionally left blank */
+	if (i < classes_no && class_sizes[i] == size) {
+		return 0;
+	}
+	if (classes_no == POOL_MAX_CLASSES) {
+		fprintf(stderr, "::pool.c:pool_add_class(): Too many size classes, %lu bytes objects won't be pooled.\n",
+			(unsigned long) size);
+		return -1;
+	}
+	memmove(&class_sizes[i + 1], &class_sizes[i], (classes_no - i) * sizeof(class_sizes[0]));
+	class_sizes[i] = size;
+	classes_no++;
+	return 0;
+}
+
+/** Creates the calling thread's pools. Every worker thread calls this once, when it starts. From then on, its allocations
+	come from its own pools.
+	@return `0` on success; `-1` if there is not enough memory, in which case the thread keeps using `malloc()`.
+*/
+int pool_thread_init(void)
+{
+	struct pool_cache *cache;
+	int i;
+
+	if ((cache = calloc(1, sizeof(*cache))) == NULL) {
+		return -1;
+	}
+	for (i = 0; i < classes_no; i++) {
+		cache->pools[i].size = class_sizes[i];
+		cache->pools[i].per_slab = (int) ((POOL_SLAB_SIZE - sizeof(struct pool_slab)) / (POOL_HEADER_SIZE + class_sizes[i]));
+		if (cache->pools[i].per_slab < POOL_MIN_SLAB_OBJECTS) {
+			cache->pools[i].per_slab = POOL_MIN_SLAB_OBJECTS;
+		}
+	}
+	pthread_mutex_lock(&caches_mutex);
+	cache->next = caches;
+	caches = cache;
+	threads_no++;
+	pthread_mutex_unlock(&caches_mutex);
+	thread_cache = cache;
+	return 0;
+}
+
+/** Finds the class for an object.
+	@param size Object size.
+	@return Index of the smallest class that fits `size`; `-1` if it's larger than every class.
+*/
+static int class_of(size_t size)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = classes_no;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (class_sizes[mid] < size) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < classes_no ? lo : -1;
+}
+
+/** Adds a new slab to a pool, and puts every object in it in the pool's free list.
+	@param pool The pool. Its free list must be empty.
+	@return `0` on success; `-1` if there is not enough memory.
+*/
+static int pool_grow(struct pool *pool)
+{
+	struct pool_slab *slab;
+	struct pool_object *obj;
+	size_t stride = POOL_HEADER_SIZE + pool->size;
+	char *base;
+	int i;
+
+	if ((slab = malloc(round_size(sizeof(*slab)) + stride * pool->per_slab)) == NULL) {
+		return -1;
+	}
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->slabs_no++;
+	base = (char *) slab + round_size(sizeof(*slab));
+	for (i = pool->per_slab - 1; i >= 0; i--) {
+		*(struct pool **) (base + i * stride) = pool;
+		obj = (struct pool_object *) (base + i * stride + POOL_HEADER_SIZE);
+		obj->next = pool->free;
+		pool->free = obj;
+	}
+	return 0;
+}
+
+/** Allocates an object with `malloc()`, for threads without pools and for objects larger than every class.
+	@param size Object size.
+	@return The object; `NULL` if there is not enough memory.
+*/
+static void *fallback_alloc(size_t size)
+{
+	char *mem;
+
+	if ((mem = malloc(POOL_HEADER_SIZE + size)) == NULL) {
+		return NULL;
+	}
+	*(struct pool **) mem = NULL;
+	__sync_add_and_fetch(&fallback_in_use, 1);
+	return mem + POOL_HEADER_SIZE;
+}
+
+/** Allocates an object. If the calling thread has pools, the object comes from the smallest class it fits in; otherwise,
+	it is allocated with `malloc()`.
+	@param size Object size, in bytes.
+	@return The object, which must be released with `pool_free()`; `NULL` if there is not enough memory. Its contents are
+	   undefined.
+*/
+void *pool_alloc(size_t size)
+{
+	struct pool *pool;
+	struct pool_object *obj;
+	int cls;
+
+	if (thread_cache == NULL || (cls = class_of(size)) == -1) {
+		return fallback_alloc(size);
+	}
+	pool = &thread_cache->pools[cls];
+	if (pool->free == NULL) {
+		pool->free = __sync_lock_test_and_set(&pool->remote, NULL);
+		if (pool->free == NULL && pool_grow(pool) == -1) {
+			return NULL;
+		}
+	}
+	obj = pool->free;
+	pool->free = obj->next;
+	pool->allocs++;
+	return obj;
+}
+
+/** Allocates an object filled with zeros. See `pool_alloc()`.
+	@param size Object size, in bytes.
+	@return The object, which must be released with `pool_free()`; `NULL` if there is not enough memory.
+*/
+void *pool_calloc(size_t size)
+{
+	void *ptr;
+
+	if ((ptr = pool_alloc(size)) != NULL) {
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+/** Releases an object. Any thread can release any object, no matter which thread allocated it.
+	@param ptr The object, as returned by `pool_alloc()` or `pool_calloc()`. Can be `NULL`, in which case nothing happens.
+*/
+void pool_free(void *ptr)
+{
+	struct pool_object *obj = (struct pool_object *) ptr;
+	struct pool_object *head;
+	struct pool_object *expected;
+	struct pool *pool;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if ((pool = *(struct pool **) ((char *) ptr - POOL_HEADER_SIZE)) == NULL) {
+		__sync_sub_and_fetch(&fallback_in_use, 1);
+		free((char *) ptr - POOL_HEADER_SIZE);
+		return;
+	}
+	if (thread_cache != NULL && pool >= thread_cache->pools && pool < thread_cache->pools + POOL_MAX_CLASSES) {
+		obj->next = pool->free;
+		pool->free = obj;
+		pool->local_frees++;
+		return;
+	}
+	/* Guess that the remote list is empty; every failed swap tells us its actual head */
+	head = NULL;
+	do {
+		expected = head;
+		obj->next = expected;
+	} while ((head = __sync_val_compare_and_swap(&pool->remote, expected, obj)) != expected);
+	__sync_add_and_fetch(&pool->remote_frees, 1);
+}
+
+/** Reports the occupancy of every size class, added over every thread's pools. Counters owned by other threads are read
+	without synchronization, so the figures are only a close approximation while the server is busy.
+	@param stats Where the report is stored.
+*/
+void pool_get_stats(struct pool_stats *stats)
+{
+	struct pool_cache *cache;
+	struct pool *pool;
+	unsigned long frees;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->classes_no = classes_no;
+	for (i = 0; i < classes_no; i++) {
+		stats->classes[i].size = class_sizes[i];
+	}
+	pthread_mutex_lock(&caches_mutex);
+	stats->threads = threads_no;
+	for (cache = caches; cache != NULL; cache = cache->next) {
+		for (i = 0; i < classes_no; i++) {
+			pool = &cache->pools[i];
+			frees = pool->local_frees + __sync_add_and_fetch(&pool->remote_frees, 0);
+			stats->classes[i].slabs += pool->slabs_no;
+			stats->classes[i].capacity += pool->slabs_no * (unsigned long) pool->per_slab;
+			stats->classes[i].allocs += pool->allocs;
+			stats->classes[i].remote_frees += pool->remote_frees;
+			stats->classes[i].in_use += (pool->allocs > frees ? pool->allocs - frees : 0);
+		}
+	}
+	pthread_mutex_unlock(&caches_mutex);
+	stats->fallback_in_use = __sync_add_and_fetch(&fallback_in_use, 0);
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "protocol.h"
+#include "burst.h"
+#include "reply.h"
+#include "msgio.h"
+#include "serverinfo.h"
+#include "write_msgs_queue.h"
+
+/** @file
+	@brief Registration burst implementation
+
+	A template is a characters sequence holding every message of the burst, except for `RPL_WELCOME`, with the nickname
+	left out, plus the offsets in that sequence where the nickname must be pasted.
+	Every message in a template is already truncated such that it fits in `MAX_MSG_SIZE` with a nickname as long as
+	`MAX_NICK_LENGTH`.
+
+	Workers greet new clients while the main thread may be rendering a new template after a `SIGHUP`. Templates are
+	reference counted: `send_burst()` holds a reference while it copies the current template, and `burst_rehash()` swaps
+	the current template under `burst_mutex` and drops the reference for the old one, which is freed by whoever holds it
+	last.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** A rendered burst template */
+struct burst {
+	int refs; /**<How many references exist to this template. Updated atomically. */
+	char *text; /**<The burst, without nicknames. It is not null terminated. */
+	size_t length; /**<How many characters are stored in `text`. */
+	size_t capacity; /**<How many characters fit in `text`. */
+	size_t *holes; /**<Offsets in `text` where the nickname goes, in increasing order. */
+	int holes_count; /**<How many entries are stored in `holes`. */
+	int holes_capacity; /**<How many entries fit in `holes`. */
+};
+
+/** Largest part of a burst queued at once. A single message can't take more than `WRITE_MSG_MAX_BLOCKS` new blocks, so
+	longer bursts are queued in parts, each ending at a message boundary.
+*/
+#define BURST_CHUNK_SIZE ((WRITE_MSG_MAX_BLOCKS - 1) * WRITE_BLOCK_SIZE)
+
+static struct burst *current; /**<The template sent to clients that register from now on. */
+static pthread_mutex_t burst_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `current`. */
+
+/** Drops a reference to a template, freeing it if it was the last one.
+	@param burst The template. Can be `NULL`.
+*/
+static void burst_release(struct burst *burst)
+{
+	if (burst != NULL && __sync_sub_and_fetch(&burst->refs, 1) == 0) {
+		free(burst->text);
+		free(burst->holes);
+		free(burst);
+	}
+}
+
+/** Gets a reference to the current template. It must be dropped with `burst_release()`.
+	@return The current template.
+*/
+static struct burst *burst_acquire(void)
+{
+	struct burst *burst;
+	pthread_mutex_lock(&burst_mutex);
+	burst = current;
+	__sync_add_and_fetch(&burst->refs, 1);
+	pthread_mutex_unlock(&burst_mutex);
+	return burst;
+}
+
+/** Appends characters to a template being rendered, growing it if needed.
+	@param burst The template.
+	@param str What to append. Does not need to be null terminated.
+	@param len How many characters from `str` to append.
+	@return `0` on success; `-1` if there is not enough memory.
+*/
+static int burst_append(struct burst *burst, const char *str, size_t len)
+{
+	size_t capacity;
+	char *text;
+	if (burst->length + len > burst->capacity) {
+		for (capacity = burst->capacity == 0 ? BURST_INITIAL_SIZE : burst->capacity; capacity < burst->length + len;
+		     capacity *= 2)
+			; /* Intentionally left blank */
+		if ((text = realloc(burst->text, capacity)) == NULL) {
+			return -1;
+		}
+		burst->text = text;
+		burst->capacity = capacity;
+	}
+	memcpy(burst->text + burst->length, str, len);
+	burst->length += len;
+	return 0;
+}
+
+/** Marks the end of a template being rendered as a place where the nickname goes.
+	@param burst The template.
+	@return `0` on success; `-1` if there is not enough memory.
+*/
+static int burst_hole(struct burst *burst)
+{
+	size_t *holes;
+	if (burst->holes_count == burst->holes_capacity) {
+		holes = realloc(burst->holes, sizeof(*holes) *
+				(burst->holes_capacity == 0 ? BURST_INITIAL_HOLES : 2 * burst->holes_capacity));
+		if (holes == NULL) {
+			return -1;
+		}
+		burst->holes = holes;
+		burst->holes_capacity = burst->holes_capacity == 0 ? BURST_INITIAL_HOLES : 2 * burst->holes_capacity;
+	}
+	burst->holes[burst->holes_count++] = burst->length;
+	return 0;
+}
+
+/** Renders a numeric reply into a template, as ":<server name> <numeric> <nick><rest>\\r\\n". The rest of the reply is
+	truncated if the whole message would not fit in `MAX_MSG_SIZE` for a nickname with `MAX_NICK_LENGTH` characters.
+	@param burst The template.
+	@param numeric The numeric, as defined in `protocol.h`.
+	@param fmt Format string for the rest of the reply, which must start with a space.
+	@param ... Arguments matching `fmt`.
+	@return `0` on success; `-1` if there is not enough memory.
+*/
+static int burst_line(struct burst *burst, const char *numeric, const char *fmt, ...)
+{
+	char rest[MAX_MSG_SIZE + 1];
+	size_t header, room, len;
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(rest, sizeof(rest), fmt, args);
+	va_end(args);
+	len = (ret < 0 ? 0 : (size_t) ret >= sizeof(rest) ? sizeof(rest) - 1 : (size_t) ret);
+	header = strlen(get_server_name()) + strlen(numeric) + 3;
+	room = (header + MAX_NICK_LENGTH + 2 < MAX_MSG_SIZE ? MAX_MSG_SIZE - header - MAX_NICK_LENGTH - 2 : 0);
+	if (len > room) {
+		len = room;
+	}
+	if (burst_append(burst, ":", 1) == -1 || burst_append(burst, get_server_name(), strlen(get_server_name())) == -1 ||
+	    burst_append(burst, " ", 1) == -1 || burst_append(burst, numeric, strlen(numeric)) == -1 ||
+	    burst_append(burst, " ", 1) == -1 || burst_hole(burst) == -1 || burst_append(burst, rest, len) == -1 ||
+	    burst_append(burst, "\r\n", 2) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+/** Renders a new template from the current settings and MOTD.
+	@return The new template, holding one reference; `NULL` if there is not enough memory.
+*/
+static struct burst *burst_render(void)
+{
+	struct burst *burst;
+	MOTD_ENTRY motd;
+	MOTD_ENTRY motd_iterator;
+	int err;
+
+	if ((burst = calloc(1, sizeof(*burst))) == NULL) {
+		return NULL;
+	}
+	burst->refs = 1;
+	err = burst_line(burst, RPL_YOURHOST, " :Your host is %s, running version %s", get_server_name(), YAIRCD_VERSION);
+	err |= burst_line(burst, RPL_CREATED, " :This server was created %s", __DATE__ " " __TIME__);
+	err |= burst_line(burst, RPL_MYINFO, " :%s %s %s %s", get_server_name(), YAIRCD_VERSION, "UMODES=xTR",
+			  "CHANMODES=mvil");
+	err |= burst_line(burst, RPL_ISUPPORT, " CHANTYPES=# CHANLIMIT=#:%d NICKLEN=%d NETWORK=%s :are supported by this server",
+			  get_chanlimit(), MAX_NICK_LENGTH, get_net_name());
+	if ((motd = get_motd()) == NULL) {
+		err |= burst_line(burst, ERR_NOMOTD, " :MOTD File is missing");
+	} else {
+		err |= burst_line(burst, RPL_MOTDSTART, " :- %s Message of the day - ", get_server_name());
+		motd_entry_for_each(motd, motd_iterator) {
+			err |= burst_line(burst, RPL_MOTD, " :- %s", motd_entry_line(motd_iterator));
+		}
+		err |= burst_line(burst, RPL_ENDOFMOTD, " :End of /MOTD command");
+	}
+	if (err) {
+		burst_release(burst);
+		return NULL;
+	}
+	return burst;
+}
+
+/** Renders the first template. This must be called exactly once by the main thread, after the configuration file is loaded
+	and before any client registers.
+	@return `0` on success; `-1` if there is not enough memory.
+*/
+int burst_init(void)
+{
+	if ((current = burst_render()) == NULL) {
+		fprintf(stderr, "::burst.c:burst_init(): Not enough memory to render the registration burst.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/** Reloads the MOTD file and renders a new template with it. Clients that are being greeted at the same time finish with
+	the old template. This must only be called by the main thread.
+	@return `0` on success; `-1` if there is not enough memory, in which case the old template stays in use.
+*/
+int burst_rehash(void)
+{
+	struct burst *burst;
+	struct burst *old;
+
+	reload_motd();
+	if ((burst = burst_render()) == NULL) {
+		fprintf(stderr, "::burst.c:burst_rehash(): Not enough memory to render the registration burst.\n");
+		return -1;
+	}
+	pthread_mutex_lock(&burst_mutex);
+	old = current;
+	current = burst;
+	pthread_mutex_unlock(&burst_mutex);
+	burst_release(old);
+	return 0;
+}
+
+/** Greets a client that just registered with the welcome messages (001 to 005) and the MOTD. Everything is rendered at once,
+	and queued in as few parts as possible, see `BURST_CHUNK_SIZE`. If the burst can't be queued, the client's session is terminated.
+	@note The whole burst must still fit in the client's hard limit (the `sendq` setting of his listening socket), since nothing
+	   is written until it was all queued.
+	@param client The new client. Its nickname, username and hostname must be known.
+	@warning Since this function may call `terminate_session()`, it must not be used while holding locks.
+*/
+void send_burst(struct irc_client *client)
+{
+	struct reply welcome;
+	struct burst *burst;
+	size_t welcome_len, nick_len, total, pos, prev, len;
+	char *buf;
+	char *nl;
+	int i, ret;
+
+	reply_numeric(&welcome, client, RPL_WELCOME);
+	reply_trailing(&welcome, "Welcome to the Internet Relay Network ");
+	reply_append(&welcome, client->nick);
+	reply_append(&welcome, "!");
+	reply_append(&welcome, client->username);
+	reply_append(&welcome, "@");
+	reply_append(&welcome, client->hostname);
+	welcome_len = reply_end(&welcome);
+
+	burst = burst_acquire();
+	nick_len = strlen(client->nick);
+	total = welcome_len + burst->length + (size_t) burst->holes_count * nick_len;
+	if ((buf = malloc(total)) == NULL) {
+		burst_release(burst);
+		terminate_session(client, NO_MEM_QUIT_MSG);
+		return;
+	}
+	memcpy(buf, welcome.buf, welcome_len);
+	pos = welcome_len;
+	prev = 0;
+	for (i = 0; i < burst->holes_count; i++) {
+		memcpy(buf + pos, burst->text + prev, burst->holes[i] - prev);
+		pos += burst->holes[i] - prev;
+		memcpy(buf + pos, client->nick, nick_len);
+		pos += nick_len;
+		prev = burst->holes[i];
+	}
+	memcpy(buf + pos, burst->text + prev, burst->length - prev);
+	burst_release(burst);
+
+	/* Every message fits in MAX_MSG_SIZE, so every part has a newline */
+	ret = 0;
+	for (pos = 0; pos < total && ret != -1; pos += len) {
+		len = total - pos;
+		if (len > BURST_CHUNK_SIZE) {
+			nl = buf + pos + BURST_CHUNK_SIZE - 1;
+			while (*nl != '\n') {
+				nl--;
+			}
+			len = (size_t) (nl - (buf + pos)) + 1;
+		}
+		ret = queue_to(client, buf + pos, len);
+	}
+	free(buf);
+	if (ret == -1) {
+		terminate_session(client, BAD_WRITE_QUIT_MSG);
+	}
+}
@@ -0,0 +1,125 @@
+#include <string.h>
+#include "reply.h"
+#include "msgio.h"
+#include "serverinfo.h"
+
+/** @file
+	@brief Reply builder implementation
+
+	Every function appends to the reply with `memcpy()`, clipping whatever doesn't fit in `REPLY_MAX_LENGTH`.
+	Once a reply is full, further appends are no-ops, so callers never need to check for truncation.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** Appends a characters sequence to a reply. If there's not enough room, the reply is truncated.
+   @param reply The reply.
+   @param str The characters to append. Does not need to be null terminated.
+   @param len How many characters from `str` to append.
+ */
+void reply_append_buf(struct reply *reply, const char *str, size_t len)
+{
+	if (len > REPLY_MAX_LENGTH - reply->length) {
+		len = REPLY_MAX_LENGTH - reply->length;
+	}
+	memcpy(reply->buf + reply->length, str, len);
+	reply->length += len;
+}
+
+/** Appends a null terminated characters sequence to a reply, as is.
+   @param reply The reply.
+   @param str The characters sequence.
+ */
+void reply_append(struct reply *reply, const char *str)
+{
+	reply_append_buf(reply, str, strlen(str));
+}
+
+/** Starts a new reply coming from this server, ":<server name> <cmd>".
+   @param reply The reply. Anything it held is discarded.
+   @param cmd The command, for example, `"NOTICE"`.
+ */
+void reply_begin(struct reply *reply, const char *cmd)
+{
+	reply->buf[0] = ':';
+	reply->length = 1;
+	reply_append(reply, get_server_name());
+	reply_param(reply, cmd);
+}
+
+/** Starts a new numeric reply to a client, ":<server name> <numeric> <nick>". Clients that didn't register yet are
+   addressed as `*`.
+   @param reply The reply. Anything it held is discarded.
+   @param client The client that will receive this reply.
+   @param numeric The numeric, as defined in `protocol.h`.
+ */
+void reply_numeric(struct reply *reply, struct irc_client *client, const char *numeric)
+{
+	reply_begin(reply, numeric);
+	reply_param(reply, client->is_registered ? client->nick : "*");
+}
+
+/** Appends a middle parameter to a reply, preceded by a space.
+   @param reply The reply.
+   @param param The parameter. Must not contain spaces.
+ */
+void reply_param(struct reply *reply, const char *param)
+{
+	reply_append_buf(reply, " ", 1);
+	reply_append(reply, param);
+}
+
+/** Appends the trailing parameter to a reply, preceded by " :". More text can be appended to the trailing parameter with
+   `reply_append()`.
+   @param reply The reply.
+   @param trailing The parameter. It can contain spaces.
+ */
+void reply_trailing(struct reply *reply, const char *trailing)
+{
+	reply_append_buf(reply, " :", 2);
+	reply_append(reply, trailing);
+}
+
+/** Tells how many characters can still be appended to a reply before it is truncated.
+   @param reply The reply.
+   @return How many characters fit.
+ */
+size_t reply_room(struct reply *reply)
+{
+	return REPLY_MAX_LENGTH - reply->length;
+}
+
+/** Terminates a reply with \\r\\n, for callers that copy the reply somewhere else instead of sending it.
+   @param reply The reply. Nothing can be appended to it after this call.
+   @return The reply's length, including the terminating \\r\\n.
+ */
+size_t reply_end(struct reply *reply)
+{
+	reply->buf[reply->length++] = '\r';
+	reply->buf[reply->length++] = '\n';
+	return reply->length;
+}
+
+/** Terminates a reply with \\r\\n and queues it in a client's output buffer, with `write_to_noerr()`.
+   @param reply The reply. Its contents are undefined after this call.
+   @param client The client to send the reply to.
+   @warning Since this function may call `terminate_session()`, it must not be used while holding locks.
+ */
+void reply_send(struct reply *reply, struct irc_client *client)
+{
+	(void)reply_end(reply);
+	write_to_noerr(client, reply->buf, reply->length);
+}
+
+/** Terminates a reply with \\r\\n and queues it in a client's output buffer, with `queue_to()`. Unlike `reply_send()`, this
+   is safe to use while holding locks.
+   @param reply The reply. Its contents are undefined after this call.
+   @param client The client to send the reply to.
+   @return `0` on success; `-1` if the reply could not be queued.
+ */
+int reply_queue(struct reply *reply, struct irc_client *client)
+{
+	(void)reply_end(reply);
+	return queue_to(client, reply->buf, reply->length);
+}
@@ -1,6 +1,5 @@
 #include "send_err.h"
-#include "msgio.h"
-#include "serverinfo.h"
+#include "reply.h"
 
 /** @file
 	@brief send_err* functions
@@ -16,10 +15,10 @@
  */
 void send_err_notregistered(struct irc_client *client)
 {
-	char *format =
-		":%s " ERR_NOTREGISTERED " * :You have not registered\r\n";
-	yaircd_send(client, format,
-		    get_server_name());
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOTREGISTERED);
+	reply_trailing(&r, "You have not registered");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_UNKNOWNCOMMAND to a client who seems to be messing around with commands.
@@ -34,10 +33,11 @@ void send_err_notregistered(struct irc_client *client)
  */
 void send_err_unknowncommand(struct irc_client *client, char *cmd)
 {
-	char *format =
-		":%s " ERR_UNKNOWNCOMMAND " %s %s :Unknown command\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->is_registered ? client->nick : "*", *cmd != '\0' ? cmd : "NULL_CMD");
+	struct reply r;
+	reply_numeric(&r, client, ERR_UNKNOWNCOMMAND);
+	reply_param(&r, *cmd != '\0' ? cmd : "NULL_CMD");
+	reply_trailing(&r, "Unknown command");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NONICKNAMEGIVEN to a client who issued a NICK command but didn't provide a nick
@@ -45,10 +45,10 @@ void send_err_unknowncommand(struct irc_client *client, char *cmd)
  */
 void send_err_nonicknamegiven(struct irc_client *client)
 {
-	char *format =
-		":%s " ERR_NONICKNAMEGIVEN " %s :No nickname given\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->is_registered ? client->nick : "*");
+	struct reply r;
+	reply_numeric(&r, client, ERR_NONICKNAMEGIVEN);
+	reply_trailing(&r, "No nickname given");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NEEDMOREPARAMS to a client who issued a command but didn't provide enough parameters for his request to be
@@ -60,10 +60,11 @@ void send_err_nonicknamegiven(struct irc_client *client)
  */
 void send_err_needmoreparams(struct irc_client *client, char *cmd)
 {
-	char *format =
-		":%s " ERR_NEEDMOREPARAMS " %s %s :Not enough parameters\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->is_registered ? client->nick : "*", cmd);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NEEDMOREPARAMS);
+	reply_param(&r, cmd);
+	reply_trailing(&r, "Not enough parameters");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_ERRONEUSNICKNAME to a client who issued a NICK command and chose a nickname that contains invalid
@@ -73,10 +74,11 @@ void send_err_needmoreparams(struct irc_client *client, char *cmd)
  */
 void send_err_erroneusnickname(struct irc_client *client, char *nick)
 {
-	char *format =
-		":%s " ERR_ERRONEUSNICKNAME " %s %s :Erroneous nickname\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->is_registered ? client->nick : "*", nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_ERRONEUSNICKNAME);
+	reply_param(&r, nick);
+	reply_trailing(&r, "Erroneous nickname");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NICKNAMEINUSE to a client who issued a NICK command and chose a nickname that is already in use.
@@ -85,10 +87,11 @@ void send_err_erroneusnickname(struct irc_client *client, char *nick)
  */
 void send_err_nicknameinuse(struct irc_client *client, char *nick)
 {
-	char *format =
-		":%s " ERR_NICKNAMEINUSE " %s %s :Nickname is already in use\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->is_registered ? client->nick : "*", nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NICKNAMEINUSE);
+	reply_param(&r, nick);
+	reply_trailing(&r, "Nickname is already in use");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_ALREADYREGISTRED to a client who issued a USER command even though he was already registred.
@@ -96,11 +99,10 @@ void send_err_nicknameinuse(struct irc_client *client, char *nick)
  */
 void send_err_alreadyregistred(struct irc_client *client)
 {
-	char *format =
-		":%s " ERR_ALREADYREGISTRED " %s :You may not reregister.\r\n";
-
-	yaircd_send(client, format,
-		    get_server_name(), client->nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_ALREADYREGISTRED);
+	reply_trailing(&r, "You may not reregister.");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NORECIPIENT to a client trying to send a message without a recipient.
@@ -109,10 +111,12 @@ void send_err_alreadyregistred(struct irc_client *client)
  */
 void send_err_norecipient(struct irc_client *client, char *cmd)
 {
-	const char *format =
-		":%s " ERR_NORECIPIENT " %s :No recipient given (%s)\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->nick, cmd);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NORECIPIENT);
+	reply_trailing(&r, "No recipient given (");
+	reply_append(&r, cmd);
+	reply_append(&r, ")");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOTEXTTOSEND to a client trying to send an empty message to another client.
@@ -120,10 +124,10 @@ void send_err_norecipient(struct irc_client *client, char *cmd)
  */
 void send_err_notexttosend(struct irc_client *client)
 {
-	const char *format =
-		":%s " ERR_NOTEXTTOSEND " %s :No text to send\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOTEXTTOSEND);
+	reply_trailing(&r, "No text to send");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOSUCHNICK to a client who supplied a nonexisting target.
@@ -132,10 +136,11 @@ void send_err_notexttosend(struct irc_client *client)
  */
 void send_err_nosuchnick(struct irc_client *client, char *nick)
 {
-	const char *format =
-		":%s " ERR_NOSUCHNICK " %s %s :No such nick/channel\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->nick, nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOSUCHNICK);
+	reply_param(&r, nick);
+	reply_trailing(&r, "No such nick/channel");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOSUCHCHANNEL to a client who supplied an invalid channel name.
@@ -144,10 +149,11 @@ void send_err_nosuchnick(struct irc_client *client, char *nick)
  */
 void send_err_nosuchchannel(struct irc_client *client, char *chan)
 {
-	const char *format =
-		":%s " ERR_NOSUCHCHANNEL " %s %s :No such channel\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->nick, chan);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOSUCHCHANNEL);
+	reply_param(&r, chan);
+	reply_trailing(&r, "No such channel");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOTONCHANNEL to a client who tried to part a channel he's not in.
@@ -156,10 +162,11 @@ void send_err_nosuchchannel(struct irc_client *client, char *chan)
  */
 void send_err_notonchannel(struct irc_client *client, char *chan)
 {
-	const char *format =
-		":%s " ERR_NOTONCHANNEL " %s %s :You're not on that channel\r\n";
-	yaircd_send(client, format,
-		    get_server_name(), client->nick, chan);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOTONCHANNEL);
+	reply_param(&r, chan);
+	reply_trailing(&r, "You're not on that channel");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_TOOMANYCHANNELS to a client who tried to join a channel, but already hit the max channels limit, as configured in yaircd.conf.
@@ -167,28 +174,59 @@ void send_err_notonchannel(struct irc_client *client, char *chan)
    @param chan The channel name
  */
 void send_err_toomanychannels(struct irc_client *client, char *chan) {
-	const char *format =
-		":%s " ERR_TOOMANYCHANNELS " %s %s :You have joined too many channels\r\n";
-	yaircd_send(client, format,
-		get_server_name(), client->nick, chan);
+	struct reply r;
+	reply_numeric(&r, client, ERR_TOOMANYCHANNELS);
+	reply_param(&r, chan);
+	reply_trailing(&r, "You have joined too many channels");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOORIGIN to a PONG reply from a client who didn't indicate the PING origin.
    @param client The erratic client to notify
  */
 void send_err_noorigin(struct irc_client *client) {
-	const char *format =
-		":%s " ERR_NOORIGIN " %s :No origin specified\r\n";
-	yaircd_send(client, format,
-		get_server_name(), client->nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOORIGIN);
+	reply_trailing(&r, "No origin specified");
+	reply_send(&r, client);
 }
 
 /** Sends ERR_NOMOTD to a client when there is no MOTD to display (no MOTD file exists).
    @param client The client to notify
  */
 void send_err_nomotd(struct irc_client *client) {
-	const char *format =
-		":%s " ERR_NOMOTD " %s :MOTD File is missing\r\n";
-	yaircd_send(client, format,
-		get_server_name(), client->nick);
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOMOTD);
+	reply_trailing(&r, "MOTD File is missing");
+	reply_send(&r, client);
+}
+
+/** Sends ERR_NOPRIVILEGES to a client who issued a command that only IRC operators can use.
+   @param client The client to notify
+ */
+void send_err_noprivileges(struct irc_client *client) {
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOPRIVILEGES);
+	reply_trailing(&r, "Permission Denied- You're not an IRC operator");
+	reply_send(&r, client);
+}
+
+/** Sends ERR_PASSWDMISMATCH to a client who issued an OPER command with the wrong password.
+   @param client The client to notify
+ */
+void send_err_passwdmismatch(struct irc_client *client) {
+	struct reply r;
+	reply_numeric(&r, client, ERR_PASSWDMISMATCH);
+	reply_trailing(&r, "Password incorrect");
+	reply_send(&r, client);
+}
+
+/** Sends ERR_NOOPERHOST to a client who issued an OPER command for an operator that isn't configured.
+   @param client The client to notify
+ */
+void send_err_nooperhost(struct irc_client *client) {
+	struct reply r;
+	reply_numeric(&r, client, ERR_NOOPERHOST);
+	reply_trailing(&r, "No O-lines for your host");
+	reply_send(&r, client);
 }
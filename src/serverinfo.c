@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <protocol.h>
 #include "serverinfo.h"
+#include "worker.h"
+#include "cloak.h"
+#include "wrappers.h"
 
 /** @file
    @brief Main server structures
@@ -24,6 +27,34 @@
 /** How many memory to allocate initially to store MOTD line entries */
 #define INITIAL_MOTD_LINES 64
 
+/** Default hard limit, in bytes, for a client's pending output, used when a listening socket doesn't define `sendq` */
+#define DEFAULT_SENDQ 1048576
+
+/** Default soft limit, in bytes, for a client's pending output, used when a listening socket doesn't define `sendq_soft` */
+#define DEFAULT_SENDQ_SOFT 131072
+
+/** Default hard limit, in bytes, for a server link's pending output, used when a link block doesn't define `sendq`. A netburst
+   must fit in it. */
+#define DEFAULT_LINK_SENDQ 8388608
+
+/** Default number of messages processed each time a client is served, used when a listening socket doesn't define `read_msgs` */
+#define DEFAULT_READ_MSGS 16
+
+/** Default number of characters read each time a client is served, used when a listening socket doesn't define `read_bytes` */
+#define DEFAULT_READ_BYTES 4096
+
+/** Default capacity of a client's token bucket, used when a listening socket defines `flood_rate` but not `flood_burst` */
+#define DEFAULT_FLOOD_BURST 20
+
+/** Number of messages processed each time a server link is served. Links are trusted, and carry everyone else's traffic. */
+#define LINK_READ_MSGS 256
+
+/** Number of characters read each time a server link is served. */
+#define LINK_READ_BYTES 16384
+
+/** Default port for a server link, used when a link block doesn't define `port` */
+#define DEFAULT_LINK_PORT 6667
+
 /** Stores important information about a socket. */
 struct socket_info {
 	const char *ip; /**<IPv4 address where this socket will be listening. 0.0.0.0 means every IP. */
@@ -31,6 +62,11 @@ struct socket_info {
 	unsigned ssl : 1; /**<Bit-field indicating if it's an SSL socket. */
 	int max_hangup_clients; /**<Max. hangup clients allowed to be on hold while the parent thread dispatches a new
 	                           thread to deal with a freshly arrived connection */
+	int sendq; /**<Hard limit, in bytes, for the data waiting to be sent to a client of this socket. Clients that reach it are
+	              disconnected. */
+	int sendq_soft; /**<Soft limit, in bytes. Commands from a client whose own pending output is above this limit are not read
+	                   until it drains. */
+	struct read_budget budget; /**<How much of the input of a client of this socket is processed each time he is served. */
 };
 
 /** Holds personal information about the server's administrator. */
@@ -47,6 +83,22 @@ struct cloaks_info {
 	const char *keys[3]; /**<Array of salt keys for the cloaking module. */
 	size_t keys_length[3]; /**<Length of each of the salt keys. Since this never changes during execution, we
 	                          compute it once when we parse the file, and store it here. */
+	int mode; /**<Cloak algorithm: `CLOAK_MODE_LEGACY` or `CLOAK_MODE_SIPHASH`. */
+};
+
+/** Holds the workers pool settings */
+struct workers_info {
+	int threads; /**<How many workers to start. `0` means one worker per online processor. */
+	int balance; /**<How new clients are handed to workers: `WORKER_BALANCE_ROUND_ROBIN` or `WORKER_BALANCE_LEAST_LOAD`. */
+	int reuseport; /**<Whether each worker accepts its own clients on its own `SO_REUSEPORT` listening sockets, instead of the main thread accepting every client. */
+};
+
+/** Holds the reverse DNS resolver settings */
+struct dns_info {
+	int threads; /**<How many resolver threads to start. */
+	ev_tstamp timeout; /**<How many seconds a new client waits for its hostname before its IP address is used instead. */
+	int cache_ttl; /**<For how many seconds a resolved hostname is cached. */
+	int negative_ttl; /**<For how many seconds an address without a hostname is cached. */
 };
 
 /** Structure to store general information about the server read from the configuration file */
@@ -64,10 +116,18 @@ struct server_info {
 	struct socket_info socket_secure; /**<Information about the secure (SSL) socket. See the documentation for
 	                                     `struct socket_info`. */
 	struct cloaks_info cloaking; /**<Cloaked hosts information. See the documentation for `struct cloaks_info`. */
+	struct workers_info workers; /**<Workers pool settings. See the documentation for `struct workers_info`. */
+	struct dns_info dns; /**<Reverse DNS resolver settings. See the documentation for `struct dns_info`. */
+	struct read_budget link_budget; /**<How much of a server link's input is processed each time it is served. Not configurable. */
+	const char *stats_socket; /**<Path of the Unix socket where statistics are served, or `NULL` if they are only available
+	                             through the `STATS` command. */
+	config_setting_t *opers; /**<The `opers` list, with one group per IRC operator, or `NULL` if there are no operators. */
+	config_setting_t *links; /**<The `links` list, with one group per server allowed to link with this one, or `NULL` if there are none. */
 	const char *certificate_path; /**<File path for the certificate file used for secure connections. */
 	const char *private_key_path; /**<File path for the server's private key. */
 	ev_tstamp ping_freq; /**<If no activity is detected in a connection after `ping_freq` seconds, a PING is sent. */
 	ev_tstamp timeout; /**<If no PONG reply arrives within `timeout` seconds, the session is terminated. */
+	ev_tstamp handshake_timeout; /**<If a secure connection doesn't complete the SSL handshake within `handshake_timeout` seconds, it is dropped. */
 	char **motd; /**<Dynamically allocated array holding MOTD entries for this server. This array is terminated with a NULL pointer. Each entry is a pointer to a null terminated
 					 characters sequence with a MOTD entry without any newline character. */
 };
@@ -78,6 +138,84 @@ static struct server_info *info;
 /** Global configuration for the server conf file used by libconfig. This is initialized in `loadServerInfo()` */
 static config_t cfg;
 
+/** Reads the output limits of a listening socket's clients: the `sendq` and `sendq_soft` settings, which are optional.
+	A hard limit that is not positive is replaced by `DEFAULT_SENDQ`. The soft limit defaults to `DEFAULT_SENDQ_SOFT`, or to
+	the hard limit if that is lower; a configured soft limit that is not positive or is above the hard limit is brought down
+	to the hard limit.
+	@param setting The socket's block.
+	@param socket Where to store the limits.
+*/
+static void read_sendq_setting(config_setting_t *setting, struct socket_info *socket) {
+	socket->sendq = DEFAULT_SENDQ;
+	config_setting_lookup_int(setting, "sendq", &socket->sendq);
+	if (socket->sendq <= 0) {
+		fprintf(stderr, "::serverinfo.c:read_sendq_setting(): sendq must be positive, using %d.\n", DEFAULT_SENDQ);
+		socket->sendq = DEFAULT_SENDQ;
+	}
+	if (config_setting_lookup_int(setting, "sendq_soft", &socket->sendq_soft) != CONFIG_TRUE) {
+		socket->sendq_soft = (DEFAULT_SENDQ_SOFT < socket->sendq ? DEFAULT_SENDQ_SOFT : socket->sendq);
+	} else if (socket->sendq_soft <= 0 || socket->sendq_soft > socket->sendq) {
+		fprintf(stderr, "::serverinfo.c:read_sendq_setting(): sendq_soft must be positive and at most sendq, using %d.\n",
+			socket->sendq);
+		socket->sendq_soft = socket->sendq;
+	}
+}
+
+/** Reads the input budget of a listening socket's clients: the `read_msgs`, `read_bytes`, `flood_rate` and `flood_burst`
+	settings, which are optional. Values out of range are brought back into range.
+	@param setting The socket's block.
+	@param budget Where to store the budget.
+*/
+static void read_budget_setting(config_setting_t *setting, struct read_budget *budget) {
+	budget->msgs = DEFAULT_READ_MSGS;
+	budget->bytes = DEFAULT_READ_BYTES;
+	budget->rate = 0;
+	budget->burst = DEFAULT_FLOOD_BURST;
+	config_setting_lookup_int(setting, "read_msgs", &budget->msgs);
+	config_setting_lookup_int(setting, "read_bytes", &budget->bytes);
+	config_setting_lookup_float(setting, "flood_rate", &budget->rate);
+	config_setting_lookup_float(setting, "flood_burst", &budget->burst);
+	if (budget->msgs < 1) {
+		budget->msgs = 1;
+	}
+	/* A whole message must always fit */
+	if (budget->bytes < MAX_MSG_SIZE) {
+		budget->bytes = MAX_MSG_SIZE;
+	}
+	if (budget->rate < 0) {
+		budget->rate = 0;
+	}
+	if (budget->burst < 1) {
+		budget->burst = 1;
+	}
+}
+
+/** Removes the link blocks that lack mandatory settings from the `links` list: every block needs `name` and `password`, and
+	blocks with `autoconnect` set need `host` too. The rest of the code can then take these settings for granted.
+	@param links The `links` list.
+*/
+static void drop_incomplete_links(config_setting_t *links) {
+	config_setting_t *block;
+	const char *value;
+	int autoconnect;
+	int i = 0;
+
+	while (i < config_setting_length(links)) {
+		block = config_setting_get_elem(links, (unsigned) i);
+		autoconnect = 0;
+		config_setting_lookup_bool(block, "autoconnect", &autoconnect);
+		if (!config_setting_is_group(block) ||
+		    config_setting_lookup_string(block, "name", &value) != CONFIG_TRUE ||
+		    config_setting_lookup_string(block, "password", &value) != CONFIG_TRUE ||
+		    (autoconnect && config_setting_lookup_string(block, "host", &value) != CONFIG_TRUE)) {
+			fprintf(stderr, "::serverinfo.c:drop_incomplete_links(): Link block %d lacks name, password or host, ignoring it.\n", i);
+			config_setting_remove_elem(links, (unsigned) i);
+			continue;
+		}
+		i++;
+	}
+}
+
 /** This function reads the MOTD file specified in the configuration file, and stores it in a convenient way to make it easy to access during the IRCd's lifetime.
 	It will read chunks of `MAX_MOTD_LINE_LENGTH` characters from the MOTD file, and store each chunk in a `MOTD_ENTRY` container. As of this writing,
 	the container is nothing more than a dynamically allocated array of characters that grows as needed.
@@ -172,6 +310,10 @@ int loadServerInfo(void)
 {
 	double ping_freq;
 	double timeout;
+	double dns_timeout;
+	double handshake_timeout = 10.0;
+	const char *balance;
+	const char *cloak_mode;
 	config_setting_t *setting;
 	config_init(&cfg);
 
@@ -214,13 +356,23 @@ int loadServerInfo(void)
 	info->cloaking.keys_length[0] = strlen(info->cloaking.keys[0]);
 	info->cloaking.keys_length[1] = strlen(info->cloaking.keys[1]);
 	info->cloaking.keys_length[2] = strlen(info->cloaking.keys[2]);
+	info->cloaking.mode = CLOAK_MODE_LEGACY;
+	if (config_setting_lookup_string(setting, "mode", &cloak_mode) == CONFIG_TRUE) {
+		if (strcmp(cloak_mode, ==, "siphash")) {
+			info->cloaking.mode = CLOAK_MODE_SIPHASH;
+		} else if (!strcmp(cloak_mode, ==, "legacy")) {
+			fprintf(stderr, "::serverinfo.c:loadServerInfo(): Unknown cloak mode \"%s\", using legacy.\n", cloak_mode);
+		}
+	}
 	
 	/* Timeout block */
 	setting = config_lookup(&cfg, "serverinfo.timeouts");
 	config_setting_lookup_float(setting, "ping_freq", &ping_freq);
 	config_setting_lookup_float(setting, "timeout", &timeout);
+	config_setting_lookup_float(setting, "handshake", &handshake_timeout);
 	info->ping_freq = ping_freq;
 	info->timeout = timeout;
+	info->handshake_timeout = handshake_timeout;
 	
 	/* Standard socket info */
 	setting = config_lookup(&cfg, "listen.sockets.standard");
@@ -228,6 +380,8 @@ int loadServerInfo(void)
 	config_setting_lookup_int(setting, "max_hangup_clients", &(info->socket_standard.max_hangup_clients));
 	config_setting_lookup_string(setting, "ip", &(info->socket_standard.ip));
 	info->socket_standard.ssl = 0;
+	read_sendq_setting(setting, &(info->socket_standard));
+	read_budget_setting(setting, &(info->socket_standard.budget));
 
 	/* Secure socket info */
 	setting = config_lookup(&cfg, "listen.sockets.secure");
@@ -235,11 +389,67 @@ int loadServerInfo(void)
 	config_setting_lookup_int(setting, "max_hangup_clients", &(info->socket_secure.max_hangup_clients));
 	config_setting_lookup_string(setting, "ip", &(info->socket_secure.ip));
 	info->socket_secure.ssl = 1;
+	read_sendq_setting(setting, &(info->socket_secure));
+	read_budget_setting(setting, &(info->socket_secure.budget));
+	info->link_budget.msgs = LINK_READ_MSGS;
+	info->link_budget.bytes = LINK_READ_BYTES;
+	info->link_budget.rate = 0;
+	info->link_budget.burst = 1;
 	
 	/* Channel block */
 	setting = config_lookup(&cfg, "channels");
 	config_setting_lookup_int(setting, "chanlimit", &(info->chanlimit));
 	
+	/* Workers block. This block is optional */
+	info->workers.threads = 0;
+	info->workers.balance = WORKER_BALANCE_ROUND_ROBIN;
+	info->workers.reuseport = 0;
+	if ((setting = config_lookup(&cfg, "workers")) != NULL) {
+		config_setting_lookup_int(setting, "threads", &(info->workers.threads));
+		config_setting_lookup_bool(setting, "reuseport", &(info->workers.reuseport));
+		if (config_setting_lookup_string(setting, "balance", &balance) == CONFIG_TRUE) {
+			if (strcmp(balance, ==, "least-load")) {
+				info->workers.balance = WORKER_BALANCE_LEAST_LOAD;
+			} else if (!strcmp(balance, ==, "round-robin")) {
+				fprintf(stderr, "::serverinfo.c:loadServerInfo(): Unknown workers balance policy \"%s\", using round-robin.\n", balance);
+			}
+		}
+	}
+	
+	/* DNS block. This block is optional */
+	info->dns.threads = 2;
+	info->dns.cache_ttl = 600;
+	info->dns.negative_ttl = 60;
+	dns_timeout = 5.0;
+	if ((setting = config_lookup(&cfg, "dns")) != NULL) {
+		config_setting_lookup_int(setting, "threads", &(info->dns.threads));
+		config_setting_lookup_float(setting, "timeout", &dns_timeout);
+		config_setting_lookup_int(setting, "cache_ttl", &(info->dns.cache_ttl));
+		config_setting_lookup_int(setting, "negative_ttl", &(info->dns.negative_ttl));
+	}
+	info->dns.timeout = dns_timeout;
+	
+	/* Stats block. This block is optional */
+	info->stats_socket = NULL;
+	if ((setting = config_lookup(&cfg, "stats")) != NULL) {
+		config_setting_lookup_string(setting, "socket", &(info->stats_socket));
+	}
+	
+	/* Operators list. This list is optional */
+	if ((info->opers = config_lookup(&cfg, "opers")) != NULL && !config_setting_is_list(info->opers)) {
+		fprintf(stderr, "::serverinfo.c:loadServerInfo(): opers must be a list, ignoring it.\n");
+		info->opers = NULL;
+	}
+	
+	/* Server links list. This list is optional */
+	if ((info->links = config_lookup(&cfg, "links")) != NULL && !config_setting_is_list(info->links)) {
+		fprintf(stderr, "::serverinfo.c:loadServerInfo(): links must be a list, ignoring it.\n");
+		info->links = NULL;
+	}
+	if (info->links != NULL) {
+		drop_incomplete_links(info->links);
+	}
+	
 	/* Read and store MOTD file */
 	info->motd = read_motd_file(&cfg);
 	
@@ -254,6 +464,14 @@ const char *get_server_name(void)
 	return info->name;
 }
 
+/** Reads this server's network name.
+   @return Pointer to null terminated characters sequence with the network name.
+ */
+const char *get_net_name(void)
+{
+	return info->net_name;
+}
+
 /** Reads this server's description.
    @return Pointer to null terminated characters sequence with the server's description.
  */
@@ -310,6 +528,62 @@ int get_ssl_socket_hangup(void)
 	return info->socket_secure.max_hangup_clients;
 }
 
+/** Reads the standard socket `sendq` attribute.
+   @return Hard limit, in bytes, for the pending output of each client connected to this socket.
+ */
+int get_std_socket_sendq(void)
+{
+	return info->socket_standard.sendq;
+}
+
+/** Reads the secure socket `sendq` attribute.
+   @return Hard limit, in bytes, for the pending output of each client connected to this socket.
+ */
+int get_ssl_socket_sendq(void)
+{
+	return info->socket_secure.sendq;
+}
+
+/** Reads the standard socket `sendq_soft` attribute.
+   @return Soft limit, in bytes, for the pending output of each client connected to this socket.
+ */
+int get_std_socket_sendq_soft(void)
+{
+	return info->socket_standard.sendq_soft;
+}
+
+/** Reads the secure socket `sendq_soft` attribute.
+   @return Soft limit, in bytes, for the pending output of each client connected to this socket.
+ */
+int get_ssl_socket_sendq_soft(void)
+{
+	return info->socket_secure.sendq_soft;
+}
+
+/** Reads the input budget of the standard socket's clients.
+   @return The budget. See `struct read_budget`.
+ */
+const struct read_budget *get_std_read_budget(void)
+{
+	return &info->socket_standard.budget;
+}
+
+/** Reads the input budget of the secure socket's clients.
+   @return The budget. See `struct read_budget`.
+ */
+const struct read_budget *get_ssl_read_budget(void)
+{
+	return &info->socket_secure.budget;
+}
+
+/** Reads the input budget of server links.
+   @return The budget. See `struct read_budget`.
+ */
+const struct read_budget *get_link_read_budget(void)
+{
+	return &info->link_budget;
+}
+
 /** Reads the server's certificate file path.
    @return Pointer to null terminated characters sequence with the server's certificate file path.
  */
@@ -353,6 +627,14 @@ size_t get_cloak_key_length(int i)
 	return info->cloaking.keys_length[i - 1];
 }
 
+/** Reads the algorithm used to cloak hosts.
+   @return `CLOAK_MODE_LEGACY` or `CLOAK_MODE_SIPHASH`, as defined in `cloak.h`.
+ */
+int get_cloak_mode(void)
+{
+	return info->cloaking.mode;
+}
+
 /** Reads the chanlimit setting. A client cannot be in more than `chanlimit` channels simultaneously.
 	@return How many channels, at most, a client can sit in
 */
@@ -375,11 +657,247 @@ ev_tstamp get_timeout(void) {
 	return info->timeout;
 }
 
+/** Reads the SSL handshake timeout value for this server.
+	Secure connections that do not complete the handshake within this amount of time are dropped.
+	@return Handshake timeout value
+*/
+ev_tstamp get_handshake_timeout(void) {
+	return info->handshake_timeout;
+}
+
 /** Reads the previously stored MOTD information.
 	@return a `MOTD_ENTRY` instance that shall be iterated with the use of `motd_entry_for_each()`.
 			  To get the corresponding line stored in a `MOTD_ENTRY`, use `motd_entry_line()`.
 			  See `serverinfo.h` for further details.
+	@warning The MOTD is replaced by `reload_motd()`. Only the main thread may use it; the rest of the code sends the copy
+			 rendered by `burst.c`.
 */
 MOTD_ENTRY get_motd(void) {
 	return info->motd;
 }
+
+/** Frees a MOTD read by `read_motd_file()`.
+	@param motd The MOTD. Can be `NULL`.
+*/
+static void free_motd(MOTD_ENTRY motd)
+{
+	MOTD_ENTRY motd_iterator;
+	if (motd == NULL) {
+		return;
+	}
+	motd_entry_for_each(motd, motd_iterator) {
+		free(motd_entry_line(motd_iterator));
+	}
+	free(motd);
+}
+
+/** Reads the MOTD file again, replacing the MOTD returned by `get_motd()`. If the file can't be read anymore, there is no
+	MOTD from now on, as if the IRCd had been started without one.
+	This must only be called by the main thread.
+*/
+void reload_motd(void)
+{
+	MOTD_ENTRY old = info->motd;
+	info->motd = read_motd_file(&cfg);
+	free_motd(old);
+}
+
+/** Reads how many workers shall serve clients.
+	@return Number of worker threads to start. `0` means one worker per online processor.
+*/
+int get_worker_threads(void) {
+	return info->workers.threads;
+}
+
+/** Reads the policy used to hand new clients to workers.
+	@return `WORKER_BALANCE_ROUND_ROBIN` or `WORKER_BALANCE_LEAST_LOAD`, as defined in `worker.h`.
+*/
+int get_worker_balance(void) {
+	return info->workers.balance;
+}
+
+/** Reads whether each worker shall accept its own clients.
+	@return `1` if every worker listens on its own `SO_REUSEPORT` sockets; `0` if the main thread accepts every client and hands it to a worker.
+*/
+int get_worker_reuseport(void) {
+	return info->workers.reuseport;
+}
+
+/** Reads how many resolver threads shall perform reverse DNS lookups.
+	@return Number of resolver threads to start.
+*/
+int get_dns_threads(void) {
+	return info->dns.threads;
+}
+
+/** Reads for how long a new client waits for its reverse DNS lookup.
+	@return The timeout, in seconds. When it expires, the client's IP address is used instead.
+*/
+ev_tstamp get_dns_timeout(void) {
+	return info->dns.timeout;
+}
+
+/** Reads for how long a resolved hostname is cached.
+	@return Positive cache TTL, in seconds. `0` means hostnames are not cached.
+*/
+int get_dns_cache_ttl(void) {
+	return info->dns.cache_ttl;
+}
+
+/** Reads for how long an address that could not be resolved is cached.
+	@return Negative cache TTL, in seconds. `0` means failed lookups are not cached.
+*/
+int get_dns_negative_ttl(void) {
+	return info->dns.negative_ttl;
+}
+
+/** Reads where statistics shall be served to monitoring tools.
+	@return Path of the Unix socket, or `NULL` if the `stats` block doesn't define one.
+*/
+const char *get_stats_socket(void) {
+	return info->stats_socket;
+}
+
+/** Compares two passwords in constant time, so that the time taken doesn't tell how much of the password was right.
+	@param a A null terminated password.
+	@param b Another null terminated password.
+	@return `1` if both passwords are equal; `0` otherwise.
+*/
+static int same_password(const char *a, const char *b) {
+	size_t len_a = strlen(a);
+	size_t len_b = strlen(b);
+	size_t i;
+	unsigned char diff = (len_a != len_b);
+
+	for (i = 0; i < len_b; i++) {
+		diff |= (unsigned char) a[i % (len_a + 1)] ^ (unsigned char) b[i];
+	}
+	return diff == 0;
+}
+
+/** Checks the credentials given with an `OPER` command against the `opers` list.
+	@param name The operator name.
+	@param password The password.
+	@return `OPER_OK` if there is an operator with this name and password; `OPER_NO_SUCH` if there is no operator with this
+	   name; `OPER_BAD_PASSWORD` if the password is wrong.
+*/
+int check_oper(const char *name, const char *password) {
+	config_setting_t *oper;
+	const char *oper_name;
+	const char *oper_password;
+	int i;
+
+	if (info->opers == NULL) {
+		return OPER_NO_SUCH;
+	}
+	for (i = 0; (oper = config_setting_get_elem(info->opers, (unsigned) i)) != NULL; i++) {
+		if (config_setting_lookup_string(oper, "name", &oper_name) == CONFIG_TRUE &&
+		    config_setting_lookup_string(oper, "password", &oper_password) == CONFIG_TRUE &&
+		    strcmp(oper_name, ==, name)) {
+			return same_password(oper_password, password) ? OPER_OK : OPER_BAD_PASSWORD;
+		}
+	}
+	return OPER_NO_SUCH;
+}
+
+/** Reads how many link blocks the `links` list holds. Link blocks are identified by their position in the list, from `0`
+	to `get_links_count() - 1`.
+	@return How many servers are allowed to link with this one.
+*/
+int get_links_count(void) {
+	return info->links == NULL ? 0 : config_setting_length(info->links);
+}
+
+/** Reads a string setting from a link block.
+	@param i The link block's position.
+	@param name The setting.
+	@return The setting's value, or `NULL` if the block doesn't define it.
+*/
+static const char *link_setting(int i, const char *name) {
+	const char *value;
+	if (config_setting_lookup_string(config_setting_get_elem(info->links, (unsigned) i), name, &value) != CONFIG_TRUE) {
+		return NULL;
+	}
+	return value;
+}
+
+/** Reads the name of the server described by a link block.
+	@param i The link block's position.
+	@return The server name.
+*/
+const char *get_link_name(int i) {
+	return link_setting(i, "name");
+}
+
+/** Reads the IPv4 address where the server described by a link block is connected to, when `autoconnect` is set.
+	@param i The link block's position.
+	@return The address, or `NULL` if the block doesn't define one.
+*/
+const char *get_link_host(int i) {
+	return link_setting(i, "host");
+}
+
+/** Reads the port where the server described by a link block is connected to, when `autoconnect` is set.
+	@param i The link block's position.
+	@return The port. Defaults to `DEFAULT_LINK_PORT`.
+*/
+int get_link_port(int i) {
+	int port = DEFAULT_LINK_PORT;
+	config_setting_lookup_int(config_setting_get_elem(info->links, (unsigned) i), "port", &port);
+	return port;
+}
+
+/** Reads whether this server connects to the server described by a link block by itself. If not, it waits for the other
+	server to connect.
+	@param i The link block's position.
+	@return `1` if this server connects to the other one; `0` otherwise.
+*/
+int get_link_autoconnect(int i) {
+	int autoconnect = 0;
+	config_setting_lookup_bool(config_setting_get_elem(info->links, (unsigned) i), "autoconnect", &autoconnect);
+	return autoconnect;
+}
+
+/** Reads the hard limit for the output waiting to be sent to the server described by a link block.
+	@param i The link block's position.
+	@return The limit, in bytes. Defaults to `DEFAULT_LINK_SENDQ`, which is also used if the block's value is not positive.
+*/
+int get_link_sendq(int i) {
+	int sendq = DEFAULT_LINK_SENDQ;
+	config_setting_lookup_int(config_setting_get_elem(info->links, (unsigned) i), "sendq", &sendq);
+	return sendq > 0 ? sendq : DEFAULT_LINK_SENDQ;
+}
+
+/** Reads the password shared with the server described by a link block. Both servers send it with `PASS`.
+	@param i The link block's position.
+	@return The password, or `NULL` if the block doesn't define one.
+*/
+const char *get_link_password(int i) {
+	return link_setting(i, "password");
+}
+
+/** Finds the link block of a server.
+	@param name The server name. Server names are case insensitive.
+	@return The link block's position; `-1` if this server is not allowed to link with us.
+*/
+int find_link(const char *name) {
+	const char *link_name;
+	int i;
+
+	for (i = 0; i < get_links_count(); i++) {
+		if ((link_name = get_link_name(i)) != NULL && strcasecmp(link_name, ==, name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Checks the password given with `PASS` by a server against its link block.
+	@param i The link block's position.
+	@param password The password.
+	@return `1` if the password is right; `0` otherwise.
+*/
+int check_link_password(int i, const char *password) {
+	const char *link_password = get_link_password(i);
+	return link_password != NULL && same_password(link_password, password);
+}
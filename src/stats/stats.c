@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <ev.h>
+#include "stats.h"
+#include "cmd_hash.h"
+#include "pool.h"
+#include "protocol.h"
+#include "client.h"
+#include "reply.h"
+
+/** @file
+	@brief Server statistics implementation
+
+	Each thread that called `stats_thread_init()` owns a `struct stats_shard`, found through a thread local pointer, and is the
+	only one writing to it. Every other thread writes to `shared`, atomically. `stats_collect()` reads every shard without
+	synchronization; a report may thus be slightly behind the counters, but it never slows down the threads being measured.
+
+	The Unix socket endpoint is served by the main thread's loop. Whoever connects gets the current report in the Prometheus text
+	format, and the connection is closed; the request, if any, is ignored. The report is rendered before the first byte is
+	written, and it is written without blocking, so a slow reader never stalls the main thread.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** How many characters fit in a Prometheus report when its rendering starts. It doubles every time it is full. */
+#define STATS_REPORT_INITIAL_SIZE 16384
+
+/** One thread's counters */
+struct stats_shard {
+	struct stats_counters counters; /**<The counters. Only written by the owner. */
+	struct stats_shard *next; /**<Next shard in the `shards` list. */
+};
+
+/** A connection to the Unix socket, waiting for its report to be written */
+struct stats_conn {
+	struct ev_io watcher; /**<Write watcher for the connection. */
+	char *report; /**<The report. */
+	size_t length; /**<Length of `report`. */
+	size_t sent; /**<How many characters of `report` were written. */
+};
+
+/** A Prometheus report being rendered */
+struct stats_report {
+	char *text; /**<The report so far. Not null terminated. */
+	size_t length; /**<How many characters are stored in `text`. */
+	size_t capacity; /**<How many characters fit in `text`. */
+	int failed; /**<Set if there wasn't enough memory to render the report. */
+};
+
+static struct stats_shard *shards; /**<Every thread's shard. */
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `shards`. */
+static struct stats_counters shared; /**<Counters for threads without a shard. Updated atomically. */
+static __thread struct stats_counters *mine; /**<The calling thread's counters, or `NULL` if it has none. */
+
+static struct ev_io listen_watcher; /**<Watcher for the Unix socket. */
+static time_t boot_time; /**<When `stats_init()` was called. */
+
+/** Adds to a counter of the calling thread, or atomically to the shared counter if the thread has no shard.
+	@param field The counter, a field of `struct stats_counters`.
+	@param n What to add.
+*/
+#define stats_add(field, n) \
+	do { \
+		if (mine != NULL) { \
+			mine->field += (n); \
+		} else { \
+			__sync_add_and_fetch(&shared.field, (n)); \
+		} \
+	} while (0)
+
+/** Creates the calling thread's shard. Every worker thread, and the main thread, calls this once. From then on, the thread's
+	counters are updated without atomic operations.
+	@return `0` on success; `-1` if there is not enough memory, in which case the thread keeps using the shared counters.
+*/
+int stats_thread_init(void)
+{
+	struct stats_shard *shard;
+
+	if ((shard = calloc(1, sizeof(*shard))) == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&shards_mutex);
+	shard->next = shards;
+	shards = shard;
+	pthread_mutex_unlock(&shards_mutex);
+	mine = &shard->counters;
+	return 0;
+}
+
+/** Records the boot time and creates the main thread's shard. This must be called once by the main thread, before the
+	workers start.
+*/
+void stats_init(void)
+{
+	boot_time = time(NULL);
+	if (stats_thread_init() == -1) {
+		fprintf(stderr, "::stats.c:stats_init(): Not enough memory for the main thread's statistics.\n");
+	}
+}
+
+/** Reads the monotonic clock.
+	@return The current time, in nanoseconds, since an arbitrary point.
+*/
+unsigned long long stats_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+/** Finds the bucket of a latency histogram for a sample.
+	@param ns The sample, in nanoseconds.
+	@return The bucket.
+*/
+static int bucket_of(unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	int i;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS - 1 && us >= (1ULL << i); i++)
+		; /* Intentionally left blank */
+	return i;
+}
+
+/** Records a command that was handled.
+	@param cmd_id The command ID, as returned by `parse_msg()`. `CMD_UNKNOWN` for an unknown command, or a message that couldn't
+	   be parsed; its handling time is not recorded.
+	@param ns How long the command took to handle, in nanoseconds.
+*/
+void stats_command(int cmd_id, unsigned long long ns)
+{
+	if (cmd_id == CMD_UNKNOWN) {
+		stats_add(unknown_commands, 1);
+		return;
+	}
+	stats_add(commands[cmd_id].buckets[bucket_of(ns)], 1);
+	stats_add(commands[cmd_id].count, 1);
+	stats_add(commands[cmd_id].sum_ns, ns);
+}
+
+/** Records bytes read from a client.
+	@param bytes How many bytes were read.
+*/
+void stats_bytes_in(size_t bytes)
+{
+	stats_add(bytes_in, bytes);
+}
+
+/** Records bytes written to a client.
+	@param bytes How many bytes were written.
+*/
+void stats_bytes_out(size_t bytes)
+{
+	stats_add(bytes_out, bytes);
+}
+
+/** Records data added to a write queue.
+	@param bytes How many bytes were added.
+	@param depth How many bytes are in the queue now.
+*/
+void stats_queue_push(size_t bytes, size_t depth)
+{
+	unsigned long high;
+
+	stats_add(queued_bytes, (long long) bytes);
+	if (mine != NULL) {
+		if (depth > mine->queue_high_water) {
+			mine->queue_high_water = depth;
+		}
+	} else {
+		while ((high = shared.queue_high_water) < depth &&
+		       !__sync_bool_compare_and_swap(&shared.queue_high_water, high, depth))
+			; /* Intentionally left blank */
+	}
+}
+
+/** Records data removed from a write queue, because it was written or the queue was destroyed.
+	@param bytes How many bytes were removed.
+*/
+void stats_queue_pop(size_t bytes)
+{
+	stats_add(queued_bytes, -(long long) bytes);
+}
+
+/** Records a wait for a contended list lock.
+	@param ns How long the lock took to be acquired, in nanoseconds.
+*/
+void stats_lock_wait(unsigned long long ns)
+{
+	stats_add(lock_waits, 1);
+	stats_add(lock_wait_ns, ns);
+}
+
+/** Records a connection that was accepted. */
+void stats_accept(void)
+{
+	stats_add(accepts, 1);
+}
+
+/** Records an SSL handshake that completed.
+	@param ns How long the handshake took, in nanoseconds, from the moment the connection was handed to its worker.
+*/
+void stats_handshake(unsigned long long ns)
+{
+	stats_add(handshakes.buckets[bucket_of(ns)], 1);
+	stats_add(handshakes.count, 1);
+	stats_add(handshakes.sum_ns, ns);
+}
+
+/** Adds a histogram to another.
+	@param to Where the sum is stored.
+	@param from The histogram to add.
+*/
+static void histogram_add(struct stats_histogram *to, const struct stats_histogram *from)
+{
+	int i;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		to->buckets[i] += from->buckets[i];
+	}
+	to->count += from->count;
+	to->sum_ns += from->sum_ns;
+}
+
+/** Adds a set of counters to another.
+	@param to Where the sum is stored.
+	@param from The counters to add.
+*/
+static void counters_add(struct stats_counters *to, const struct stats_counters *from)
+{
+	int i;
+
+	for (i = 0; i < CMD_COUNT; i++) {
+		histogram_add(&to->commands[i], &from->commands[i]);
+	}
+	to->unknown_commands += from->unknown_commands;
+	to->bytes_in += from->bytes_in;
+	to->bytes_out += from->bytes_out;
+	to->queued_bytes += from->queued_bytes;
+	if (from->queue_high_water > to->queue_high_water) {
+		to->queue_high_water = from->queue_high_water;
+	}
+	to->lock_waits += from->lock_waits;
+	to->lock_wait_ns += from->lock_wait_ns;
+	to->accepts += from->accepts;
+	histogram_add(&to->handshakes, &from->handshakes);
+}
+
+/** Adds every thread's counters.
+	@param totals Where the sum is stored.
+*/
+void stats_collect(struct stats_counters *totals)
+{
+	struct stats_shard *shard;
+
+	memset(totals, 0, sizeof(*totals));
+	__sync_synchronize();
+	counters_add(totals, &shared);
+	pthread_mutex_lock(&shards_mutex);
+	for (shard = shards; shard != NULL; shard = shard->next) {
+		counters_add(totals, &shard->counters);
+	}
+	pthread_mutex_unlock(&shards_mutex);
+	if (totals->queued_bytes < 0) {
+		/* Some thread's pops were seen before another one's pushes */
+		totals->queued_bytes = 0;
+	}
+}
+
+/** Appends formatted text to a report being rendered, growing it if needed.
+	@param report The report.
+	@param fmt Format string, as in `printf()`.
+	@param ... Arguments matching `fmt`.
+*/
+static void report_printf(struct stats_report *report, const char *fmt, ...)
+{
+	va_list args;
+	size_t capacity;
+	char *text;
+	int len;
+
+	if (report->failed) {
+		return;
+	}
+	for (;;) {
+		va_start(args, fmt);
+		len = vsnprintf(report->text + report->length, report->capacity - report->length, fmt, args);
+		va_end(args);
+		if (len < 0) {
+			report->failed = 1;
+			return;
+		}
+		if (report->length + (size_t) len < report->capacity) {
+			report->length += (size_t) len;
+			return;
+		}
+		capacity = 2 * report->capacity;
+		if ((text = realloc(report->text, capacity)) == NULL) {
+			report->failed = 1;
+			return;
+		}
+		report->text = text;
+		report->capacity = capacity;
+	}
+}
+
+/** Renders a latency histogram in the Prometheus text format. The `# TYPE` line must have been rendered already.
+	@param report The report.
+	@param name Metric name.
+	@param labels Labels for every sample, or the empty string.
+	@param h The histogram.
+*/
+static void report_histogram(struct stats_report *report, const char *name, const char *labels, const struct stats_histogram *h)
+{
+	const char *sep = (labels[0] == '\0' ? "" : ",");
+	unsigned long cumulative = 0;
+	int i;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS - 1; i++) {
+		cumulative += h->buckets[i];
+		report_printf(report, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep, (double) (1UL << i) / 1e6, cumulative);
+	}
+	report_printf(report, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, h->count);
+	report_printf(report, "%s_sum{%s} %.9f\n", name, labels, (double) h->sum_ns / 1e9);
+	report_printf(report, "%s_count{%s} %lu\n", name, labels, h->count);
+}
+
+/** Renders every counter, and the memory pools occupancy, in the Prometheus text format.
+	@param length Where the report's length is stored.
+	@return The report, which must be freed by the caller; `NULL` if there is not enough memory.
+*/
+static char *render_prometheus(size_t *length)
+{
+	struct stats_counters *totals;
+	struct stats_report report;
+	struct pool_stats pools;
+	char labels[64];
+	int i;
+
+	if ((totals = malloc(sizeof(*totals))) == NULL) {
+		return NULL;
+	}
+	stats_collect(totals);
+	pool_get_stats(&pools);
+	report.length = 0;
+	report.capacity = STATS_REPORT_INITIAL_SIZE;
+	report.failed = 0;
+	if ((report.text = malloc(report.capacity)) == NULL) {
+		free(totals);
+		return NULL;
+	}
+
+	report_printf(&report, "# HELP yaircd_command_duration_seconds Time spent handling each command.\n"
+		      "# TYPE yaircd_command_duration_seconds histogram\n");
+	for (i = 0; i < CMD_COUNT; i++) {
+		snprintf(labels, sizeof(labels), "command=\"%s\"", cmd_name(i));
+		report_histogram(&report, "yaircd_command_duration_seconds", labels, &totals->commands[i]);
+	}
+	report_printf(&report, "# HELP yaircd_unknown_commands_total Messages with an unknown command.\n"
+		      "# TYPE yaircd_unknown_commands_total counter\nyaircd_unknown_commands_total %lu\n",
+		      totals->unknown_commands);
+	report_printf(&report, "# HELP yaircd_received_bytes_total Bytes read from clients.\n"
+		      "# TYPE yaircd_received_bytes_total counter\nyaircd_received_bytes_total %llu\n", totals->bytes_in);
+	report_printf(&report, "# HELP yaircd_sent_bytes_total Bytes written to clients.\n"
+		      "# TYPE yaircd_sent_bytes_total counter\nyaircd_sent_bytes_total %llu\n", totals->bytes_out);
+	report_printf(&report, "# HELP yaircd_queued_bytes Bytes waiting in write queues.\n"
+		      "# TYPE yaircd_queued_bytes gauge\nyaircd_queued_bytes %lld\n", totals->queued_bytes);
+	report_printf(&report, "# HELP yaircd_queue_high_water_bytes Largest write queue seen.\n"
+		      "# TYPE yaircd_queue_high_water_bytes gauge\nyaircd_queue_high_water_bytes %lu\n",
+		      totals->queue_high_water);
+	report_printf(&report, "# HELP yaircd_lock_waits_total Contended list lock acquisitions.\n"
+		      "# TYPE yaircd_lock_waits_total counter\nyaircd_lock_waits_total %lu\n", totals->lock_waits);
+	report_printf(&report, "# HELP yaircd_lock_wait_seconds_total Time spent waiting for contended list locks.\n"
+		      "# TYPE yaircd_lock_wait_seconds_total counter\nyaircd_lock_wait_seconds_total %.9f\n",
+		      (double) totals->lock_wait_ns / 1e9);
+	report_printf(&report, "# HELP yaircd_accepted_connections_total Accepted connections.\n"
+		      "# TYPE yaircd_accepted_connections_total counter\nyaircd_accepted_connections_total %lu\n",
+		      totals->accepts);
+	report_printf(&report, "# HELP yaircd_handshake_duration_seconds Duration of completed SSL handshakes.\n"
+		      "# TYPE yaircd_handshake_duration_seconds histogram\n");
+	report_histogram(&report, "yaircd_handshake_duration_seconds", "", &totals->handshakes);
+	report_printf(&report, "# HELP yaircd_pool_objects Objects in the memory pools, by size class and state.\n"
+		      "# TYPE yaircd_pool_objects gauge\n");
+	for (i = 0; i < pools.classes_no; i++) {
+		report_printf(&report, "yaircd_pool_objects{size=\"%lu\",state=\"used\"} %lu\n",
+			      (unsigned long) pools.classes[i].size, pools.classes[i].in_use);
+		report_printf(&report, "yaircd_pool_objects{size=\"%lu\",state=\"free\"} %lu\n",
+			      (unsigned long) pools.classes[i].size,
+			      pools.classes[i].capacity > pools.classes[i].in_use ?
+			      pools.classes[i].capacity - pools.classes[i].in_use : 0);
+	}
+	report_printf(&report, "# HELP yaircd_pool_fallback_objects Objects allocated outside the memory pools.\n"
+		      "# TYPE yaircd_pool_fallback_objects gauge\nyaircd_pool_fallback_objects %lu\n",
+		      pools.fallback_in_use);
+	free(totals);
+	if (report.failed) {
+		free(report.text);
+		return NULL;
+	}
+	*length = report.length;
+	return report.text;
+}
+
+/** Closes a connection to the Unix socket and frees it.
+	@param loop The main thread's loop.
+	@param conn The connection.
+*/
+static void conn_close(struct ev_loop *loop, struct stats_conn *conn)
+{
+	ev_io_stop(loop, &conn->watcher);
+	close(conn->watcher.fd);
+	free(conn->report);
+	free(conn);
+}
+
+/** Callback for a connection's write watcher. Writes as much of the report as the socket takes, and closes the connection once
+	it is all written, or if a write error occurs.
+	@param w Pointer to the connection's watcher, which is the first field of `struct stats_conn`.
+	@param revents libev's flags. Only `EV_WRITE` is expected.
+*/
+static void conn_write_cb(EV_P_ ev_io *w, int revents)
+{
+	struct stats_conn *conn = (struct stats_conn *) w;
+	ssize_t written;
+
+	while (conn->sent < conn->length) {
+		if ((written = write(w->fd, conn->report + conn->sent, conn->length - conn->sent)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				break;
+			}
+			return;
+		}
+		conn->sent += (size_t) written;
+	}
+	conn_close(EV_A_ conn);
+}
+
+/** Callback for the Unix socket's watcher. Accepts a connection, renders the report and starts writing it.
+	@param w Pointer to `listen_watcher`.
+	@param revents libev's flags. Only `EV_READ` is expected.
+*/
+static void listen_cb(EV_P_ ev_io *w, int revents)
+{
+	struct stats_conn *conn;
+	int fd;
+
+	if ((fd = accept(w->fd, NULL, NULL)) == -1) {
+		return;
+	}
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || (conn = malloc(sizeof(*conn))) == NULL) {
+		close(fd);
+		return;
+	}
+	if ((conn->report = render_prometheus(&conn->length)) == NULL) {
+		fprintf(stderr, "::stats.c:listen_cb(): Not enough memory to render the statistics report.\n");
+		free(conn);
+		close(fd);
+		return;
+	}
+	conn->sent = 0;
+	ev_io_init(&conn->watcher, conn_write_cb, fd, EV_WRITE);
+	ev_io_start(EV_A_ &conn->watcher);
+}
+
+/** Starts serving the statistics report on a Unix socket. This must be called by the main thread, and the report is served
+	by its loop.
+	@param loop The main thread's loop.
+	@param path Where to create the socket. An old socket in the same place is removed. Only the user running the server can
+	   connect to it: its permissions are set to `0600` before it starts listening.
+	@return `0` on success; `-1` on error, in which case an appropriate error message is printed.
+*/
+int stats_listen(struct ev_loop *loop, const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "::stats.c:stats_listen(): Statistics socket path is too long: %s\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("::stats.c:stats_listen(): Could not create the statistics socket");
+		return -1;
+	}
+	(void) unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || chmod(path, S_IRUSR | S_IWUSR) == -1 ||
+	    listen(fd, SOMAXCONN) == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		perror("::stats.c:stats_listen(): Could not listen on the statistics socket");
+		close(fd);
+		return -1;
+	}
+	ev_io_init(&listen_watcher, listen_cb, fd, EV_READ);
+	ev_io_start(loop, &listen_watcher);
+	return 0;
+}
+
+/** Finds an upper bound for a quantile of a latency histogram.
+	@param h The histogram.
+	@param q The quantile, between `0` and `1`.
+	@return The upper bound of the bucket holding the quantile, in microseconds; `0` if the histogram is empty. For the last
+	   bucket, its lower bound is returned instead.
+*/
+static unsigned long histogram_quantile_us(const struct stats_histogram *h, double q)
+{
+	unsigned long seen = 0;
+	unsigned long target;
+	int i;
+
+	if (h->count == 0) {
+		return 0;
+	}
+	target = (unsigned long) (q * (double) h->count);
+	for (i = 0; i < STATS_LATENCY_BUCKETS - 1; i++) {
+		if ((seen += h->buckets[i]) > target) {
+			return 1UL << i;
+		}
+	}
+	return 1UL << (STATS_LATENCY_BUCKETS - 2);
+}
+
+/** Sends an `RPL_STATSDEBUG` line to a client.
+	@param client The client.
+	@param fmt Format string for the line, as in `printf()`.
+	@param ... Arguments matching `fmt`.
+	@warning Since this function may call `terminate_session()`, it must not be used while holding locks.
+*/
+static void stats_debug(struct irc_client *client, const char *fmt, ...)
+{
+	char line[MAX_MSG_SIZE + 1];
+	struct reply r;
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	reply_numeric(&r, client, RPL_STATSDEBUG);
+	reply_trailing(&r, line);
+	reply_send(&r, client);
+}
+
+/** Answers a `STATS` query. The reply ends with `RPL_ENDOFSTATS`; queries that are not listed below only get that line.
+	<ul>
+	<li>`m`: calls, average and 99th percentile handling time, in microseconds, of every command that was used</li>
+	<li>`u`: uptime</li>
+	<li>`t`: traffic, accepted connections and SSL handshakes</li>
+	<li>`q`: write queues and list locks</li>
+	<li>`z`: memory pools</li>
+	</ul>
+	@param client The client who asked. Permissions are not checked here.
+	@param query The query. Only its first character is used.
+	@warning Since this function may call `terminate_session()`, it must not be used while holding locks.
+*/
+void send_stats(struct irc_client *client, const char *query)
+{
+	struct stats_counters totals;
+	struct pool_stats pools;
+	struct reply r;
+	char num[3][24];
+	char letter[2];
+	time_t up;
+	int i;
+
+	letter[0] = query[0];
+	letter[1] = '\0';
+	stats_collect(&totals);
+	switch (letter[0]) {
+	case 'm':
+		for (i = 0; i < CMD_COUNT; i++) {
+			if (totals.commands[i].count == 0) {
+				continue;
+			}
+			snprintf(num[0], sizeof(num[0]), "%lu", totals.commands[i].count);
+			snprintf(num[1], sizeof(num[1]), "%llu", totals.commands[i].sum_ns / totals.commands[i].count / 1000);
+			snprintf(num[2], sizeof(num[2]), "%lu", histogram_quantile_us(&totals.commands[i], 0.99));
+			reply_numeric(&r, client, RPL_STATSCOMMANDS);
+			reply_param(&r, cmd_name(i));
+			reply_param(&r, num[0]);
+			reply_param(&r, num[1]);
+			reply_param(&r, num[2]);
+			reply_send(&r, client);
+		}
+		break;
+	case 'u':
+		up = time(NULL) - boot_time;
+		snprintf(num[0], sizeof(num[0]), "%ld", (long) (up / 86400));
+		reply_numeric(&r, client, RPL_STATSUPTIME);
+		reply_trailing(&r, "Server Up ");
+		reply_append(&r, num[0]);
+		snprintf(num[0], sizeof(num[0]), " days %ld:%02ld:%02ld", (long) (up % 86400 / 3600), (long) (up % 3600 / 60),
+			 (long) (up % 60));
+		reply_append(&r, num[0]);
+		reply_send(&r, client);
+		break;
+	case 't':
+		up = time(NULL) - boot_time;
+		stats_debug(client, "Received %llu bytes, sent %llu bytes", totals.bytes_in, totals.bytes_out);
+		stats_debug(client, "Accepted %lu connections, %.2f per second", totals.accepts,
+			    (double) totals.accepts / (double) (up > 0 ? up : 1));
+		stats_debug(client, "SSL handshakes: %lu, average %llu us, 99%% under %lu us", totals.handshakes.count,
+			    totals.handshakes.count == 0 ? 0 : totals.handshakes.sum_ns / totals.handshakes.count / 1000,
+			    histogram_quantile_us(&totals.handshakes, 0.99));
+		stats_debug(client, "Unknown commands: %lu", totals.unknown_commands);
+		break;
+	case 'q':
+		stats_debug(client, "Write queues: %lld bytes queued, largest queue %lu bytes", totals.queued_bytes,
+			    totals.queue_high_water);
+		stats_debug(client, "List locks: %lu contended, %.3f ms waiting", totals.lock_waits,
+			    (double) totals.lock_wait_ns / 1e6);
+		break;
+	case 'z':
+		pool_get_stats(&pools);
+		for (i = 0; i < pools.classes_no; i++) {
+			stats_debug(client, "Pool %lu bytes: %lu/%lu objects used, %lu slabs, %lu allocations, %lu remote frees",
+				    (unsigned long) pools.classes[i].size, pools.classes[i].in_use, pools.classes[i].capacity,
+				    pools.classes[i].slabs, pools.classes[i].allocs, pools.classes[i].remote_frees);
+		}
+		stats_debug(client, "Pools: %d threads, %lu objects outside the pools", pools.threads, pools.fallback_in_use);
+		break;
+	}
+	reply_numeric(&r, client, RPL_ENDOFSTATS);
+	reply_param(&r, letter);
+	reply_trailing(&r, "End of STATS report");
+	reply_send(&r, client);
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/** @file
+	@brief Perfect hash generator for the commands table
+
+	This is a build tool; it is not part of the IRCd. It reads the list of commands in `msg/commands.def` and writes
+	`include/cmd_ids.h` and `msg/cmd_hash.c`, which are included in the build.
+
+	The hash function is the same one that `parse_msg()` computes with `cmd_hash_step()`: FNV-1a over the case folded command, starting
+	at a seed. The generator tries seeds until it finds one that maps every command to a different slot of a table with a power of 2
+	size; if no seed works, it doubles the table and starts over. For a few dozen commands, this finishes instantly.
+
+	Usage: `gen_cmd_hash commands.def cmd_ids.h cmd_hash.c`
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see cmd_hash.h
+*/
+
+/** Maximum number of commands in the definitions file */
+#define MAX_COMMANDS 256
+
+/** Maximum length of a command */
+#define MAX_COMMAND_LENGTH 32
+
+/** How many seeds to try before growing the table */
+#define SEEDS_PER_SIZE 100000
+
+/** FNV-1a offset basis; seeds are derived from it */
+#define FNV_OFFSET 2166136261U
+
+/** Must match `cmd_hash_step()` in cmd_hash.h */
+#define hash_step(h, c) (((h) ^ (unsigned) ((unsigned char) (c) | 0x20)) * 16777619U)
+
+static char commands[MAX_COMMANDS][MAX_COMMAND_LENGTH + 1]; /**<Commands read from the definitions file. */
+static int commands_count; /**<How many commands are in `commands`. */
+
+/** Hashes a command.
+	@param seed Initial hash value.
+	@param cmd The command.
+	@return The hash.
+*/
+static unsigned hash(unsigned seed, const char *cmd)
+{
+	unsigned h = seed;
+	for (; *cmd != '\0'; cmd++) {
+		h = hash_step(h, *cmd);
+	}
+	return h;
+}
+
+/** Reads the definitions file. Empty lines and lines starting with `#` are ignored; every other line holds a command, which must be
+	alphabetic.
+	@param path The definitions file.
+	@return `0` on success; `-1` on error, in which case a message is printed to `stderr`.
+*/
+static int read_commands(const char *path)
+{
+	char line[256];
+	char *p, *end;
+	FILE *in;
+	int i, lineno = 0;
+
+	if ((in = fopen(path, "r")) == NULL) {
+		perror("::gen_cmd_hash.c:read_commands(): Could not open commands file");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), in) != NULL) {
+		lineno++;
+		for (p = line; isspace((unsigned char)*p); p++)
+			; /* Intentionally left blank */
+		for (end = p; isalpha((unsigned char)*end); end++) {
+			*end = tolower((unsigned char)*end);
+		}
+		if (*p == '#' || *p == '\0') {
+			continue;
+		}
+		if (end == p || (*end != '\0' && !isspace((unsigned char)*end))) {
+			fprintf(stderr, "::gen_cmd_hash.c:read_commands(): %s:%d: commands must be alphabetic.\n", path, lineno);
+			fclose(in);
+			return -1;
+		}
+		if (end - p > MAX_COMMAND_LENGTH || commands_count == MAX_COMMANDS) {
+			fprintf(stderr, "::gen_cmd_hash.c:read_commands(): %s:%d: command too long, or too many commands.\n", path, lineno);
+			fclose(in);
+			return -1;
+		}
+		*end = '\0';
+		for (i = 0; i < commands_count; i++) {
+			if (strcmp(commands[i], p) == 0) {
+				fprintf(stderr, "::gen_cmd_hash.c:read_commands(): %s:%d: duplicate command %s.\n", path, lineno, p);
+				fclose(in);
+				return -1;
+			}
+		}
+		strcpy(commands[commands_count++], p);
+	}
+	fclose(in);
+	if (commands_count == 0) {
+		fprintf(stderr, "::gen_cmd_hash.c:read_commands(): %s: no commands defined.\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/** Searches for a seed that maps every command to a different slot.
+	@param size Table size. Must be a power of 2.
+	@param slots Where the command stored in each slot is written; `-1` marks an empty slot. Must have room for `size` entries.
+	@param seed Where the seed found is written.
+	@return `1` if a seed was found; `0` otherwise.
+*/
+static int find_seed(unsigned size, int *slots, unsigned *seed)
+{
+	unsigned s, slot;
+	int i;
+
+	for (s = 0; s < SEEDS_PER_SIZE; s++) {
+		for (slot = 0; slot < size; slot++) {
+			slots[slot] = -1;
+		}
+		for (i = 0; i < commands_count; i++) {
+			slot = hash(FNV_OFFSET + s, commands[i]) & (size - 1);
+			if (slots[slot] != -1) {
+				break;
+			}
+			slots[slot] = i;
+		}
+		if (i == commands_count) {
+			*seed = FNV_OFFSET + s;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** Writes the header with the commands IDs.
+	@param path Where to write the header.
+	@param seed The hash seed.
+	@param size The table size.
+	@return `0` on success; `-1` on error.
+*/
+static int write_ids(const char *path, unsigned seed, unsigned size)
+{
+	FILE *out;
+	const char *c;
+	size_t max_length = 0;
+	int i;
+
+	if ((out = fopen(path, "w")) == NULL) {
+		perror("::gen_cmd_hash.c:write_ids(): Could not create header");
+		return -1;
+	}
+	fprintf(out, "/* Generated by tools/gen_cmd_hash.c from msg/commands.def. Do not edit. */\n");
+	fprintf(out, "#ifndef __YAIRCD_CMD_IDS_GUARD__\n#define __YAIRCD_CMD_IDS_GUARD__\n\n");
+	for (i = 0; i < commands_count; i++) {
+		fprintf(out, "#define CMD_");
+		for (c = commands[i]; *c != '\0'; c++) {
+			fputc(toupper((unsigned char)*c), out);
+		}
+		fprintf(out, " %d\n", i);
+		if (strlen(commands[i]) > max_length) {
+			max_length = strlen(commands[i]);
+		}
+	}
+	fprintf(out, "\n#define CMD_COUNT %d\n", commands_count);
+	fprintf(out, "#define CMD_HASH_SEED %uU\n", seed);
+	fprintf(out, "#define CMD_HASH_SIZE %u\n", size);
+	fprintf(out, "#define CMD_MAX_LENGTH %lu\n", (unsigned long) max_length);
+	fprintf(out, "\n#endif /* __YAIRCD_CMD_IDS_GUARD__ */\n");
+	return fclose(out) == 0 ? 0 : -1;
+}
+
+/** Writes the lookup table and functions.
+	@param path Where to write the source file.
+	@param slots The command in each slot, as filled by `find_seed()`.
+	@param size The table size.
+	@return `0` on success; `-1` on error.
+*/
+static int write_table(const char *path, const int *slots, unsigned size)
+{
+	FILE *out;
+	const char *c;
+	unsigned i;
+
+	if ((out = fopen(path, "w")) == NULL) {
+		perror("::gen_cmd_hash.c:write_table(): Could not create source file");
+		return -1;
+	}
+	fprintf(out, "/* Generated by tools/gen_cmd_hash.c from msg/commands.def. Do not edit. */\n");
+	fprintf(out, "#include <stddef.h>\n#include \"cmd_hash.h\"\n\n");
+	fprintf(out, "/** A slot in the commands table */\nstruct cmd_slot {\n");
+	fprintf(out, "\tconst char *name; /**<The command, in lower case; `NULL` for an empty slot. */\n");
+	fprintf(out, "\tsize_t length; /**<Length of `name`. */\n");
+	fprintf(out, "\tint id; /**<The command ID. */\n};\n\n");
+	fprintf(out, "/** The commands table, indexed by hash */\nstatic const struct cmd_slot cmd_table[CMD_HASH_SIZE] = {\n");
+	for (i = 0; i < size; i++) {
+		if (slots[i] == -1) {
+			fprintf(out, "\t{ NULL, 0, CMD_UNKNOWN },\n");
+		} else {
+			fprintf(out, "\t{ \"%s\", %lu, %d },\n", commands[slots[i]], (unsigned long) strlen(commands[slots[i]]), slots[i]);
+		}
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out, "/** Every command's name, in upper case, indexed by command ID */\nstatic const char *const cmd_names[CMD_COUNT] = {\n");
+	for (i = 0; i < (unsigned) commands_count; i++) {
+		fprintf(out, "\t\"");
+		for (c = commands[i]; *c != '\0'; c++) {
+			fputc(toupper((unsigned char)*c), out);
+		}
+		fprintf(out, "\",\n");
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out,
+		"/** Finds a command whose hash was already computed with `cmd_hash_step()`.\n"
+		"\t@param cmd The command. Does not need to be null terminated.\n"
+		"\t@param length How many characters are in `cmd`.\n"
+		"\t@param hash The hash of the first `length` characters of `cmd`, starting with `CMD_HASH_SEED`.\n"
+		"\t@return The command ID, or `CMD_UNKNOWN` if there is no such command.\n"
+		"*/\n"
+		"int cmd_lookup_hashed(const char *cmd, size_t length, unsigned hash)\n"
+		"{\n"
+		"\tconst struct cmd_slot *slot = &cmd_table[hash & (CMD_HASH_SIZE - 1)];\n"
+		"\tsize_t i;\n\n"
+		"\tif (slot->length != length) {\n"
+		"\t\treturn CMD_UNKNOWN;\n"
+		"\t}\n"
+		"\tfor (i = 0; i < length; i++) {\n"
+		"\t\tif (((unsigned char) cmd[i] | 0x20) != (unsigned char) slot->name[i]) {\n"
+		"\t\t\treturn CMD_UNKNOWN;\n"
+		"\t\t}\n"
+		"\t}\n"
+		"\treturn slot->id;\n"
+		"}\n\n");
+	fprintf(out,
+		"/** Finds a command.\n"
+		"\t@param cmd The command. Must be null terminated. The case is ignored.\n"
+		"\t@return The command ID, or `CMD_UNKNOWN` if there is no such command.\n"
+		"*/\n"
+		"int cmd_lookup(const char *cmd)\n"
+		"{\n"
+		"\tunsigned hash = CMD_HASH_SEED;\n"
+		"\tsize_t length;\n\n"
+		"\tfor (length = 0; cmd[length] != '\\0'; length++) {\n"
+		"\t\tif (!((cmd[length] >= 'a' && cmd[length] <= 'z') || (cmd[length] >= 'A' && cmd[length] <= 'Z'))) {\n"
+		"\t\t\treturn CMD_UNKNOWN;\n"
+		"\t\t}\n"
+		"\t\thash = cmd_hash_step(hash, cmd[length]);\n"
+		"\t}\n"
+		"\treturn cmd_lookup_hashed(cmd, length, hash);\n"
+		"}\n\n");
+	fprintf(out,
+		"/** Finds a command's name.\n"
+		"\t@param id The command ID. Must be a valid ID, i.e., not `CMD_UNKNOWN`.\n"
+		"\t@return The command, in upper case.\n"
+		"*/\n"
+		"const char *cmd_name(int id)\n"
+		"{\n"
+		"\treturn cmd_names[id];\n"
+		"}\n");
+	return fclose(out) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned size, seed;
+	int *slots;
+
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s commands.def cmd_ids.h cmd_hash.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (read_commands(argv[1]) == -1) {
+		return EXIT_FAILURE;
+	}
+	for (size = 8; size < 2 * (unsigned) commands_count; size <<= 1)
+		; /* Intentionally left blank */
+	for (;; size <<= 1) {
+		if ((slots = malloc(size * sizeof(*slots))) == NULL) {
+			perror("::gen_cmd_hash.c:main(): Out of memory");
+			return EXIT_FAILURE;
+		}
+		if (find_seed(size, slots, &seed)) {
+			break;
+		}
+		free(slots);
+	}
+	if (write_ids(argv[2], seed, size) == -1 || write_table(argv[3], slots, size) == -1) {
+		free(slots);
+		return EXIT_FAILURE;
+	}
+	free(slots);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1006 @@
+/* clock_gettime(), getopt() */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <ev.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/** @file
+	@brief Load generator for yaIRCd
+
+	This is a benchmarking tool; it is not part of the IRCd. It is built with `make bench`.
+
+	It opens many synthetic client connections, plain and secure, to a running server. Every client registers and joins a
+	few channels; channel `i` of client `c` is `#lg((c * joins + i) % channels)`, so every channel ends up with about
+	`clients * joins / channels` members. Once every client is registered, or when the setup timeout expires, the load starts:
+	clients send `PRIVMSG` to their channels at the target rate and, optionally, leave a channel and join another one at the
+	churn rate. With `-s`, every client also drops its connection and reconnects at once, every few seconds.
+
+	Every `PRIVMSG` carries the time it was sent, so the client that receives it can measure the delivery latency, from the
+	moment the sender wrote it to the moment it was read by the recipient. Clients run in the load generator's own threads and
+	share its monotonic clock, so no clock synchronization is needed. Connection latency is measured from `connect()` to
+	`RPL_WELCOME`, which includes the SSL handshake.
+
+	Usage: `loadgen.out [options]`, where options are:
+	<ul>
+	<li>`-h host`: server's IPv4 address. Default: `127.0.0.1`.</li>
+	<li>`-p port`, `-P port`: standard and secure ports. Default: `6667` and `6697`.</li>
+	<li>`-n clients`: how many clients to connect. Default: `1000`.</li>
+	<li>`-S percent`: percentage of clients that connect to the secure port. Default: `0`.</li>
+	<li>`-t threads`: how many threads drive the clients. Default: `4`.</li>
+	<li>`-c channels`, `-k joins`: how many channels exist, and how many of them each client joins. Default: `100` and `1`.</li>
+	<li>`-r rate`: messages sent per second, over every client. Default: `1000`.</li>
+	<li>`-j rate`: channel changes (a `PART` followed by a `JOIN`) per second, over every client. Default: `0`.</li>
+	<li>`-s seconds`: reconnect every client every `seconds`. Default: `0`, no reconnect storms.</li>
+	<li>`-d seconds`: how long the load runs. Default: `30`.</li>
+	<li>`-w seconds`: how long to wait for every client to register before the load starts anyway. Default: `60`.</li>
+	</ul>
+
+	A progress line is printed every second, and a report with throughput and latency percentiles at the end.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** Maximum number of channels a client joins */
+#define MAX_CLIENT_CHANNELS 15
+
+/** Size of a client's input buffer */
+#define CONN_IN_SIZE 8192
+
+/** Size of a client's output buffer. Messages that don't fit are dropped and counted. */
+#define CONN_OUT_SIZE 4096
+
+/** Maximum length of an IRC message, including "\r\n" */
+#define MAX_LINE 512
+
+/** How often, in seconds, each thread sends the messages it owes */
+#define TICK_INTERVAL 0.005
+
+/** How many sub-buckets each power of 2 of a latency histogram is split into, as a power of 2 */
+#define HIST_SUB_BITS 4
+
+/** How many buckets a latency histogram has. Samples up to `2^41` nanoseconds (about 36 minutes) are recorded with a relative
+	error under `2^-HIST_SUB_BITS`; longer ones go to the last bucket. */
+#define HIST_BUCKETS ((42 - HIST_SUB_BITS) << HIST_SUB_BITS)
+
+/** The load generator is waiting for every client to register */
+#define PHASE_SETUP 0
+/** The load is running */
+#define PHASE_RUN 1
+/** The load is over, threads must stop */
+#define PHASE_DONE 2
+
+/** Parsed command line options. See the file documentation. */
+struct options {
+	const char *host; /**<Server's address. */
+	int port; /**<Standard port. */
+	int ssl_port; /**<Secure port. */
+	int clients; /**<How many clients to connect. */
+	int ssl_percent; /**<Percentage of secure clients. */
+	int threads; /**<How many threads to start. */
+	int channels; /**<How many channels exist. */
+	int joins; /**<How many channels each client joins. */
+	double rate; /**<Messages per second. */
+	double churn; /**<Channel changes per second. */
+	double storm_interval; /**<Seconds between reconnect storms; `0` disables them. */
+	double duration; /**<How long the load runs, in seconds. */
+	double setup_timeout; /**<How long to wait for the clients to register, in seconds. */
+};
+
+/** A log-linear latency histogram, in nanoseconds */
+struct histogram {
+	unsigned long long buckets[HIST_BUCKETS]; /**<How many samples fell in each bucket. */
+	unsigned long long count; /**<How many samples were recorded. */
+	unsigned long long max; /**<Largest sample. */
+};
+
+/** Counters kept by each thread. They are only written by their thread, with atomic operations, so that the main thread
+	can read them while the load runs. */
+struct counters {
+	unsigned long long sent; /**<Messages sent. */
+	unsigned long long delivered; /**<Messages received. */
+	unsigned long long dropped; /**<Messages not sent because a client's output buffer was full. */
+	unsigned long long churns; /**<Channel changes. */
+	unsigned long long connects; /**<Clients that registered. */
+	unsigned long long failures; /**<Connections that failed or were closed by the server. */
+};
+
+/** Where a client is in its life */
+enum conn_state {
+	CONN_CLOSED, /**<Not connected. */
+	CONN_CONNECTING, /**<Waiting for `connect()` to complete. */
+	CONN_HANDSHAKE, /**<Performing the SSL handshake. */
+	CONN_REGISTERING, /**<`NICK` and `USER` were sent, waiting for `RPL_WELCOME`. */
+	CONN_READY /**<Registered. */
+};
+
+struct bench_thread;
+
+/** A synthetic client */
+struct conn {
+	struct ev_io watcher; /**<Watcher for the client's socket. Must be the first field. */
+	struct bench_thread *thread; /**<The thread driving this client. */
+	int id; /**<Client number, from `0` to `clients - 1`. */
+	int use_ssl; /**<Whether this client connects to the secure port. */
+	SSL *ssl; /**<SSL connection, for secure clients. */
+	enum conn_state state; /**<Where this client is in its life. */
+	int events; /**<Events the watcher is waiting for. */
+	unsigned attempt; /**<How many times this client tried to register, used to build a new nickname when it is in use. */
+	unsigned long long connect_start; /**<When `connect()` was called, in nanoseconds. */
+	int joined[MAX_CLIENT_CHANNELS]; /**<Channels this client is in. */
+	int next_channel; /**<Which entry of `joined` gets the next message. */
+	char in[CONN_IN_SIZE]; /**<Characters read and not yet processed. */
+	size_t in_len; /**<How many characters are stored in `in`. */
+	char out[CONN_OUT_SIZE]; /**<Characters waiting to be written. */
+	size_t out_len; /**<How many characters are stored in `out`. */
+};
+
+/** A thread driving a share of the clients */
+struct bench_thread {
+	pthread_t tid; /**<The thread. */
+	struct ev_loop *loop; /**<The thread's loop. */
+	struct ev_timer tick; /**<Timer that sends the messages and channel changes owed, and checks the phase. */
+	struct conn *conns; /**<This thread's clients. */
+	int conns_no; /**<How many entries are stored in `conns`. */
+	int ready; /**<How many clients are registered. Updated atomically. */
+	int next_sender; /**<Next client to send a message. */
+	int next_churner; /**<Next client to change channels. */
+	double msg_credit; /**<Messages owed. */
+	double churn_credit; /**<Channel changes owed. */
+	ev_tstamp last_tick; /**<When `tick` last fired. */
+	int phase; /**<Phase seen on the last tick. */
+	unsigned storms; /**<Reconnect storms performed. */
+	unsigned seed; /**<Seed for `rand_r()`. */
+	struct histogram latency; /**<Delivery latency, only recorded while the load runs. */
+	struct histogram connect; /**<Connection latency. */
+	struct counters counters; /**<This thread's counters. */
+};
+
+static struct options opt; /**<Command line options. */
+static SSL_CTX *ssl_context; /**<SSL context for secure clients. */
+static struct sockaddr_in std_addr; /**<Standard port's address. */
+static struct sockaddr_in ssl_addr; /**<Secure port's address. */
+static int phase = PHASE_SETUP; /**<Current phase, set by the main thread. Read and written atomically. */
+static unsigned storms_requested; /**<How many reconnect storms the main thread requested. Read and written atomically. */
+
+static void conn_start(struct conn *conn);
+static void conn_cb(EV_P_ ev_io *w, int revents);
+
+/** Reads the monotonic clock.
+	@return The current time, in nanoseconds.
+*/
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+/** Finds the bucket of a histogram that a sample falls in.
+	@param ns The sample.
+	@return The bucket's index.
+*/
+static int bucket_of(unsigned long long ns)
+{
+	int exp;
+
+	if (ns < (1ULL << HIST_SUB_BITS)) {
+		return (int) ns;
+	}
+	exp = 63 - __builtin_clzll(ns);
+	if (exp > 40) {
+		return HIST_BUCKETS - 1;
+	}
+	return ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int) ((ns >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/** Finds the smallest sample that falls in a bucket.
+	@param bucket The bucket's index.
+	@return The sample, in nanoseconds.
+*/
+static unsigned long long bucket_floor(int bucket)
+{
+	int exp = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+	if (bucket < (1 << HIST_SUB_BITS)) {
+		return (unsigned long long) bucket;
+	}
+	return (1ULL << exp) | ((unsigned long long) (bucket & ((1 << HIST_SUB_BITS) - 1)) << (exp - HIST_SUB_BITS));
+}
+
+/** Records a sample in a histogram.
+	@param h The histogram.
+	@param ns The sample, in nanoseconds.
+*/
+static void hist_record(struct histogram *h, unsigned long long ns)
+{
+	h->buckets[bucket_of(ns)]++;
+	h->count++;
+	if (ns > h->max) {
+		h->max = ns;
+	}
+}
+
+/** Adds a histogram to another.
+	@param to Where the sum is stored.
+	@param from The histogram to add.
+*/
+static void hist_add(struct histogram *to, const struct histogram *from)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		to->buckets[i] += from->buckets[i];
+	}
+	to->count += from->count;
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+/** Finds a quantile of a histogram.
+	@param h The histogram.
+	@param q The quantile, between `0` and `1`.
+	@return The smallest sample of the bucket holding the quantile, in microseconds, with a relative error under
+	   `2^-HIST_SUB_BITS`; `0` if the histogram is empty.
+*/
+static double hist_quantile_us(const struct histogram *h, double q)
+{
+	unsigned long long seen = 0;
+	unsigned long long target;
+	int i;
+
+	if (h->count == 0) {
+		return 0.;
+	}
+	target = (unsigned long long) (q * (double) (h->count - 1));
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if ((seen += h->buckets[i]) > target) {
+			return (double) bucket_floor(i) / 1e3;
+		}
+	}
+	return (double) h->max / 1e3;
+}
+
+/** Prints one line with the percentiles of a histogram.
+	@param name What the histogram measures.
+	@param h The histogram.
+*/
+static void hist_print(const char *name, const struct histogram *h)
+{
+	printf("%-10s samples %-10llu p50 %10.1f us  p99 %10.1f us  p999 %10.1f us  max %10.1f us\n", name, h->count,
+	       hist_quantile_us(h, 0.5), hist_quantile_us(h, 0.99), hist_quantile_us(h, 0.999), (double) h->max / 1e3);
+}
+
+/** Increments one of a thread's counters. */
+#define count_add(thread, field, n) ((void) __sync_add_and_fetch(&(thread)->counters.field, (n)))
+
+/** Reads one of a thread's counters from another thread. */
+#define read_count(thread, field) __sync_add_and_fetch(&(thread)->counters.field, 0)
+
+/** Closes a client's connection. The client is left in `CONN_CLOSED`, and can be started again with `conn_start()`.
+	@param conn The client.
+*/
+static void conn_close(struct conn *conn)
+{
+	if (conn->state == CONN_CLOSED) {
+		return;
+	}
+	if (conn->state == CONN_READY) {
+		(void) __sync_sub_and_fetch(&conn->thread->ready, 1);
+	}
+	ev_io_stop(conn->thread->loop, &conn->watcher);
+	if (conn->ssl != NULL) {
+		SSL_free(conn->ssl);
+		conn->ssl = NULL;
+	}
+	close(conn->watcher.fd);
+	conn->state = CONN_CLOSED;
+	conn->in_len = conn->out_len = 0;
+}
+
+/** Closes a client's connection after an error, and counts the failure. Clients that fail are not reconnected until the
+	next reconnect storm.
+	@param conn The client.
+*/
+static void conn_fail(struct conn *conn)
+{
+	count_add(conn->thread, failures, 1);
+	conn_close(conn);
+}
+
+/** Sets the events the client's watcher waits for.
+	@param conn The client.
+	@param events `EV_READ`, `EV_WRITE` or both.
+*/
+static void conn_watch(struct conn *conn, int events)
+{
+	if (conn->events == events) {
+		return;
+	}
+	conn->events = events;
+	ev_io_stop(conn->thread->loop, &conn->watcher);
+	ev_io_set(&conn->watcher, conn->watcher.fd, events);
+	ev_io_start(conn->thread->loop, &conn->watcher);
+}
+
+/** Writes as much of a client's output buffer as the socket takes.
+	@param conn The client. Must be registering or registered.
+	@return `0` on success, even if some characters are still waiting to be written; `-1` if the connection was closed
+	   because of an error.
+*/
+static int conn_flush(struct conn *conn)
+{
+	ssize_t written;
+	int err;
+
+	while (conn->out_len > 0) {
+		if (conn->ssl != NULL) {
+			if ((written = SSL_write(conn->ssl, conn->out, (int) conn->out_len)) <= 0) {
+				err = SSL_get_error(conn->ssl, (int) written);
+				if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+					break;
+				}
+				conn_fail(conn);
+				return -1;
+			}
+		} else if ((written = send(conn->watcher.fd, conn->out, conn->out_len, MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			conn_fail(conn);
+			return -1;
+		}
+		memmove(conn->out, conn->out + written, conn->out_len - (size_t) written);
+		conn->out_len -= (size_t) written;
+	}
+	conn_watch(conn, conn->out_len > 0 ? EV_READ | EV_WRITE : EV_READ);
+	return 0;
+}
+
+/** Queues a message in a client's output buffer and tries to write it.
+	@param conn The client.
+	@param fmt Format string for the message, as in `printf()`, including the final "\r\n".
+	@param ... Arguments matching `fmt`.
+	@return `0` on success; `1` if the message didn't fit in the output buffer, and was dropped; `-1` if the connection was
+	   closed because of an error.
+*/
+static int conn_send(struct conn *conn, const char *fmt, ...)
+{
+	char line[MAX_LINE + 1];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	if (len < 0 || len > MAX_LINE) {
+		return 1;
+	}
+	if (conn->out_len + (size_t) len > sizeof(conn->out)) {
+		return 1;
+	}
+	memcpy(conn->out + conn->out_len, line, (size_t) len);
+	conn->out_len += (size_t) len;
+	return conn_flush(conn);
+}
+
+/** Writes a client's nickname. The first attempt uses the client's number in base 36; later attempts, made when the
+	nickname is in use, append the attempt number.
+	@param conn The client.
+	@param nick Where the nickname is stored. Must hold at least 10 characters.
+*/
+static void conn_nick(struct conn *conn, char *nick)
+{
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	char tmp[16];
+	unsigned value;
+	int len = 0;
+	int i;
+
+	nick[len++] = 'l';
+	for (i = 0, value = (unsigned) conn->id; i == 0 || value > 0; i++, value /= 36) {
+		tmp[i] = digits[value % 36];
+	}
+	while (i > 0 && len < 9) {
+		nick[len++] = tmp[--i];
+	}
+	if (conn->attempt > 0 && len < 8) {
+		nick[len++] = '_';
+		for (i = 0, value = conn->attempt; i == 0 || value > 0; i++, value /= 36) {
+			tmp[i] = digits[value % 36];
+		}
+		while (i > 0 && len < 9) {
+			nick[len++] = tmp[--i];
+		}
+	}
+	nick[len] = '\0';
+}
+
+/** Sends `NICK` and `USER`.
+	@param conn The client.
+*/
+static void conn_register(struct conn *conn)
+{
+	char nick[16];
+
+	conn_nick(conn, nick);
+	conn->state = CONN_REGISTERING;
+	(void) conn_send(conn, "NICK %s\r\nUSER %s 0 * :yaIRCd load generator\r\n", nick, nick);
+}
+
+/** Handles `RPL_WELCOME`: the client is registered, and joins its channels.
+	@param conn The client.
+*/
+static void conn_welcome(struct conn *conn)
+{
+	int i;
+
+	if (conn->state == CONN_READY) {
+		return;
+	}
+	hist_record(&conn->thread->connect, now_ns() - conn->connect_start);
+	count_add(conn->thread, connects, 1);
+	conn->state = CONN_READY;
+	(void) __sync_add_and_fetch(&conn->thread->ready, 1);
+	for (i = 0; i < opt.joins; i++) {
+		if (conn_send(conn, "JOIN #lg%d\r\n", conn->joined[i]) == -1) {
+			return;
+		}
+	}
+}
+
+/** Handles a message received by a client.
+	@param conn The client.
+	@param line The message, null terminated, without "\r\n".
+*/
+static void conn_line(struct conn *conn, char *line)
+{
+	char *cmd = line;
+	char *stamp;
+	unsigned long long sent;
+
+	if (*cmd == ':') {
+		if ((cmd = strchr(cmd, ' ')) == NULL) {
+			return;
+		}
+		cmd++;
+	}
+	if (strncmp(cmd, "PRIVMSG ", 8) == 0) {
+		if ((stamp = strstr(cmd, " :t=")) != NULL && conn->thread->phase == PHASE_RUN) {
+			sent = strtoull(stamp + 4, NULL, 10);
+			hist_record(&conn->thread->latency, now_ns() - sent);
+		}
+		count_add(conn->thread, delivered, 1);
+	} else if (strncmp(cmd, "PING ", 5) == 0) {
+		(void) conn_send(conn, "PONG %s\r\n", cmd + 5);
+	} else if (strncmp(cmd, "001 ", 4) == 0) {
+		conn_welcome(conn);
+	} else if (strncmp(cmd, "433 ", 4) == 0) {
+		conn->attempt++;
+		conn_register(conn);
+	} else if (strncmp(cmd, "ERROR ", 6) == 0) {
+		conn_fail(conn);
+	}
+}
+
+/** Reads everything available in a client's socket, and handles every complete message.
+	@param conn The client. Must be registering or registered.
+*/
+static void conn_read(struct conn *conn)
+{
+	ssize_t nread;
+	char *begin;
+	char *end;
+	int err;
+
+	for (;;) {
+		if (conn->ssl != NULL) {
+			if ((nread = SSL_read(conn->ssl, conn->in + conn->in_len, (int) (sizeof(conn->in) - conn->in_len - 1))) <= 0) {
+				err = SSL_get_error(conn->ssl, (int) nread);
+				if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+					return;
+				}
+				conn_fail(conn);
+				return;
+			}
+		} else if ((nread = recv(conn->watcher.fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len - 1, 0)) <= 0) {
+			if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				return;
+			}
+			conn_fail(conn);
+			return;
+		}
+		conn->in_len += (size_t) nread;
+		conn->in[conn->in_len] = '\0';
+		for (begin = conn->in; (end = strchr(begin, '\n')) != NULL; begin = end + 1) {
+			*end = '\0';
+			if (end > begin && end[-1] == '\r') {
+				end[-1] = '\0';
+			}
+			conn_line(conn, begin);
+			if (conn->state == CONN_CLOSED) {
+				return;
+			}
+		}
+		conn->in_len -= (size_t) (begin - conn->in);
+		memmove(conn->in, begin, conn->in_len);
+		if (conn->in_len == sizeof(conn->in) - 1) {
+			/* No message is this long; forget it */
+			conn->in_len = 0;
+		}
+	}
+}
+
+/** Moves a client's SSL handshake forward.
+	@param conn The client. Must be in `CONN_HANDSHAKE`.
+*/
+static void conn_handshake(struct conn *conn)
+{
+	int ret;
+	int err;
+
+	ERR_clear_error();
+	if ((ret = SSL_connect(conn->ssl)) == 1) {
+		conn_watch(conn, EV_READ);
+		conn_register(conn);
+		return;
+	}
+	err = SSL_get_error(conn->ssl, ret);
+	if (err == SSL_ERROR_WANT_READ) {
+		conn_watch(conn, EV_READ);
+	} else if (err == SSL_ERROR_WANT_WRITE) {
+		conn_watch(conn, EV_WRITE);
+	} else {
+		conn_fail(conn);
+	}
+}
+
+/** Handles the completion of a client's `connect()`.
+	@param conn The client. Must be in `CONN_CONNECTING`.
+*/
+static void conn_connected(struct conn *conn)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+	int one = 1;
+
+	if (getsockopt(conn->watcher.fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+		conn_fail(conn);
+		return;
+	}
+	(void) setsockopt(conn->watcher.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (!conn->use_ssl) {
+		conn_watch(conn, EV_READ);
+		conn_register(conn);
+		return;
+	}
+	if ((conn->ssl = SSL_new(ssl_context)) == NULL || SSL_set_fd(conn->ssl, conn->watcher.fd) != 1) {
+		conn_fail(conn);
+		return;
+	}
+	SSL_set_connect_state(conn->ssl);
+	conn->state = CONN_HANDSHAKE;
+	conn_handshake(conn);
+}
+
+/** Callback for a client's watcher.
+	@param w Pointer to the client's watcher, which is the first field of `struct conn`.
+	@param revents libev's flags.
+*/
+static void conn_cb(EV_P_ ev_io *w, int revents)
+{
+	struct conn *conn = (struct conn *) w;
+
+	switch (conn->state) {
+	case CONN_CONNECTING:
+		conn_connected(conn);
+		break;
+	case CONN_HANDSHAKE:
+		conn_handshake(conn);
+		break;
+	case CONN_REGISTERING:
+	case CONN_READY:
+		if (revents & EV_READ) {
+			conn_read(conn);
+		}
+		if (conn->state != CONN_CLOSED && (revents & EV_WRITE)) {
+			(void) conn_flush(conn);
+		}
+		break;
+	case CONN_CLOSED:
+		break;
+	}
+}
+
+/** Opens a client's connection. The client registers and joins its channels once it is connected.
+	@param conn The client. Must be in `CONN_CLOSED`.
+*/
+static void conn_start(struct conn *conn)
+{
+	struct sockaddr_in *addr = (conn->use_ssl ? &ssl_addr : &std_addr);
+	int fd;
+
+	conn->attempt = 0;
+	conn->connect_start = now_ns();
+	if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		count_add(conn->thread, failures, 1);
+		return;
+	}
+	if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) == -1 && errno != EINPROGRESS) {
+		close(fd);
+		count_add(conn->thread, failures, 1);
+		return;
+	}
+	conn->state = CONN_CONNECTING;
+	conn->events = EV_WRITE;
+	ev_io_init(&conn->watcher, conn_cb, fd, EV_WRITE);
+	ev_io_start(conn->thread->loop, &conn->watcher);
+}
+
+/** Finds the registered client that shall act next, in round-robin.
+	@param thread The thread.
+	@param next The thread's cursor, `next_sender` or `next_churner`.
+	@return The client; `NULL` if none is registered.
+*/
+static struct conn *next_ready(struct bench_thread *thread, int *next)
+{
+	struct conn *conn;
+	int i;
+
+	for (i = 0; i < thread->conns_no; i++) {
+		conn = &thread->conns[*next];
+		*next = (*next + 1) % thread->conns_no;
+		if (conn->state == CONN_READY) {
+			return conn;
+		}
+	}
+	return NULL;
+}
+
+/** Sends a timestamped message to one of a client's channels.
+	@param conn The client.
+*/
+static void send_message(struct conn *conn)
+{
+	int ret;
+
+	ret = conn_send(conn, "PRIVMSG #lg%d :t=%llu yaIRCd load generator\r\n", conn->joined[conn->next_channel],
+			now_ns());
+	conn->next_channel = (conn->next_channel + 1) % opt.joins;
+	if (ret == 0) {
+		count_add(conn->thread, sent, 1);
+	} else if (ret == 1) {
+		count_add(conn->thread, dropped, 1);
+	}
+}
+
+/** Makes a client leave one of its channels and join another one, picked at random.
+	@param conn The client.
+*/
+static void change_channel(struct conn *conn)
+{
+	int slot = rand_r(&conn->thread->seed) % opt.joins;
+	int channel = rand_r(&conn->thread->seed) % opt.channels;
+
+	if (conn_send(conn, "PART #lg%d\r\nJOIN #lg%d\r\n", conn->joined[slot], channel) == 0) {
+		conn->joined[slot] = channel;
+		count_add(conn->thread, churns, 1);
+	}
+}
+
+/** Callback for a thread's tick. Follows the phase set by the main thread, performs the reconnect storms it requested, and
+	sends the messages and channel changes owed since the last tick.
+	@param w Pointer to the thread's `tick`.
+	@param revents libev's flags. Not used.
+*/
+static void tick_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct bench_thread *thread = (struct bench_thread *) ((char *) w - offsetof(struct bench_thread, tick));
+	struct conn *conn;
+	ev_tstamp now = ev_now(EV_A);
+	unsigned storms;
+	int i;
+
+	if ((thread->phase = __sync_add_and_fetch(&phase, 0)) == PHASE_DONE) {
+		ev_break(EV_A_ EVBREAK_ALL);
+		return;
+	}
+	if ((storms = __sync_add_and_fetch(&storms_requested, 0)) != thread->storms) {
+		thread->storms = storms;
+		for (i = 0; i < thread->conns_no; i++) {
+			conn_close(&thread->conns[i]);
+		}
+		for (i = 0; i < thread->conns_no; i++) {
+			conn_start(&thread->conns[i]);
+		}
+	}
+	if (thread->phase == PHASE_RUN) {
+		thread->msg_credit += (now - thread->last_tick) * opt.rate / opt.threads;
+		thread->churn_credit += (now - thread->last_tick) * opt.churn / opt.threads;
+		for (; thread->msg_credit >= 1.; thread->msg_credit -= 1.) {
+			if ((conn = next_ready(thread, &thread->next_sender)) == NULL) {
+				thread->msg_credit = 0.;
+				break;
+			}
+			send_message(conn);
+		}
+		for (; thread->churn_credit >= 1.; thread->churn_credit -= 1.) {
+			if ((conn = next_ready(thread, &thread->next_churner)) == NULL) {
+				thread->churn_credit = 0.;
+				break;
+			}
+			change_channel(conn);
+		}
+	}
+	thread->last_tick = now;
+}
+
+/** A thread's starting point. Connects the thread's clients and runs its loop until the load is over.
+	@param arg Pointer to the thread's `struct bench_thread`.
+	@return Always `NULL`.
+*/
+static void *thread_main(void *arg)
+{
+	struct bench_thread *thread = (struct bench_thread *) arg;
+	int i;
+
+	for (i = 0; i < thread->conns_no; i++) {
+		conn_start(&thread->conns[i]);
+	}
+	thread->last_tick = ev_now(thread->loop);
+	ev_timer_init(&thread->tick, tick_cb, TICK_INTERVAL, TICK_INTERVAL);
+	ev_timer_start(thread->loop, &thread->tick);
+	ev_run(thread->loop, 0);
+	for (i = 0; i < thread->conns_no; i++) {
+		conn_close(&thread->conns[i]);
+	}
+	return NULL;
+}
+
+/** Prints the usage message.
+	@param name The program's name.
+*/
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-P ssl_port] [-n clients] [-S ssl_percent] [-t threads] [-c channels]\n"
+		"\t[-k joins] [-r msgs_per_sec] [-j churn_per_sec] [-s storm_interval] [-d duration] [-w setup_timeout]\n", name);
+}
+
+/** Parses the command line.
+	@param argc Number of arguments.
+	@param argv The arguments.
+	@return `0` on success; `-1` if the options are invalid, in which case the usage message was printed.
+*/
+static int parse_options(int argc, char *argv[])
+{
+	int c;
+
+	opt.host = "127.0.0.1";
+	opt.port = 6667;
+	opt.ssl_port = 6697;
+	opt.clients = 1000;
+	opt.ssl_percent = 0;
+	opt.threads = 4;
+	opt.channels = 100;
+	opt.joins = 1;
+	opt.rate = 1000.;
+	opt.churn = 0.;
+	opt.storm_interval = 0.;
+	opt.duration = 30.;
+	opt.setup_timeout = 60.;
+	while ((c = getopt(argc, argv, "h:p:P:n:S:t:c:k:r:j:s:d:w:")) != -1) {
+		switch (c) {
+		case 'h': opt.host = optarg; break;
+		case 'p': opt.port = atoi(optarg); break;
+		case 'P': opt.ssl_port = atoi(optarg); break;
+		case 'n': opt.clients = atoi(optarg); break;
+		case 'S': opt.ssl_percent = atoi(optarg); break;
+		case 't': opt.threads = atoi(optarg); break;
+		case 'c': opt.channels = atoi(optarg); break;
+		case 'k': opt.joins = atoi(optarg); break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 'j': opt.churn = atof(optarg); break;
+		case 's': opt.storm_interval = atof(optarg); break;
+		case 'd': opt.duration = atof(optarg); break;
+		case 'w': opt.setup_timeout = atof(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (opt.clients < 1 || opt.threads < 1 || opt.channels < 1 || opt.joins < 1 || opt.joins > MAX_CLIENT_CHANNELS ||
+	    opt.ssl_percent < 0 || opt.ssl_percent > 100 || opt.rate < 0. || opt.churn < 0. || opt.duration <= 0.) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (opt.threads > opt.clients) {
+		opt.threads = opt.clients;
+	}
+	return 0;
+}
+
+/** Fills a server address.
+	@param addr Where the address is stored.
+	@param port The port.
+	@return `0` on success; `-1` if `opt.host` is not a valid IPv4 address.
+*/
+static int fill_address(struct sockaddr_in *addr, int port)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons((unsigned short) port);
+	return inet_pton(AF_INET, opt.host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+/** Sets up the threads and their clients. Clients are spread evenly; every `100 / ssl_percent`-th client is secure.
+	@return The threads; `NULL` if there is not enough memory.
+*/
+static struct bench_thread *create_threads(void)
+{
+	struct bench_thread *threads;
+	struct conn *conn;
+	int t, i, j, id;
+
+	if ((threads = calloc((size_t) opt.threads, sizeof(*threads))) == NULL) {
+		return NULL;
+	}
+	for (t = 0, id = 0; t < opt.threads; t++) {
+		threads[t].conns_no = opt.clients / opt.threads + (t < opt.clients % opt.threads);
+		threads[t].seed = (unsigned) t * 2654435761U + 1;
+		if ((threads[t].conns = calloc((size_t) threads[t].conns_no, sizeof(struct conn))) == NULL ||
+		    (threads[t].loop = ev_loop_new(EVFLAG_AUTO)) == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < threads[t].conns_no; i++, id++) {
+			conn = &threads[t].conns[i];
+			conn->thread = &threads[t];
+			conn->id = id;
+			conn->use_ssl = (id * opt.ssl_percent / 100 != (id + 1) * opt.ssl_percent / 100);
+			conn->state = CONN_CLOSED;
+			for (j = 0; j < opt.joins; j++) {
+				conn->joined[j] = (id * opt.joins + j) % opt.channels;
+			}
+		}
+	}
+	return threads;
+}
+
+/** Adds every thread's counters.
+	@param threads The threads.
+	@param totals Where the sum is stored.
+	@param ready Where the number of registered clients is stored.
+*/
+static void sum_counters(struct bench_thread *threads, struct counters *totals, int *ready)
+{
+	int t;
+
+	memset(totals, 0, sizeof(*totals));
+	*ready = 0;
+	for (t = 0; t < opt.threads; t++) {
+		totals->sent += read_count(&threads[t], sent);
+		totals->delivered += read_count(&threads[t], delivered);
+		totals->dropped += read_count(&threads[t], dropped);
+		totals->churns += read_count(&threads[t], churns);
+		totals->connects += read_count(&threads[t], connects);
+		totals->failures += read_count(&threads[t], failures);
+		*ready += __sync_add_and_fetch(&threads[t].ready, 0);
+	}
+}
+
+/** The load generator's starting point. Starts the threads, waits for the clients to register, runs the load for the
+	requested duration, printing a progress line every second, and prints the final report.
+	@param argc Number of arguments.
+	@param argv The arguments.
+	@return `0` on success; `1` on error.
+*/
+int main(int argc, char *argv[])
+{
+	struct bench_thread *threads;
+	struct counters start, totals, last;
+	struct histogram latency, connecting;
+	struct timespec second = { 1, 0 };
+	double elapsed, setup, next_storm;
+	int ready, t;
+
+	/* SSL_write() can't pass MSG_NOSIGNAL; a connection closed by the server must not kill us */
+	signal(SIGPIPE, SIG_IGN);
+	if (parse_options(argc, argv) == -1) {
+		return 1;
+	}
+	if (fill_address(&std_addr, opt.port) == -1 || fill_address(&ssl_addr, opt.ssl_port) == -1) {
+		fprintf(stderr, "Invalid server address: %s\n", opt.host);
+		return 1;
+	}
+	SSL_library_init();
+	SSL_load_error_strings();
+	if ((ssl_context = SSL_CTX_new(SSLv23_client_method())) == NULL) {
+		fprintf(stderr, "Could not create the SSL context.\n");
+		return 1;
+	}
+	SSL_CTX_set_mode(ssl_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if ((threads = create_threads()) == NULL) {
+		fprintf(stderr, "Not enough memory for %d clients.\n", opt.clients);
+		return 1;
+	}
+	for (t = 0; t < opt.threads; t++) {
+		if (pthread_create(&threads[t].tid, NULL, thread_main, &threads[t]) != 0) {
+			fprintf(stderr, "Could not create thread %d.\n", t);
+			return 1;
+		}
+	}
+
+	/* Setup: wait for every client to register */
+	for (setup = 0.; ; setup += 1.) {
+		sum_counters(threads, &totals, &ready);
+		printf("setup %4.0fs: %d/%d registered, %llu failures\n", setup, ready, opt.clients, totals.failures);
+		fflush(stdout);
+		if (ready == opt.clients || setup >= opt.setup_timeout) {
+			break;
+		}
+		nanosleep(&second, NULL);
+	}
+
+	/* Load */
+	sum_counters(threads, &start, &ready);
+	last = start;
+	__sync_lock_test_and_set(&phase, PHASE_RUN);
+	next_storm = opt.storm_interval;
+	for (elapsed = 1.; elapsed <= opt.duration; elapsed += 1.) {
+		nanosleep(&second, NULL);
+		sum_counters(threads, &totals, &ready);
+		printf("run %6.0fs: %d registered, %llu sent/s, %llu delivered/s, %llu dropped, %llu churns, %llu failures\n",
+		       elapsed, ready, totals.sent - last.sent, totals.delivered - last.delivered, totals.dropped - start.dropped,
+		       totals.churns - start.churns, totals.failures - start.failures);
+		fflush(stdout);
+		last = totals;
+		if (opt.storm_interval > 0. && elapsed >= next_storm) {
+			(void) __sync_add_and_fetch(&storms_requested, 1);
+			next_storm += opt.storm_interval;
+		}
+	}
+	__sync_lock_test_and_set(&phase, PHASE_DONE);
+	memset(&latency, 0, sizeof(latency));
+	memset(&connecting, 0, sizeof(connecting));
+	for (t = 0; t < opt.threads; t++) {
+		pthread_join(threads[t].tid, NULL);
+		hist_add(&latency, &threads[t].latency);
+		hist_add(&connecting, &threads[t].connect);
+	}
+
+	/* Report */
+	sum_counters(threads, &totals, &ready);
+	elapsed = opt.duration;
+	printf("\n%d clients (%d%% SSL), %d threads, %d channels, %d joins per client, %.0fs\n", opt.clients, opt.ssl_percent,
+	       opt.threads, opt.channels, opt.joins, elapsed);
+	printf("sent       %llu messages, %.1f/s, %llu dropped\n", totals.sent - start.sent,
+	       (double) (totals.sent - start.sent) / elapsed, totals.dropped - start.dropped);
+	printf("delivered  %llu messages, %.1f/s, fan-out %.2f\n", totals.delivered - start.delivered,
+	       (double) (totals.delivered - start.delivered) / elapsed,
+	       totals.sent == start.sent ? 0. : (double) (totals.delivered - start.delivered) / (double) (totals.sent - start.sent));
+	printf("churn      %llu channel changes, %.1f/s\n", totals.churns - start.churns,
+	       (double) (totals.churns - start.churns) / elapsed);
+	printf("registered %llu clients, %llu failures, %u reconnect storms\n", totals.connects, totals.failures,
+	       __sync_add_and_fetch(&storms_requested, 0));
+	hist_print("delivery", &latency);
+	hist_print("connect", &connecting);
+	return 0;
+}
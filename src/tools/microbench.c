@@ -0,0 +1,1000 @@
+/* clock_gettime(), getopt() */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ev.h>
+#include "protocol.h"
+#include "client.h"
+#include "client_list.h"
+#include "trie.h"
+#include "list.h"
+#include "parsemsg.h"
+#include "read_msgs.h"
+#include "cloak.h"
+#include "write_msgs_queue.h"
+#include "pool.h"
+#include "stats.h"
+#include "reply.h"
+#include "serverinfo.h"
+
+/** @file
+	@brief Microbenchmarks for the core data structures and parsers
+
+	This is a benchmarking tool; it is not part of the IRCd. It is built with `make microbench`, and links the server's own
+	`trie.c`, `list.c`, `parsemsg.c`, `read_msgs.c`, `cloak.c`, `write_msgs_queue.c`, `pool.c` and `stats.c`, so it measures
+	exactly the code that runs in the server, statistics hooks included. The few functions those files need from the rest of
+	the server are provided here: the cloak keys come from constants instead of the configuration file, and socket reads are
+	served from the traffic in memory.
+
+	Each kernel is run `RUNS` times and prints one line in JSON, with the kernel's name, how many threads ran it, how many
+	operations each run performed, and the fastest and median time per operation, in nanoseconds. Setup and teardown are
+	never timed. Clients' nicknames are made of a few common syllables, optionally followed by a suffix, like real
+	nicknames, and lookups follow a skewed distribution, where a few nicknames and channels get most of the traffic.
+
+	Usage: `microbench.out [-k prefix] [-n scale] [-t threads] [-f traffic]`, where:
+	<ul>
+	<li>`-k prefix`: only run kernels whose name starts with `prefix`.</li>
+	<li>`-n scale`: multiply the size of every data set by `scale`. Default: `1`.</li>
+	<li>`-t threads`: largest number of threads for the contended kernels, which run with 1, 2, 4, ... threads. Default: `8`.</li>
+	<li>`-f traffic`: parse this file, holding raw IRC messages, one per line, instead of the built-in synthetic traffic.</li>
+	</ul>
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** How many times each kernel runs */
+#define RUNS 5
+
+/** How many nicknames there are, before scaling */
+#define NICKS_NO 50000
+
+/** How many channels there are, before scaling */
+#define CHANNELS_NO 20000
+
+/** How many lookups a lookup kernel performs, before scaling */
+#define LOOKUPS_NO 1000000
+
+/** How many messages the built-in traffic has, before scaling */
+#define TRAFFIC_MESSAGES 200000
+
+/** How many hosts the cache miss kernels cloak, before scaling. Must be larger than `CLOAK_CACHE_SIZE`. */
+#define CLOAK_HOSTS_NO 100000
+
+/** How many hosts the cache hit kernels cloak over and over. Must be smaller than `CLOAK_CACHE_SIZE`. */
+#define CLOAK_HOT_HOSTS 1000
+
+/** How many messages a queue kernel queues before each flush */
+#define QUEUE_BATCH 64
+
+/** How many messages a queue kernel queues, before scaling */
+#define QUEUE_MESSAGES 1000000
+
+/** How many characters a simulated socket read returns at most, like a TCP segment */
+#define READ_CHUNK 1460
+
+/** One in how many operations of the churn kernels deletes and adds back a nickname */
+#define CHURN_RATIO 64
+
+/** Size of the channel alphabet, as in `channel.c` */
+#define BENCH_CHANNEL_EDGES 256
+
+/** A kernel. It performs one timed run.
+	@param threads How many threads run the kernel.
+	@param ops Where the number of operations performed is stored.
+	@return How long the timed part took, in nanoseconds.
+*/
+typedef unsigned long long (*kernel_fn)(int threads, unsigned long long *ops);
+
+static const char *kernel_filter = ""; /**<Only kernels whose name starts with this are run. */
+static int scale = 1; /**<Multiplier for the size of every data set. */
+static int max_threads = 8; /**<Largest number of threads for the contended kernels. */
+
+static char **nicks; /**<The nicknames. */
+static int nicks_no; /**<How many entries are stored in `nicks`. */
+static char **channels; /**<The channels. */
+static int channels_no; /**<How many entries are stored in `channels`. */
+static int *lookups; /**<Skewed sequence of indices into `nicks` or `channels`, used by every lookup. */
+static int lookups_no; /**<How many entries are stored in `lookups`. */
+
+static char *traffic; /**<The traffic, raw IRC messages terminated by "\r\n" or "\n". */
+static size_t traffic_len; /**<Length of `traffic`. */
+static size_t traffic_pos; /**<How many characters of `traffic` were served by `read_from_noerr()`. */
+
+static int cloak_mode = CLOAK_MODE_LEGACY; /**<Cloak mode returned by `get_cloak_mode()`. */
+
+static volatile unsigned long sink; /**<Every kernel adds its results here, so the compiler can't throw away the work. */
+
+/** Syllables nicknames are made of */
+static const char *syllables[] = { "an", "el", "ri", "ka", "zo", "mi", "th", "or", "us", "de", "la", "ne", "x", "jo",
+				   "sh", "ar", "ix", "be", "to", "ry" };
+
+/** Suffixes some nicknames end with */
+static const char *nick_suffixes[] = { "|away", "^", "`", "-", "[w]", "|afk" };
+
+/** Words channels are made of */
+static const char *words[] = { "linux", "help", "dev", "chat", "music", "games", "news", "c", "python", "ops", "br", "pt",
+			       "fr", "de", "irc", "anime", "bsd" };
+
+/* Stand-ins for the rest of the server */
+
+/** Stands in for `serverinfo.c`.
+	@return The cloak's network prefix.
+*/
+const char *get_cloak_net_prefix(void)
+{
+	return "bench";
+}
+
+/** Stands in for `serverinfo.c`.
+	@param i Which key, from `1` to `3`.
+	@return The key.
+*/
+const char *get_cloak_key(int i)
+{
+	static const char *keys[] = { "a1s2d3f4g5h6j7k8l9", "q1w2e3r4t5y6u7i8o9", "z1x2c3v4b5n6m7p8o9" };
+	return keys[i - 1];
+}
+
+/** Stands in for `serverinfo.c`.
+	@param i Which key, from `1` to `3`.
+	@return The key's length.
+*/
+size_t get_cloak_key_length(int i)
+{
+	return strlen(get_cloak_key(i));
+}
+
+/** Stands in for `serverinfo.c`.
+	@return The cloak mode of the kernel that is running.
+*/
+int get_cloak_mode(void)
+{
+	return cloak_mode;
+}
+
+/** Stands in for `msgio.c`. Serves `traffic` in chunks of at most `READ_CHUNK` characters.
+	@param client Not used.
+	@param buf Where the characters are stored.
+	@param len How many characters fit in `buf`.
+	@return How many characters were stored; `0` once the whole traffic was served.
+*/
+ssize_t read_from_noerr(struct irc_client *client, char *buf, size_t len)
+{
+	if (len > READ_CHUNK) {
+		len = READ_CHUNK;
+	}
+	if (len > traffic_len - traffic_pos) {
+		len = traffic_len - traffic_pos;
+	}
+	memcpy(buf, traffic + traffic_pos, len);
+	traffic_pos += len;
+	return (ssize_t) len;
+}
+
+/** Stands in for `reply.c`, which `stats.c` needs to answer `STATS`. Never called by the kernels. */
+void reply_numeric(struct reply *reply, struct irc_client *client, const char *numeric)
+{
+	abort();
+}
+
+/** Stands in for `reply.c`. Never called by the kernels. */
+void reply_append(struct reply *reply, const char *str)
+{
+	abort();
+}
+
+/** Stands in for `reply.c`. Never called by the kernels. */
+void reply_param(struct reply *reply, const char *param)
+{
+	abort();
+}
+
+/** Stands in for `reply.c`. Never called by the kernels. */
+void reply_trailing(struct reply *reply, const char *trailing)
+{
+	abort();
+}
+
+/** Stands in for `reply.c`. Never called by the kernels. */
+void reply_send(struct reply *reply, struct irc_client *client)
+{
+	abort();
+}
+
+/* Alphabets, as in client_list.c and channel.c */
+
+/** Defines what characters are allowed inside a nickname, like `nick_is_valid()`.
+	@param s The character.
+	@return `1` if `s` is allowed in a nickname; `0` otherwise.
+*/
+static int bench_nick_is_valid(char s)
+{
+	return (s >= 'a' && s <= 'z') || (s >= 'A' && s <= 'Z') || strchr("-[]\\`^{}|", s) != NULL;
+}
+
+/** Converts a character ID back into its character, like `nick_pos_to_char()`.
+	@param i The ID.
+	@return The character.
+*/
+static char bench_nick_pos_to_char(int i)
+{
+	return i < NICK_ALPHABET_SIZE ? (char) ('a' + i) : "-{}|`^"[i - NICK_ALPHABET_SIZE];
+}
+
+/** Converts a character into its ID, like `nick_char_to_pos()`.
+	@param s The character.
+	@return The ID.
+*/
+static int bench_nick_char_to_pos(char s)
+{
+	if ((s >= 'a' && s <= 'z') || (s >= 'A' && s <= 'Z')) {
+		return (s | 0x20) - 'a';
+	}
+	return NICK_ALPHABET_SIZE + (s == '-' ? 0 : s == '[' || s == '{' ? 1 : s == ']' || s == '}' ? 2 :
+				     s == '\\' || s == '|' ? 3 : s == '`' ? 4 : 5);
+}
+
+/** Defines what characters are allowed inside a channel name, as in `channel.c`.
+	@param c The character.
+	@return `1` if `c` is allowed; `0` otherwise.
+*/
+static int bench_chan_is_valid(char c)
+{
+	return c != '\0' && c != '\a' && c != '\r' && c != '\n' && c != ' ' && c != ',' && c != ':';
+}
+
+/** Maps a character ID into its character, as in `channel.c`.
+	@param i The ID.
+	@return The character.
+*/
+static char bench_chan_pos_to_char(int i)
+{
+	return (char) i;
+}
+
+/** Maps a character into its ID, as in `channel.c`.
+	@param c The character.
+	@return The ID.
+*/
+static int bench_chan_char_to_pos(char c)
+{
+	return (int) (unsigned char) c;
+}
+
+/* Data sets */
+
+/** Reads the monotonic clock.
+	@return The current time, in nanoseconds.
+*/
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+/** Picks an index with a skewed distribution: low indices are picked much more often than high ones.
+	@param seed Seed for `rand_r()`.
+	@param n How many indices exist.
+	@return An index between `0` and `n - 1`.
+*/
+static int skewed(unsigned *seed, int n)
+{
+	double u = (double) rand_r(seed) / ((double) RAND_MAX + 1.);
+	return (int) (u * u * u * n);
+}
+
+/** Allocates memory, and gives up if there isn't enough.
+	@param size How many bytes to allocate.
+	@return The memory.
+*/
+static void *xmalloc(size_t size)
+{
+	void *ptr;
+
+	if ((ptr = malloc(size)) == NULL) {
+		fprintf(stderr, "Not enough memory.\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+/** Builds the nicknames, the channels and the lookup sequence. */
+static void make_names(void)
+{
+	char name[MAX_CHANNAME_LENGTH + 1];
+	unsigned seed = 42;
+	int i, len, parts;
+
+	nicks_no = NICKS_NO * scale;
+	nicks = xmalloc(sizeof(*nicks) * (size_t) nicks_no);
+	for (i = 0; i < nicks_no; i++) {
+		name[0] = '\0';
+		for (parts = 2 + rand_r(&seed) % 3; parts > 0; parts--) {
+			strcat(name, syllables[rand_r(&seed) % (sizeof(syllables) / sizeof(*syllables))]);
+		}
+		if (rand_r(&seed) % 10 < 3) {
+			strcat(name, nick_suffixes[rand_r(&seed) % (sizeof(nick_suffixes) / sizeof(*nick_suffixes))]);
+		}
+		name[MAX_NICK_LENGTH] = '\0';
+		/* The same name may come up more than once; spread them over every letter, like real users do */
+		if (i % 4 == 0) {
+			name[0] = (char) ('a' + i / 4 % 26);
+		}
+		nicks[i] = strdup(name);
+	}
+	channels_no = CHANNELS_NO * scale;
+	channels = xmalloc(sizeof(*channels) * (size_t) channels_no);
+	for (i = 0; i < channels_no; i++) {
+		len = snprintf(name, sizeof(name), "#%s", words[rand_r(&seed) % (sizeof(words) / sizeof(*words))]);
+		if (rand_r(&seed) % 2 == 0) {
+			len += snprintf(name + len, sizeof(name) - (size_t) len, "-%s",
+					words[rand_r(&seed) % (sizeof(words) / sizeof(*words))]);
+		}
+		snprintf(name + len, sizeof(name) - (size_t) len, "%d", i);
+		channels[i] = strdup(name);
+	}
+	lookups_no = LOOKUPS_NO * scale;
+	lookups = xmalloc(sizeof(*lookups) * (size_t) lookups_no);
+	for (i = 0; i < lookups_no; i++) {
+		lookups[i] = skewed(&seed, 1 << 30);
+	}
+}
+
+/** Reads the traffic from a file.
+	@param path The file.
+	@return `0` on success; `-1` if the file can't be read.
+*/
+static int load_traffic(const char *path)
+{
+	FILE *f;
+	long size;
+
+	if ((f = fopen(path, "rb")) == NULL || fseek(f, 0, SEEK_END) == -1 || (size = ftell(f)) <= 0) {
+		perror("Could not read the traffic file");
+		return -1;
+	}
+	rewind(f);
+	traffic = xmalloc((size_t) size + 1);
+	traffic_len = fread(traffic, 1, (size_t) size, f);
+	fclose(f);
+	if (traffic_len > 0 && traffic[traffic_len - 1] != '\n') {
+		traffic[traffic_len++] = '\n';
+	}
+	return 0;
+}
+
+/** Builds synthetic traffic, with the command mix of a busy network: mostly channel and private messages, some joins and
+	parts, pings, and a few other commands.
+*/
+static void make_traffic(void)
+{
+	static const char *texts[] = { "hi", "anyone around?", "lol", "did you try turning it off and on again",
+				       "the build is broken again, somebody pushed without running the tests first", ":)",
+				       "ACTION waves", "see http://www.example.org/some/long/path?with=query&and=more for details" };
+	size_t capacity = (size_t) TRAFFIC_MESSAGES * scale * 128;
+	unsigned seed = 7;
+	int i, kind;
+
+	traffic = xmalloc(capacity);
+	traffic_len = 0;
+	for (i = 0; i < TRAFFIC_MESSAGES * scale; i++) {
+		kind = rand_r(&seed) % 100;
+		if (capacity - traffic_len < MAX_MSG_SIZE) {
+			break;
+		}
+		if (kind < 45) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "PRIVMSG %s :%s\r\n",
+							channels[skewed(&seed, channels_no)],
+							texts[rand_r(&seed) % (sizeof(texts) / sizeof(*texts))]);
+		} else if (kind < 60) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "PRIVMSG %s :%s\r\n", nicks[skewed(&seed, nicks_no)],
+							texts[rand_r(&seed) % (sizeof(texts) / sizeof(*texts))]);
+		} else if (kind < 68) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "JOIN %s\r\n", channels[skewed(&seed, channels_no)]);
+		} else if (kind < 74) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "PART %s :Leaving\r\n",
+							channels[skewed(&seed, channels_no)]);
+		} else if (kind < 86) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "PONG :%s\r\n", "starwars.development.yaircd.org");
+		} else if (kind < 90) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "NICK %s\n", nicks[rand_r(&seed) % nicks_no]);
+		} else if (kind < 94) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "WHOIS %s\r\n", nicks[skewed(&seed, nicks_no)]);
+		} else if (kind < 97) {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, ":%s MODE %s +o %s\r\n", nicks[0],
+							channels[skewed(&seed, channels_no)], nicks[skewed(&seed, nicks_no)]);
+		} else {
+			traffic_len += (size_t) sprintf(traffic + traffic_len, "LIST >%d\r\n", rand_r(&seed) % 50);
+		}
+	}
+}
+
+/* Kernels */
+
+/** Creates a nicknames trie, as `client_list.c` does.
+	@return The trie.
+*/
+static struct trie_t *nick_trie(void)
+{
+	return init_trie(NULL, bench_nick_is_valid, bench_nick_pos_to_char, bench_nick_char_to_pos, NICK_EDGES_NO);
+}
+
+/** Creates a channels trie, as `channel.c` does.
+	@return The trie.
+*/
+static struct trie_t *chan_trie(void)
+{
+	return init_trie(NULL, bench_chan_is_valid, bench_chan_pos_to_char, bench_chan_char_to_pos, BENCH_CHANNEL_EDGES);
+}
+
+/** Fills a trie.
+	@param trie The trie.
+	@param names The words.
+	@param n How many entries are stored in `names`.
+*/
+static void fill_trie(struct trie_t *trie, char **names, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		(void) add_word_trie(trie, names[i], names[i]);
+	}
+}
+
+/** Adds every nickname to an empty trie. */
+static unsigned long long kernel_trie_insert_nick(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = nick_trie();
+	unsigned long long start, elapsed;
+
+	start = now_ns();
+	fill_trie(trie, nicks, nicks_no);
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	*ops = (unsigned long long) nicks_no;
+	return elapsed;
+}
+
+/** Adds every channel to an empty trie. */
+static unsigned long long kernel_trie_insert_chan(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = chan_trie();
+	unsigned long long start, elapsed;
+
+	start = now_ns();
+	fill_trie(trie, channels, channels_no);
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	*ops = (unsigned long long) channels_no;
+	return elapsed;
+}
+
+/** Looks up nicknames that exist, with a skewed distribution. */
+static unsigned long long kernel_trie_find_nick(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = nick_trie();
+	unsigned long long start, elapsed;
+	unsigned long found = 0;
+	int i;
+
+	fill_trie(trie, nicks, nicks_no);
+	start = now_ns();
+	for (i = 0; i < lookups_no; i++) {
+		found += (find_word_trie(trie, nicks[lookups[i] % nicks_no]) != NULL);
+	}
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	sink += found;
+	*ops = (unsigned long long) lookups_no;
+	return elapsed;
+}
+
+/** Looks up nicknames that don't exist: every nickname with its last character replaced. */
+static unsigned long long kernel_trie_find_miss(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = nick_trie();
+	char **missing = xmalloc(sizeof(*missing) * (size_t) nicks_no);
+	unsigned long long start, elapsed;
+	unsigned long found = 0;
+	int i;
+
+	fill_trie(trie, nicks, nicks_no);
+	for (i = 0; i < nicks_no; i++) {
+		missing[i] = strdup(nicks[i]);
+		missing[i][strlen(missing[i]) - 1] = '{';
+	}
+	start = now_ns();
+	for (i = 0; i < lookups_no; i++) {
+		found += (find_word_trie(trie, missing[lookups[i] % nicks_no]) != NULL);
+	}
+	elapsed = now_ns() - start;
+	for (i = 0; i < nicks_no; i++) {
+		free(missing[i]);
+	}
+	free(missing);
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	sink += found;
+	*ops = (unsigned long long) lookups_no;
+	return elapsed;
+}
+
+/** Looks up channels that exist, with a skewed distribution. */
+static unsigned long long kernel_trie_find_chan(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = chan_trie();
+	unsigned long long start, elapsed;
+	unsigned long found = 0;
+	int i;
+
+	fill_trie(trie, channels, channels_no);
+	start = now_ns();
+	for (i = 0; i < lookups_no; i++) {
+		found += (find_word_trie(trie, channels[lookups[i] % channels_no]) != NULL);
+	}
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	sink += found;
+	*ops = (unsigned long long) lookups_no;
+	return elapsed;
+}
+
+/** Deletes every nickname from a full trie. */
+static unsigned long long kernel_trie_delete_nick(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = nick_trie();
+	unsigned long long start, elapsed;
+	int i;
+
+	fill_trie(trie, nicks, nicks_no);
+	start = now_ns();
+	for (i = 0; i < nicks_no; i++) {
+		(void) delete_word_trie(trie, nicks[i]);
+	}
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	*ops = (unsigned long long) nicks_no;
+	return elapsed;
+}
+
+/** Iterates over every nickname starting with each two letter prefix, as nickname completion or a `WHO` mask would. Each
+	match counts as one operation. */
+static unsigned long long kernel_trie_prefix_nick(int threads, unsigned long long *ops)
+{
+	struct trie_t *trie = nick_trie();
+	struct trie_node_stack *st;
+	unsigned long long start, elapsed;
+	unsigned long long matches = 0;
+	char result[MAX_NICK_LENGTH + 1];
+	char prefix[3];
+	void *data;
+	int err;
+	int i;
+
+	fill_trie(trie, nicks, nicks_no);
+	start = now_ns();
+	for (i = 0; i < 26 * 26; i++) {
+		prefix[0] = (char) ('a' + i / 26);
+		prefix[1] = (char) ('a' + i % 26);
+		prefix[2] = '\0';
+		for (st = NULL; (st = find_by_prefix_next_trie(trie, st, prefix, sizeof(result), result, &err, &data)) != NULL; ) {
+			matches++;
+		}
+	}
+	elapsed = now_ns() - start;
+	destroy_trie(trie, TRIE_NO_FREE_DATA, NULL);
+	*ops = matches > 0 ? matches : 1;
+	return elapsed;
+}
+
+/** Arguments for a thread of the list kernels */
+struct list_worker {
+	pthread_t tid; /**<The thread. */
+	Word_list_ptr list; /**<The list. */
+	int first; /**<First entry of `lookups` used by this thread. */
+	int count; /**<How many lookups this thread performs. */
+	int churn; /**<Whether this thread also deletes and adds back nicknames. */
+	unsigned long found; /**<How many lookups found their nickname. */
+};
+
+/** Runs inside the list node's lock, like the commands that look up a client and write to it do.
+	@param data The nickname.
+	@param args Not used.
+	@return `data`.
+*/
+static void *list_match(void *data, void *args)
+{
+	return data;
+}
+
+/** A thread of the list kernels. It looks up nicknames with `list_find_and_execute()`; in the churn kernel, it also deletes
+	a nickname and adds it back once every `CHURN_RATIO` lookups, as clients changing nicknames or quitting do.
+	@param arg Pointer to the thread's `struct list_worker`.
+	@return Always `NULL`.
+*/
+static void *list_worker_main(void *arg)
+{
+	struct list_worker *w = (struct list_worker *) arg;
+	char *nick;
+	int success;
+	int i;
+
+	pool_thread_init();
+	stats_thread_init();
+	for (i = 0; i < w->count; i++) {
+		nick = nicks[lookups[(w->first + i) % lookups_no] % nicks_no];
+		if (w->churn && i % CHURN_RATIO == 0) {
+			if (list_delete(w->list, nick) != NULL) {
+				(void) list_add(w->list, nick, nick);
+			}
+			continue;
+		}
+		(void) list_find_and_execute(w->list, nick, list_match, NULL, NULL, NULL, &success);
+		w->found += (unsigned long) success;
+	}
+	return NULL;
+}
+
+/** Runs the list kernels.
+	@param threads How many threads look up nicknames at the same time.
+	@param churn Whether the threads also delete and add back nicknames.
+	@param ops Where the number of operations is stored.
+	@return How long it took for every thread to finish, in nanoseconds.
+*/
+static unsigned long long run_list(int threads, int churn, unsigned long long *ops)
+{
+	struct list_worker *workers = xmalloc(sizeof(*workers) * (size_t) threads);
+	Word_list_ptr list;
+	unsigned long long start, elapsed;
+	int i;
+
+	list = init_word_list(NULL, bench_nick_is_valid, bench_nick_pos_to_char, bench_nick_char_to_pos, NICK_EDGES_NO);
+	for (i = 0; i < nicks_no; i++) {
+		(void) list_add(list, nicks[i], nicks[i]);
+	}
+	start = now_ns();
+	for (i = 0; i < threads; i++) {
+		workers[i].list = list;
+		workers[i].first = i * (lookups_no / threads);
+		workers[i].count = lookups_no / threads;
+		workers[i].churn = churn;
+		workers[i].found = 0;
+		if (pthread_create(&workers[i].tid, NULL, list_worker_main, &workers[i]) != 0) {
+			fprintf(stderr, "Could not create a thread.\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+	}
+	elapsed = now_ns() - start;
+	for (i = 0; i < threads; i++) {
+		sink += workers[i].found;
+	}
+	destroy_word_list(list, LIST_NO_FREE_NODE_DATA);
+	free(workers);
+	*ops = (unsigned long long) (lookups_no / threads) * (unsigned long long) threads;
+	return elapsed;
+}
+
+/** Looks up nicknames in a list shared by every thread. */
+static unsigned long long kernel_list_find_execute(int threads, unsigned long long *ops)
+{
+	return run_list(threads, 0, ops);
+}
+
+/** Looks up nicknames in a list shared by every thread, while nicknames are deleted and added back. */
+static unsigned long long kernel_list_find_execute_churn(int threads, unsigned long long *ops)
+{
+	return run_list(threads, 1, ops);
+}
+
+/** Parses every message in the traffic with `parse_msg()`. */
+static unsigned long long kernel_parse_msg(int threads, unsigned long long *ops)
+{
+	char *copy = xmalloc(traffic_len + 1);
+	char **lines = xmalloc(sizeof(*lines) * (traffic_len / 2 + 1));
+	char *params[MAX_IRC_PARAMS];
+	char *prefix, *cmd, *p, *end;
+	unsigned long long start, elapsed;
+	int cmd_id, params_no;
+	int lines_no = 0;
+	int bad = 0;
+	int i;
+
+	memcpy(copy, traffic, traffic_len);
+	copy[traffic_len] = '\0';
+	for (p = copy; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+		*end = '\0';
+		if (end > p && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		lines[lines_no++] = p;
+	}
+	start = now_ns();
+	for (i = 0; i < lines_no; i++) {
+		bad += (parse_msg(lines[i], &prefix, &cmd, &cmd_id, params, &params_no) == -1);
+	}
+	elapsed = now_ns() - start;
+	free(lines);
+	free(copy);
+	sink += (unsigned long) bad;
+	*ops = (unsigned long long) (lines_no > 0 ? lines_no : 1);
+	return elapsed;
+}
+
+/** Reads the whole traffic through a client's input buffer with `read_data()`, and extracts every message with
+	`next_msg()`. */
+static unsigned long long kernel_next_msg(int threads, unsigned long long *ops)
+{
+	struct irc_client *client = calloc(1, sizeof(*client));
+	unsigned long long start, elapsed;
+	unsigned long long messages = 0;
+	char *msg;
+
+	if (client == NULL) {
+		fprintf(stderr, "Not enough memory.\n");
+		exit(1);
+	}
+	client->ev_loop = EV_DEFAULT;
+	initialize_irc_message(&client->last_msg);
+	traffic_pos = 0;
+	start = now_ns();
+	while (traffic_pos < traffic_len) {
+		read_data(client, sizeof(client->last_msg.msg));
+		while (next_msg(&client->last_msg, &msg) != MSG_CONTINUE) {
+			messages++;
+		}
+	}
+	elapsed = now_ns() - start;
+	free(client);
+	*ops = messages > 0 ? messages : 1;
+	return elapsed;
+}
+
+/** Runs the cloak kernels.
+	@param mode The cloak mode.
+	@param ipv4 Whether IPv4 addresses or hostnames are cloaked.
+	@param hot Whether a few hosts are cloaked over and over, so that they are found in the cache, or every host is different.
+	@param ops Where the number of operations is stored.
+	@return How long it took, in nanoseconds.
+*/
+static unsigned long long run_cloak(int mode, int ipv4, int hot, unsigned long long *ops)
+{
+	int hosts_no = (hot ? CLOAK_HOT_HOSTS : CLOAK_HOSTS_NO * scale);
+	int calls = CLOAK_HOSTS_NO * scale;
+	char **hosts = xmalloc(sizeof(*hosts) * (size_t) hosts_no);
+	char host[64];
+	unsigned long long start, elapsed;
+	unsigned seed = 3;
+	char *cloaked;
+	int i;
+
+	for (i = 0; i < hosts_no; i++) {
+		if (ipv4) {
+			snprintf(host, sizeof(host), "%d.%d.%d.%d", 1 + rand_r(&seed) % 223, rand_r(&seed) % 256, rand_r(&seed) % 256,
+				 1 + rand_r(&seed) % 254);
+		} else {
+			snprintf(host, sizeof(host), "dsl-%d-%d.pool%d.%s.example.net", rand_r(&seed) % 256, rand_r(&seed) % 256,
+				 rand_r(&seed) % 64, words[rand_r(&seed) % (sizeof(words) / sizeof(*words))]);
+		}
+		hosts[i] = strdup(host);
+	}
+	cloak_mode = mode;
+	cloak_init();
+	start = now_ns();
+	for (i = 0; i < calls; i++) {
+		cloaked = (ipv4 ? hide_ipv4(hosts[i % hosts_no]) : hide_host(hosts[i % hosts_no]));
+		free(cloaked);
+	}
+	elapsed = now_ns() - start;
+	for (i = 0; i < hosts_no; i++) {
+		free(hosts[i]);
+	}
+	free(hosts);
+	*ops = (unsigned long long) calls;
+	return elapsed;
+}
+
+/** Cloaks IPv4 addresses that are not cached, in legacy mode. */
+static unsigned long long kernel_cloak_ipv4_legacy(int threads, unsigned long long *ops)
+{
+	return run_cloak(CLOAK_MODE_LEGACY, 1, 0, ops);
+}
+
+/** Cloaks IPv4 addresses that are not cached, with SipHash. */
+static unsigned long long kernel_cloak_ipv4_siphash(int threads, unsigned long long *ops)
+{
+	return run_cloak(CLOAK_MODE_SIPHASH, 1, 0, ops);
+}
+
+/** Cloaks hostnames that are not cached, in legacy mode. */
+static unsigned long long kernel_cloak_host_legacy(int threads, unsigned long long *ops)
+{
+	return run_cloak(CLOAK_MODE_LEGACY, 0, 0, ops);
+}
+
+/** Cloaks hostnames that are not cached, with SipHash. */
+static unsigned long long kernel_cloak_host_siphash(int threads, unsigned long long *ops)
+{
+	return run_cloak(CLOAK_MODE_SIPHASH, 0, 0, ops);
+}
+
+/** Cloaks a few IPv4 addresses over and over, so they are found in the cache. */
+static unsigned long long kernel_cloak_ipv4_cached(int threads, unsigned long long *ops)
+{
+	return run_cloak(CLOAK_MODE_LEGACY, 1, 1, ops);
+}
+
+/** Runs the queue kernels. Messages are queued in batches of `QUEUE_BATCH`, and each batch is flushed to `/dev/null`, so the
+	time spent in the kernel's network stack is left out.
+	@param shared Whether messages are queued as shared messages, as channel messages are, or copied into the queue.
+	@param ops Where the number of operations is stored.
+	@return How long it took, in nanoseconds.
+*/
+static unsigned long long run_queue(int shared, unsigned long long *ops)
+{
+	static const char line[] = ":anelri!~anelri@bench-1A2B3C4D.example.net PRIVMSG #linux-dev42 :did you try turning it off "
+				   "and on again\r\n";
+	struct irc_client *client = calloc(1, sizeof(*client));
+	struct msg_buf *msg;
+	unsigned long long start, elapsed;
+	int messages = QUEUE_MESSAGES * scale;
+	int i;
+
+	if (client == NULL || (client->socket_fd = open("/dev/null", O_WRONLY)) == -1 ||
+	    client_queue_init(&client->write_queue, (size_t) 1 << 30, (size_t) 1 << 29) == -1 ||
+	    (msg = msg_buf_create(line, sizeof(line) - 1)) == NULL) {
+		fprintf(stderr, "Could not set up the queue.\n");
+		exit(1);
+	}
+	client->uses_ssl = 0;
+	start = now_ns();
+	for (i = 0; i < messages; i++) {
+		if (shared) {
+			(void) client_enqueue_shared(&client->write_queue, msg);
+		} else {
+			(void) client_enqueue_buf(&client->write_queue, line, sizeof(line) - 1);
+		}
+		if (i % QUEUE_BATCH == QUEUE_BATCH - 1) {
+			(void) flush_queue(client, &client->write_queue);
+		}
+	}
+	(void) flush_queue(client, &client->write_queue);
+	elapsed = now_ns() - start;
+	msg_buf_release(msg);
+	client_queue_destroy(&client->write_queue);
+	close(client->socket_fd);
+	free(client);
+	*ops = (unsigned long long) messages;
+	return elapsed;
+}
+
+/** Copies messages into a queue and flushes it. */
+static unsigned long long kernel_queue_copy_flush(int threads, unsigned long long *ops)
+{
+	return run_queue(0, ops);
+}
+
+/** Queues shared messages and flushes them. */
+static unsigned long long kernel_queue_shared_flush(int threads, unsigned long long *ops)
+{
+	return run_queue(1, ops);
+}
+
+/** Sorts run times.
+	@param a A run time.
+	@param b Another run time.
+	@return A negative number, zero or a positive number if `a` is faster, as fast or slower than `b`.
+*/
+static int compare_times(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/** Runs a kernel `RUNS` times, and prints its results.
+	@param name The kernel's name.
+	@param fn The kernel.
+	@param threads How many threads run it.
+*/
+static void run_kernel(const char *name, kernel_fn fn, int threads)
+{
+	double ns_per_op[RUNS];
+	unsigned long long ops = 0;
+	unsigned long long elapsed;
+	int i;
+
+	if (strncmp(name, kernel_filter, strlen(kernel_filter)) != 0) {
+		return;
+	}
+	for (i = 0; i < RUNS; i++) {
+		elapsed = (*fn)(threads, &ops);
+		ns_per_op[i] = (double) elapsed / (double) ops;
+	}
+	qsort(ns_per_op, RUNS, sizeof(*ns_per_op), compare_times);
+	printf("{\"kernel\": \"%s\", \"threads\": %d, \"ops\": %llu, \"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f}\n", name,
+	       threads, ops, ns_per_op[0], ns_per_op[RUNS / 2]);
+	fflush(stdout);
+}
+
+/** Prints the usage message.
+	@param name The program's name.
+*/
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-k prefix] [-n scale] [-t threads] [-f traffic]\n", name);
+}
+
+/** The microbenchmarks' starting point. Builds the data sets and runs every kernel.
+	@param argc Number of arguments.
+	@param argv The arguments.
+	@return `0` on success; `1` on error.
+*/
+int main(int argc, char *argv[])
+{
+	const char *traffic_path = NULL;
+	int threads;
+	int c;
+
+	while ((c = getopt(argc, argv, "k:n:t:f:")) != -1) {
+		switch (c) {
+		case 'k': kernel_filter = optarg; break;
+		case 'n': scale = atoi(optarg); break;
+		case 't': max_threads = atoi(optarg); break;
+		case 'f': traffic_path = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (scale < 1 || max_threads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	stats_init();
+	if (pool_init() == -1 || pool_add_class(sizeof(struct msg_buf) + WRITE_BLOCK_SIZE) == -1 || pool_thread_init() == -1) {
+		fprintf(stderr, "Could not set up the memory pools.\n");
+		return 1;
+	}
+	make_names();
+	if (traffic_path != NULL) {
+		if (load_traffic(traffic_path) == -1) {
+			return 1;
+		}
+	} else {
+		make_traffic();
+	}
+
+	run_kernel("trie_insert_nick", kernel_trie_insert_nick, 1);
+	run_kernel("trie_insert_chan", kernel_trie_insert_chan, 1);
+	run_kernel("trie_find_nick", kernel_trie_find_nick, 1);
+	run_kernel("trie_find_miss", kernel_trie_find_miss, 1);
+	run_kernel("trie_find_chan", kernel_trie_find_chan, 1);
+	run_kernel("trie_delete_nick", kernel_trie_delete_nick, 1);
+	run_kernel("trie_prefix_nick", kernel_trie_prefix_nick, 1);
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		run_kernel("list_find_execute", kernel_list_find_execute, threads);
+	}
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		run_kernel("list_find_execute_churn", kernel_list_find_execute_churn, threads);
+	}
+	run_kernel("parse_msg", kernel_parse_msg, 1);
+	run_kernel("next_msg", kernel_next_msg, 1);
+	run_kernel("cloak_ipv4_legacy", kernel_cloak_ipv4_legacy, 1);
+	run_kernel("cloak_ipv4_siphash", kernel_cloak_ipv4_siphash, 1);
+	run_kernel("cloak_ipv4_cached", kernel_cloak_ipv4_cached, 1);
+	run_kernel("cloak_host_legacy", kernel_cloak_host_legacy, 1);
+	run_kernel("cloak_host_siphash", kernel_cloak_host_siphash, 1);
+	run_kernel("queue_copy_flush", kernel_queue_copy_flush, 1);
+	run_kernel("queue_shared_flush", kernel_queue_shared_flush, 1);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include "trace.h"
+
+/** @file
+	@brief Message IDs for the static tracepoints
+
+	An ID is made of the thread's number, in the upper `TRACE_SEQ_BITS` bits, and a per-thread sequence number, in the lower bits,
+	so threads hand out IDs without talking to each other. Threads are numbered the first time they begin a message. IDs never
+	repeat until a thread processes `2^TRACE_SEQ_BITS` messages, which is way longer than any trace session.
+
+	This file is only built with `make TRACE=1`.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+/** How many bits of an ID hold the sequence number */
+#define TRACE_SEQ_BITS 44
+
+static unsigned long long threads_no; /**<How many threads got a number. Updated atomically. */
+static __thread unsigned long long thread_base; /**<The calling thread's number, shifted into place; `0` until it gets one. */
+static __thread unsigned long long seq; /**<Sequence number of the calling thread's last message. */
+static __thread unsigned long long current; /**<ID of the message being processed by the calling thread, or `0`. */
+
+/** Tells which ID the next message processed by the calling thread will get, without giving it away. The thread gets its
+	number here if it doesn't have one yet.
+	@return The ID, which is never `0`.
+*/
+unsigned long long trace_msg_next(void)
+{
+	if (thread_base == 0) {
+		thread_base = __sync_add_and_fetch(&threads_no, 1) << TRACE_SEQ_BITS;
+	}
+	return thread_base | ((seq + 1) & ((1ULL << TRACE_SEQ_BITS) - 1));
+}
+
+/** Gives a new ID to the message that the calling thread is about to process.
+	@return The new ID, which is never `0`.
+*/
+unsigned long long trace_msg_begin(void)
+{
+	current = trace_msg_next();
+	seq = current & ((1ULL << TRACE_SEQ_BITS) - 1);
+	return current;
+}
+
+/** Tells which message the calling thread is processing.
+	@return The ID given by the last call to `trace_msg_begin()` in this thread; `0` if there was none.
+*/
+unsigned long long trace_msg_current(void)
+{
+	return current;
+}
+
+/** Forgets the message being processed by the calling thread, once it is done with it. */
+void trace_msg_end(void)
+{
+	current = 0;
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "trie.h"
+#include "pool.h"
 
 /** @file
    @brief Flexible trie implementation with some neat options.
@@ -20,46 +21,307 @@
       insertion, deletion and search time, where `n` is the size of the word. When compared to hash tables,it is a good
       alternative, since hash tables provide `O(1)` access, but normally take about `O(n)` time to compute the hash
       function, and there can be collisions.
+   Nodes do not reserve an edge for every character in the alphabet. Instead, a node's edges grow with the number of
+      children it has, in the spirit of Adaptive Radix Trees: leaves have no edges at all, small nodes keep up to 4 or
+      16 edge IDs in a sorted array, medium nodes keep 48 edges and an index with one byte per character, and only
+      crowded nodes pay for a direct array with `edges_no` pointers. Nodes grow when a child is added to a full node,
+      and shrink back when enough children are deleted.
+   Chains of nodes with a single child and no word are collapsed into their child's `prefix` (path compression), so that
+      a word that shares nothing with the other words (the common case for channel names) costs a single node.
    @author Filipe Goncalves
    @date November 2013
    @see client_list.c
    @warning This implementation is reentrant, but it is not thread safe. The same trie instance cannot be fed into this
       implementation from different threads concurrently.
    Upper caller needs to make the necessary use of mutexes or other synchronization primitives.
+   The only exception is `find_word_trie()`, which may run concurrently with one writer, provided that released nodes
+      are kept alive with `trie_set_release()` and that the caller validates its result. To make this possible, nodes are
+      always fully built before being linked into the trie, vacated edges are cleared, and `find_word_trie()` never
+      follows a `NULL` edge.
  */
 
-/** Initializes a new trie node with no children and no edges.
-   @param edges Number of edges (alphabet size)
-   @return The new node, or `NULL` if there are no resources to create a node.
+/** Node capacities below a direct array, in increasing order. A capacity is only used if it is smaller than the
+   alphabet size; otherwise, a direct array with `edges_no` edges is cheaper.
+ */
+static const int capacities[] = { 0, 4, 16, 48 };
+
+/** Computes the smallest capacity that holds a given number of children.
+   @param trie A trie, as returned by `init_trie()`.
+   @param children How many children must fit.
+   @return A capacity from `capacities`, or `trie->edges_no` if none of them is both big enough and smaller than the
+      alphabet.
  */
-static struct trie_node *init_node(int edges)
+static int fit_capacity(struct trie_t *trie, int children)
 {
 	int i;
+	for (i = 0; i < (int) (sizeof(capacities) / sizeof(capacities[0])); i++) {
+		if (capacities[i] >= children && capacities[i] < trie->edges_no) {
+			return capacities[i];
+		}
+	}
+	return trie->edges_no;
+}
+
+/** Allocates a new trie node with no children. The node, its edges, its keys and its prefix are stored in a single
+   memory block.
+   @param trie A trie, as returned by `init_trie()`.
+   @param capacity How many edges the node can hold. Must have been returned by `fit_capacity()`; it determines the
+      node kind.
+   @param prefix_len Length of the node's compressed path. The caller is expected to fill `prefix`.
+   @return The new node, or `NULL` if there are no resources to create a node.
+ */
+static struct trie_node *alloc_node(struct trie_t *trie, int capacity, int prefix_len)
+{
 	struct trie_node *new_node;
-	if ((new_node = malloc(sizeof(struct trie_node))) == NULL) {
+	unsigned char kind;
+	size_t keys_size;
+
+	if (capacity == trie->edges_no && capacity > 0) {
+		kind = TRIE_NODE_FULL;
+		keys_size = 0;
+	} else if (capacity <= 16) {
+		kind = TRIE_NODE_SORTED;
+		keys_size = (size_t) capacity;
+	} else {
+		kind = TRIE_NODE_INDEXED;
+		keys_size = (size_t) trie->edges_no;
+	}
+	if ((new_node = pool_alloc(sizeof(struct trie_node) + capacity * sizeof(struct trie_node *) + keys_size +
+			       prefix_len)) == NULL) {
 		return NULL;
 	}
 	new_node->is_word = 0;
+	new_node->kind = kind;
+	new_node->capacity = (unsigned short) capacity;
 	new_node->children = 0;
+	new_node->prefix_len = prefix_len;
 	new_node->data = NULL;
-	if ((new_node->edges = malloc(sizeof(*new_node->edges) * edges)) == NULL) {
-		free(new_node);
+	new_node->edges = (struct trie_node **) (new_node + 1);
+	new_node->keys = (unsigned char *) (new_node->edges + capacity);
+	new_node->prefix = new_node->keys + keys_size;
+	new_node->next_released = NULL;
+	memset(new_node->edges, 0, capacity * sizeof(struct trie_node *));
+	if (kind == TRIE_NODE_INDEXED) {
+		memset(new_node->keys, 0, keys_size);
+	}
+	return new_node;
+}
+
+/** Disposes of a node that is no longer part of the trie, either by calling the function set with
+   `trie_set_release()`, or by freeing it right away.
+   @param trie A trie, as returned by `init_trie()`.
+   @param node The node.
+ */
+static void release_node(struct trie_t *trie, struct trie_node *node)
+{
+	if (trie->release_f != NULL) {
+		(*trie->release_f)(node, trie->release_arg);
+	} else {
+		pool_free(node);
+	}
+}
+
+/** Creates a leaf node for the remaining characters of a word.
+   @param trie A trie, as returned by `init_trie()`.
+   @param word Characters that follow the edge to this leaf. They are stored in the leaf's `prefix`. It is assumed that
+      every character has already been validated.
+   @param data The data to associate to the word.
+   @return The new leaf, or `NULL` if there are no resources to create a node.
+ */
+static struct trie_node *new_leaf(struct trie_t *trie, const char *word, void *data)
+{
+	struct trie_node *leaf;
+	int len = (int) strlen(word);
+	int i;
+
+	if ((leaf = alloc_node(trie, 0, len)) == NULL) {
 		return NULL;
 	}
-	for (i = 0; i < edges; i++) {
-		new_node->edges[i] = NULL;
+	for (i = 0; i < len; i++) {
+		leaf->prefix[i] = (unsigned char) (*trie->char_to_pos)(word[i]);
+	}
+	leaf->is_word = 1;
+	leaf->data = data;
+	return leaf;
+}
+
+/** Finds the edge leading to a node's child.
+   @param node The parent node.
+   @param pos The child's edge ID.
+   @return Pointer to the edge holding the child, or `NULL` if there is no such child.
+ */
+static struct trie_node **child_ref(struct trie_node *node, unsigned char pos)
+{
+	int i;
+	switch (node->kind) {
+	case TRIE_NODE_SORTED:
+		for (i = 0; i < node->children && node->keys[i] < pos; i++)
+			; /* Intentionally left blank */
+		return (i < node->children && node->keys[i] == pos) ? &node->edges[i] : NULL;
+	case TRIE_NODE_INDEXED:
+		/* Read the index only once: it may be changing under a concurrent lookup */
+		i = ((volatile unsigned char *) node->keys)[pos];
+		return i != 0 ? &node->edges[i - 1] : NULL;
+	default:
+		return node->edges[pos] != NULL ? &node->edges[pos] : NULL;
 	}
-	return new_node;
+}
+
+/** Finds the child with the smallest edge ID greater than or equal to `*pos`. This is how children are traversed in
+   order: `for (pos = 0; (child = next_child(trie, node, &pos)) != NULL; pos++)`.
+   @param trie A trie, as returned by `init_trie()`.
+   @param node The parent node.
+   @param pos Where to start looking. When a child is found, it is updated to hold the child's edge ID.
+   @return The child, or `NULL` if there are no more children.
+ */
+static struct trie_node *next_child(struct trie_t *trie, struct trie_node *node, int *pos)
+{
+	int i;
+	switch (node->kind) {
+	case TRIE_NODE_SORTED:
+		for (i = 0; i < node->children && node->keys[i] < *pos; i++)
+			; /* Intentionally left blank */
+		if (i < node->children) {
+			*pos = node->keys[i];
+			return node->edges[i];
+		}
+		return NULL;
+	case TRIE_NODE_INDEXED:
+		for (i = *pos; i < trie->edges_no && node->keys[i] == 0; i++)
+			; /* Intentionally left blank */
+		if (i < trie->edges_no) {
+			*pos = i;
+			return node->edges[node->keys[i] - 1];
+		}
+		return NULL;
+	default:
+		for (i = *pos; i < trie->edges_no && node->edges[i] == NULL; i++)
+			; /* Intentionally left blank */
+		if (i < trie->edges_no) {
+			*pos = i;
+			return node->edges[i];
+		}
+		return NULL;
+	}
+}
+
+/** Adds a child to a node.
+   @param node The parent node.
+   @param pos The child's edge ID.
+   @param child The child.
+   @warning Assumes that `node->children < node->capacity` and that there is no child with edge ID `pos` yet.
+ */
+static void insert_child(struct trie_node *node, unsigned char pos, struct trie_node *child)
+{
+	int i;
+	/* The child must be complete before a concurrent lookup can reach it */
+	__sync_synchronize();
+	switch (node->kind) {
+	case TRIE_NODE_SORTED:
+		for (i = node->children; i > 0 && node->keys[i - 1] > pos; i--) {
+			node->keys[i] = node->keys[i - 1];
+			node->edges[i] = node->edges[i - 1];
+		}
+		node->keys[i] = pos;
+		node->edges[i] = child;
+		break;
+	case TRIE_NODE_INDEXED:
+		node->edges[node->children] = child;
+		__sync_synchronize();
+		node->keys[pos] = (unsigned char) (node->children + 1);
+		break;
+	default:
+		node->edges[pos] = child;
+		break;
+	}
+	__sync_synchronize();
+	node->children++;
+}
+
+/** Removes a child from a node. The child itself is not freed.
+   @param trie A trie, as returned by `init_trie()`.
+   @param node The parent node.
+   @param pos The child's edge ID.
+   @warning Assumes that the child exists.
+ */
+static void remove_child(struct trie_t *trie, struct trie_node *node, unsigned char pos)
+{
+	int i;
+	int slot;
+	switch (node->kind) {
+	case TRIE_NODE_SORTED:
+		for (i = 0; node->keys[i] != pos; i++)
+			; /* Intentionally left blank */
+		for (; i + 1 < node->children; i++) {
+			node->keys[i] = node->keys[i + 1];
+			node->edges[i] = node->edges[i + 1];
+		}
+		node->edges[i] = NULL;
+		break;
+	case TRIE_NODE_INDEXED:
+		/* Keep the used slots contiguous by moving the last one into the hole */
+		slot = node->keys[pos] - 1;
+		node->keys[pos] = 0;
+		if (slot != node->children - 1) {
+			node->edges[slot] = node->edges[node->children - 1];
+			__sync_synchronize();
+			for (i = 0; i < trie->edges_no && node->keys[i] != node->children; i++)
+				; /* Intentionally left blank */
+			node->keys[i] = (unsigned char) (slot + 1);
+			__sync_synchronize();
+		}
+		node->edges[node->children - 1] = NULL;
+		break;
+	default:
+		node->edges[pos] = NULL;
+		break;
+	}
+	node->children--;
+}
+
+/** Creates a copy of a node with a different capacity and frees the original. Optionally, the copy's prefix can be
+   extended with the prefix of the node's parent and the edge ID between both, which is how a parent with a single child
+   is merged into it.
+   @param trie A trie, as returned by `init_trie()`.
+   @param node The node to copy.
+   @param capacity The copy's capacity, as returned by `fit_capacity()`. It must hold `node->children` children.
+   @param above `node`'s parent when merging, or `NULL` to keep the same prefix.
+   @param key Edge ID from `above` to `node`. Ignored if `above` is `NULL`.
+   @return The copy, or `NULL` if there are no resources to create a node, in which case `node` is left untouched.
+ */
+static struct trie_node *rebuild_node(struct trie_t *trie, struct trie_node *node, int capacity,
+				      struct trie_node *above, int key)
+{
+	struct trie_node *copy;
+	struct trie_node *child;
+	int head;
+	int pos;
+
+	head = (above != NULL ? above->prefix_len + 1 : 0);
+	if ((copy = alloc_node(trie, capacity, head + node->prefix_len)) == NULL) {
+		return NULL;
+	}
+	if (above != NULL) {
+		memcpy(copy->prefix, above->prefix, above->prefix_len);
+		copy->prefix[above->prefix_len] = (unsigned char) key;
+	}
+	memcpy(copy->prefix + head, node->prefix, node->prefix_len);
+	copy->is_word = node->is_word;
+	copy->data = node->data;
+	for (pos = 0; (child = next_child(trie, node, &pos)) != NULL; pos++) {
+		insert_child(copy, (unsigned char) pos, child);
+	}
+	release_node(trie, node);
+	return copy;
 }
 
 /** Creates a new trie.
    @param free_function Pointer to function that is called inside `destroy_trie()` to free a node's `data`
    @param is_valid Pointer to function that returns `1` if a char is part of this trie's alphabet; `0` otherwise
-   @param pos_to_char Pointer to function that converts an index position from `edges` back to its character
-      representation.
-   @param char_to_pos Pointer to function that converts a character `s` into a valid, unique position that is used to
-      index `edges`.
-   @param edges How many edges each node is allowed to have, that is, the size of this trie's alphabet.
+   @param pos_to_char Pointer to function that converts an edge ID back to its character representation.
+   @param char_to_pos Pointer to function that converts a character `s` into a valid, unique edge ID.
+   @param edges The size of this trie's alphabet, that is, how many different edges a node can have. Must not be
+      greater than 256.
    @return A new trie instance with no words, or `NULL` if there isn't enough memory to create a trie.
  */
 struct trie_t *init_trie(void (*free_function)(void *, void *), int (*is_valid)(char),
@@ -69,32 +331,33 @@ struct trie_t *init_trie(void (*free_function)(void *, void *), int (*is_valid)(
 	if ((trie = malloc(sizeof(struct trie_t))) == NULL) {
 		return NULL;
 	}
-	if ((trie->root = init_node(edges)) == NULL) {
-		free(trie);
-		return NULL;
-	}
 	trie->free_f = free_function;
 	trie->is_valid = is_valid;
 	trie->pos_to_char = pos_to_char;
 	trie->char_to_pos = char_to_pos;
 	trie->edges_no = edges;
+	trie->release_f = NULL;
+	trie->release_arg = NULL;
+	if ((trie->root = alloc_node(trie, fit_capacity(trie, 1), 0)) == NULL) {
+		free(trie);
+		return NULL;
+	}
 	return trie;
 }
 
-/** Frees a node's child. After returning, ensures that `node->edges[pos] == NULL` and that every resource previously
-   allocated was freed.
-   @param node Node that contains the child to free
-   @param pos Which child to free
-   @warning Assumes that `node->edges[pos]` is not `NULL`.
-   @warning This function is not recursive. If the node in `node->edges[pos]` references other nodes, these references
-      will be lost and there is a memory leak.
+/** Sets the function that disposes of nodes that are no longer part of a trie. By default, nodes are freed as soon as
+   they are unlinked; a trie that is searched concurrently with `find_word_trie()` must instead keep released nodes alive
+   until every lookup that might still be reading them is done.
+   @param trie A trie, as returned by `init_trie()`.
+   @param release_f Function called with each released node and `arg`. It becomes responsible for eventually calling
+      `pool_free()` on the node. `NULL` restores the default behavior.
+   @param arg Passed as second argument to `release_f`.
+   @note `destroy_trie()` always frees nodes right away.
  */
-static inline void free_child(struct trie_node *node, unsigned char pos)
+void trie_set_release(struct trie_t *trie, void (*release_f)(struct trie_node *, void *), void *arg)
 {
-	free(node->edges[pos]->edges);
-	free(node->edges[pos]);
-	node->edges[pos] = NULL;
-	node->children--;
+	trie->release_f = release_f;
+	trie->release_arg = arg;
 }
 
 /** Recursively frees every node reachable from `node`.
@@ -108,17 +371,15 @@ static inline void free_child(struct trie_node *node, unsigned char pos)
  */
 static void destroy_aux(struct trie_node *node, struct trie_t *trie, int free_data, void *args)
 {
-	int i;
-	for (i = 0; i < trie->edges_no; i++) {
-		if (node->edges[i] != NULL) {
-			destroy_aux(node->edges[i], trie, free_data, args);
-		}
+	struct trie_node *child;
+	int pos;
+	for (pos = 0; (child = next_child(trie, node, &pos)) != NULL; pos++) {
+		destroy_aux(child, trie, free_data, args);
 	}
-	if (free_data == TRIE_FREE_DATA) {
+	if (free_data == TRIE_FREE_DATA && node->is_word) {
 		(*trie->free_f)(node->data, args);
 	}
-	free(node->edges);
-	free(node);
+	pool_free(node);
 }
 
 /** Frees every allocated storage for a trie.
@@ -135,48 +396,69 @@ void destroy_trie(struct trie_t *trie, int free_data, void *args)
 	free(trie);
 }
 
-/** Recursive implementation that is called by `add_word_trie()`.
-   @param root Current node.
+/** Splits a node whose prefix only partially matches the word being added. A new node holding the common part of the
+   prefix takes the node's place; the node becomes its child and keeps the rest of its prefix.
    @param trie A trie, as returned by `init_trie()`.
-   @param word The word to add. Must be a null-terminated characters sequence.
-   @param data The data to associate to this word.
-   @return On success, 0 is returned. Otherwise, a non-zero constant is returned to denote an error, which can be either
-      `TRIE_INVALID_WORD` or `TRIE_NO_MEM`.
-   `TRIE_INVALID_WORD` means that there are characters in `word` that are no part of this trie's alphabet, as defined by
-      the functions indicated in `init_trie()`.
-   `TRIE_NO_MEM` means that there wasn't enough memory to add `word`. In this case, it is undefined whether `word` is
-      valid or not: it just means that we couldn't keep onchecking the word and adding the necessary structures anymore.
-   When an error occurs, the trie remains unchanged.
-   @note If the word already exists, its `data` will now point to the new data. Care must be taken not to lose reference
-      to the old data.
+   @param ref The edge holding the node to split.
+   @param common How many characters of the node's prefix match the word. Must be less than the prefix's length.
+   @param word The rest of the word, starting at the first character that did not match.
+   @param data The data to associate to the word.
+   @return `0` on success, `TRIE_NO_MEM` if there wasn't enough memory, in which case the trie remains unchanged.
  */
-static int add_word_trie_aux(struct trie_node *root, char *word, struct trie_t *trie, void *data)
+static int split_node(struct trie_t *trie, struct trie_node **ref, int common, char *word, void *data)
 {
-	unsigned char pos;
-	int ret;
+	struct trie_node *node = *ref;
+	struct trie_node *parent;
+	struct trie_node *leaf;
+
+	if ((parent = alloc_node(trie, fit_capacity(trie, 2), common)) == NULL) {
+		return TRIE_NO_MEM;
+	}
+	memcpy(parent->prefix, node->prefix, common);
 	if (*word == '\0') {
-		root->is_word = 1;
-		root->data = data;
-		return 0;
+		parent->is_word = 1;
+		parent->data = data;
 	} else {
-		if (!(*trie->is_valid)(*word)) {
-			return TRIE_INVALID_WORD;
+		if ((leaf = new_leaf(trie, word + 1, data)) == NULL) {
+			pool_free(parent);
+			return TRIE_NO_MEM;
 		}
-		if (root->edges[pos = (*trie->char_to_pos)(*word)] == NULL) {
-			if ((root->edges[pos] = init_node(trie->edges_no)) == NULL) {
-				return TRIE_NO_MEM;
-			}
-			root->children++;
-			if ((ret = add_word_trie_aux(root->edges[pos], word + 1, trie, data)) != 0) {
-				/* There was an error somewhere down there */
-				free_child(root, pos);
-				return ret;
-			}
-			/* assert: ret == 0 */
-			return 0;
+		insert_child(parent, (unsigned char) (*trie->char_to_pos)(*word), leaf);
+	}
+	insert_child(parent, node->prefix[common], node);
+	memmove(node->prefix, node->prefix + common + 1, node->prefix_len - common - 1);
+	node->prefix_len -= common + 1;
+	__sync_synchronize();
+	*ref = parent;
+	return 0;
+}
+
+/** Adds a new leaf as a child of a node, growing the node if it is full.
+   @param trie A trie, as returned by `init_trie()`.
+   @param ref The edge holding the parent node.
+   @param pos Edge ID for the new leaf.
+   @param word Characters that follow the edge to the new leaf.
+   @param data The data to associate to the word.
+   @return `0` on success, `TRIE_NO_MEM` if there wasn't enough memory, in which case the trie remains unchanged.
+ */
+static int add_leaf(struct trie_t *trie, struct trie_node **ref, unsigned char pos, char *word, void *data)
+{
+	struct trie_node *node = *ref;
+	struct trie_node *leaf;
+
+	if ((leaf = new_leaf(trie, word, data)) == NULL) {
+		return TRIE_NO_MEM;
+	}
+	if (node->children == node->capacity) {
+		if ((node = rebuild_node(trie, node, fit_capacity(trie, node->children + 1), NULL, 0)) == NULL) {
+			pool_free(leaf);
+			return TRIE_NO_MEM;
 		}
-		return add_word_trie_aux(root->edges[pos], word + 1, trie, data);
+		__sync_synchronize();
+		*ref = node;
 	}
+	insert_child(node, pos, leaf);
+	return 0;
 }
 
 /** Adds a new word to a trie.
@@ -187,45 +469,103 @@ static int add_word_trie_aux(struct trie_node *root, char *word, struct trie_t *
       `TRIE_INVALID_WORD` or `TRIE_NO_MEM`.
    `TRIE_INVALID_WORD` means that there are characters in `word` that are no part of this trie's alphabet, as defined by
       the functions indicated in `init_trie()`.
-   `TRIE_NO_MEM` means that there wasn't enough memory to add `word`. In this case, it is undefined whether `word` is
-      valid or not: it just means that we couldn't keep onchecking the word and adding the necessary structures anymore.
+   `TRIE_NO_MEM` means that there wasn't enough memory to add `word`.
    When an error occurs, the trie remains unchanged.
    @note If the word already exists, its `data` will now point to the new data. Care must be taken not to lose reference
       to the old data.
  */
 int add_word_trie(struct trie_t *trie, char *word, void *data)
 {
-	return add_word_trie_aux(trie->root, word, trie, data);
+	struct trie_node **ref;
+	struct trie_node **next;
+	struct trie_node *node;
+	unsigned char pos;
+	int i;
+
+	for (i = 0; word[i] != '\0'; i++) {
+		if (!(*trie->is_valid)(word[i])) {
+			return TRIE_INVALID_WORD;
+		}
+	}
+	for (ref = &trie->root;; ref = next, word++) {
+		node = *ref;
+		for (i = 0; i < node->prefix_len && word[i] != '\0' &&
+		     (unsigned char) (*trie->char_to_pos)(word[i]) == node->prefix[i]; i++)
+			; /* Intentionally left blank */
+		if (i < node->prefix_len) {
+			return split_node(trie, ref, i, word + i, data);
+		}
+		word += i;
+		if (*word == '\0') {
+			node->is_word = 1;
+			node->data = data;
+			return 0;
+		}
+		pos = (unsigned char) (*trie->char_to_pos)(*word);
+		if ((next = child_ref(node, pos)) == NULL) {
+			return add_leaf(trie, ref, pos, word + 1, data);
+		}
+	}
 }
 
-/** Recursive implementation called by `delete_word_trie()`.
-   @param root Current node.
+/** Recursive implementation called by `delete_word_trie()`. On the way back, nodes that are no longer needed are freed,
+   children that were left with a single child of their own are merged with it, and nodes that lost enough children are
+   shrunk. If there isn't enough memory to merge or shrink a node, it is left as it is; this never affects the trie's
+   contents.
    @param trie A trie, as returned by `init_trie()`.
+   @param ref The edge holding the current node.
    @param word The word to delete. Must be a null-terminated characters sequence.
    @return If the word existed, its associated data is returned. Otherwise, `NULL` is returned.
  */
-static void *delete_word_trie_aux(struct trie_node *root, char *word, struct trie_t *trie)
+static void *delete_word_trie_aux(struct trie_t *trie, struct trie_node **ref, char *word)
 {
+	struct trie_node *node = *ref;
+	struct trie_node **next;
+	struct trie_node *child;
+	struct trie_node *compact;
 	unsigned char pos;
 	void *ret;
+	int i;
+
+	for (i = 0; i < node->prefix_len; i++) {
+		if (word[i] == '\0' || !(*trie->is_valid)(word[i]) ||
+		    (unsigned char) (*trie->char_to_pos)(word[i]) != node->prefix[i]) {
+			return NULL;
+		}
+	}
+	word += i;
 	if (*word == '\0') {
-		if (root->is_word) {
-			root->is_word = 0;
-			return root->data;
+		if (!node->is_word) {
+			return NULL;
 		}
+		node->is_word = 0;
+		ret = node->data;
+		node->data = NULL;
+		return ret;
+	}
+	if (!(*trie->is_valid)(*word) || (next = child_ref(node, pos = (unsigned char) (*trie->char_to_pos)(*word))) == NULL) {
 		return NULL;
-	} else {
-		if (!(*trie->is_valid)(*word) || root->edges[pos = (*trie->char_to_pos)(*word)] == NULL) {
-			return NULL;
-		} else {
-			/* assert: root->edges[pos] != NULL */
-			ret = delete_word_trie_aux(root->edges[pos], word + 1, trie);
-			if (root->edges[pos]->children == 0 && !root->edges[pos]->is_word) {
-				free_child(root, pos);
-			}
-			return ret;
+	}
+	ret = delete_word_trie_aux(trie, next, word + 1);
+	child = *next;
+	if (!child->is_word && child->children == 0) {
+		remove_child(trie, node, pos);
+		release_node(trie, child);
+		if (fit_capacity(trie, node->children + 1) < node->capacity &&
+		    (compact = rebuild_node(trie, node, fit_capacity(trie, node->children + 1), NULL, 0)) != NULL) {
+			__sync_synchronize();
+			*ref = compact;
+		}
+	} else if (!child->is_word && child->children == 1) {
+		i = 0;
+		compact = next_child(trie, child, &i);
+		if ((compact = rebuild_node(trie, compact, compact->capacity, child, i)) != NULL) {
+			__sync_synchronize();
+			*next = compact;
+			release_node(trie, child);
 		}
 	}
+	return ret;
 }
 
 /** Deletes a word from a trie.
@@ -235,27 +575,7 @@ static void *delete_word_trie_aux(struct trie_node *root, char *word, struct tri
  */
 void *delete_word_trie(struct trie_t *trie, char *word)
 {
-	return delete_word_trie_aux(trie->root, word, trie);
-}
-
-/** Recursive search implementation used by `find_word_trie()`.
-   @param root Current node.
-   @param trie A trie, as returned by `init_trie()`.
-   @param word The word to search for. Must be a null-terminated characters sequence.
-   @return The data associated with `word` if there's a match; `NULL` if there's no match, or `word` contains invalid
-      characters.
- */
-static void *find_word_trie_aux(struct trie_node *root, char *word, struct trie_t *trie)
-{
-	struct trie_node *ptr;
-	if (*word == '\0') {
-		return root->is_word ? root->data : NULL;
-	}
-	if (!(*trie->is_valid)(*word)) {
-		return NULL;
-	}
-	ptr = root->edges[(*trie->char_to_pos)(*word)];
-	return ptr ? find_word_trie_aux(ptr, word + 1, trie) : NULL;
+	return delete_word_trie_aux(trie, &trie->root, word);
 }
 
 /** Searches for a word in a trie.
@@ -266,7 +586,27 @@ static void *find_word_trie_aux(struct trie_node *root, char *word, struct trie_
  */
 void *find_word_trie(struct trie_t *trie, char *word)
 {
-	return find_word_trie_aux(trie->root, word, trie);
+	struct trie_node *node = trie->root;
+	struct trie_node **next;
+	int i;
+
+	for (;;) {
+		for (i = 0; i < node->prefix_len; i++, word++) {
+			if (*word == '\0' || !(*trie->is_valid)(*word) ||
+			    (unsigned char) (*trie->char_to_pos)(*word) != node->prefix[i]) {
+				return NULL;
+			}
+		}
+		if (*word == '\0') {
+			return node->is_word ? node->data : NULL;
+		}
+		if (!(*trie->is_valid)(*word) ||
+		    (next = child_ref(node, (unsigned char) (*trie->char_to_pos)(*word))) == NULL ||
+		    (node = *next) == NULL) {
+			return NULL;
+		}
+		word++;
+	}
 }
 
 /** `trie_for_each()` auxiliary implementation. This function recursively traverses a trie using a DFS approach on a
@@ -279,14 +619,13 @@ void *find_word_trie(struct trie_t *trie, char *word)
  */
 static void trie_for_each_aux(struct trie_t *trie, struct trie_node *node, void (*f)(void *, void *), void *fargs)
 {
-	int i;
+	struct trie_node *child;
+	int pos;
 	if (node->is_word) {
 		(*f)(node->data, fargs);
 	}
-	for (i = 0; i < trie->edges_no; i++) {
-		if (node->edges[i] != NULL) {
-			trie_for_each_aux(trie, node->edges[i], f, fargs);
-		}
+	for (pos = 0; (child = next_child(trie, node, &pos)) != NULL; pos++) {
+		trie_for_each_aux(trie, child, f, fargs);
 	}
 }
 
@@ -325,33 +664,40 @@ static inline int trie_stack_empty(struct trie_node_stack *st)
 	return st->top == NULL;
 }
 
-/** Pushes a new element into a stack of an on going search by prefix. Creates a new instance of `struct
-   trie_node_stack_elm` and places it at the top of `st`.
+/** Pushes every child of a node into a stack of an on going search by prefix, so that they are popped in ascending
+   order of edge IDs. Children whose path would be longer than `st->depth-1` characters are not pushed.
    @param st The stack.
-   @param el A trie node that is associated with this element.
-   @param depth This element's depth in the stack.
-   @param letter Last letter used to arrive to this node.
-   @return A pointer to the new node pushed, or `NULL` if there wasn't enough memory to push a new node, in which case
-      the stack remains unchanged.
+   @param trie A trie, as returned by `init_trie()`
+   @param node The node whose children are pushed.
+   @param depth Length of the path from the search's starting point down to `node`.
+   @return `0` on success; `TRIE_NO_MEM` if there wasn't enough memory to push every child, in which case only some of
+      the children were pushed.
  */
-static inline struct trie_node_stack_elm *trie_push(struct trie_node_stack *st,
-						    struct trie_node *el,
-						    int depth,
-						    char letter)
+static int trie_push_children(struct trie_node_stack *st, struct trie_t *trie, struct trie_node *node, int depth)
 {
+	struct trie_node_stack_elm *old_top = st->top;
+	struct trie_node_stack_elm **tail = &st->top;
 	struct trie_node_stack_elm *new_el;
+	struct trie_node *child;
+	int ret = 0;
+	int pos;
 
-	if ((new_el = malloc(sizeof(struct trie_node_stack_elm))) == NULL) {
-		return NULL;
+	for (pos = 0; (child = next_child(trie, node, &pos)) != NULL; pos++) {
+		if (depth + 1 + child->prefix_len >= st->depth) {
+			continue;
+		}
+		if ((new_el = malloc(sizeof(struct trie_node_stack_elm))) == NULL) {
+			ret = TRIE_NO_MEM;
+			break;
+		}
+		new_el->el = child;
+		new_el->letter = (*trie->pos_to_char)(pos);
+		new_el->depth = depth + 1 + child->prefix_len;
+		*tail = new_el;
+		tail = &new_el->next;
 	}
-
-	new_el->letter = letter;
-	new_el->depth = depth;
-	new_el->next = st->top;
-	st->top = new_el;
-	new_el->el = el;
-
-	return new_el;
+	*tail = old_top;
+	return ret;
 }
 
 /** Finds the next match for an on going search by prefix.
@@ -387,21 +733,19 @@ static struct trie_node_stack *find_by_prefix_next_trie_n(struct trie_node_stack
 							  void **data)
 {
 	struct trie_node_stack_elm *curr;
+	int start;
 	int i;
 	*err_code = 0;
 	while (!trie_stack_empty(st)) {
 		curr = trie_pop(st);
-		if (curr->depth + 1 < st->depth) {
-			for (i = trie->edges_no - 1; i >= 0 && *err_code == 0; i--) {
-				if (curr->el->edges[i] != NULL) {
-					if (trie_push(st, curr->el->edges[i], curr->depth + 1,
-						      (*trie->pos_to_char)(i)) == NULL) {
-						*err_code = TRIE_NO_MEM;
-					}
-				}
-			}
+		if (curr->depth + 1 < st->depth && trie_push_children(st, trie, curr->el, curr->depth) != 0) {
+			*err_code = TRIE_NO_MEM;
+		}
+		start = curr->depth - curr->el->prefix_len - 1;
+		st->path[start] = curr->letter;
+		for (i = 0; i < curr->el->prefix_len; i++) {
+			st->path[start + 1 + i] = (*trie->pos_to_char)(curr->el->prefix[i]);
 		}
-		st->path[curr->depth - 1] = curr->letter;
 		if (curr->el->is_word) {
 			st->path[curr->depth] = '\0';
 			strcpy(result, st->path);
@@ -457,8 +801,9 @@ void free_trie_stack(struct trie_node_stack *st);
    @warning `prefix` must be a characters sequence such that `strlen(prefix) <= depth-1`. Ignoring this requirement
       leads to buffer overflows when writing to `result`.
    @warning This function will have undefined behavior if it is called with a state `st` that holds information for a
-      `prefix`, but in the meantime, words were removed that matched `prefix`. The caller must ensure that this never
-      happens, otherwise, the program will most likely crash for accessing invalid memory positions.
+      `prefix`, but in the meantime, words were added to or removed from the trie. Nodes are reallocated when they grow,
+      shrink, split or merge, so the caller must ensure that this never happens, otherwise, the program will most likely
+      crash for accessing invalid memory positions.
    @warning It is not allowed to call this function with old `st` values. The only valid `st` is the one that was
       returned by the previous call, since this function frees some of the state information as the search goes along.
       Thus, it is assumed that the search always moves forward, and never backwards. Calling this with an old value for
@@ -482,17 +827,34 @@ struct trie_node_stack *find_by_prefix_next_trie(struct trie_t *trie,
 						 void **data)
 {
 	struct trie_node *n;
+	struct trie_node **next;
 	struct trie_node_stack *new_st;
 	const char *ptr;
-	int i;
+	unsigned char pos;
+	int matched;
+	int rest;
 	int size;
+	int i;
 
 	*err_code = 0;
 	if (st == NULL) {
-		for (size = 0, n = trie->root, ptr = prefix; *ptr != '\0'; ptr++, size++) {
-			if (!(*trie->is_valid)(*ptr) || (n = n->edges[(*trie->char_to_pos)(*ptr)]) == NULL) {
+		/* The prefix may end in the middle of a node's compressed path */
+		for (size = 0, matched = 0, n = trie->root, ptr = prefix; *ptr != '\0'; ptr++, size++) {
+			if (!(*trie->is_valid)(*ptr)) {
 				return NULL;
 			}
+			pos = (unsigned char) (*trie->char_to_pos)(*ptr);
+			if (matched < n->prefix_len) {
+				if (n->prefix[matched++] != pos) {
+					return NULL;
+				}
+			} else {
+				if ((next = child_ref(n, pos)) == NULL) {
+					return NULL;
+				}
+				n = *next;
+				matched = 0;
+			}
 		}
 		/* assert: n != NULL */
 		if ((st = malloc(sizeof(struct trie_node_stack))) == NULL) {
@@ -509,20 +871,22 @@ struct trie_node_stack *find_by_prefix_next_trie(struct trie_t *trie,
 		}
 		st->top = NULL;
 		st->depth = depth - size;
-		if (st->depth > 1) {
-			/* We can still write at least 1 char in result */
-			for (i = trie->edges_no - 1; i >= 0 && *err_code == 0; i--) {
-				if (n->edges[i] != NULL) {
-					if (trie_push(st, n->edges[i], 1, (*trie->pos_to_char)(i)) == NULL) {
-						*err_code = TRIE_NO_MEM;
-					}
-				}
+		/* The rest of n's compressed path belongs to every match */
+		rest = n->prefix_len - matched;
+		if (rest < st->depth) {
+			for (i = 0; i < rest; i++) {
+				st->path[i] = (*trie->pos_to_char)(n->prefix[matched + i]);
+			}
+			if (rest + 1 < st->depth) {
+				/* We can still write at least 1 char in result */
+				*err_code = trie_push_children(st, trie, n, rest);
+			}
+			if (n->is_word) {
+				st->path[rest] = '\0';
+				sprintf(result, "%s%s", st->prefix, st->path);
+				*data = n->data;
+				return st;
 			}
-		}
-		if (n->is_word) {
-			strcpy(result, st->prefix);
-			*data = n->data;
-			return st;
 		}
 	}
 	result += sprintf(result, "%s", st->prefix);
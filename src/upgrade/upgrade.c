@@ -0,0 +1,940 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include "upgrade.h"
+#include "client.h"
+#include "client_list.h"
+#include "channel.h"
+#include "protocol.h"
+#include "worker.h"
+#include "write_msgs_queue.h"
+#include "uring.h"
+
+/** @file
+	@brief Hot restart implementation
+
+	The old process creates a `socketpair()` and runs its executable again, with `UPGRADE_ENV` holding the new process' end.
+	The new process boots as usual, but before opening any listening socket, it calls `upgrade_resume()`, which says it is
+	ready. The old process then stops every worker, so that nothing changes while the state is being sent, and sends a
+	sequence of records:
+	<ul>
+	<li>`RECORD_LISTENER`, with a listening socket;</li>
+	<li>`RECORD_CLIENT`, with a client's socket, followed by his nickname, username, hostname, cloaked hostname, realname,
+	flags (`o` for operators, `r` for reversed hostnames, `d` for clients whose current message is being thrown away), and the lengths of his partial input and pending output, all null terminated, and then the raw input and output;</li>
+	<li>`RECORD_CHANNEL`, with a channel's name, topic and modes, followed by the prefix and modes of each of its users;</li>
+	<li>`RECORD_END`.</li>
+	</ul>
+	Every record starts with a `struct record_header`; the socket, if any, is attached to it. Numbers are sent as text.
+	Once the new process has its listening sockets up, it confirms, with `upgrade_done()`, and the old process exits.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see upgrade.h
+*/
+
+/** Sent by the new process when it is ready to take over. */
+#define UPGRADE_READY 'R'
+/** Sent by the new process once it took over. */
+#define UPGRADE_ACK 'K'
+
+/** A listening socket */
+#define RECORD_LISTENER 'L'
+/** A client */
+#define RECORD_CLIENT 'C'
+/** A channel */
+#define RECORD_CHANNEL 'H'
+/** Nothing else follows */
+#define RECORD_END 'E'
+
+extern char **environ;
+
+/** Header of every record. */
+struct record_header {
+	uint32_t type; /**<The record's type. */
+	uint32_t length; /**<How many bytes follow. */
+};
+
+/** A record's contents, being built or parsed. */
+struct record {
+	char *buf; /**<The contents. */
+	size_t length; /**<How many bytes are stored in `buf`. */
+	size_t capacity; /**<How many bytes fit in `buf`. */
+	int failed; /**<Set if there wasn't enough memory for something that was appended. */
+};
+
+/** State of a hot restart, on the old process' side. */
+struct upgrade_state {
+	int sock; /**<The socket leading to the new process. */
+	struct record record; /**<The record being built. */
+	int failed; /**<Set if something could not be sent. */
+	int clients; /**<How many clients were sent. */
+};
+
+static char self_path[PATH_MAX]; /**<The executable, as it was when this process started. */
+
+static pthread_mutex_t freeze_mutex = PTHREAD_MUTEX_INITIALIZER; /**<Protects `frozen`, `freeze_generation`, `parked` and `park_failed`. */
+static pthread_cond_t freeze_cond = PTHREAD_COND_INITIALIZER; /**<Signaled when `frozen` or `parked` change. */
+static int frozen; /**<Set while the workers must stay stopped. */
+static uintptr_t freeze_generation; /**<Incremented by every `freeze_workers()` call. Tasks posted by an older call are stale. */
+static int parked; /**<How many workers were stopped by the current `freeze_workers()` call. */
+static int park_failed; /**<Set if a worker could not quiesce its io_uring instance before stopping. */
+
+static int resume_fd = -1; /**<In a new process, the socket leading to the old one, until `upgrade_done()`. */
+static int *inherited; /**<Listening sockets handed over by the old process. Taken ones are set to `-1`. */
+static int inherited_count; /**<How many positions of `inherited` are taken. */
+static struct irc_client **resumed; /**<Clients handed over by the old process, waiting for `upgrade_done()`. */
+static int resumed_count; /**<How many positions of `resumed` are taken. */
+static int resumed_capacity; /**<How many clients fit in `resumed`. */
+
+/** Appends bytes to a record. If there isn't enough memory, the record's `failed` flag is set.
+	@param r The record.
+	@param data The bytes.
+	@param len How many bytes.
+ */
+static void record_append(struct record *r, const void *data, size_t len)
+{
+	size_t capacity;
+	char *buf;
+	if (r->failed || len == 0) {
+		return;
+	}
+	if (r->length + len > r->capacity) {
+		for (capacity = (r->capacity == 0 ? 4096 : r->capacity); capacity < r->length + len; capacity *= 2)
+			; /* Intentionally left blank */
+		if ((buf = realloc(r->buf, capacity)) == NULL) {
+			r->failed = 1;
+			return;
+		}
+		r->buf = buf;
+		r->capacity = capacity;
+	}
+	memcpy(r->buf + r->length, data, len);
+	r->length += len;
+}
+
+/** Appends a null terminated string to a record, along with its terminator.
+	@param r The record.
+	@param str The string.
+ */
+static void record_str(struct record *r, const char *str)
+{
+	record_append(r, str, strlen(str) + 1);
+}
+
+/** Appends a number to a record, as a null terminated string.
+	@param r The record.
+	@param n The number.
+ */
+static void record_uint(struct record *r, unsigned long n)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lu", n);
+	record_str(r, buf);
+}
+
+/** Reads the next null terminated field of a record.
+	@param r The record.
+	@param pos Position of the field; it is moved past it.
+	@return The field; `NULL` if there are no more fields.
+ */
+static char *record_next(struct record *r, size_t *pos)
+{
+	char *field, *end;
+	if (*pos >= r->length) {
+		return NULL;
+	}
+	field = r->buf + *pos;
+	if ((end = memchr(field, '\0', r->length - *pos)) == NULL) {
+		return NULL;
+	}
+	*pos = (size_t) (end - r->buf) + 1;
+	return field;
+}
+
+/** Reads the next field of a record as a number.
+	@param r The record.
+	@param pos Position of the field; it is moved past it.
+	@param n Where to store the number.
+	@return `0` on success; `-1` if there are no more fields, or the field is not a number.
+ */
+static int record_next_uint(struct record *r, size_t *pos, unsigned long *n)
+{
+	char *field, *end;
+	if ((field = record_next(r, pos)) == NULL || *field == '\0') {
+		return -1;
+	}
+	*n = strtoul(field, &end, 10);
+	return *end == '\0' ? 0 : -1;
+}
+
+/** Writes every byte of a buffer into a blocking socket.
+	@param sock The socket.
+	@param buf The buffer.
+	@param len How many bytes to write.
+	@return `0` on success; `-1` on error, including a timeout.
+ */
+static int write_all(int sock, const char *buf, size_t len)
+{
+	ssize_t n;
+	while (len > 0) {
+		if ((n = write(sock, buf, len)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+	return 0;
+}
+
+/** Reads exactly `len` bytes from a blocking socket.
+	@param sock The socket.
+	@param buf Where to store the bytes.
+	@param len How many bytes to read.
+	@return `0` on success; `-1` on error, including a timeout and the other end closing the socket.
+ */
+static int read_all(int sock, char *buf, size_t len)
+{
+	ssize_t n;
+	while (len > 0) {
+		if ((n = read(sock, buf, len)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			return -1;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+	return 0;
+}
+
+/** Sends a record, attaching a file descriptor to its header.
+	@param sock The socket leading to the new process.
+	@param type The record's type.
+	@param fd The file descriptor, or `-1`.
+	@param r The record's contents, or `NULL` if it has none.
+	@return `0` on success; `-1` on error.
+ */
+static int send_record(int sock, int type, int fd, struct record *r)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct record_header header;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	header.type = (uint32_t) type;
+	header.length = (uint32_t) (r != NULL ? r->length : 0);
+	iov.iov_base = &header;
+	iov.iov_len = sizeof(header);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd != -1) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	while ((n = sendmsg(sock, &msg, 0)) == -1 && errno == EINTR)
+		; /* Intentionally left blank */
+	if (n != (ssize_t) sizeof(header)) {
+		return -1;
+	}
+	return header.length == 0 ? 0 : write_all(sock, r->buf, r->length);
+}
+
+/** Receives a record.
+	@param sock The socket leading to the old process.
+	@param type Where to store the record's type.
+	@param fd Where to store the file descriptor attached to the record, or `-1` if there is none.
+	@param r Where to store the record's contents.
+	@return `0` on success; `-1` on error. Whatever file descriptor came with the record is closed on error.
+ */
+static int recv_record(int sock, int *type, int *fd, struct record *r)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct record_header header;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+	char *buf;
+
+	iov.iov_base = &header;
+	iov.iov_len = sizeof(header);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	while ((n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+		; /* Intentionally left blank */
+	*fd = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	if (n != (ssize_t) sizeof(header) || header.length > UPGRADE_MAX_RECORD) {
+		goto error;
+	}
+	*type = (int) header.type;
+	r->length = 0;
+	r->failed = 0;
+	if (header.length > r->capacity) {
+		if ((buf = realloc(r->buf, header.length)) == NULL) {
+			goto error;
+		}
+		r->buf = buf;
+		r->capacity = header.length;
+	}
+	if (read_all(sock, r->buf, header.length) == -1) {
+		goto error;
+	}
+	r->length = header.length;
+	return 0;
+
+error:
+	if (*fd != -1) {
+		close(*fd);
+		*fd = -1;
+	}
+	return -1;
+}
+
+/** Makes every read and write on a socket give up after `UPGRADE_TIMEOUT` seconds, so that a stuck process can't hang the
+	other one.
+	@param sock The socket.
+ */
+static void set_timeouts(int sock)
+{
+	struct timeval tv;
+	tv.tv_sec = UPGRADE_TIMEOUT;
+	tv.tv_usec = 0;
+	(void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void)setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/** Worker task that keeps a worker stopped while `frozen` is set. Since the worker is not running any callback, none of
+	its clients changes, and it holds no locks.
+	If the worker has an io_uring instance, it is quiesced first, so that nothing is received or sent by this process once
+	the state is handed over; see `uring_quiesce()`. It is resumed when the worker goes on.
+	A task posted by a `freeze_workers()` call that already gave up does nothing, so that it is not counted by a later one.
+	@param w The worker.
+	@param arg The `freeze_generation` of the `freeze_workers()` call that posted this task, casted to `void *`.
+ */
+static void park_worker(struct worker *w, void *arg)
+{
+	uintptr_t generation = (uintptr_t) arg;
+	int quiesced = 1;
+	int stale;
+
+	pthread_mutex_lock(&freeze_mutex);
+	stale = (!frozen || generation != freeze_generation);
+	pthread_mutex_unlock(&freeze_mutex);
+	if (stale) {
+		return;
+	}
+#ifdef YAIRCD_URING
+	if (w->uring != NULL && uring_quiesce(w->uring) == -1) {
+		quiesced = 0;
+	}
+#else
+	(void)w;
+#endif
+	pthread_mutex_lock(&freeze_mutex);
+	if (frozen && generation == freeze_generation) {
+		parked++;
+		if (!quiesced) {
+			park_failed = 1;
+		}
+		pthread_cond_broadcast(&freeze_cond);
+		while (frozen && generation == freeze_generation) {
+			pthread_cond_wait(&freeze_cond, &freeze_mutex);
+		}
+	}
+	pthread_mutex_unlock(&freeze_mutex);
+#ifdef YAIRCD_URING
+	if (w->uring != NULL) {
+		uring_unquiesce(w->uring);
+	}
+#endif
+}
+
+/** Lets the workers stopped by `freeze_workers()` go on. */
+static void thaw_workers(void)
+{
+	pthread_mutex_lock(&freeze_mutex);
+	frozen = 0;
+	pthread_cond_broadcast(&freeze_cond);
+	pthread_mutex_unlock(&freeze_mutex);
+}
+
+/** Stops every worker, and waits until they are all stopped.
+	@return `0` on success; `-1` if some worker could not be stopped within `UPGRADE_TIMEOUT` seconds, or could not quiesce
+	   its io_uring instance, in which case every worker is let go.
+ */
+static int freeze_workers(void)
+{
+	struct timespec deadline;
+	uintptr_t generation;
+	int ret = 0;
+	int i;
+
+	pthread_mutex_lock(&freeze_mutex);
+	frozen = 1;
+	generation = ++freeze_generation;
+	parked = 0;
+	park_failed = 0;
+	pthread_mutex_unlock(&freeze_mutex);
+	for (i = 0; i < worker_pool_size(); i++) {
+		if (worker_post(worker_get(i), park_worker, (void*)generation) == -1) {
+			thaw_workers();
+			return -1;
+		}
+	}
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += UPGRADE_TIMEOUT;
+	pthread_mutex_lock(&freeze_mutex);
+	while (parked < worker_pool_size() && ret == 0) {
+		ret = pthread_cond_timedwait(&freeze_cond, &freeze_mutex, &deadline);
+	}
+	if (park_failed) {
+		ret = -1;
+	}
+	pthread_mutex_unlock(&freeze_mutex);
+	if (parked < worker_pool_size() || ret == -1) {
+		thaw_workers();
+		return -1;
+	}
+	return 0;
+}
+
+/** Sends a client to the new process. This is the callback passed to `client_list_for_each()`. Only local, registered,
+	plaintext clients are sent.
+	@param data The client.
+	@param args The `struct upgrade_state`. Its `failed` flag is set if the client could not be sent.
+ */
+static void export_client(void *data, void *args)
+{
+	struct irc_client *client = (struct irc_client*)data;
+	struct upgrade_state *st = (struct upgrade_state*)args;
+	struct irc_message *in = &client->last_msg;
+	char flags[4], *p;
+	size_t in_len;
+	char *out;
+	size_t out_len;
+
+	if (st->failed || !client->is_registered || client->link != NULL || client->uses_ssl) {
+		return;
+	}
+	if (client_queue_copy(&client->write_queue, &out, &out_len) == -1) {
+		st->failed = 1;
+		return;
+	}
+	in_len = (in->discarding ? 0 : (size_t) (in->index - in->msg_begin));
+	p = flags;
+	if (client->is_oper) {
+		*p++ = 'o';
+	}
+	if (client->host_reversed) {
+		*p++ = 'r';
+	}
+	if (in->discarding) {
+		*p++ = 'd';
+	}
+	*p = '\0';
+	st->record.length = 0;
+	record_str(&st->record, client->nick);
+	record_str(&st->record, client->username);
+	record_str(&st->record, client->hostname);
+	record_str(&st->record, client->public_host);
+	record_str(&st->record, client->realname);
+	record_str(&st->record, flags);
+	record_uint(&st->record, in_len);
+	record_uint(&st->record, out_len);
+	record_append(&st->record, in->msg + in->msg_begin, in_len);
+	record_append(&st->record, out, out_len);
+	free(out);
+	if (st->record.failed || send_record(st->sock, RECORD_CLIENT, client->socket_fd, &st->record) == -1) {
+		st->failed = 1;
+		return;
+	}
+	st->clients++;
+}
+
+/** Sends a channel to the new process. This is the function passed to `chan_export()`.
+	@param args The `struct upgrade_state`.
+	@param name The channel's name.
+	@param topic The channel's topic.
+	@param modes The channel's modes.
+	@param members The channel's users.
+	@param count How many users there are.
+	@return `0` on success; `-1` if the channel could not be sent.
+ */
+static int export_channel(void *args, const char *name, const char *topic, unsigned modes, struct chan_member_info *members,
+			  int count)
+{
+	struct upgrade_state *st = (struct upgrade_state*)args;
+	int i;
+
+	st->record.length = 0;
+	record_str(&st->record, name);
+	record_str(&st->record, topic);
+	record_uint(&st->record, modes);
+	for (i = 0; i < count; i++) {
+		record_str(&st->record, members[i].prefix);
+		record_uint(&st->record, members[i].modes);
+	}
+	if (st->record.failed) {
+		return -1;
+	}
+	return send_record(st->sock, RECORD_CHANNEL, -1, &st->record);
+}
+
+/** Sends everything the new process needs: the listening sockets, the clients, and the channels. Every worker must be
+	stopped.
+	@param sock The socket leading to the new process.
+	@param fds The listening sockets.
+	@param count How many listening sockets there are.
+	@return How many clients were sent; `-1` on error.
+ */
+static int send_state(int sock, const int fds[], int count)
+{
+	struct upgrade_state st;
+	int i;
+
+	st.sock = sock;
+	st.record.buf = NULL;
+	st.record.length = 0;
+	st.record.capacity = 0;
+	st.record.failed = 0;
+	st.failed = 0;
+	st.clients = 0;
+	for (i = 0; i < count && !st.failed; i++) {
+		if (fds[i] != -1 && send_record(sock, RECORD_LISTENER, fds[i], NULL) == -1) {
+			st.failed = 1;
+		}
+	}
+	if (!st.failed) {
+		client_list_for_each(export_client, &st);
+	}
+	if (!st.failed && chan_export(export_channel, &st) == -1) {
+		st.failed = 1;
+	}
+	if (!st.failed && send_record(sock, RECORD_END, -1, NULL) == -1) {
+		st.failed = 1;
+	}
+	free(st.record.buf);
+	return st.failed ? -1 : st.clients;
+}
+
+/** Runs the executable again, with `UPGRADE_ENV` telling it which file descriptor leads to this process. Every other
+	file descriptor, except for the standard ones, is closed in the new process.
+	@param sock The new process' end of the `socketpair()`.
+	@return The new process' ID; `-1` on error.
+ */
+static pid_t spawn(int sock)
+{
+	char env[sizeof(UPGRADE_ENV) + 16];
+	char *argv[2];
+	char **envp;
+	sigset_t none;
+	long maxfd;
+	pid_t pid;
+	size_t i, j;
+	int fd;
+
+	for (i = 0; environ[i] != NULL; i++)
+		; /* Intentionally left blank */
+	if ((envp = malloc((i + 2) * sizeof(*envp))) == NULL) {
+		return -1;
+	}
+	for (i = 0, j = 0; environ[i] != NULL; i++) {
+		if (strncmp(environ[i], UPGRADE_ENV "=", sizeof(UPGRADE_ENV)) != 0) {
+			envp[j++] = environ[i];
+		}
+	}
+	snprintf(env, sizeof(env), "%s=%d", UPGRADE_ENV, sock);
+	envp[j++] = env;
+	envp[j] = NULL;
+	argv[0] = self_path;
+	argv[1] = NULL;
+	if ((maxfd = sysconf(_SC_OPEN_MAX)) == -1) {
+		maxfd = 1024;
+	}
+	sigemptyset(&none);
+	if ((pid = fork()) == 0) {
+		/* Only async-signal-safe functions can be used in here, since other threads may have held locks */
+		for (fd = 3; fd < maxfd; fd++) {
+			if (fd != sock) {
+				close(fd);
+			}
+		}
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		execve(self_path, argv, envp);
+		_exit(127);
+	}
+	if (pid == -1) {
+		perror("::upgrade.c:spawn(): Could not fork");
+	}
+	free(envp);
+	return pid;
+}
+
+/** Gets rid of a new process that could not take over.
+	@param pid The new process.
+	@param sock The socket leading to it. It is closed.
+ */
+static void abort_child(pid_t pid, int sock)
+{
+	close(sock);
+	kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		; /* Intentionally left blank */
+}
+
+/** Hands every plaintext session over to a new process, running the executable again. This is called by the main loop when
+	`SIGUSR2` arrives.
+	The main loop is blocked while the new process boots, and the workers are stopped while the state is sent; new
+	connections wait in the listening sockets' backlog, and are accepted by the new process.
+	@param fds The listening sockets. Positions holding `-1` are skipped.
+	@param count How many positions `fds` has.
+	@return `-1` if the new process could not take over, in which case this process goes on as usual. On success, this
+	   function doesn't return: the process exits.
+ */
+int upgrade_start(const int fds[], int count)
+{
+	int sv[2];
+	pid_t pid;
+	char byte;
+	int clients;
+
+	if (self_path[0] == '\0') {
+		fprintf(stderr, "::upgrade.c:upgrade_start(): The executable's path is unknown.\n");
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		perror("::upgrade.c:upgrade_start(): Could not create a socket pair");
+		return -1;
+	}
+	/* The new process' end must survive execve() */
+	(void)fcntl(sv[1], F_SETFD, 0);
+	set_timeouts(sv[0]);
+	pid = spawn(sv[1]);
+	close(sv[1]);
+	if (pid == -1) {
+		close(sv[0]);
+		return -1;
+	}
+	if (read_all(sv[0], &byte, 1) == -1 || byte != UPGRADE_READY) {
+		fprintf(stderr, "::upgrade.c:upgrade_start(): The new process did not start.\n");
+		abort_child(pid, sv[0]);
+		return -1;
+	}
+	if (freeze_workers() == -1) {
+		fprintf(stderr, "::upgrade.c:upgrade_start(): Could not stop the workers.\n");
+		abort_child(pid, sv[0]);
+		return -1;
+	}
+	if ((clients = send_state(sv[0], fds, count)) == -1 || read_all(sv[0], &byte, 1) == -1 || byte != UPGRADE_ACK) {
+		fprintf(stderr, "::upgrade.c:upgrade_start(): The new process could not take over.\n");
+		abort_child(pid, sv[0]);
+		thaw_workers();
+		return -1;
+	}
+	fprintf(stderr, "::upgrade.c:upgrade_start(): Process %d took over %d clients. Exiting.\n", (int) pid, clients);
+	exit(0);
+}
+
+/** Callback for `client_list_find_and_execute()` that returns the client found.
+	@param data The client.
+	@param args Not used.
+	@return `data`.
+ */
+static void *found_client(void *data, void *args)
+{
+	(void)args;
+	return data;
+}
+
+/** Recreates a client sent by the old process. A client that can't be recreated is disconnected, but that is not an
+	error.
+	@param r The `RECORD_CLIENT` record.
+	@param fd The client's socket.
+	@return `0` on success; `-1` if the record is malformed, or there isn't enough memory to keep track of the client.
+ */
+static int import_client(struct record *r, int fd)
+{
+	char *nick, *username, *hostname, *public_host, *realname, *flags;
+	struct irc_client **grown, *client;
+	unsigned long in_len, out_len, n;
+	size_t pos = 0;
+	char *in;
+
+	if ((nick = record_next(r, &pos)) == NULL || (username = record_next(r, &pos)) == NULL ||
+	    (hostname = record_next(r, &pos)) == NULL || (public_host = record_next(r, &pos)) == NULL ||
+	    (realname = record_next(r, &pos)) == NULL || (flags = record_next(r, &pos)) == NULL ||
+	    record_next_uint(r, &pos, &in_len) == -1 || record_next_uint(r, &pos, &out_len) == -1 ||
+	    in_len > INPUT_BUFFER_SIZE || r->length - pos != in_len + out_len) {
+		close(fd);
+		return -1;
+	}
+	if (resumed_count == resumed_capacity) {
+		n = (resumed_capacity == 0 ? 256 : 2 * (unsigned long) resumed_capacity);
+		if ((grown = realloc(resumed, n * sizeof(*resumed))) == NULL) {
+			close(fd);
+			return -1;
+		}
+		resumed = grown;
+		resumed_capacity = (int) n;
+	}
+	if ((client = resume_client(worker_get(resumed_count % worker_pool_size()), fd, nick, username, hostname,
+				    public_host, realname)) == NULL) {
+		fprintf(stderr, "::upgrade.c:import_client(): Could not resume %s's session.\n", nick);
+		return 0;
+	}
+	client->is_oper = (strchr(flags, 'o') != NULL);
+	client->host_reversed = (strchr(flags, 'r') != NULL);
+	in = r->buf + pos;
+	memcpy(client->last_msg.msg, in, in_len);
+	client->last_msg.index = (int) in_len;
+	client->last_msg.discarding = (strchr(flags, 'd') != NULL);
+	for (in += in_len; out_len > 0; in += n, out_len -= n) {
+		n = (out_len > WRITE_BLOCK_SIZE ? WRITE_BLOCK_SIZE : out_len);
+		if (client_enqueue_buf(&client->write_queue, in, (size_t) n) == -1) {
+			/* Resuming him with a gap in his output would corrupt his stream */
+			fprintf(stderr, "::upgrade.c:import_client(): Could not restore %s's output.\n", nick);
+			discard_resumed_client(client);
+			return 0;
+		}
+	}
+	resumed[resumed_count++] = client;
+	return 0;
+}
+
+/** Recreates a channel sent by the old process, with `chan_import()`. Users that were not resumed are left out. A channel
+	that can't be recreated is lost, but that is not an error.
+	@param r The `RECORD_CHANNEL` record.
+	@return `0` on success; `-1` if the record is malformed, or there isn't enough memory to parse it.
+ */
+static int import_channel(struct record *r)
+{
+	struct chan_member_info *members, *grown;
+	char nick[MAX_NICK_LENGTH + 1];
+	char *name, *topic, *prefix;
+	unsigned long modes, user_modes;
+	int count, capacity, found;
+	size_t pos = 0, len;
+
+	if ((name = record_next(r, &pos)) == NULL || (topic = record_next(r, &pos)) == NULL ||
+	    record_next_uint(r, &pos, &modes) == -1) {
+		return -1;
+	}
+	members = NULL;
+	count = capacity = 0;
+	while ((prefix = record_next(r, &pos)) != NULL) {
+		if (record_next_uint(r, &pos, &user_modes) == -1) {
+			free(members);
+			return -1;
+		}
+		if (count == capacity) {
+			capacity = (capacity == 0 ? 16 : 2 * capacity);
+			if ((grown = realloc(members, (size_t) capacity * sizeof(*members))) == NULL) {
+				free(members);
+				return -1;
+			}
+			members = grown;
+		}
+		members[count].prefix = prefix;
+		members[count].modes = (unsigned) user_modes;
+		members[count].user = NULL;
+		if ((len = strcspn(prefix, "!")) <= MAX_NICK_LENGTH) {
+			memcpy(nick, prefix, len);
+			nick[len] = '\0';
+			members[count].user = (struct irc_client*)client_list_find_and_execute(nick, found_client, NULL, &found);
+		}
+		count++;
+	}
+	if (pos != r->length) {
+		free(members);
+		return -1;
+	}
+	if (count > 0 && chan_import(name, topic, (unsigned) modes, members, count) != 0) {
+		fprintf(stderr, "::upgrade.c:import_channel(): Could not recreate %s.\n", name);
+	}
+	free(members);
+	return 0;
+}
+
+/** Remembers where the executable is, for a later hot restart. If this process was started by `upgrade_start()`, it also
+	takes over the old process' listening sockets, clients and channels. Clients are not resumed until `upgrade_done()`.
+	@return `0` on success, or if there's nothing to take over; `-1` if taking over failed, in which case the process must
+	   exit, and the old process keeps running.
+	@warning Must be called by the parent thread, after the workers started, and before the listening sockets are opened.
+ */
+int upgrade_resume(void)
+{
+	struct record r;
+	char byte = UPGRADE_READY;
+	ssize_t len;
+	char *env, *end;
+	int *grown;
+	long sock;
+	int type, fd;
+	int ret;
+
+	if ((len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1)) == -1) {
+		fprintf(stderr, "::upgrade.c:upgrade_resume(): Could not find the executable; hot restart is not available.\n");
+		len = 0;
+	}
+	self_path[len] = '\0';
+	if ((env = getenv(UPGRADE_ENV)) == NULL) {
+		return 0;
+	}
+	sock = strtol(env, &end, 10);
+	if (*env == '\0' || *end != '\0' || sock < 0 || sock > INT_MAX) {
+		fprintf(stderr, "::upgrade.c:upgrade_resume(): Invalid %s.\n", UPGRADE_ENV);
+		return -1;
+	}
+	unsetenv(UPGRADE_ENV);
+	resume_fd = (int) sock;
+	(void)fcntl(resume_fd, F_SETFD, FD_CLOEXEC);
+	set_timeouts(resume_fd);
+	if (write_all(resume_fd, &byte, 1) == -1) {
+		perror("::upgrade.c:upgrade_resume(): Could not reach the old process");
+		return -1;
+	}
+	r.buf = NULL;
+	r.length = 0;
+	r.capacity = 0;
+	r.failed = 0;
+	for (ret = 0; ret == 0 && (ret = recv_record(resume_fd, &type, &fd, &r)) == 0 && type != RECORD_END;) {
+		switch (type) {
+		case RECORD_LISTENER:
+			if (fd == -1 || (grown = realloc(inherited, (size_t) (inherited_count + 1) * sizeof(*inherited))) == NULL) {
+				ret = -1;
+				break;
+			}
+			inherited = grown;
+			inherited[inherited_count++] = fd;
+			fd = -1;
+			break;
+		case RECORD_CLIENT:
+			if (fd == -1) {
+				ret = -1;
+				break;
+			}
+			ret = import_client(&r, fd);
+			fd = -1;
+			break;
+		case RECORD_CHANNEL:
+			ret = import_channel(&r);
+			break;
+		default:
+			ret = -1;
+		}
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+	free(r.buf);
+	if (ret == -1) {
+		fprintf(stderr, "::upgrade.c:upgrade_resume(): Could not take over from the old process.\n");
+		return -1;
+	}
+	fprintf(stderr, "::upgrade.c:upgrade_resume(): Took over %d clients.\n", resumed_count);
+	return 0;
+}
+
+/** Hands a listening socket taken over from the old process to the code that would otherwise open a new one.
+	@param addr The address the socket must be bound to.
+	@return A listening socket bound to `addr`, which the caller owns from now on; `-1` if there is none.
+ */
+int upgrade_listener(struct sockaddr_in *addr)
+{
+	struct sockaddr_in bound;
+	socklen_t len;
+	int fd;
+	int i;
+
+	for (i = 0; i < inherited_count; i++) {
+		len = sizeof(bound);
+		if (inherited[i] == -1 || getsockname(inherited[i], (struct sockaddr*)&bound, &len) == -1) {
+			continue;
+		}
+		if (bound.sin_family == addr->sin_family && bound.sin_port == addr->sin_port &&
+		    bound.sin_addr.s_addr == addr->sin_addr.s_addr) {
+			fd = inherited[i];
+			inherited[i] = -1;
+			return fd;
+		}
+	}
+	return -1;
+}
+
+/** Finishes taking over from the old process: listening sockets that were not needed are closed, the old process is
+	told to exit, and the clients' sessions are resumed. Nothing is done if this process was not started by
+	`upgrade_start()`.
+	@warning Must be called by the parent thread, once the listening sockets are open.
+ */
+void upgrade_done(void)
+{
+	char byte = UPGRADE_ACK;
+	int i;
+
+	if (resume_fd == -1) {
+		return;
+	}
+	for (i = 0; i < inherited_count; i++) {
+		if (inherited[i] != -1) {
+			close(inherited[i]);
+		}
+	}
+	free(inherited);
+	inherited = NULL;
+	inherited_count = 0;
+	if (write_all(resume_fd, &byte, 1) == -1) {
+		perror("::upgrade.c:upgrade_done(): Could not tell the old process to exit");
+	}
+	close(resume_fd);
+	resume_fd = -1;
+	for (i = 0; i < resumed_count; i++) {
+		if (worker_post(resumed[i]->worker, start_resumed_client, resumed[i]) == -1) {
+			fprintf(stderr, "::upgrade.c:upgrade_done(): Could not resume %s's session.\n", resumed[i]->nick);
+		}
+	}
+	free(resumed);
+	resumed = NULL;
+	resumed_count = resumed_capacity = 0;
+}
@@ -0,0 +1,190 @@
+#include <stddef.h>
+#include <ev.h>
+#include "timer_wheel.h"
+
+/** @file
+	@brief Hierarchical timer wheel implementation
+
+	Each slot is a circular doubly linked list whose sentinel is the slot itself, so that a timer can be removed in `O(1)` without
+	knowing where it is. A timer that is not pending has both links set to `NULL`.
+
+	Ticks are counted with an `unsigned`, and distances between ticks are computed with unsigned subtraction, so the counter can
+	safely wrap around.
+
+	A wheel is only used by the thread running its loop; none of these functions are thread safe.
+
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+static void tick_cb(EV_P_ ev_timer *w, int revents);
+
+/** Empties a slot.
+	@param slot The slot's sentinel.
+*/
+static void slot_init(struct wheel_timer *slot)
+{
+	slot->prev = slot->next = slot;
+}
+
+/** Appends a timer to a slot.
+	@param slot The slot's sentinel.
+	@param timer The timer. It must not be in any slot.
+*/
+static void slot_append(struct wheel_timer *slot, struct wheel_timer *timer)
+{
+	timer->prev = slot->prev;
+	timer->next = slot;
+	slot->prev->next = timer;
+	slot->prev = timer;
+}
+
+/** Removes a timer from the slot it is in, and marks it as not pending.
+	@param timer The timer.
+*/
+static void slot_unlink(struct wheel_timer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+}
+
+/** Moves every timer in a slot to another, empty, slot.
+	@param from The slot to empty.
+	@param to The slot that receives the timers.
+*/
+static void slot_move(struct wheel_timer *from, struct wheel_timer *to)
+{
+	if (from->next == from) {
+		slot_init(to);
+		return;
+	}
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	slot_init(from);
+}
+
+/** Places a timer in the slot matching its expiration tick.
+	@param wheel The wheel.
+	@param timer The timer, with `expires` already set. It must not be in any slot. `expires` must not be earlier than `wheel->now`.
+*/
+static void place(struct timer_wheel *wheel, struct wheel_timer *timer)
+{
+	unsigned distance = timer->expires - wheel->now;
+
+	if (distance < TIMER_WHEEL_INNER_SLOTS) {
+		slot_append(&wheel->inner[timer->expires & (TIMER_WHEEL_INNER_SLOTS - 1)], timer);
+	} else if (distance < TIMER_WHEEL_INNER_SLOTS * TIMER_WHEEL_OUTER_SLOTS) {
+		slot_append(&wheel->outer[(timer->expires >> TIMER_WHEEL_INNER_BITS) & (TIMER_WHEEL_OUTER_SLOTS - 1)], timer);
+	} else {
+		/* Too far away; park it in the last outer slot, it will be placed again once that slot is reached */
+		slot_append(&wheel->outer[((wheel->now >> TIMER_WHEEL_INNER_BITS) + TIMER_WHEEL_OUTER_SLOTS - 1) &
+					  (TIMER_WHEEL_OUTER_SLOTS - 1)], timer);
+	}
+}
+
+/** Initializes an empty wheel. The wheel's tick watcher is only started when the first timer is added.
+	@param wheel The wheel.
+	@param loop The loop that shall drive the wheel. Every timer callback runs inside this loop's thread.
+*/
+void timer_wheel_init(struct timer_wheel *wheel, struct ev_loop *loop)
+{
+	int i;
+
+	for (i = 0; i < TIMER_WHEEL_INNER_SLOTS; i++) {
+		slot_init(&wheel->inner[i]);
+	}
+	for (i = 0; i < TIMER_WHEEL_OUTER_SLOTS; i++) {
+		slot_init(&wheel->outer[i]);
+	}
+	wheel->now = 0;
+	wheel->pending = 0;
+	wheel->loop = loop;
+	ev_timer_init(&wheel->tick_watcher, tick_cb, TIMER_WHEEL_TICK, TIMER_WHEEL_TICK);
+}
+
+/** Initializes a timer that is not pending. This must be called once before the timer is used.
+	@param timer The timer.
+	@param cb Function to call when the timer fires.
+*/
+void wheel_timer_init(struct wheel_timer *timer, void (*cb)(struct wheel_timer *))
+{
+	timer->prev = timer->next = NULL;
+	timer->expires = 0;
+	timer->cb = cb;
+}
+
+/** Adds a timer to a wheel. A timer fires within one tick of the requested time.
+	@param wheel The wheel.
+	@param timer The timer. If it is already pending, it is rescheduled.
+	@param after In how many seconds the timer shall fire.
+*/
+void timer_wheel_add(struct timer_wheel *wheel, struct wheel_timer *timer, ev_tstamp after)
+{
+	unsigned ticks;
+
+	if (timer->next != NULL) {
+		timer_wheel_remove(wheel, timer);
+	}
+	if (after <= 0.) {
+		ticks = 1;
+	} else if (after >= TIMER_WHEEL_TICK * (double) (1U << 30)) {
+		ticks = 1U << 30;
+	} else {
+		ticks = (unsigned) (after / TIMER_WHEEL_TICK) + 1;
+	}
+	timer->expires = wheel->now + ticks;
+	place(wheel, timer);
+	if (wheel->pending++ == 0) {
+		ev_timer_again(wheel->loop, &wheel->tick_watcher);
+	}
+}
+
+/** Removes a timer from a wheel. Nothing happens if the timer is not pending.
+	@param wheel The wheel.
+	@param timer The timer.
+*/
+void timer_wheel_remove(struct timer_wheel *wheel, struct wheel_timer *timer)
+{
+	if (timer->next == NULL) {
+		return;
+	}
+	slot_unlink(timer);
+	if (--wheel->pending == 0) {
+		ev_timer_stop(wheel->loop, &wheel->tick_watcher);
+	}
+}
+
+/** Callback for a wheel's tick watcher. Advances the wheel by one tick: if the inner wheel completed a turn, the next outer slot is
+	spread over the inner wheel; then, every timer in the current inner slot fires.
+	The current slot is detached before running the callbacks, so that callbacks can freely add and remove timers, including the one
+	that fired.
+	@param w Pointer to the wheel's `tick_watcher`. The wheel is obtained with `offsetof()`.
+	@param revents libev's flags. Not used for this callback.
+*/
+static void tick_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct timer_wheel *wheel;
+	struct wheel_timer expired;
+	struct wheel_timer cascade;
+	struct wheel_timer *timer;
+
+	wheel = (struct timer_wheel *) ((char *) w - offsetof(struct timer_wheel, tick_watcher));
+	wheel->now++;
+	if ((wheel->now & (TIMER_WHEEL_INNER_SLOTS - 1)) == 0) {
+		slot_move(&wheel->outer[(wheel->now >> TIMER_WHEEL_INNER_BITS) & (TIMER_WHEEL_OUTER_SLOTS - 1)], &cascade);
+		while (cascade.next != &cascade) {
+			timer = cascade.next;
+			slot_unlink(timer);
+			place(wheel, timer);
+		}
+	}
+	slot_move(&wheel->inner[wheel->now & (TIMER_WHEEL_INNER_SLOTS - 1)], &expired);
+	while (expired.next != &expired) {
+		timer = expired.next;
+		timer_wheel_remove(wheel, timer);
+		timer->cb(timer);
+	}
+}
@@ -0,0 +1,637 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+#include <ev.h>
+#include "uring.h"
+#include "client.h"
+#include "write_msgs_queue.h"
+#include "stats.h"
+#include "trace.h"
+
+/** @file
+	@brief io_uring socket I/O implementation
+
+	Every request carries a pointer to a `struct uring_op` as its user data, which tells what the request was for. Cancel requests
+	carry `NULL`; their completions are ignored, since the outcome is reported by the completion of the request they cancel.
+	A client's `struct uring_conn` can outlive the client: when the client is freed, his multishot recv is cancelled, and the
+	connection is only freed once every request that references it completed. Completions arriving in the meantime are dropped.
+	Before a hot restart hands the sockets over, `uring_quiesce()` cancels every request and waits for their final completions,
+	so that nothing is accepted, received or sent behind the new process' back. Until `uring_unquiesce()`, requests are not queued
+	again: connections only remember that they want to read or write.
+
+	@author Filipe Goncalves
+	@date November 2013
+	@see uring.h
+*/
+
+/** A multishot recv request */
+#define OP_RECV 1
+/** A `sendmsg()` request */
+#define OP_SEND 2
+/** A multishot accept request */
+#define OP_ACCEPT 3
+
+/** Identifies what a request was for. */
+struct uring_op {
+	int type; /**<One of `OP_RECV`, `OP_SEND` or `OP_ACCEPT`. */
+};
+
+/** An io_uring instance, driven by a libev loop. */
+struct uring {
+	struct io_uring ring; /**<The instance. */
+	struct io_uring_buf_ring *bufs; /**<Ring of provided buffers for multishot recv. */
+	char *space; /**<Memory of the provided buffers: `URING_BUFFERS` buffers, `URING_BUFFER_SIZE` characters each. */
+	int efd; /**<`eventfd()` signaled by the kernel when completions are posted. */
+	struct ev_loop *loop; /**<The loop that owns this instance. */
+	struct ev_io cqe_watcher; /**<Watches `efd`, and reaps completions. */
+	struct ev_prepare submit_watcher; /**<Submits every pending request before the loop blocks. */
+	struct uring_acceptor *acceptors; /**<Every listener served through this instance. */
+	struct uring_conn *conns; /**<Every connection served through this instance, including the ones whose client is gone. */
+	int quiescing; /**<Set between `uring_quiesce()` and `uring_unquiesce()`; no request is queued meanwhile. */
+};
+
+/** A client's connection served through a ring. */
+struct uring_conn {
+	struct uring *ring; /**<The ring. */
+	struct irc_client *client; /**<The client, or `NULL` once he is gone. */
+	int fd; /**<The client's socket. */
+	struct uring_op recv_op; /**<User data of the multishot recv. */
+	struct uring_op send_op; /**<User data of the send. */
+	unsigned recv_armed : 1; /**<Bit field set while the multishot recv has not posted its final completion. */
+	unsigned recv_wanted : 1; /**<Bit field set while the client's input must be read. */
+	unsigned send_inflight : 1; /**<Bit field set while the send has not completed. */
+	unsigned dispatching : 1; /**<Bit field set while a completion for this connection calls back into the client's code. */
+	unsigned flush_wanted : 1; /**<Bit field set if the client's queue must be flushed once the ring is no longer quiescing. */
+	struct uring_conn *prev; /**<Previous connection in the ring's `conns`. */
+	struct uring_conn *next; /**<Next connection in the ring's `conns`. */
+	int send_error; /**<`0`, or the negated `errno` value of the last send that failed. */
+	struct msghdr msg; /**<Message of the send. */
+	struct iovec iov[URING_SEND_SEGMENTS]; /**<What the send writes: the segments at the bottom of the client's write queue. */
+	struct msg_buf *bufs[URING_SEND_SEGMENTS]; /**<References to the buffers in `iov`, released when the send completes. */
+	int iovcnt; /**<How many positions of `iov` and `bufs` are taken. */
+};
+
+/** A listening socket served through a ring. */
+struct uring_acceptor {
+	struct uring_op op; /**<User data of the multishot accept. */
+	struct uring *ring; /**<The ring. */
+	int fd; /**<The listening socket. */
+	void (*cb)(void *arg, int sock); /**<Called with every new connection. */
+	void *arg; /**<Argument for `cb`. */
+	int armed; /**<Set while the multishot accept has not posted its final completion. */
+	struct uring_acceptor *next; /**<Next listener in the ring's `acceptors`. */
+};
+
+static void cqe_cb(EV_P_ ev_io *w, int revents);
+static void submit_cb(EV_P_ ev_prepare *w, int revents);
+static void reap(struct uring *ring);
+
+/** Gets a submission queue entry. If the submission queue is full, every pending request is submitted first.
+	@param ring The ring.
+	@return The entry; `NULL` if there is none, which should never happen.
+ */
+static struct io_uring_sqe *get_sqe(struct uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	if ((sqe = io_uring_get_sqe(&ring->ring)) == NULL) {
+		(void)io_uring_submit(&ring->ring);
+		sqe = io_uring_get_sqe(&ring->ring);
+	}
+	return sqe;
+}
+
+/** Sets up an io_uring instance for a loop. Must be called by the thread that runs the loop.
+	@param loop The loop.
+	@return The new ring; `NULL` if io_uring is not available, in which case the loop must use libev watchers. An appropriate
+	   message is printed.
+ */
+struct uring *uring_create(struct ev_loop *loop)
+{
+	struct uring *ring;
+	int ret;
+	int i;
+
+	if ((ring = malloc(sizeof(*ring))) == NULL) {
+		fprintf(stderr, "::uring.c:uring_create(): Not enough memory, using libev.\n");
+		return NULL;
+	}
+	if ((ret = io_uring_queue_init(URING_ENTRIES, &ring->ring, 0)) < 0) {
+		fprintf(stderr, "::uring.c:uring_create(): io_uring is not available (%s), using libev.\n", strerror(-ret));
+		free(ring);
+		return NULL;
+	}
+	if ((ring->space = malloc((size_t) URING_BUFFERS * URING_BUFFER_SIZE)) == NULL) {
+		fprintf(stderr, "::uring.c:uring_create(): Not enough memory for the provided buffers, using libev.\n");
+		goto error_ring;
+	}
+	if ((ring->bufs = io_uring_setup_buf_ring(&ring->ring, URING_BUFFERS, URING_BUFFER_GROUP, 0, &ret)) == NULL) {
+		fprintf(stderr, "::uring.c:uring_create(): Could not register the provided buffers (%s), using libev.\n",
+			strerror(-ret));
+		goto error_space;
+	}
+	for (i = 0; i < URING_BUFFERS; i++) {
+		io_uring_buf_ring_add(ring->bufs, ring->space + (size_t) i * URING_BUFFER_SIZE, URING_BUFFER_SIZE,
+				      (unsigned short) i, io_uring_buf_ring_mask(URING_BUFFERS), i);
+	}
+	io_uring_buf_ring_advance(ring->bufs, URING_BUFFERS);
+	if ((ring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("::uring.c:uring_create(): Could not create an eventfd, using libev");
+		goto error_bufs;
+	}
+	if ((ret = io_uring_register_eventfd(&ring->ring, ring->efd)) < 0) {
+		fprintf(stderr, "::uring.c:uring_create(): Could not register the eventfd (%s), using libev.\n", strerror(-ret));
+		close(ring->efd);
+		goto error_bufs;
+	}
+	ring->loop = loop;
+	ring->acceptors = NULL;
+	ring->conns = NULL;
+	ring->quiescing = 0;
+	ev_io_init(&ring->cqe_watcher, cqe_cb, ring->efd, EV_READ);
+	ev_io_start(loop, &ring->cqe_watcher);
+	ev_prepare_init(&ring->submit_watcher, submit_cb);
+	ev_prepare_start(loop, &ring->submit_watcher);
+	return ring;
+
+error_bufs:
+	io_uring_free_buf_ring(&ring->ring, ring->bufs, URING_BUFFERS, URING_BUFFER_GROUP);
+error_space:
+	free(ring->space);
+error_ring:
+	io_uring_queue_exit(&ring->ring);
+	free(ring);
+	return NULL;
+}
+
+/** Queues a multishot accept request for a listener.
+	@param a The listener.
+	@return `0` on success; `-1` if there is no submission queue entry.
+ */
+static int arm_accept(struct uring_acceptor *a)
+{
+	struct io_uring_sqe *sqe;
+	if ((sqe = get_sqe(a->ring)) == NULL) {
+		return -1;
+	}
+	io_uring_prep_multishot_accept(sqe, a->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	io_uring_sqe_set_data(sqe, &a->op);
+	a->armed = 1;
+	return 0;
+}
+
+/** Accepts every new connection on a listening socket through a ring, instead of watching the socket with libev.
+	@param ring The ring of the loop that owns the listener.
+	@param fd The listening socket.
+	@param cb Function called with every new, non-blocking socket, in the ring's loop. It owns the socket.
+	@param arg Argument for `cb`.
+	@return `0` on success; `-1` on error, in which case the listener must be watched with libev.
+ */
+int uring_accept(struct uring *ring, int fd, void (*cb)(void *arg, int sock), void *arg)
+{
+	struct uring_acceptor *a;
+	if ((a = malloc(sizeof(*a))) == NULL) {
+		return -1;
+	}
+	a->op.type = OP_ACCEPT;
+	a->ring = ring;
+	a->fd = fd;
+	a->cb = cb;
+	a->arg = arg;
+	a->armed = 0;
+	if (arm_accept(a) == -1) {
+		free(a);
+		return -1;
+	}
+	a->next = ring->acceptors;
+	ring->acceptors = a;
+	return 0;
+}
+
+/** Queues a multishot recv request for a connection.
+	@param conn The connection.
+	@return `0` on success; `-1` if there is no submission queue entry.
+ */
+static int arm_recv(struct uring_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+	if ((sqe = get_sqe(conn->ring)) == NULL) {
+		return -1;
+	}
+	io_uring_prep_recv_multishot(sqe, conn->fd, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	io_uring_sqe_set_data(sqe, &conn->recv_op);
+	conn->recv_armed = 1;
+	return 0;
+}
+
+/** Queues the cancellation of a request. The request posts its final completion once it is cancelled.
+	@param ring The ring.
+	@param op The request's user data.
+ */
+static void cancel_op(struct uring *ring, struct uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+	if ((sqe = get_sqe(ring)) != NULL) {
+		io_uring_prep_cancel(sqe, op, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+}
+
+/** Queues the cancellation of a connection's multishot recv, if it is armed.
+	@param conn The connection.
+ */
+static void cancel_recv(struct uring_conn *conn)
+{
+	if (conn->recv_armed) {
+		cancel_op(conn->ring, &conn->recv_op);
+	}
+}
+
+/** Frees a connection whose client is gone, once no request references it.
+	@param conn The connection.
+ */
+static void conn_maybe_free(struct uring_conn *conn)
+{
+	if (conn->client == NULL && !conn->recv_armed && !conn->send_inflight && !conn->dispatching) {
+		if (conn->prev != NULL) {
+			conn->prev->next = conn->next;
+		} else {
+			conn->ring->conns = conn->next;
+		}
+		if (conn->next != NULL) {
+			conn->next->prev = conn->prev;
+		}
+		free(conn);
+	}
+}
+
+/** Serves a plaintext client through a ring, instead of his libev watchers. His input is not read until
+	`uring_conn_read()` is called.
+	@param ring The ring of the client's worker.
+	@param client The client. His `uring` field is set.
+	@return `0` on success; `-1` if there's not enough memory, in which case the client must be served by libev.
+ */
+int uring_conn_open(struct uring *ring, struct irc_client *client)
+{
+	struct uring_conn *conn;
+	if ((conn = malloc(sizeof(*conn))) == NULL) {
+		return -1;
+	}
+	conn->ring = ring;
+	conn->client = client;
+	conn->fd = client->socket_fd;
+	conn->recv_op.type = OP_RECV;
+	conn->send_op.type = OP_SEND;
+	conn->recv_armed = 0;
+	conn->recv_wanted = 0;
+	conn->send_inflight = 0;
+	conn->dispatching = 0;
+	conn->flush_wanted = 0;
+	conn->send_error = 0;
+	conn->iovcnt = 0;
+	conn->prev = NULL;
+	conn->next = ring->conns;
+	if (ring->conns != NULL) {
+		ring->conns->prev = conn;
+	}
+	ring->conns = conn;
+	client->uring = conn;
+	return 0;
+}
+
+/** Starts or stops reading a client's input. Characters that were already received when reading stops are still delivered.
+	@param client The client, which must be served through a ring.
+	@param on `1` to start reading; `0` to stop.
+	@return `0` on success; `-1` if reading could not be started.
+ */
+int uring_conn_read(struct irc_client *client, int on)
+{
+	struct uring_conn *conn = client->uring;
+	conn->recv_wanted = (on != 0);
+	if (on && !conn->recv_armed && !conn->ring->quiescing) {
+		return arm_recv(conn);
+	}
+	if (!on) {
+		cancel_recv(conn);
+	}
+	return 0;
+}
+
+/** Releases the references taken by a connection's send.
+	@param conn The connection.
+ */
+static void release_send(struct uring_conn *conn)
+{
+	int i;
+	for (i = 0; i < conn->iovcnt; i++) {
+		msg_buf_release(conn->bufs[i]);
+	}
+	conn->iovcnt = 0;
+}
+
+/** Counterpart of `flush_queue()` for clients served through a ring. Rather than writing the queue, a `sendmsg()` request for
+	it is prepared, and submitted with every other pending request before the loop blocks; when it completes, the characters
+	sent are discarded from the queue, and `client_uring_output()` is called to flush the rest.
+	@param client The client.
+	@param queue The client's write queue.
+	@return `FLUSH_DONE` if the queue is empty and nothing is in flight; `FLUSH_PENDING` if a send is in flight, or
+	   `FLUSH_ERROR` if the last send failed.
+ */
+int uring_flush(struct irc_client *client, struct msg_queue *queue)
+{
+	struct uring_conn *conn = client->uring;
+	struct io_uring_sqe *sqe;
+
+	if (conn->send_error != 0) {
+		errno = -conn->send_error;
+		return FLUSH_ERROR;
+	}
+	if (conn->send_inflight) {
+		return FLUSH_PENDING;
+	}
+	if (conn->ring->quiescing) {
+		/* uring_unquiesce() flushes it */
+		conn->flush_wanted = 1;
+		return FLUSH_PENDING;
+	}
+	if ((conn->iovcnt = client_queue_gather(queue, conn->iov, conn->bufs, URING_SEND_SEGMENTS)) == 0) {
+		return FLUSH_DONE;
+	}
+	if ((sqe = get_sqe(conn->ring)) == NULL) {
+		release_send(conn);
+		return FLUSH_ERROR;
+	}
+	memset(&conn->msg, 0, sizeof(conn->msg));
+	conn->msg.msg_iov = conn->iov;
+	conn->msg.msg_iovlen = (size_t) conn->iovcnt;
+	io_uring_prep_sendmsg(sqe, conn->fd, &conn->msg, MSG_NOSIGNAL);
+	io_uring_sqe_set_data(sqe, &conn->send_op);
+	conn->send_inflight = 1;
+	return FLUSH_PENDING;
+}
+
+/** Detaches a client from his connection, when the client is freed. His multishot recv is cancelled; a send in flight keeps
+	the buffers it references until it completes. The connection is freed once nothing references it.
+	@param client The client. His `uring` field is cleared. Nothing is done if it is `NULL`.
+ */
+void uring_conn_close(struct irc_client *client)
+{
+	struct uring_conn *conn = client->uring;
+	if (conn == NULL) {
+		return;
+	}
+	client->uring = NULL;
+	conn->client = NULL;
+	conn->recv_wanted = 0;
+	cancel_recv(conn);
+	conn_maybe_free(conn);
+}
+
+/** Handles a completion of a multishot recv.
+	@param ring The ring.
+	@param conn The connection.
+	@param res The completion's result: how many characters were received, `0` at the end of the stream, or a negated `errno`.
+	@param flags The completion's flags.
+ */
+static void recv_done(struct uring *ring, struct uring_conn *conn, int res, unsigned flags)
+{
+	unsigned short bid = 0;
+	char *data = NULL;
+
+	if (!(flags & IORING_CQE_F_MORE)) {
+		conn->recv_armed = 0;
+	}
+	if (flags & IORING_CQE_F_BUFFER) {
+		bid = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+		data = ring->space + (size_t) bid * URING_BUFFER_SIZE;
+	}
+	/* Running out of buffers is not the client's fault, and a cancelled recv was asked for */
+	if (conn->client != NULL && res != -ENOBUFS && res != -ECANCELED) {
+		conn->dispatching = 1;
+		client_uring_input(conn->client, data, (ssize_t) res);
+		conn->dispatching = 0;
+	}
+	if (data != NULL) {
+		io_uring_buf_ring_add(ring->bufs, data, URING_BUFFER_SIZE, bid, io_uring_buf_ring_mask(URING_BUFFERS), 0);
+		io_uring_buf_ring_advance(ring->bufs, 1);
+	}
+	if (conn->client != NULL && conn->recv_wanted && !conn->recv_armed && !ring->quiescing &&
+	    (res > 0 || res == -ENOBUFS || res == -ECANCELED) && arm_recv(conn) == -1) {
+		fprintf(stderr, "::uring.c:recv_done(): Could not read from a client anymore.\n");
+	}
+	conn_maybe_free(conn);
+}
+
+/** Handles the completion of a send.
+	@param conn The connection.
+	@param res The completion's result: how many characters were sent, or a negated `errno`. A cancelled send sent nothing,
+	   and that is not an error.
+ */
+static void send_done(struct uring_conn *conn, int res)
+{
+	struct irc_client *client = conn->client;
+
+	conn->send_inflight = 0;
+	release_send(conn);
+	if (client == NULL) {
+		conn_maybe_free(conn);
+		return;
+	}
+	if (res < 0 && res != -ECANCELED) {
+		conn->send_error = res;
+	} else if (res > 0) {
+		stats_bytes_out((size_t) res);
+		TRACE_MSG_FLUSH(client, &client->write_queue, res);
+		client_queue_consume(&client->write_queue, (size_t) res);
+	}
+	conn->dispatching = 1;
+	client_uring_output(client);
+	conn->dispatching = 0;
+	conn_maybe_free(conn);
+}
+
+/** Handles a completion of a multishot accept. The request is queued again if it stopped.
+	@param a The listener.
+	@param res The completion's result: the new socket, or a negated `errno`.
+	@param flags The completion's flags.
+ */
+static void accept_done(struct uring_acceptor *a, int res, unsigned flags)
+{
+	if (!(flags & IORING_CQE_F_MORE)) {
+		a->armed = 0;
+	}
+	if (res >= 0) {
+		stats_accept();
+		a->cb(a->arg, res);
+	} else if (res != -ECONNABORTED && res != -EAGAIN && res != -EINTR) {
+		fprintf(stderr, "::uring.c:accept_done(): Error while accepting new client connection: %s\n", strerror(-res));
+	}
+	if (!a->armed && res != -ECANCELED && !a->ring->quiescing && arm_accept(a) == -1) {
+		fprintf(stderr, "::uring.c:accept_done(): Could not accept new clients anymore.\n");
+	}
+}
+
+/** Callback for a ring's eventfd. Every completion posted is handled.
+	@param w The eventfd's watcher. A pointer to the ring is obtained with `offsetof()`.
+	@param revents Bit flags reported by `libev`.
+ */
+static void cqe_cb(EV_P_ ev_io *w, int revents)
+{
+	struct uring *ring = (struct uring*)((char*)w - offsetof(struct uring, cqe_watcher));
+	eventfd_t count;
+
+	(void)eventfd_read(ring->efd, &count);
+	reap(ring);
+}
+
+/** Handles every completion posted to a ring.
+	@param ring The ring.
+ */
+static void reap(struct uring *ring)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_op *op;
+	unsigned flags;
+	int res;
+
+	while (io_uring_peek_cqe(&ring->ring, &cqe) == 0) {
+		op = (struct uring_op*)io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		flags = cqe->flags;
+		io_uring_cqe_seen(&ring->ring, cqe);
+		if (op == NULL) {
+			continue;
+		}
+		switch (op->type) {
+		case OP_RECV:
+			recv_done(ring, (struct uring_conn*)((char*)op - offsetof(struct uring_conn, recv_op)), res, flags);
+			break;
+		case OP_SEND:
+			send_done((struct uring_conn*)((char*)op - offsetof(struct uring_conn, send_op)), res);
+			break;
+		case OP_ACCEPT:
+			accept_done((struct uring_acceptor*)((char*)op - offsetof(struct uring_acceptor, op)), res, flags);
+			break;
+		}
+	}
+}
+
+/** Prepare watcher callback, called right before the loop blocks. Every request prepared during this loop iteration is
+	submitted with a single system call.
+	@param w The prepare watcher. A pointer to the ring is obtained with `offsetof()`.
+	@param revents Bit flags reported by `libev`.
+ */
+static void submit_cb(EV_P_ ev_prepare *w, int revents)
+{
+	struct uring *ring = (struct uring*)((char*)w - offsetof(struct uring, submit_watcher));
+	int ret;
+	if (io_uring_sq_ready(&ring->ring) > 0 && (ret = io_uring_submit(&ring->ring)) < 0) {
+		fprintf(stderr, "::uring.c:submit_cb(): Could not submit requests: %s\n", strerror(-ret));
+	}
+}
+
+/** Determines if any request of a ring, other than cancellations, did not post its final completion yet.
+	@param ring The ring.
+	@return `1` if there is such a request; `0` otherwise.
+ */
+static int ring_busy(struct uring *ring)
+{
+	struct uring_acceptor *a;
+	struct uring_conn *conn;
+	for (a = ring->acceptors; a != NULL; a = a->next) {
+		if (a->armed) {
+			return 1;
+		}
+	}
+	for (conn = ring->conns; conn != NULL; conn = conn->next) {
+		if (conn->recv_armed || conn->send_inflight) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** Stops a ring before a hot restart hands its sockets over to a new process: every multishot accept, multishot recv and send
+	is cancelled, and this function waits until they all posted their final completions, which are handled as usual. Sends that
+	were cancelled sent nothing, so the client's write queue holds exactly what is still pending. Until `uring_unquiesce()`,
+	nothing is queued again.
+	Must be called by the thread that runs the ring's loop, outside the ring's callbacks.
+	@param ring The ring.
+	@return `0` on success; `-1` if the requests did not complete within `URING_QUIESCE_TIMEOUT` seconds. Either way, the
+	   caller must call `uring_unquiesce()` if it goes on using the ring.
+ */
+int uring_quiesce(struct uring *ring)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	struct uring_acceptor *a;
+	struct uring_conn *conn;
+	int ret;
+
+	ring->quiescing = 1;
+	for (a = ring->acceptors; a != NULL; a = a->next) {
+		if (a->armed) {
+			cancel_op(ring, &a->op);
+		}
+	}
+	for (conn = ring->conns; conn != NULL; conn = conn->next) {
+		cancel_recv(conn);
+		if (conn->send_inflight) {
+			cancel_op(ring, &conn->send_op);
+		}
+	}
+	while (ring_busy(ring)) {
+		ts.tv_sec = URING_QUIESCE_TIMEOUT;
+		ts.tv_nsec = 0;
+		if ((ret = io_uring_submit_and_wait_timeout(&ring->ring, &cqe, 1, &ts, NULL)) < 0) {
+			fprintf(stderr, "::uring.c:uring_quiesce(): Requests did not complete: %s\n", strerror(-ret));
+			return -1;
+		}
+		reap(ring);
+	}
+	return 0;
+}
+
+/** Resumes a ring stopped by `uring_quiesce()`, when the hot restart failed: listeners accept again, connections that want
+	to read are read again, and queues that could not be flushed meanwhile are flushed.
+	Must be called by the thread that runs the ring's loop, outside the ring's callbacks.
+	@param ring The ring.
+ */
+void uring_unquiesce(struct uring *ring)
+{
+	struct uring_acceptor *a;
+	struct uring_conn *conn, *next;
+
+	ring->quiescing = 0;
+	for (a = ring->acceptors; a != NULL; a = a->next) {
+		if (!a->armed && arm_accept(a) == -1) {
+			fprintf(stderr, "::uring.c:uring_unquiesce(): Could not accept new clients anymore.\n");
+		}
+	}
+	for (conn = ring->conns; conn != NULL; conn = next) {
+		next = conn->next;
+		if (conn->client == NULL) {
+			continue;
+		}
+		if (conn->recv_wanted && !conn->recv_armed && arm_recv(conn) == -1) {
+			fprintf(stderr, "::uring.c:uring_unquiesce(): Could not read from a client anymore.\n");
+		}
+		if (conn->flush_wanted) {
+			conn->flush_wanted = 0;
+			conn->dispatching = 1;
+			client_uring_output(conn->client);
+			conn->dispatching = 0;
+			next = conn->next;
+			conn_maybe_free(conn);
+		}
+	}
+}
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ev.h>
+#include "worker.h"
+#include "client.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+#include "uring.h"
+
+/** @file
+	@brief Implementation of the worker threads pool
+
+	The pool is created once, at boot time, by `worker_pool_init()`, and it is never destroyed; see the notes about
+	shutting down in `yaircd.c`.
+	Each worker sleeps inside `ev_run()` until one of its clients' watchers fires, or until another thread posts a task
+	with `worker_post()`. Posting a task appends it to the worker's tasks queue and calls `ev_async_send()` on the
+	worker's `task_watcher`; `run_tasks_cb()` then drains the queue inside the worker's thread.
+	Messages for a worker's clients are handled in a similar way. A channel message fans out to every member, and many members
+	share the same worker, so signalling the worker once per recipient would mean an `eventfd` write, and possibly a wakeup,
+	for each of them. Instead, `worker_wake_client()` appends the recipient to the worker's wakeup list, unless it is already
+	there, and only signals the worker's `wakeup_watcher` when the list goes from empty to non empty. Thus, a message for a whole
+	channel costs at most one signal per destination worker, and so does a burst of messages that arrives before the worker wakes
+	up. `wakeup_cb()` then flushes every client in the list with `client_wakeup()`.
+	Clients that sent more than their read budget allows are kept in a third list, the deferred list: `worker_defer_client()` appends
+	them, and `deferred_cb()` serves each of them once per loop iteration with `client_resume_input()`. libev invokes check watchers
+	right after polling, so the deferred clients are served first, and the clients with new events right after them.
+	@author Filipe Goncalves
+	@date November 2013
+*/
+
+static struct worker *workers; /**<The workers pool. */
+static int workers_no; /**<How many workers exist in `workers`. */
+static int balance_policy; /**<Either `WORKER_BALANCE_ROUND_ROBIN` or `WORKER_BALANCE_LEAST_LOAD`. */
+static unsigned next_worker; /**<Next worker to use when balancing in round-robin. Only touched by the accepting thread. */
+
+static void *worker_main(void *arg);
+static void run_tasks_cb(EV_P_ ev_async *w, int revents);
+static void wakeup_cb(EV_P_ ev_async *w, int revents);
+static void deferred_cb(EV_P_ ev_check *w, int revents);
+static void deferred_idle_cb(EV_P_ ev_idle *w, int revents);
+
+/** Creates and starts the workers pool. This must be called exactly once by the main thread, before any connection is
+	accepted.
+	@param threads How many workers to create. If this is less than or equal to `0`, one worker per online processor is created.
+	@param balance How to pick a worker for a new client: `WORKER_BALANCE_ROUND_ROBIN` or `WORKER_BALANCE_LEAST_LOAD`.
+	@return `0` on success; `-1` if the pool could not be created, typically indicating a resource allocation problem.
+*/
+int worker_pool_init(int threads, int balance)
+{
+	pthread_attr_t attr;
+	long cores;
+	int i;
+
+	if (threads <= 0) {
+		cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cores > 0 ? (int) cores : 1);
+	}
+	if ((workers = calloc((size_t) threads, sizeof(*workers))) == NULL) {
+		fprintf(stderr, "::worker.c:worker_pool_init(): Could not allocate memory for %d workers.\n", threads);
+		return -1;
+	}
+	workers_no = threads;
+	balance_policy = balance;
+	next_worker = 0;
+
+	if (pthread_attr_init(&attr) != 0) {
+		perror("::worker.c:worker_pool_init(): Could not initialize thread attributes");
+		return -1;
+	}
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].id = i;
+		workers[i].clients = 0;
+		workers[i].tasks_head = workers[i].tasks_tail = NULL;
+		workers[i].terminated = NULL;
+		workers[i].wakeup_head = workers[i].wakeup_tail = NULL;
+		workers[i].quit_stamp = 0;
+		workers[i].uring = NULL;
+		workers[i].deferred_head = workers[i].deferred_tail = workers[i].deferred_running = NULL;
+		if ((workers[i].loop = ev_loop_new(0)) == NULL) {
+			fprintf(stderr, "::worker.c:worker_pool_init(): Could not create events loop for worker %d.\n", i);
+			return -1;
+		}
+		if (pthread_mutex_init(&workers[i].tasks_mutex, NULL) != 0) {
+			fprintf(stderr, "::worker.c:worker_pool_init(): Could not initialize tasks mutex for worker %d.\n", i);
+			return -1;
+		}
+		timer_wheel_init(&workers[i].timers, workers[i].loop);
+		if (pthread_mutex_init(&workers[i].wakeup_mutex, NULL) != 0) {
+			fprintf(stderr, "::worker.c:worker_pool_init(): Could not initialize wakeup mutex for worker %d.\n", i);
+			return -1;
+		}
+		ev_async_init(&workers[i].task_watcher, run_tasks_cb);
+		ev_async_start(workers[i].loop, &workers[i].task_watcher);
+		ev_async_init(&workers[i].wakeup_watcher, wakeup_cb);
+		ev_async_start(workers[i].loop, &workers[i].wakeup_watcher);
+		ev_check_init(&workers[i].deferred_check, deferred_cb);
+		ev_idle_init(&workers[i].deferred_idle, deferred_idle_cb);
+		if (pthread_create(&workers[i].thread, &attr, worker_main, (void *) &workers[i]) != 0) {
+			perror("::worker.c:worker_pool_init(): Could not create worker thread");
+			return -1;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+/** A worker thread's starting point. It creates the thread's memory pools, statistics counters and, when built with io_uring
+	support, the worker's ring, and runs the worker's loop forever.
+	@param arg Pointer to the `struct worker` that this thread runs.
+	@return This function never returns.
+*/
+static void *worker_main(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	if (pool_thread_init() == -1) {
+		fprintf(stderr, "::worker.c:worker_main(): Not enough memory for this worker's pools, using malloc() instead.\n");
+	}
+	if (stats_thread_init() == -1) {
+		fprintf(stderr, "::worker.c:worker_main(): Not enough memory for this worker's statistics, using shared counters.\n");
+	}
+#ifdef YAIRCD_URING
+	w->uring = uring_create(w->loop);
+#endif
+	ev_run(w->loop, 0);
+	return NULL;
+}
+
+/** Posts a task to a worker. The task is executed later, inside the worker's thread. Tasks posted to the same worker are executed
+	in the order they were posted.
+	This function is thread safe and can be called from any thread, including the worker's own thread.
+	@param w The worker that shall execute the task.
+	@param run Function to execute. It will be called with `w` and `arg`.
+	@param arg Arbitrary argument for `run`.
+	@return `0` on success; `-1` if there is not enough memory to post the task, in which case `run` is never called.
+*/
+int worker_post(struct worker *w, void (*run)(struct worker *, void *), void *arg)
+{
+	struct worker_task *task;
+
+	if ((task = malloc(sizeof(*task))) == NULL) {
+		return -1;
+	}
+	task->run = run;
+	task->arg = arg;
+	task->next = NULL;
+
+	pthread_mutex_lock(&w->tasks_mutex);
+	if (w->tasks_tail == NULL) {
+		w->tasks_head = task;
+	} else {
+		w->tasks_tail->next = task;
+	}
+	w->tasks_tail = task;
+	pthread_mutex_unlock(&w->tasks_mutex);
+
+	ev_async_send(w->loop, &w->task_watcher);
+	return 0;
+}
+
+/** Callback for a worker's task watcher. Detaches every pending task from the queue and runs them, in order.
+	The queue lock is not held while the tasks run, so that tasks can safely post new tasks.
+	@param w Pointer to the worker's `task_watcher`. The worker is obtained with `offsetof()`.
+	@param revents libev's flags. Not used for async callbacks.
+*/
+static void run_tasks_cb(EV_P_ ev_async *w, int revents)
+{
+	struct worker *worker;
+	struct worker_task *task;
+	struct worker_task *next;
+
+	worker = (struct worker *) ((char *) w - offsetof(struct worker, task_watcher));
+
+	pthread_mutex_lock(&worker->tasks_mutex);
+	task = worker->tasks_head;
+	worker->tasks_head = worker->tasks_tail = NULL;
+	pthread_mutex_unlock(&worker->tasks_mutex);
+
+	for (; task != NULL; task = next) {
+		next = task->next;
+		task->run(worker, task->arg);
+		free(task);
+	}
+}
+
+/** Tells a client's worker that there is new data in the client's queue. The client is appended to the worker's wakeup list,
+	unless it is already there, and the worker is only signalled if the list was empty. If the caller is the client's own worker,
+	the wakeup is fed directly into its loop, without any system call.
+	This function is thread safe, and it is safe to call it while holding locks.
+	@param client The client that has new data queued.
+*/
+void worker_wake_client(struct irc_client *client)
+{
+	struct worker *w = client->worker;
+	int signal = 0;
+
+	pthread_mutex_lock(&w->wakeup_mutex);
+	if (!client->wakeup_pending) {
+		client->wakeup_pending = 1;
+		client->wakeup_next = NULL;
+		if (w->wakeup_tail == NULL) {
+			w->wakeup_head = client;
+			signal = 1;
+		} else {
+			w->wakeup_tail->wakeup_next = client;
+		}
+		w->wakeup_tail = client;
+	}
+	pthread_mutex_unlock(&w->wakeup_mutex);
+
+	TRACE_CLIENT_WAKE(client, signal);
+	if (signal) {
+		if (pthread_equal(pthread_self(), w->thread)) {
+			ev_feed_event(w->loop, &w->wakeup_watcher, EV_ASYNC);
+		} else {
+			ev_async_send(w->loop, &w->wakeup_watcher);
+		}
+	}
+}
+
+/** Removes a client from its worker's wakeup list. This must be called by the client's worker before the client is freed.
+	@param client The client.
+*/
+void worker_cancel_wakeup(struct irc_client *client)
+{
+	struct worker *w = client->worker;
+	struct irc_client **p;
+	struct irc_client *prev = NULL;
+
+	pthread_mutex_lock(&w->wakeup_mutex);
+	if (client->wakeup_pending) {
+		for (p = &w->wakeup_head; *p != client; prev = *p, p = &(*p)->wakeup_next)
+			; /* Intentionally left blank */
+		*p = client->wakeup_next;
+		if (w->wakeup_tail == client) {
+			w->wakeup_tail = prev;
+		}
+		client->wakeup_pending = 0;
+	}
+	pthread_mutex_unlock(&w->wakeup_mutex);
+}
+
+/** Callback for a worker's wakeup watcher. Takes clients out of the wakeup list, in order, and flushes their queues with
+	`client_wakeup()`, until the list is empty. Clients are taken out one at a time, and the lock is not held while they are flushed,
+	so that other threads keep queueing in the meantime, and so that a client can be destroyed while it is flushed.
+	A client that gets new data after it was taken out of the list is appended to it again.
+	@param w Pointer to the worker's `wakeup_watcher`. The worker is obtained with `offsetof()`.
+	@param revents libev's flags. Not used for async callbacks.
+*/
+static void wakeup_cb(EV_P_ ev_async *w, int revents)
+{
+	struct worker *worker;
+	struct irc_client *client;
+
+	worker = (struct worker *) ((char *) w - offsetof(struct worker, wakeup_watcher));
+	for (;;) {
+		pthread_mutex_lock(&worker->wakeup_mutex);
+		if ((client = worker->wakeup_head) != NULL) {
+			if ((worker->wakeup_head = client->wakeup_next) == NULL) {
+				worker->wakeup_tail = NULL;
+			}
+			client->wakeup_pending = 0;
+		}
+		pthread_mutex_unlock(&worker->wakeup_mutex);
+		if (client == NULL) {
+			break;
+		}
+		client_wakeup(client);
+	}
+}
+
+/** Tells a client's worker to process the rest of the client's input in the next loop iteration, once every other event that is
+	pending was handled, with `client_resume_input()`. This is how a client that sends more than his read budget allows is kept from
+	monopolizing the worker. The client is appended to the worker's deferred list, unless it is already there.
+	Must be called by the client's worker.
+	@param client The client.
+*/
+void worker_defer_client(struct irc_client *client)
+{
+	struct worker *w = client->worker;
+
+	if (client->deferred_pending) {
+		return;
+	}
+	client->deferred_pending = 1;
+	client->deferred_next = NULL;
+	if (w->deferred_tail == NULL) {
+		w->deferred_head = client;
+		ev_check_start(w->loop, &w->deferred_check);
+		ev_idle_start(w->loop, &w->deferred_idle);
+	} else {
+		w->deferred_tail->deferred_next = client;
+	}
+	w->deferred_tail = client;
+}
+
+/** Removes a client from its worker's deferred list. This must be called by the client's worker before the client is freed.
+	@param client The client.
+*/
+void worker_cancel_defer(struct irc_client *client)
+{
+	struct worker *w = client->worker;
+	struct irc_client **p;
+	struct irc_client *prev = NULL;
+
+	if (!client->deferred_pending) {
+		return;
+	}
+	for (p = &w->deferred_running; *p != NULL && *p != client; p = &(*p)->deferred_next)
+		; /* Intentionally left blank */
+	if (*p == NULL) {
+		for (p = &w->deferred_head; *p != client; prev = *p, p = &(*p)->deferred_next)
+			; /* Intentionally left blank */
+		if (w->deferred_tail == client) {
+			w->deferred_tail = prev;
+		}
+	}
+	*p = client->deferred_next;
+	client->deferred_pending = 0;
+}
+
+/** Callback for a worker's deferred check watcher, which runs after every poll while there are deferred clients. Every client in the
+	deferred list is served once, in order, with `client_resume_input()`; clients deferred again in the meantime wait for the next loop
+	iteration. libev invokes check watchers before the other watchers that the same poll made pending, so the clients with new events
+	are served after the deferred ones, and before any of them is served again. Once the list is empty, the watchers are stopped.
+	@param w Pointer to the worker's `deferred_check`. The worker is obtained with `offsetof()`.
+	@param revents libev's flags.
+*/
+static void deferred_cb(EV_P_ ev_check *w, int revents)
+{
+	struct worker *worker;
+	struct irc_client *client;
+
+	worker = (struct worker *) ((char *) w - offsetof(struct worker, deferred_check));
+	worker->deferred_running = worker->deferred_head;
+	worker->deferred_head = worker->deferred_tail = NULL;
+	while ((client = worker->deferred_running) != NULL) {
+		worker->deferred_running = client->deferred_next;
+		client->deferred_pending = 0;
+		client_resume_input(client);
+	}
+	if (worker->deferred_head == NULL) {
+		ev_check_stop(worker->loop, &worker->deferred_check);
+		ev_idle_stop(worker->loop, &worker->deferred_idle);
+	}
+}
+
+/** Callback for a worker's deferred idle watcher. It does nothing: the watcher only keeps the loop from blocking, so that
+	`deferred_cb()` runs in the next loop iteration even if there are no other events.
+	@param w The watcher.
+	@param revents libev's flags.
+*/
+static void deferred_idle_cb(EV_P_ ev_idle *w, int revents)
+{
+}
+
+/** Picks the worker that shall own a new client, according to the configured balancing policy.
+	@return The chosen worker.
+*/
+static struct worker *pick_worker(void)
+{
+	int i;
+	int best;
+
+	if (balance_policy == WORKER_BALANCE_LEAST_LOAD) {
+		best = 0;
+		for (i = 1; i < workers_no; i++) {
+			if (workers[i].clients < workers[best].clients) {
+				best = i;
+			}
+		}
+		return &workers[best];
+	}
+	return &workers[next_worker++ % workers_no];
+}
+
+/** Hands a new client over to a worker. The worker is chosen according to the balancing policy, its load is incremented, and `run`
+	is posted to it. `run` is expected to set up the client inside the worker; when the client leaves, `worker_release_client()`
+	must be called to decrement the worker's load.
+	This function is meant to be called only by the accepting thread.
+	@param run The task that sets up the new client.
+	@param arg Argument for `run`, typically the new client's `struct irc_client_args_wrapper`.
+	@return `0` on success; `-1` if the task could not be posted.
+*/
+int worker_dispatch(void (*run)(struct worker *, void *), void *arg)
+{
+	struct worker *w = pick_worker();
+
+	__sync_fetch_and_add(&w->clients, 1);
+	if (worker_post(w, run, arg) == -1) {
+		__sync_fetch_and_sub(&w->clients, 1);
+		return -1;
+	}
+	return 0;
+}
+
+/** Accounts for a client that a worker accepted by itself, on one of its own listening sockets, rather than receiving it from
+	`worker_dispatch()`. The worker's load is incremented; as with dispatched clients, `worker_release_client()` must be called
+	when the client leaves.
+	@param w The worker that accepted the client.
+*/
+void worker_adopt_client(struct worker *w)
+{
+	__sync_fetch_and_add(&w->clients, 1);
+}
+
+/** Decrements a worker's load. Called once for each client that was handed to `w` with `worker_dispatch()` or `worker_adopt_client()`, when the client leaves.
+	@param w The worker that owned the client.
+*/
+void worker_release_client(struct worker *w)
+{
+	__sync_fetch_and_sub(&w->clients, 1);
+}
+
+/** Reads how many workers exist in the pool.
+	@return Number of workers.
+*/
+int worker_pool_size(void)
+{
+	return workers_no;
+}
+
+/** Gives access to a worker in the pool.
+	@param i Which worker. Must be greater than or equal to `0` and less than `worker_pool_size()`.
+	@return Pointer to worker `i`.
+*/
+struct worker *worker_get(int i)
+{
+	return &workers[i];
+}
@@ -1,3 +1,5 @@
+/* accept4() */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -6,6 +8,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <strings.h>
 #include <ev.h>
@@ -18,6 +21,15 @@
 #include "channel.h"
 #include "serverinfo.h"
 #include "interpretmsg.h"
+#include "worker.h"
+#include "resolver.h"
+#include "burst.h"
+#include "cloak.h"
+#include "pool.h"
+#include "stats.h"
+#include "link.h"
+#include "upgrade.h"
+#include "uring.h"
 
 /**
    @file
@@ -25,19 +37,23 @@
 
    Where it all begins. The functions in this file are responsible for booting the IRCd.
    A daemon process is created. This process will be awaken by `libev`'s callback mechanism when a newconnection request
-      arrives. When that happens, a new thread is created to deal with our fortunate new client,and the main process
+      arrives. When that happens, our fortunate new client is handed over to one of the workers, and the main process
       goes back to rest until another client pops in and the whole cycle repeats.
-   The basic architecture is a client-server model where each client is represented by a dedicated thread that monitors
-      the client's socket.
-   The parent thread listens on the main socket for new incoming connections. When one arrives, it creates a separate
-      thread to deal with that new clientduring his session, and goes back to listening for new clients. We use detached
-      threads, because no calls to `pthread_join()` are used. This makes it slightly easierand more efficient for the
-      operating system to deal with, since no state information must be stored about dead threads. This is often the
-      case for server daemons.
+   The basic architecture is a client-server model where a fixed pool of worker threads serves every client. Each
+      worker runs its own events loop and owns many clients; every callback for a given client always runs in the
+      worker that owns it. See `worker.h`.
+   The parent thread listens on the main socket for new incoming connections. When one arrives, it picks a worker,
+      either in turn (round-robin) or the one serving the fewest clients (least-load), as configured in the `workers`
+      block of the configuration file, and goes back to listening for new clients. Workers are detached threads, because
+      no calls to `pthread_join()` are used. This makes it slightly easierand more efficient for the operating system to
+      deal with, since no state information must be stored about dead threads. This is often the case for server
+      daemons.
+   Optionally, the main thread can stay out of the way entirely: with `reuseport` set in the `workers` block, every worker
+      owns its own listening sockets, bound to the same ports with `SO_REUSEPORT`, and accepts its own clients.
    There are a couple of details worth mentioning about the whole IRCd. First of all, it relies heavily on libev. libev
       is a high performanceevent loop library. Only when there is actually something interesting to process (a new
       command arrived, a message must be sent, etc.), will the corresponding threadbe awaken. When there's nothing to
-      do, libev makes sure that threads are not given any CPU time. Using threads in this way shall scale well. It is
+      do, libev makes sure that threads are not given any CPU time. Using a few threads in this way shall scale well. It is
       very important to learnand read about libev. The general idea is that libev works by using event loops. An event
       loop, as the name says, is a loop that triggers something when an event occurs.
    The loop is not really running, it is a virtual loop that seems to be blocking. When an interesting event occurs, a
@@ -45,9 +61,9 @@
    Events are defined using watchers. There are various types of watchers. One of them is the IO watcher, which allows
       you to get notified when a file stream is readable. You don't have toblock on a read operation, because you will
       only be notified that there is something to read when there really is something to read. Thus, `read()` never
-      blocks.yaIRCd creates an event loop for each new client connection. In other words, each thread has its own events
-      loop, and each thread registers an IO watcher for the client's socket. As a consequence,each client's thread is
-      sleeping most of the time, and it is awaken when new messages are available to read on the socket.
+      blocks.yaIRCd creates an event loop for each worker. In other words, each worker thread has its own events loop,
+      and it registers an IO watcher for each of its clients' sockets. As a consequence,each worker is sleeping most of
+      the time, and it is awaken when new messages are available to read on one of its clients' sockets.
    A similar process happens when we need to write to a client's socket.
    Some questions that bugged the development team when adopting the library will probably be your questions as well.
       These include:
@@ -93,27 +109,60 @@
    @todo See how to daemonize properly. Read http://www-theorie.physik.unizh.ch/~dpotter/howto/daemonize
  */
 
-/** Flag for `accept_connection()` to indicate an IPv6 socket */
+/** Listener flag to indicate an IPv6 socket */
 #define IPv6_SOCK 0x1
 
-/** Flag for `accept_connection()` to indicate an SSL socket */
+/** Listener flag to indicate an SSL socket */
 #define SSL_SOCK 0x2
 
-static int mainsock_fd; /**<Main socket file descriptor, where new insecure connection request arrive */
-static int sslsock_fd; /**<SSL socket file descriptor, where new secure connection request arrive */
+/** How many SSL sessions are kept in the server's session cache, so that reconnecting clients can resume their previous session
+   and skip the full handshake. */
+#define SSL_SESSION_CACHE_SIZE 20480
+
+/** For how many seconds a cached SSL session can be resumed */
+#define SSL_SESSION_TIMEOUT 3600
+
+/** Session ID context for the server's session cache. Sessions are only resumed in the context that created them. */
+#define SSL_SESSION_ID_CONTEXT "yaircd"
+
+/** How many connections are accepted, at most, each time a listening socket becomes readable. Draining the backlog in batches
+   keeps it from overflowing during reconnect storms, while still letting the loop serve other events in between. */
+#define ACCEPT_BATCH 64
+
+/** A listening socket and the watcher that accepts new connections on it */
+struct listener {
+	struct ev_io watcher; /**<IO watcher for the listening socket. */
+	int fd; /**<The listening socket, or `-1` if it could not be opened. */
+	int flags; /**<Either `0` or `SSL_SOCK`. */
+	struct worker *worker; /**<The worker that owns this listener and every client accepted on it, or `NULL` if this listener
+	                          belongs to the main loop, in which case clients are handed to workers with `worker_dispatch()`. */
+};
+
+static int mainsock_fd; /**<Main socket file descriptor, where new insecure connection request arrive. With per-worker
+                           listeners, this is the first worker's socket. */
+static int sslsock_fd; /**<SSL socket file descriptor, where new secure connection request arrive. With per-worker
+                          listeners, this is the first worker's socket. `-1` if the secure socket could not be opened. */
+static struct listener *listeners; /**<Every listener, two per acceptor: the standard one, followed by the secure one. */
+static int listeners_count; /**<How many positions `listeners` has. */
 static struct sockaddr_in serv_addr; /**<This node's address, namely, the IP and port where we will be listening for new
                                         standard connections. */
 static struct sockaddr_in ssl_addr; /**<This node's address, namely, the IP and port where we will be listening for new
                                        secure connections. */
-static pthread_attr_t thread_attr; /**<Threads creation attributes. We use detached threads, since we're not interested
-                                      in calling `pthread_join()`. */
-
 static const SSL_METHOD *ssl_method; /**<Openssl's structure holding information about the specific SSL protocol used.
                                         This code uses SSLv23 method. */
 static SSL_CTX *ssl_context; /**<The SSL context for the main ssl socket, as required by the OpenSSL library. */
 
-static void connection_cb(EV_P_ ev_io *w, int revents);
-static void ssl_connection_cb(EV_P_ ev_io *w, int revents);
+static struct ev_signal rehash_watcher; /**<Watcher for `SIGHUP`, which makes the IRCd reload its MOTD. */
+#ifdef YAIRCD_URING
+static struct uring *main_ring; /**<The main loop's io_uring instance, which accepts on the listeners it owns. `NULL` if io_uring
+                                   is not available. */
+#endif
+static struct ev_signal upgrade_watcher; /**<Watcher for `SIGUSR2`, which makes the IRCd restart without dropping clients. */
+
+static void listener_cb(EV_P_ ev_io *w, int revents);
+#ifdef YAIRCD_URING
+static void uring_accepted(void *arg, int sock);
+#endif
 
 /**
    This is where everything with SSL is initialized
@@ -167,6 +216,22 @@ int initSSL(void)
 		perror("::yaircd.c:main(): Server certificate and private-key don't match");
 		return 1;
 	}
+
+	/* Client sockets are non-blocking. Let SSL_write() report partial writes, and allow retrying a write
+	   from a different address, since output buffers are drained block by block (see write_msgs_queue.c)
+	 */
+	SSL_CTX_set_mode(ssl_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	/* Let reconnecting clients resume their sessions, either from the server side cache or with a session ticket
+	   (tickets are enabled by default), instead of going through the full handshake again */
+	if (!SSL_CTX_set_session_id_context(ssl_context, (const unsigned char*)SSL_SESSION_ID_CONTEXT,
+					    sizeof(SSL_SESSION_ID_CONTEXT) - 1)) {
+		fprintf(stderr, "::yaircd.c:initSSL(): Could not set the SSL session ID context.\n");
+		return 1;
+	}
+	SSL_CTX_set_session_cache_mode(ssl_context, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ssl_context, SSL_SESSION_CACHE_SIZE);
+	SSL_CTX_set_timeout(ssl_context, SSL_SESSION_TIMEOUT);
 	return 0;
 }
 
@@ -176,15 +241,23 @@ int initSSL(void)
 void shutSSL(void)
 {
 	/* Terminate communication on a socket */
-	close(sslsock_fd);
+	if (sslsock_fd != -1) {
+		close(sslsock_fd);
+	}
 	/* Free the SSL_CTX structure */
 	SSL_CTX_free(ssl_context);
 }
 
-/** Initializes the server's data structures. As of this writing, these include the clients list, channels list, and commands list. The clients list is managed by client_list.c, the channels list by channel.c, and the commands list by interpretmsg.c.
+/** Initializes the server's data structures. As of this writing, these include the memory pools' size classes, the clients list, channels list, and commands list. The pools are managed by pool.c, the clients list by client_list.c, the channels list by channel.c, and the commands list by interpretmsg.c.
 @return `0` on success; `-1` if an error occurred, typically indicating a resource allocation problem.
 */
 int init_data_structures(void) {
+	if (pool_init() == -1 || pool_add_class(sizeof(struct irc_client)) == -1 ||
+	    pool_add_class(sizeof(struct msg_buf) + WRITE_BLOCK_SIZE) == -1) {
+		fprintf(stderr, "::yaircd.c:init_data_structures(): Unable to set up the memory pools.\n");
+		return -1;
+	}
+
 	if (client_list_init() == -1) {
 		fprintf(stderr, "::yaircd.c:init_data_structures(): Unable to initialize clients list.\n");
 		return -1;
@@ -199,25 +272,204 @@ int init_data_structures(void) {
 		fprintf(stderr, "::yaircd.c:init_data_structures(): Unable to initialize server commands list.\n");
 		return -1;
 	}
+
+	if (link_init() == -1) {
+		fprintf(stderr, "::yaircd.c:init_data_structures(): Unable to initialize server links.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/** Creates a listening socket, or takes the one handed over by the process this one replaced, see `upgrade_listener()`.
+   @param addr Address and port to bind to.
+   @param backlog How many connections can be waiting to be accepted.
+   @param reuseport Whether to set `SO_REUSEPORT`, so that other sockets, one per worker, can be bound to the same address.
+   @param what Name of the socket for error messages.
+   @return The new non-blocking socket; `-1` on error, in which case an appropriate error message is printed.
+ */
+static int open_listener(struct sockaddr_in *addr, int backlog, int reuseport, const char *what)
+{
+	const int yes = 1; /* for setsockopt() */
+	int fd;
+
+	if ((fd = upgrade_listener(addr)) != -1) {
+		/* The backlog may have changed in the configuration file */
+		(void)listen(fd, backlog);
+		return fd;
+	}
+	if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		fprintf(stderr, "::yaircd.c:open_listener(): Could not create %s socket.\n", what);
+		perror("Error summary");
+		return -1;
+	}
+	/* Set SO_REUSEADDR. To learn why, see (read the WHOLE answers!):
+	        - http://stackoverflow.com/questions/3229860/what-is-the-meaning-of-so-reuseaddr-setsockopt-option-linux
+	        -
+	           http://stackoverflow.com/questions/14388706/socket-options-so-reuseaddr-and-so-reuseport-how-do-they-differ-do-they-mean-t
+	 */
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
+		fprintf(stderr, "::yaircd.c:open_listener(): Could not set SO_REUSEADDR in %s socket.\n", what);
+		perror("Error summary");
+		close(fd);
+		return -1;
+	}
+	if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+		fprintf(stderr, "::yaircd.c:open_listener(): Could not set SO_REUSEPORT in %s socket.\n", what);
+		perror("Error summary");
+		close(fd);
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+		fprintf(
+			stderr,
+			"::yaircd.c:open_listener(): Could not bind on %s socket with port %d. Please make sure this port is free, and that the IP you're binding to is valid.\n",
+			what, ntohs(addr->sin_port));
+		perror("Error summary");
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, backlog) == -1) {
+		fprintf(stderr, "::yaircd.c:open_listener(): Could not listen on %s socket.\n", what);
+		perror("Error summary");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Worker task that starts a per-worker listener. Watchers must be started by the thread running the loop.
+   @param w The worker that owns the listener.
+   @param arg The listener.
+ */
+static void start_listener(struct worker *w, void *arg)
+{
+	struct listener *l = (struct listener*)arg;
+#ifdef YAIRCD_URING
+	if (w->uring != NULL && uring_accept(w->uring, l->fd, uring_accepted, l) == 0) {
+		return;
+	}
+#endif
+	ev_io_start(w->loop, &l->watcher);
+}
+
+/** Opens the listening sockets and starts accepting connections.
+   By default, the main loop owns a standard and a secure listener and hands every new client to a worker. When `reuseport`
+      is set in the `workers` block, each worker owns a standard and a secure listener instead, all of them bound to the same
+      ports with `SO_REUSEPORT`; the kernel spreads new connections across them, and each worker accepts its own clients.
+   The workers pool must have been started.
+   @param loop The main loop.
+   @return `0` on success; `-1` if the standard socket could not be opened. Failing to open the secure socket is reported, but is
+      not fatal.
+ */
+static int start_listeners(struct ev_loop *loop)
+{
+	int reuseport = get_worker_reuseport();
+	int acceptors = (reuseport ? worker_pool_size() : 1);
+	int fd;
+	int i;
+
+	if ((listeners = calloc((size_t) acceptors * 2, sizeof(*listeners))) == NULL) {
+		fprintf(stderr, "::yaircd.c:start_listeners(): Could not allocate memory for listeners.\n");
+		return -1;
+	}
+	listeners_count = acceptors * 2;
+#ifdef YAIRCD_URING
+	if (!reuseport) {
+		main_ring = uring_create(loop);
+	}
+#endif
+	sslsock_fd = -1;
+	for (i = 0; i < acceptors * 2; i++) {
+		listeners[i].fd = -1;
+		if (i % 2 == 0) {
+			if ((fd = open_listener(&serv_addr, get_std_socket_hangup(), reuseport, "main")) == -1) {
+				return -1;
+			}
+		} else if ((fd = open_listener(&ssl_addr, get_ssl_socket_hangup(), reuseport, "ssl")) == -1) {
+			continue;
+		}
+		if (i == 0) {
+			mainsock_fd = fd;
+		} else if (i == 1) {
+			sslsock_fd = fd;
+		}
+		listeners[i].fd = fd;
+		listeners[i].flags = (i % 2 == 0 ? 0 : SSL_SOCK);
+		listeners[i].worker = (reuseport ? worker_get(i / 2) : NULL);
+		ev_io_init(&listeners[i].watcher, listener_cb, fd, EV_READ);
+		if (listeners[i].worker == NULL) {
+#ifdef YAIRCD_URING
+			if (main_ring != NULL && uring_accept(main_ring, fd, uring_accepted, &listeners[i]) == 0) {
+				continue;
+			}
+#endif
+			ev_io_start(loop, &listeners[i].watcher);
+		} else if (worker_post(listeners[i].worker, start_listener, &listeners[i]) == -1) {
+			fprintf(stderr, "::yaircd.c:start_listeners(): Could not start a listener in worker %d.\n", i / 2);
+			return -1;
+		}
+	}
 	return 0;
 }
 
+/** Callback function that is called by the main loop when the IRCd receives `SIGHUP`. The MOTD file is read again, and the
+   registration burst is rendered with it, see `burst_rehash()`.
+   @param w The signal watcher.
+   @param revents Bit flags reported by `libev`.
+ */
+static void rehash_cb(EV_P_ ev_signal *w, int revents)
+{
+	fprintf(stderr, "::yaircd.c:rehash_cb(): Got SIGHUP, reloading the MOTD.\n");
+	(void)burst_rehash();
+}
+
+/** Callback function that is called by the main loop when the IRCd receives `SIGUSR2`. The executable is run again, and
+   the new process takes over the listening sockets and the plaintext clients, see `upgrade_start()`. If that fails, this
+   process goes on.
+   If the main loop accepts through io_uring, its ring is quiesced first, so that new connections wait in the backlog for the
+   new process instead of being accepted by this one; see `uring_quiesce()`.
+   @param w The signal watcher.
+   @param revents Bit flags reported by `libev`.
+ */
+static void upgrade_cb(EV_P_ ev_signal *w, int revents)
+{
+	int fds[listeners_count];
+	int i;
+
+	fprintf(stderr, "::yaircd.c:upgrade_cb(): Got SIGUSR2, restarting.\n");
+	for (i = 0; i < listeners_count; i++) {
+		fds[i] = listeners[i].fd;
+	}
+#ifdef YAIRCD_URING
+	if (main_ring != NULL && uring_quiesce(main_ring) == -1) {
+		fprintf(stderr, "::yaircd.c:upgrade_cb(): Could not stop accepting through io_uring, not restarting.\n");
+		uring_unquiesce(main_ring);
+		return;
+	}
+#endif
+	(void)upgrade_start(fds, listeners_count);
+#ifdef YAIRCD_URING
+	if (main_ring != NULL) {
+		uring_unquiesce(main_ring);
+	}
+#endif
+}
+
 /** The core. This function sets it all up. 
 The first step is to load the server information. This information is read from the configuration file and stored in a way that is accessible through the functions defined in serverinfo.h
-Then, SIGPIPE is disabled, to prevent any misbehaved client's connection from bringing our server down. It creates the main socket, assigning it to `mainsock_fd`, as well as the secure socket (`sslsock_fd`), and fills `serv_addr` with the necessary fields. Both sockets are created with the option `SO_REUSEADDR`
-The threads attributes variable, `thread_attr` is initialized with `PTHREAD_CREATE_DETACHED`, since we won't be joining any thread. The main socket is not polled for new clients; instead, `libev` is used with a watcher that calls `connection_cb` when a new connection request arrives. Default events loop is used.
-The server's data structures, such as clients list, channels list, commands list, etc, are all initialized before the socket starts accepting new connections.
+Then, SIGPIPE is disabled, to prevent any misbehaved client's connection from bringing our server down. It fills `serv_addr` and `ssl_addr` with the necessary fields.
+The server's data structures, such as clients list, channels list, commands list, etc, as well as the workers pool, are all initialized before the sockets start accepting new connections.
+If this process was started by a hot restart, it takes over the clients and listening sockets of the process it replaces, see `upgrade.h`.
+`SIGHUP` is watched by the main loop, and reloads the MOTD; `SIGUSR2` triggers a hot restart.
+Finally, the listening sockets are opened by `start_listeners()`. Sockets are not polled for new clients; instead, `libev` is used with a watcher that calls `listener_cb()` when new connection requests arrive. Both sockets are created with the option `SO_REUSEADDR`.
 @return `1` on error; `0` otherwise
 @todo Think about IRCd logging features
  */
 int ircd_boot(void)
 {
-	const int reuse_addr_yes = 1; /* for setsockopt() later */
 	struct sigaction act;
 	/* Libev suff */
 	struct ev_loop *loop;
-	struct ev_io socket_watcher;
-	struct ev_io socket_ssl_watcher;
 
 	if (loadServerInfo() != 0) {
 		perror("::yaircd.c:ircd_boot(): Server unable to load configuration file info.");
@@ -236,18 +488,6 @@ int ircd_boot(void)
 		fprintf(stderr, "::yaircd.c:ircd_boot(): Server unable to support SSL connections.\n");
 	}
 
-	mainsock_fd = socket(AF_INET, SOCK_STREAM, 0);
-	sslsock_fd = socket(AF_INET, SOCK_STREAM, 0);
-
-	if (mainsock_fd < 0) {
-		perror("::yaircd.c:ircd_boot(): Could not create main socket.");
-		return 1;
-	}
-	if (sslsock_fd < 0) {
-		perror("::yaircd.c:ircd_boot(): Could not create ssl socket.");
-		return 1;
-	}
-
 	memset(&serv_addr, 0, sizeof(serv_addr));
 	serv_addr.sin_family = AF_INET;
 	if ((serv_addr.sin_addr.s_addr = inet_addr(get_std_socket_ip())) == -1) {
@@ -265,65 +505,48 @@ int ircd_boot(void)
 	}
 	ssl_addr.sin_port = htons(get_ssl_socket_port());
 
-	/* Set SO_REUSEADDR. To learn why, see (read the WHOLE answers!):
-	        - http://stackoverflow.com/questions/3229860/what-is-the-meaning-of-so-reuseaddr-setsockopt-option-linux
-	        -
-	           http://stackoverflow.com/questions/14388706/socket-options-so-reuseaddr-and-so-reuseport-how-do-they-differ-do-they-mean-t
-	 */
-	if (setsockopt(mainsock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr_yes, sizeof(int)) == -1) {
-		perror("::yaircd.c:main(): Could not set SO_REUSEADDR in main socket.\nError summary");
+	/* Initialize data structures */
+	stats_init();
+	if (init_data_structures() == -1) {
 		return 1;
 	}
-	if (setsockopt(sslsock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr_yes, sizeof(int)) == -1) {
-		perror("::yaircd.c:main(): Could not set SO_REUSEADDR in ssl socket.\nError summary");
-	}
-	if (bind(mainsock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-		fprintf(
-			stderr,
-			"::yaircd.c:main(): Could not bind on socket with port %d. Please make sure this port is free, and that the IP you're binding to is valid.\n",
-			get_std_socket_port());
-		perror("Error summary");
-		close(mainsock_fd);
+	/* Render the welcome messages and the MOTD that every new client gets */
+	if (burst_init() == -1) {
 		return 1;
 	}
-	if (bind(sslsock_fd, (struct sockaddr*)&ssl_addr, sizeof(ssl_addr)) < 0) {
-		fprintf(
-			stderr,
-			"::yaircd.c:main(): Could not bind on ssl socket with port %d. Please make sure this port is free, and that the IP you're binding to is valid.\n",
-			get_ssl_socket_port());
-		perror("Error summary");
-		close(sslsock_fd);
-	}
-	if (listen(mainsock_fd, get_std_socket_hangup()) == -1) {
-		perror("::yaircd.c:main(): Could not listen on main socket");
-		close(mainsock_fd);
+	/* Set up the cloaked hosts cache and keys */
+	cloak_init();
+
+	/* Start the workers */
+	if (worker_pool_init(get_worker_threads(), get_worker_balance()) == -1) {
+		fprintf(stderr, "::yaircd.c:ircd_boot(): Unable to start the workers pool.\n");
 		return 1;
 	}
-	if (listen(sslsock_fd, get_ssl_socket_hangup()) == -1) {
-		perror("::yaircd.c:main(): Could not listen on ssl socket");
-		close(sslsock_fd);
-	}
-
-	/* Initialize data structures */
-	if (init_data_structures() == -1) {
+	/* Start the reverse DNS resolvers */
+	if (resolver_init(get_dns_threads(), get_dns_cache_ttl(), get_dns_negative_ttl()) == -1) {
+		fprintf(stderr, "::yaircd.c:ircd_boot(): Unable to start the DNS resolvers.\n");
 		return 1;
 	}
-
-	/* Initialize thread creation attributes */
-	if (pthread_attr_init(&thread_attr) != 0) {
-		/* On Linux, this will never happen */
-		perror("::yaircd.c:main(): Could not initialize thread attributes");
+	/* Take over from the previous process, if this is a hot restart */
+	if (upgrade_resume() == -1) {
 		return 1;
 	}
-	/* We want detached threads */
-	pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
-	/* At this point, we're ready to accept new clients. Set the callback function for new connections */
+	/* At this point, we're ready to accept new clients. Open the listening sockets */
 	loop = EV_DEFAULT;
-	ev_io_init(&socket_watcher, connection_cb, mainsock_fd, EV_READ);
-	ev_io_start(loop, &socket_watcher);
-
-	ev_io_init(&socket_ssl_watcher, ssl_connection_cb, sslsock_fd, EV_READ);
-	ev_io_start(loop, &socket_ssl_watcher);
+	if (start_listeners(loop) == -1) {
+		return 1;
+	}
+	/* Let the previous process go, and resume its clients */
+	upgrade_done();
+	/* Connect to the servers configured with autoconnect */
+	links_start();
+	if (get_stats_socket() != NULL && stats_listen(loop, get_stats_socket()) == -1) {
+		fprintf(stderr, "::yaircd.c:ircd_boot(): Statistics won't be available through %s.\n", get_stats_socket());
+	}
+	ev_signal_init(&rehash_watcher, rehash_cb, SIGHUP);
+	ev_signal_start(loop, &rehash_watcher);
+	ev_signal_init(&upgrade_watcher, upgrade_cb, SIGUSR2);
+	ev_signal_start(loop, &upgrade_watcher);
 
 	/* Now we just have to sit and wait */
 	ev_loop(loop, 0);
@@ -341,93 +564,70 @@ int main(void)
 
 void free_thread_arguments(struct irc_client_args_wrapper *args);
 
-/** This function accepts a new generic incoming connection. It wraps the client's information in a dynamically
-   allocated `irc_client_args_wrapper` structure to be passed to `pthread_create()`. Every new client gets a dedicated
-   thread whose starting point is `new_client()`.
-   This function returns prematurely if:
+/** Sets up a freshly accepted connection. It wraps the client's information in a dynamically allocated
+   `irc_client_args_wrapper` structure to be passed to `new_client()`. If the listener belongs to the main loop, the client is
+   handed over to a worker with `worker_dispatch()`; otherwise, the listener's worker sets it up right away.
+   The connection is closed if:
    <ul>
-   <li>an `EV_ERROR` occurred, or `EV_READ` was not set for some reason;</li>
-   <li>`accept()` returned an error code and no socket could be created;</li>
    <li>the client address is malformed, namely, its family is not `AF_INET`;</li>
-   <li>the operating system reports that no thread could be created.</li>
-   </ul>
-   @param revents Bit flags reported by `libev`. Can be `EV_ERROR` or `EV_READ`.
-   @param flags Flags to change default behavior. Possible flags include:
-   <ul>
-   <li>`SSL_SOCK`, to be used when the new connection is coming from an SSL socket.</li>
-   <li>`IPv6_SOCK`, to be used when the new connection is coming from an IPv6 address.</li>
+   <li>there is not enough memory to hand the client over to a worker.</li>
    </ul>
+   Secure connections are not handshaked here: a slow or malicious SSL client must never stall the accepting thread. The
+      SSL structure is only created and put in accept state; the handshake is performed by the worker, without blocking.
+   @param l The listener that accepted the connection.
+   @param newsock_fd The new connection's socket. It is already non-blocking.
+   @param address The client's address.
+   @param address_length Length of `address`.
  */
-static void accept_connection(int revents, int flags)
+static void setup_connection(struct listener *l, int newsock_fd, struct sockaddr_in *address, socklen_t address_length)
 {
-	int newsock_fd;
-	struct irc_client_args_wrapper *thread_arguments; /* Wrapper for passing arguments to thread function */
-	pthread_t thread_id;
-
-	/* NOTES: possible event bits are EV_READ and EV_ERROR */
-	if (revents & EV_ERROR) {
-		fprintf(stderr, "::yaircd.c:accept_connection(): unexpected EV_ERROR on server event watcher\n");
-		return;
-	}
+	struct irc_client_args_wrapper *thread_arguments; /* Wrapper for passing arguments to the worker */
 
-	if (!(revents & EV_READ)) {
-		fprintf(
-			stderr,
-			"::yaircd.c:accept_connection(): EV_READ not present, but there was no EV_ERROR, ignoring request\n");
+	if (address->sin_family != AF_INET) {
+		/* This should never happen */
+		fprintf(stderr, "::yaircd.c:setup_connection(): Invalid sockaddr_in family.\n");
+		close(newsock_fd); /* We hang up on this client, sorry! */
 		return;
 	}
 
 	if ((thread_arguments = malloc(sizeof(struct irc_client_args_wrapper))) == NULL) {
 		fprintf(stderr,
-			"::yaircd.c:accept_connection(): Could not allocate wrapper for new thread arguments.\n");
+			"::yaircd.c:setup_connection(): Could not allocate wrapper for new client arguments.\n");
+		close(newsock_fd);
 		return;
 	}
 
-	thread_arguments->address_length = sizeof(thread_arguments->address.ipv4_address);
+	memcpy(&thread_arguments->address.ipv4_address, address, sizeof(*address));
+	thread_arguments->address_length = address_length;
 	thread_arguments->is_ipv6 = 0;
-	newsock_fd = accept((flags & SSL_SOCK) ? sslsock_fd : mainsock_fd,
-			    (struct sockaddr*)&thread_arguments->address.ipv4_address,
-			    &thread_arguments->address_length);
-
-	if (newsock_fd == -1) {
-		perror("::yaircd.c:accept_connection(): Error while accepting new client connection");
-		free(thread_arguments);
-		return;
-	}
-
-	if (thread_arguments->address.ipv4_address.sin_family != AF_INET) {
-		/* This should never happen */
-		fprintf(stderr, "::yaircd.c:accept_connection(): Invalid sockaddr_in family.\n");
-		close(newsock_fd); /* We hang up on this client, sorry! */
-		free(thread_arguments);
-		return;
-	}
-
 	thread_arguments->socket = newsock_fd;
 
-	if (flags & SSL_SOCK) {
-		/* Create SSL structure */
-		thread_arguments->ssl = SSL_new(ssl_context);
-		/* Assign the socket to the SSL structure */
-		SSL_set_fd(thread_arguments->ssl, newsock_fd);
-		/* SSL Handshake */
-		if (SSL_accept(thread_arguments->ssl) == -1) {
-			SSL_shutdown(thread_arguments->ssl);
-			SSL_free(thread_arguments->ssl);
-			fprintf(stderr, "::yaircd.c:accept_connection(): SSL Handshake failed.\n");
+	if (l->flags & SSL_SOCK) {
+		/* Create SSL structure. The handshake is driven by the worker, see client.c */
+		if ((thread_arguments->ssl = SSL_new(ssl_context)) == NULL) {
+			fprintf(stderr, "::yaircd.c:setup_connection(): Could not create SSL structure.\n");
 			close(newsock_fd);
 			free_thread_arguments(thread_arguments);
 			return;
 		}
+		/* Assign the socket to the SSL structure */
+		SSL_set_fd(thread_arguments->ssl, newsock_fd);
+		SSL_set_accept_state(thread_arguments->ssl);
 	}else {
 		thread_arguments->ssl = NULL;
 	}
 
-	/* thread_arguments will be freed inside the new thread at the right time */
-	if (pthread_create(&thread_id, &thread_attr, new_client, (void*)thread_arguments) < 0) {
-		perror("::yaircd.c:accept_connection(): could not create new thread");
-		if (flags & SSL_SOCK) {
-			SSL_shutdown(thread_arguments->ssl);
+	if (l->worker != NULL) {
+		/* We are the worker; thread_arguments is freed by new_client() */
+		worker_adopt_client(l->worker);
+		new_client(l->worker, (void*)thread_arguments);
+		return;
+	}
+
+	/* thread_arguments will be freed inside the worker at the right time */
+	if (worker_dispatch(new_client, (void*)thread_arguments) == -1) {
+		fprintf(stderr, "::yaircd.c:setup_connection(): could not hand the new client over to a worker.\n");
+		if (l->flags & SSL_SOCK) {
 			SSL_free(thread_arguments->ssl);
 		}
 		close(newsock_fd);
@@ -435,44 +635,74 @@ static void accept_connection(int revents, int flags)
 	}
 }
 
-/** Callback function that is called when new clients arrive. It accepts the new connection and wraps the client's
-   information in a dynamically allocated `irc_client_args_wrapper` structure to be passed to `pthread_create()`. Every
-   new client gets a dedicated thread whose starting point is `new_client()`.
-   This function returns prematurely if:
-   <ul>
-   <li>an `EV_ERROR` occurred, or `EV_READ` was not set for some reason;</li>
-   <li>`accept()` returned an error code and no socket could be created;</li>
-   <li>the client address is malformed, namely, its family is not `AF_INET`;</li>
-   <li>the operating system reports that no thread could be created.</li>
-   </ul>
-   @param w The watcher that caused this callback to execute. Always comes from the main default loop.
+/** Callback function that is called when new clients arrive at a listening socket, be it a standard or a secure one, and be it
+   owned by the main loop or by a worker.
+   Up to `ACCEPT_BATCH` pending connections are accepted with `accept4()`, which creates the client sockets already
+   non-blocking; each one is set up by `setup_connection()`. The function stops early when there are no more pending
+   connections.
+   This function returns prematurely if an `EV_ERROR` occurred, or `EV_READ` was not set for some reason.
+   @param w The listener's watcher. A pointer to the listener is obtained with `offsetof()`.
    @param revents Bit flags reported by `libev`. Can be `EV_ERROR` or `EV_READ`.
  */
-static void connection_cb(EV_P_ ev_io *w, int revents)
+static void listener_cb(EV_P_ ev_io *w, int revents)
 {
-	accept_connection(revents, 0);
+	struct listener *l = (struct listener*)((char*)w - offsetof(struct listener, watcher));
+	struct sockaddr_in address;
+	socklen_t address_length;
+	int newsock_fd;
+	int i;
+
+	/* NOTES: possible event bits are EV_READ and EV_ERROR */
+	if (revents & EV_ERROR) {
+		fprintf(stderr, "::yaircd.c:listener_cb(): unexpected EV_ERROR on server event watcher\n");
+		return;
+	}
+
+	if (!(revents & EV_READ)) {
+		fprintf(stderr,
+			"::yaircd.c:listener_cb(): EV_READ not present, but there was no EV_ERROR, ignoring request\n");
+		return;
+	}
+
+	for (i = 0; i < ACCEPT_BATCH; i++) {
+		address_length = sizeof(address);
+		/* Workers serve many clients; a slow client must never block its worker */
+		newsock_fd = accept4(w->fd, (struct sockaddr*)&address, &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (newsock_fd == -1) {
+			if (errno == ECONNABORTED || errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("::yaircd.c:listener_cb(): Error while accepting new client connection");
+			}
+			return;
+		}
+		stats_accept();
+		setup_connection(l, newsock_fd, &address, address_length);
+	}
 }
 
-/** Callback function that is called when new SSL clients arrive. It accepts the new connection and wraps the client's
-   information in a dynamically allocated `irc_client_args_wrapper` structure to be passed to `pthread_create()`. Every
-   new client gets a dedicated thread whose starting point is `new_client()`.
-   This function returns prematurely if:
-   <ul>
-   <li>an `EV_ERROR` occurred, or `EV_READ` was not set for some reason;</li>
-   <li>`accept()` returned an error code and no socket could be created;</li>
-   <li>the client address is malformed, namely, its family is not `AF_INET`;</li>
-   <li>the operating system reports that no thread could be created.</li>
-   </ul>
-   @param w The watcher that caused this callback to execute. Always comes from the main default loop.
-   @param revents Bit flags reported by `libev`. Can be `EV_ERROR` or `EV_READ`.
+#ifdef YAIRCD_URING
+/** Called by io_uring with every connection accepted on a listener, instead of `listener_cb()`. The peer's address is
+   looked up with `getpeername()`, since multishot accept can't report it, and the client is set up by `setup_connection()`.
+   @param arg The listener that accepted the connection.
+   @param sock The new, non-blocking socket.
  */
-static void ssl_connection_cb(EV_P_ ev_io *w, int revents)
+static void uring_accepted(void *arg, int sock)
 {
-	accept_connection(revents, SSL_SOCK);
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof(address);
+	if (getpeername(sock, (struct sockaddr*)&address, &address_length) == -1) {
+		/* The client is already gone */
+		close(sock);
+		return;
+	}
+	setup_connection((struct listener*)arg, sock, &address, address_length);
 }
+#endif
 
-/** This is called by a client thread everytime its arguments structure is not needed anymore.
-   @param args A pointer to the arguments structure that was passed to the thread's initialization function.
+/** This is called by a worker everytime a new client's arguments structure is not needed anymore.
+   @param args A pointer to the arguments structure that was passed to `new_client()`.
  */
 void free_thread_arguments(struct irc_client_args_wrapper *args)
 {